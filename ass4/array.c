@@ -113,6 +113,16 @@ void array_remove_at(Array* array, int index) {
     array->numItems--;
 }
 
+// see header
+bool array_contains(Array* array, void* item) {
+    for (int i = 0; i < array->numItems; i++) {
+        if (array->items[i] == item) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // see header
 void array_remove(Array* array, void* item) {
     for (int i = 0; i < array->numItems; i++) {
@@ -125,39 +135,62 @@ void array_remove(Array* array, void* item) {
     assert(0); // item was not found in array.
 }
 
+/* Merges the sorted runs items[lo:mid] and items[mid:hi] (python slice
+ * notation) using the array's mapper and sorter. temp must have space for
+ * hi - lo items.
+ */
+void arraymap_merge(Array* array, ArrayItem* temp, int lo, int mid, int hi) {
+    ArrayItem* items = array->items;
+    int i = lo;
+    int j = mid;
+    int k = 0;
+    while (i < mid && j < hi) {
+        // take from the left run on ties, so the sort is stable
+        if (array->sorter(array->mapper(items[j]),
+                array->mapper(items[i])) < 0) {
+            temp[k++] = items[j++];
+        } else {
+            temp[k++] = items[i++];
+        }
+    }
+    while (i < mid) {
+        temp[k++] = items[i++];
+    }
+    // anything left in the right run is already in place
+    memcpy(items + lo, temp, k * sizeof(ArrayItem));
+}
+
+/* Sorts items[lo:hi] (python slice notation) with top-down merge sort.
+ */
+void arraymap_sort_range(Array* array, ArrayItem* temp, int lo, int hi) {
+    if (hi - lo < 2) {
+        return; // a 1-element list is trivially sorted
+    }
+    int mid = lo + (hi - lo) / 2;
+    arraymap_sort_range(array, temp, lo, mid);
+    arraymap_sort_range(array, temp, mid, hi);
+    // skip merging runs which are already in order. this gives O(n) on
+    // sorted arrays, like the insertion sort this replaced.
+    if (array->sorter(array->mapper(array->items[mid - 1]),
+            array->mapper(array->items[mid])) <= 0) {
+        return;
+    }
+    arraymap_merge(array, temp, lo, mid, hi);
+}
+
 // see header
 void arraymap_sort(Array* array) {
     // *grumble* C/POSIX compliance making me write a sorting algorithm.
     // we need to use mapper and sorter from the array struct to sort the
-    // array correctly.
-
-    // this is insertion sort, efficient for almost sorted arrays but O(n^2)
-    // in worst-case.
-
-    // invariant: A[:i] is sorted (using python slice notation) so we start
-    // at i = 1 because a 1-element list is trivially sorted.
-    for (int i = 1; i < array->numItems; i++) {
-        // starting at j=i, we compare A[j] with A[j-1] and swap them if
-        // A[j] should sort before A[j-1]. stop after j = 1 because j-1=0.
-        // invariant: A[j:i] is sorted. when j=0 and we quit this loop, j=0
-        // so this enforces the outer invariant.
-        for (int j = i; j > 0; j--) {
-            void* thisItem = array->items[j];
-            void* thisKey = array->mapper(thisItem);
-
-            void* othItem = array->items[j - 1];
-            void* othKey = array->mapper(othItem);
-
-            // currently, order is [..., othItem, thisItem, ...]
-            if (array->sorter(othKey, thisKey) > 0) {
-                // if othKey > thisKey, othItem is out of order. swap
-                array->items[j] = othItem;
-                array->items[j - 1] = thisItem;
-            } else {
-                // if othKey <= thisKey, we know thisKey >= all prior keys
-                // as well. this gives O(n) on sorted arrays.
-                break;
-            }
-        }
+    // array correctly, which qsort has no way to pass through.
+
+    // this is merge sort, O(n log n) in the worst case so large arrays can
+    // be sorted on demand.
+    if (array->numItems < 2) {
+        return;
     }
+    ArrayItem* temp = malloc(array->numItems * sizeof(ArrayItem));
+    assert(temp != NULL);
+    arraymap_sort_range(array, temp, 0, array->numItems);
+    free(temp);
 }
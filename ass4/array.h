@@ -93,6 +93,10 @@ void* array_get_at(Array* array, int index);
  */
 void* arraymap_get(Array* arrayMap, void* key);
 
+/* Returns true if the given item itself (not an equal one) is in array.
+ */
+bool array_contains(Array* array, void* item);
+
 /* Remove the given item from array, asserting item is in array. Maintains
  * relative order of other items.
  */
@@ -103,7 +107,8 @@ void array_remove(Array* array, void* item);
 void array_remove_at(Array* array, int index);
 
 /* Sorts the array map in-place, in the total ordering defined by sorter and
- * by mapping each item through the mapper function.
+ * by mapping each item through the mapper function. The sort is stable and
+ * O(n log n), or O(n) if the array is already sorted.
  */
 void arraymap_sort(Array* array);
 
@@ -2,15 +2,25 @@
 
 #include "arrayHelpers.h"
 #include "material.h"
+#include "coalescer.h"
 #include "connection.h"
 #include "deferGroup.h"
 #include "messages.h"
+#include "wire.h"
+#include "strView.h"
+#include "util.h"
 
 // see header
 int ah_strcmp(void* a, void* b) {
     return strcmp(a, b);
 }
 
+// see header
+int ah_strviewcmp(void* str, void* view) {
+    // only equality matters to hash map lookups
+    return sv_equals(*(StrView*)view, str) ? 0 : 1;
+}
+
 // see header
 int ah_intcmp(void* a, void* b) {
     int aVal = *(int*)a;
@@ -18,6 +28,21 @@ int ah_intcmp(void* a, void* b) {
     return aVal - bVal;
 }
 
+// see header
+unsigned int ah_strhash(void* str) {
+    return sv_hash(sv_from(str));
+}
+
+// see header
+unsigned int ah_inthash(void* number) {
+    return hash_djb2(*(int*)number);
+}
+
+// see header
+unsigned int ah_symhash(void* id) {
+    return *(SymId*)id;
+}
+
 // see header
 void* ah_noop_mapper(void* object) {
     return object;
@@ -28,11 +53,31 @@ void* ah_mat_mapper(void* material) {
     return ((Material*) material)->name;
 }
 
+// see header
+void* ah_mat_id_mapper(void* material) {
+    return &((Material*) material)->id;
+}
+
+// see header
+void* ah_wirename_mapper(void* wireName) {
+    return &((WireName*) wireName)->sym;
+}
+
 // see header
 void* ah_conn_mapper(void* connection) {
     return ((Connection*) connection)->name;
 }
 
+// see header
+void* ah_conn_port_mapper(void* connection) {
+    return &((Connection*) connection)->port;
+}
+
+// see header
+void* ah_held_mapper(void* heldDeliver) {
+    return &((HeldDeliver*) heldDeliver)->id;
+}
+
 // see header
 void* ah_dg_mapper(void* deferGroup) {
     // because key is stored as an int, take the pointer
@@ -59,3 +104,8 @@ void ah_msg_destroy(void* message) {
     msg_destroy(message);
 }
 
+// see header
+void ah_msg_release(void* message) {
+    msg_release(message);
+}
+
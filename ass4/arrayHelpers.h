@@ -12,17 +12,39 @@
 
 // compares two char*'s, passed as void*'s
 int ah_strcmp(void*, void*);
+// compares a char* with a StrView*, passed as void*'s. only returns 0 if
+// they are equal, otherwise ordering is arbitrary.
+int ah_strviewcmp(void*, void*);
 // compares the integer pointed to by two int*'s, passed as void*'s
 int ah_intcmp(void*, void*);
 
+// these functions implement HashFunction from hashMap.h
+
+// hashes a char*, passed as void*, with FNV-1a
+unsigned int ah_strhash(void*);
+// hashes the integer pointed to by an int*, passed as void*
+unsigned int ah_inthash(void*);
+// hashes an interned name id pointed to by a SymId*, passed as void*. ids
+// are dense, so the id is its own hash
+unsigned int ah_symhash(void*);
+
 // these functions implement ArrayMapper from array.h
 
 // returns the given pointer itself.
 void* ah_noop_mapper(void* object);
 // returns the name of the material, as a char* cast to void*
 void* ah_mat_mapper(void*);
+// returns pointer to the material's interned name id, as int* cast to void*
+void* ah_mat_id_mapper(void*);
+// returns pointer to a WireName's interned name id, as int* cast to void*
+void* ah_wirename_mapper(void*);
 // returns the name of the connection, as char* cast to void*
 void* ah_conn_mapper(void*);
+// returns pointer to the connection's port, as int* cast to void*
+void* ah_conn_port_mapper(void*);
+// returns pointer to a HeldDeliver's interned name id, as int* cast to
+// void*
+void* ah_held_mapper(void*);
 // returns pointer to defer group key, as int* cast to void*
 void* ah_dg_mapper(void*);
 
@@ -37,6 +59,8 @@ void ah_conn_destroy(void*);
 void ah_dg_destroy(void*);
 // destroys the given message, passed as Message* cast to void*
 void ah_msg_destroy(void*);
+// destroys and frees the given message, passed as Message* cast to void*
+void ah_msg_release(void*);
 // destroys the given message from, passed as MessageFrom* cast to void*
 void ah_msgfrom_destroy(void*);
 
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "benchUtil.h"
+#include "messages.h"
+#include "msgView.h"
+#include "strBuffer.h"
+#include "wire.h"
+#include "util.h"
+
+// default number of operations sent at each batch size
+#define DEFAULT_OPS 200000
+// distinct materials the operations cycle through
+#define BENCH_MATERIALS 8
+
+// batch sizes measured, where 0 means each op is its own Deliver line
+static const int batchSizes[] = {0, 1, 4, 16, 64, 256, 1024};
+
+/* Benchmark for Batch messages. For each batch size, opens a verified
+ * connection to a running depot, sends the same number of Deliver
+ * operations grouped into Batch messages of that size, then a Transfer back
+ * to itself, and measures the time until that Deliver comes back. Since a
+ * connection's messages are executed in order, that proves every operation
+ * was applied. Size 0 sends plain Deliver lines, as a baseline.
+ *
+ * The depot must be run with DEPOT_WIRE=1. With encoding "binary", batches
+ * are sent as binary frames instead of text lines.
+ *
+ * Usage: bench_batch port [numOps [text|binary]]
+ */
+
+/* Appends the message in the given text line to the burst, as a line or, if
+ * binary, as binary frames.
+ */
+void append_message(StrBuffer* burst, StrBuffer* line, WireEncoder* encoder,
+        bool binary) {
+    if (!binary) {
+        sb_append(burst, line->data, line->len);
+        sb_append_char(burst, '\n');
+        return;
+    }
+    MessageView view;
+    Message message;
+    if (mv_parse(line->data, line->len, &view) != MS_OK) {
+        fprintf(stderr, "built an invalid line: %s\n", line->data);
+        exit(5);
+    }
+    mv_to_message(&view, &message);
+    wenc_encode(encoder, message, burst);
+    msg_destroy(&message);
+}
+
+/* Builds the burst sent by connection self into the buffer: numOps Delivers
+ * in batches of batchSize (or as lines if 0), then a Transfer back to self.
+ */
+void build_burst(StrBuffer* burst, char* self, int batchSize, int numOps,
+        bool binary) {
+    StrBuffer line;
+    sb_init(&line);
+    WireEncoder encoder;
+    wenc_init(&encoder);
+    if (binary) {
+        sb_append_str(burst, WIRE_SWITCH "\n");
+    }
+    int op = 0;
+    while (op < numOps) {
+        int count = numOps - op < batchSize ? numOps - op : batchSize;
+        sb_clear(&line);
+        if (batchSize > 0) {
+            sb_append_str(&line, "Batch:");
+            sb_append_int(&line, count);
+            sb_append_char(&line, ':');
+        } else {
+            count = 1;
+        }
+        for (int i = 0; i < count; i++, op++) {
+            if (i > 0) {
+                sb_append_char(&line, ':');
+            }
+            sb_append_str(&line, "Deliver:1:benchmat");
+            sb_append_int(&line, op % BENCH_MATERIALS);
+        }
+        append_message(burst, &line, &encoder, binary);
+    }
+    sb_clear(&line);
+    sb_append_str(&line, "Transfer:1:benchmat0:");
+    sb_append_str(&line, self);
+    append_message(burst, &line, &encoder, binary);
+    wenc_destroy(&encoder);
+    sb_destroy(&line);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_batch port [numOps [text|binary]]\n");
+        return 1;
+    }
+    char* port = argv[1];
+    int numOps = argc > 2 ? atoi(argv[2]) : DEFAULT_OPS;
+    bool binary = argc > 3 && strcmp(argv[3], "binary") == 0;
+
+    int numSizes = sizeof(batchSizes) / sizeof(batchSizes[0]);
+    for (int i = 0; i < numSizes; i++) {
+        char* self = asprintf("batch%d", i);
+        int fd = open_bench_conn(port, self, i, binary);
+        if (fd < 0) {
+            fprintf(stderr, "connection %d failed\n", i);
+            return 2;
+        }
+        usleep(100000); // let the depot finish registering the connection
+
+        // the burst is built up front so only sending it is timed
+        StrBuffer burst;
+        sb_init(&burst);
+        build_burst(&burst, self, batchSizes[i], numOps, binary);
+
+        double start = monotonic_seconds();
+        if (!write_all(fd, burst.data, burst.len)) {
+            fprintf(stderr, "write to connection %d failed\n", i);
+            return 3;
+        }
+        if (!wait_for_deliver(fd, binary)) {
+            fprintf(stderr, "connection %d closed early\n", i);
+            return 4;
+        }
+        double elapsed = monotonic_seconds() - start;
+
+        printf("encoding=%s batch=%d ops=%d bytes=%d seconds=%.3f "
+                "ops/s=%.0f\n", binary ? "binary" : "text", batchSizes[i],
+                numOps, burst.len, elapsed, numOps / elapsed);
+        fflush(stdout);
+        close(fd);
+        sb_destroy(&burst);
+        free(self);
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "benchUtil.h"
+#include "messages.h"
+#include "strBuffer.h"
+#include "wire.h"
+#include "util.h"
+
+// default number of Deliver messages each connection sends
+#define DEFAULT_MESSAGES 100
+
+/* Benchmark for the depot's IO model. Opens many verified connections to a
+ * running depot, has each send a burst of Deliver messages followed by a
+ * Transfer back to itself, and measures the time until every connection has
+ * received its Deliver back. Because each depot connection is processed in
+ * order, that Deliver proves all of the connection's messages were executed.
+ *
+ * The depot must be run with DEPOT_WIRE=1. With encoding "binary", every
+ * connection accepts the depot's offer and sends (and receives) binary
+ * frames, otherwise the offer is ignored and everything stays text.
+ *
+ * Usage: bench_conns port depotPid numConns [messagesPerConn [encoding]]
+ */
+
+/* Builds the burst of messages sent by connection i into the buffer: a
+ * Deliver numMessages times then a Transfer back to bench<i>. If binary, the
+ * burst starts by switching to binary frames.
+ */
+void build_burst(StrBuffer* burst, int i, int numMessages, bool binary) {
+    char* self = asprintf("bench%d", i);
+    Message deliver = msg_deliver(1, sym_intern_str("benchmat"));
+    Message transfer = msg_deliver(1, sym_intern_str("benchmat"));
+    transfer.type = MSG_TRANSFER;
+    transfer.data.depotName = self; // freed with transfer
+
+    WireEncoder encoder;
+    wenc_init(&encoder);
+    if (binary) {
+        sb_append_str(burst, WIRE_SWITCH "\n");
+    }
+    for (int m = 0; m <= numMessages; m++) {
+        Message* message = m < numMessages ? &deliver : &transfer;
+        if (binary) {
+            wenc_encode(&encoder, *message, burst);
+        } else {
+            msg_encode_into(*message, burst);
+            sb_append_char(burst, '\n');
+        }
+    }
+    wenc_destroy(&encoder);
+    msg_destroy(&deliver);
+    msg_destroy(&transfer);
+}
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the value in kB of the given field (e.g. "VmRSS:") from
+ * /proc/pid/status, or -1 if it could not be read.
+ */
+long proc_status_kb(int pid, char* field) {
+    char* path = asprintf("/proc/%d/status", pid);
+    FILE* file = fopen(path, "r");
+    free(path);
+    if (file == NULL) {
+        return -1;
+    }
+    long value = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            value = strtol(line + strlen(field), NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: bench_conns port depotPid numConns "
+                "[messagesPerConn [text|binary]]\n");
+        return 1;
+    }
+    char* port = argv[1];
+    int pid = atoi(argv[2]);
+    int numConns = atoi(argv[3]);
+    int numMessages = argc > 4 ? atoi(argv[4]) : DEFAULT_MESSAGES;
+    bool binary = argc > 5 && strcmp(argv[5], "binary") == 0;
+    long rssBefore = proc_status_kb(pid, "VmRSS:");
+
+    int* fds = calloc(numConns, sizeof(int));
+    for (int i = 0; i < numConns; i++) {
+        char* self = asprintf("bench%d", i);
+        fds[i] = open_bench_conn(port, self, i, binary);
+        free(self);
+        if (fds[i] < 0) {
+            fprintf(stderr, "connection %d failed\n", i);
+            return 2;
+        }
+    }
+    usleep(200000); // let the depot finish registering connections
+    long rssConnected = proc_status_kb(pid, "VmRSS:");
+
+    // bursts are built up front so only sending them is timed
+    StrBuffer* bursts = calloc(numConns, sizeof(StrBuffer));
+    long totalBytes = 0;
+    for (int i = 0; i < numConns; i++) {
+        sb_init(&bursts[i]);
+        build_burst(&bursts[i], i, numMessages, binary);
+        totalBytes += bursts[i].len;
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < numConns; i++) {
+        if (!write_all(fds[i], bursts[i].data, bursts[i].len)) {
+            fprintf(stderr, "write to connection %d failed\n", i);
+            return 3;
+        }
+    }
+    for (int i = 0; i < numConns; i++) {
+        if (!wait_for_deliver(fds[i], binary)) {
+            fprintf(stderr, "connection %d closed early\n", i);
+            return 4;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    long totalMessages = (long)numConns * (numMessages + 1);
+    printf("encoding=%s conns=%d msgs=%ld bytes=%ld seconds=%.3f "
+            "msgs/s=%.0f rss_idle_kb=%ld rss_connected_kb=%ld "
+            "rss_peak_kb=%ld\n", binary ? "binary" : "text", numConns,
+            totalMessages, totalBytes, elapsed, totalMessages / elapsed,
+            rssBefore, rssConnected, proc_status_kb(pid, "VmHWM:"));
+
+    for (int i = 0; i < numConns; i++) {
+        close(fds[i]);
+        sb_destroy(&bursts[i]);
+    }
+    free(fds);
+    free(bursts);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "messages.h"
+#include "strBuffer.h"
+
+// number of times each message is encoded per run
+#define DEFAULT_ITERATIONS 1000000
+
+/* Microbenchmark comparing msg_encode, which builds each line with asprintf,
+ * against msg_encode_into, which appends the line to a reused StrBuffer.
+ * For a few representative messages, each is encoded repeatedly by both and
+ * the encodes per second are printed. Both are checked to give the same
+ * line first.
+ *
+ * Usage: bench_encode [iterations]
+ */
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Encodes the message iterations times with msg_encode, returning encodes
+ * per second.
+ */
+double bench_asprintf(Message message, long iterations) {
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        char* encoded = msg_encode(message);
+        free(encoded);
+    }
+    return iterations / (now_seconds() - start);
+}
+
+/* Encodes the message iterations times with msg_encode_into, returning
+ * encodes per second.
+ */
+double bench_buffer(Message message, long iterations) {
+    StrBuffer buffer;
+    sb_init(&buffer);
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        sb_clear(&buffer);
+        msg_encode_into(message, &buffer);
+    }
+    double elapsed = now_seconds() - start;
+    sb_destroy(&buffer);
+    return iterations / elapsed;
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+
+    Message messages[3];
+    messages[0] = msg_deliver(1234, sym_intern_str("steel"));
+    messages[1] = msg_deliver(99, sym_intern_str("timber"));
+    messages[1].type = MSG_TRANSFER;
+    messages[1].data.depotName = strdup("northDepot");
+    messages[2] = (Message) {0};
+    messages[2].type = MSG_DEFER;
+    messages[2].data.deferKey = 42;
+    messages[2].data.deferMessage = malloc(sizeof(Message));
+    *messages[2].data.deferMessage = msg_deliver(7, sym_intern_str("gold"));
+
+    printf("%-30s %14s %14s\n", "message", "asprintf/s", "buffer/s");
+    for (int i = 0; i < 3; i++) {
+        char* expected = msg_encode(messages[i]);
+        StrBuffer buffer;
+        sb_init(&buffer);
+        msg_encode_into(messages[i], &buffer);
+        if (strcmp(expected, buffer.data) != 0) {
+            fprintf(stderr, "mismatch: %s vs %s\n", expected, buffer.data);
+            return 1;
+        }
+        printf("%-30s %14.0f %14.0f\n", expected,
+                bench_asprintf(messages[i], iterations),
+                bench_buffer(messages[i], iterations));
+        fflush(stdout);
+        free(expected);
+        sb_destroy(&buffer);
+        msg_destroy(&messages[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "channel.h"
+#include "ring.h"
+
+// total number of items posted in each run, split across producers
+#define DEFAULT_ITEMS 1000000
+// items drained per wakeup when using ring_wait_batch
+#define BATCH 64
+// most producer threads tried
+#define MAX_PRODUCERS 64
+
+/* Contention microbenchmark comparing the semaphore Channel with the
+ * lock-free Ring. For 1 to 64 producer threads, each posts its share of the
+ * items while the main thread consumes them all, and the throughput is
+ * printed for Channel (chan_wait), Ring (ring_wait) and Ring with batched
+ * draining (ring_wait_batch).
+ *
+ * Usage: bench_ring [totalItems]
+ */
+
+/* Queue implementations being compared.
+ */
+typedef enum QueueKind {
+    QUEUE_CHANNEL,
+    QUEUE_RING,
+    QUEUE_RING_BATCH
+} QueueKind;
+
+// struct for passing information into producer_thread
+typedef struct ProducerData {
+    QueueKind kind;
+    Channel* channel; // BORROW
+    Ring* ring; // BORROW
+    long numItems;
+} ProducerData;
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Posts numItems non-NULL dummy items to the queue given in the
+ * ProducerData*. Return value unused.
+ */
+void* producer_thread(void* producerArg) {
+    ProducerData* data = producerArg;
+    for (long i = 1; i <= data->numItems; i++) {
+        if (data->kind == QUEUE_CHANNEL) {
+            chan_post(data->channel, (void*)i);
+        } else {
+            ring_post(data->ring, (void*)i);
+        }
+    }
+    return NULL;
+}
+
+/* Runs one benchmark with the given queue and number of producers, returning
+ * the throughput in items per second.
+ */
+double run_bench(QueueKind kind, int numProducers, long totalItems) {
+    Channel channel = {0};
+    Ring ring = {0};
+    chan_init(&channel);
+    ring_init(&ring, CHANNEL_SIZE);
+
+    long perProducer = totalItems / numProducers;
+    ProducerData data = {kind, &channel, &ring, perProducer};
+    pthread_t threads[MAX_PRODUCERS];
+
+    double start = now_seconds();
+    for (int i = 0; i < numProducers; i++) {
+        pthread_create(&threads[i], NULL, producer_thread, &data);
+    }
+    long received = 0;
+    void* items[BATCH];
+    while (received < perProducer * numProducers) {
+        if (kind == QUEUE_CHANNEL) {
+            chan_wait(&channel);
+            received++;
+        } else if (kind == QUEUE_RING) {
+            ring_wait(&ring);
+            received++;
+        } else {
+            received += ring_wait_batch(&ring, items, BATCH);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    for (int i = 0; i < numProducers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    chan_destroy(&channel);
+    ring_destroy(&ring);
+    return received / elapsed;
+}
+
+int main(int argc, char** argv) {
+    long totalItems = argc > 1 ? atol(argv[1]) : DEFAULT_ITEMS;
+
+    printf("%9s %14s %14s %14s\n", "producers", "channel/s", "ring/s",
+            "ring_batch/s");
+    for (int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+        printf("%9d %14.0f %14.0f %14.0f\n", producers,
+                run_bench(QUEUE_CHANNEL, producers, totalItems),
+                run_bench(QUEUE_RING, producers, totalItems),
+                run_bench(QUEUE_RING_BATCH, producers, totalItems));
+        fflush(stdout);
+    }
+    return 0;
+}
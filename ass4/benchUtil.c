@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include "benchUtil.h"
+#include "network.h"
+#include "wire.h"
+#include "util.h"
+
+// see header
+bool skip_line(int fd) {
+    char c = '\0';
+    while (c != '\n') {
+        if (read(fd, &c, 1) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// see header
+bool skip_frame(int fd, char* tag) {
+    unsigned int len = 0;
+    unsigned char byte = 0x80;
+    for (int shift = 0; byte & 0x80; shift += 7) {
+        if (read(fd, &byte, 1) != 1) {
+            return false;
+        }
+        len |= (unsigned int)(byte & 0x7f) << shift;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+        char c;
+        if (read(fd, &c, 1) != 1) {
+            return false;
+        }
+        if (i == 0) {
+            *tag = c;
+        }
+    }
+    return true;
+}
+
+// see header
+bool wait_for_deliver(int fd, bool binary) {
+    if (!binary) {
+        return skip_line(fd);
+    }
+    char tag = WIRE_DEFINE;
+    if (!skip_line(fd)) { // WIRE_SWITCH
+        return false;
+    }
+    while (tag == WIRE_DEFINE) {
+        if (!skip_frame(fd, &tag)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// see header
+bool write_all(int fd, char* buffer, size_t len) {
+    while (len > 0) {
+        ssize_t wrote = write(fd, buffer, len);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote <= 0) {
+            return false;
+        }
+        buffer += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+// see header
+int open_bench_conn(char* port, char* self, int i, bool binary) {
+    int fd;
+    // skip the depot's IM and offer
+    if (!start_active_socket(&fd, port) || !skip_line(fd) ||
+            !skip_line(fd)) {
+        return -1;
+    }
+    char* im = asprintf("IM:%d:%s\n%s", FAKE_PORT_BASE + i, self,
+            binary ? WIRE_OFFER "\n" : "");
+    bool ok = write_all(fd, im, strlen(im));
+    free(im);
+    return ok ? fd : -1;
+}
@@ -0,0 +1,40 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Socket helpers shared by the benchmarks which talk to a running depot as
+ * its peers (bench_conns and bench_batch). All of them block.
+ */
+
+// fake ports given in our IMs start here, outside the valid port range so
+// they can never clash with the depot's own port
+#define FAKE_PORT_BASE 70000
+
+/* Reads from fd until a newline is read, discarding the data. Returns false
+ * on EOF or error.
+ */
+bool skip_line(int fd);
+
+/* Reads one binary frame from fd, discarding it and storing its tag in
+ * *tag. Returns false on EOF or error.
+ */
+bool skip_frame(int fd, char* tag);
+
+/* Waits for the depot to deliver back to connection fd, skipping any
+ * definitions and the switch line first if binary.
+ */
+bool wait_for_deliver(int fd, bool binary);
+
+/* Writes all of the given buffer to fd, returning false on error.
+ */
+bool write_all(int fd, char* buffer, size_t len);
+
+/* Connects to the depot on the given port and exchanges IMs, naming
+ * ourselves self on fake port FAKE_PORT_BASE + i, and offers binary if
+ * asked. Returns the socket fd or -1 on failure.
+ */
+int open_bench_conn(char* port, char* self, int i, bool binary);
+
+#endif
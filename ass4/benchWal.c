@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "config.h"
+#include "depotState.h"
+#include "execute.h"
+#include "msgView.h"
+#include "wal.h"
+#include "util.h"
+
+// default number of messages executed per run
+#define DEFAULT_MESSAGES 1000000
+// messages executed between commits, as the main loop's INCOMING_BATCH
+#define COMMIT_BATCH 64
+// number of distinct materials the messages are spread over
+#define NUM_MATERIALS 1000
+
+/* Benchmark for the write-ahead log. For each fsync policy (and without a
+ * log), executes Deliver and Withdraw messages against a depot state,
+ * committing every COMMIT_BATCH messages as the main loop does, and prints
+ * messages per second. Then times recovering the resulting log, both with
+ * and without periodic snapshots.
+ *
+ * The log is written to <dir>/bench_wal, which is removed first and after.
+ *
+ * Usage: bench_wal dir [messages]
+ */
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Removes the bench's log directory and everything in it.
+ */
+void remove_wal_dir(char* dir) {
+    char* path = asprintf("%s/%s", dir, WAL_LOG_FILE);
+    unlink(path);
+    free(path);
+    path = asprintf("%s/%s", dir, WAL_SNAPSHOT_FILE);
+    unlink(path);
+    free(path);
+    rmdir(dir);
+}
+
+/* Executes numMessages messages against the depot state, committing every
+ * COMMIT_BATCH. Returns messages per second.
+ */
+double run_messages(DepotState* depotState, long numMessages) {
+    char line[64];
+    double start = now_seconds();
+    for (long i = 0; i < numMessages; i++) {
+        snprintf(line, sizeof(line), "%s:%ld:mat%ld",
+                i % 4 == 3 ? "Withdraw" : "Deliver", 1 + i % 10,
+                i % NUM_MATERIALS);
+        MessageView view;
+        mv_parse(line, strlen(line), &view);
+        execute_message_view(depotState, &view);
+        if (i % COMMIT_BATCH == COMMIT_BATCH - 1) {
+            ds_commit(depotState);
+        }
+    }
+    ds_commit(depotState);
+    return numMessages / (now_seconds() - start);
+}
+
+/* Runs the messages with the given config, printing the throughput, then
+ * if logging, reopens the log and prints how long recovery took.
+ */
+void bench_config(DepotConfig* config, char* label, long numMessages) {
+    DepotState depotState = {0};
+    bool recovered;
+    ds_init(&depotState, "bench", config);
+    if (config->walDir != NULL && !ds_open_wal(&depotState, &recovered)) {
+        fprintf(stderr, "cannot open log in %s\n", config->walDir);
+        exit(1);
+    }
+    double rate = run_messages(&depotState, numMessages);
+    ds_destroy(&depotState);
+    printf("%-28s msgs/s=%-10.0f", label, rate);
+
+    if (config->walDir != NULL) {
+        memset(&depotState, 0, sizeof(DepotState));
+        ds_init(&depotState, "bench", config);
+        double start = now_seconds();
+        ds_open_wal(&depotState, &recovered);
+        double elapsed = now_seconds() - start;
+        printf(" recover_s=%.3f", elapsed);
+        ds_destroy(&depotState);
+        remove_wal_dir(config->walDir);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_wal dir [messages]\n");
+        return 1;
+    }
+    long numMessages = argc > 2 ? atol(argv[2]) : DEFAULT_MESSAGES;
+    char* walDir = asprintf("%s/bench_wal", argv[1]);
+    remove_wal_dir(walDir);
+
+    DepotConfig config = {0};
+    config_load(&config); // for the defaults
+    config.shards = 0;
+    config.walDir = NULL;
+    bench_config(&config, "no log", numMessages);
+
+    config.walDir = walDir;
+    char* names[] = {"none", "batch", "always"};
+    WalFsync policies[] = {WAL_FSYNC_NONE, WAL_FSYNC_BATCH,
+            WAL_FSYNC_ALWAYS};
+    for (int i = 0; i < 3; i++) {
+        config.walFsync = policies[i];
+        char* label;
+        config.snapshotEvery = 0;
+        label = asprintf("fsync=%s no snapshots", names[i]);
+        bench_config(&config, label, numMessages);
+        free(label);
+        config.snapshotEvery = numMessages / 10;
+        label = asprintf("fsync=%s snapshot/%d", names[i],
+                config.snapshotEvery);
+        bench_config(&config, label, numMessages);
+        free(label);
+    }
+    free(walDir);
+    return 0;
+}
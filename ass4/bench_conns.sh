@@ -0,0 +1,25 @@
+#!/bin/bash
+# Runs bench_conns against a fresh depot in each IO model at 10, 1k and 10k
+# connections, once with text and once with binary messages. 10k connections
+# needs ulimit -n above 20000 for this shell. The depot is started with
+# DEPOT_SHARDS set to the second argument, if given.
+
+msgs="${1:-100}"
+shards="${2:-0}"
+make -s 2310depot bench_conns || exit 1
+
+for mode in 0 1; do
+    for conns in 10 1000 10000; do
+        for encoding in text binary; do
+            coproc DEPOT {
+                DEPOT_EVENT_LOOP=$mode DEPOT_WIRE=1 DEPOT_SHARDS=$shards \
+                        exec ./2310depot bench
+            }
+            read -r port <&"${DEPOT[0]}"
+            echo -n "event_loop=$mode shards=$shards "
+            ./bench_conns "$port" "$DEPOT_PID" "$conns" "$msgs" "$encoding"
+            kill -USR2 "$DEPOT_PID"
+            wait "$DEPOT_PID" 2>/dev/null
+        done
+    done
+done
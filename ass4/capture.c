@@ -0,0 +1,220 @@
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "wire.h"
+#include "util.h"
+
+// records are written early if this many bytes are captured in one batch
+#define CAP_WRITE_AT 65536
+
+/* Writes all of the given buffer to fd, returning false on error.
+ */
+bool cap_write_all(int fd, char* data, int len) {
+    while (len > 0) {
+        ssize_t wrote = write(fd, data, len);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote < 0) {
+            return false;
+        }
+        data += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+/* Writes everything captured so far. If the file can't be written, gives up
+ * on it, capturing nothing more.
+ */
+void cap_write(Capture* capture) {
+    if (capture->fd >= 0 && !cap_write_all(capture->fd,
+            capture->pending.data, capture->pending.len)) {
+        DEBUG_PERROR("write()");
+        close(capture->fd);
+        capture->fd = -1;
+    }
+    sb_clear(&capture->pending);
+}
+
+/* Captures one record of the given kind, value and len bytes of data.
+ */
+void cap_record(Capture* capture, CaptureKind kind, int value, char* data,
+        int len) {
+    if (capture->fd < 0) {
+        return;
+    }
+    double now = monotonic_seconds();
+    StrBuffer* pending = &capture->pending;
+    sb_append_char(pending, (char)kind);
+    wire_append_varint(pending, (unsigned int)((now - capture->last) * 1e6));
+    wire_append_varint(pending, (unsigned int)value);
+    wire_append_varint(pending, (unsigned int)len);
+    sb_append(pending, data, len);
+    capture->last = now;
+    capture->dirty = kind != CAP_FLUSH;
+    if (pending->len >= CAP_WRITE_AT) {
+        cap_write(capture);
+    }
+}
+
+// see header
+bool cap_open(Capture* capture, char* path, int port, char* name) {
+    memset(capture, 0, sizeof(Capture));
+    sb_init(&capture->pending);
+    sb_init(&capture->line);
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (capture->fd < 0) {
+        DEBUG_PERROR("open()");
+        return false;
+    }
+    capture->last = monotonic_seconds();
+    sb_append(&capture->pending, CAP_MAGIC, strlen(CAP_MAGIC));
+    cap_record(capture, CAP_START, port, name, strlen(name));
+    return true;
+}
+
+// see header
+void cap_close(Capture* capture) {
+    if (capture == NULL) {
+        return;
+    }
+    cap_write(capture);
+    if (capture->fd >= 0) {
+        close(capture->fd);
+        capture->fd = -1;
+    }
+    sb_destroy(&capture->pending);
+    sb_destroy(&capture->line);
+}
+
+// see header
+void cap_message(Capture* capture, int fromPort, Message* message) {
+    if (capture == NULL) {
+        return;
+    }
+    sb_clear(&capture->line);
+    msg_encode_into(*message, &capture->line);
+    cap_record(capture, CAP_MESSAGE, fromPort, capture->line.data,
+            capture->line.len);
+}
+
+// see header
+void cap_view(Capture* capture, int fromPort, MessageView* view) {
+    if (capture == NULL) {
+        return;
+    }
+    Message message = {0};
+    mv_to_message(view, &message);
+    cap_message(capture, fromPort, &message);
+    msg_destroy(&message);
+}
+
+// see header
+void cap_meta(Capture* capture, Message* message) {
+    if (capture == NULL) {
+        return;
+    }
+    Connection* conn = message->data.connection;
+    switch (message->type) {
+        case MSG_META_CONN_NEW:
+            cap_record(capture, CAP_CONN_NEW, conn->port, conn->name,
+                    strlen(conn->name));
+            break;
+        case MSG_META_CONN_EOF:
+            cap_record(capture, CAP_CONN_EOF, conn->port, "", 0);
+            break;
+        case MSG_META_CONN_FAILED:
+            cap_record(capture, CAP_CONN_FAILED, message->data.depotPort,
+                    "", 0);
+            break;
+        case MSG_META_WIRE_OFFER:
+            cap_record(capture, CAP_WIRE_OFFER, conn->port, "", 0);
+            break;
+        case MSG_META_SIGNAL:
+            cap_record(capture, CAP_SIGNAL, message->data.signal, "", 0);
+            break;
+        default:
+            break; // nothing to replay
+    }
+}
+
+// see header
+void cap_flush(Capture* capture) {
+    if (capture == NULL) {
+        return;
+    }
+    if (capture->dirty) {
+        cap_record(capture, CAP_FLUSH, 0, "", 0);
+    }
+    if (capture->pending.len > 0) {
+        cap_write(capture);
+    }
+}
+
+/* Reads a varint from the given file into output. Returns false at the end
+ * of the file, or if it does not fit in 32 bits.
+ */
+bool cap_read_varint(FILE* file, unsigned int* output) {
+    unsigned int value = 0;
+    for (int i = 0; i < WIRE_MAX_VARINT; i++) {
+        int byte = getc(file);
+        if (byte == EOF ||
+                (i == WIRE_MAX_VARINT - 1 && (byte & 0xf0) != 0)) {
+            return false;
+        }
+        value |= (unsigned int)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *output = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// see header
+bool cap_read_magic(FILE* file) {
+    char magic[sizeof(CAP_MAGIC) - 1];
+    return fread(magic, sizeof(magic), 1, file) == 1 &&
+            memcmp(magic, CAP_MAGIC, sizeof(magic)) == 0;
+}
+
+// see header
+MessageStatus cap_read_record(FILE* file, StrBuffer* buffer,
+        CaptureRecord* outRecord) {
+    int kind = getc(file);
+    unsigned int value;
+    unsigned int len;
+    if (kind == EOF) {
+        return MS_EOF;
+    }
+    // cap_record takes an int length, so a longer one is damage
+    if (kind < CAP_START || kind > CAP_FLUSH ||
+            !cap_read_varint(file, &outRecord->micros) ||
+            !cap_read_varint(file, &value) ||
+            !cap_read_varint(file, &len) || len > INT_MAX) {
+        DEBUG_PRINT("capture record damaged");
+        return MS_INVALID;
+    }
+    sb_clear(buffer);
+    char chunk[256];
+    for (unsigned int left = len; left > 0; ) {
+        unsigned int size = left < sizeof(chunk) ? left : sizeof(chunk);
+        if (fread(chunk, 1, size, file) != size) {
+            DEBUG_PRINT("capture record cut short");
+            return MS_INVALID;
+        }
+        sb_append(buffer, chunk, size);
+        left -= size;
+    }
+    outRecord->kind = kind;
+    outRecord->value = (int)value;
+    outRecord->data = buffer->data;
+    outRecord->len = len;
+    return MS_OK;
+}
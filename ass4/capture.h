@@ -0,0 +1,111 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "messages.h"
+#include "msgView.h"
+#include "strBuffer.h"
+
+/* Capture of everything the main thread executes, in the order it executes
+ * it, so that a depot's traffic can be replayed offline against the same
+ * executor (see depotreplay.c). Every peer message and meta message is
+ * captured with the time and the peer it came from, as are the ends of
+ * batches, where ds_flush_connections writes to peers. A capture starts with
+ * the depot's materials and defer groups at the time, so replaying it from
+ * an empty depot reaches the same state.
+ *
+ * Records are built in memory by the main thread and written together once
+ * per batch, as with the WAL, so capturing costs one write() per batch.
+ * Messages are kept as their text lines, whichever encoding they arrived
+ * in. Sharded Deliver and Withdraw never reach the main thread, so
+ * DEPOT_CAPTURE turns off sharding.
+ *
+ * File: CAP_MAGIC, then records of
+ *   u8 CaptureKind, varint microseconds since the previous record, varint
+ *   value, varint dataLen, data
+ * where varints are as in wire.h, and value and data are by kind:
+ */
+typedef enum CaptureKind {
+    CAP_START = 1, // our port, our name. always the first record
+    CAP_MESSAGE, // the sending peer's port (0 if none), the message's line
+    CAP_CONN_NEW, // the peer's port, the peer's name
+    CAP_CONN_EOF, // the peer's port
+    CAP_CONN_FAILED, // the port which was being connected to
+    CAP_WIRE_OFFER, // the offering peer's port
+    CAP_SIGNAL, // the signal number
+    CAP_FLUSH // nothing. ds_flush_connections ran after the records before
+} CaptureKind;
+
+// identifies (and versions) a capture file
+#define CAP_MAGIC "DEPOTCP1"
+
+/* A capture file being written by the main thread.
+ */
+typedef struct Capture {
+    int fd; // opened for appending
+    double last; // monotonic_seconds of the last record
+    bool dirty; // whether anything was captured since the last CAP_FLUSH
+    StrBuffer pending; // sb_destroy! records captured but not yet written
+    StrBuffer line; // sb_destroy! reused to encode messages into
+} Capture;
+
+/* One record read back from a capture file.
+ */
+typedef struct CaptureRecord {
+    CaptureKind kind;
+    unsigned int micros; // since the previous record
+    int value;
+    // BORROWED from the reader, \0 terminated, valid until the next record
+    char* data;
+    int len;
+} CaptureRecord;
+
+/* Opens a capture file at the given path, replacing any file there, and
+ * captures the CAP_START record of the depot with the given port and name.
+ * Returns false if the file could not be created, when the capture should be
+ * closed without capturing anything.
+ */
+bool cap_open(Capture* capture, char* path, int port, char* name);
+
+/* Writes anything captured but not yet written and closes the capture file.
+ * Does nothing if capture is NULL.
+ */
+void cap_close(Capture* capture);
+
+/* Captures a CAP_MESSAGE of the given peer message, from the peer on the
+ * given port. Does nothing if capture is NULL.
+ */
+void cap_message(Capture* capture, int fromPort, Message* message);
+
+/* As cap_message, for a message parsed into a view.
+ */
+void cap_view(Capture* capture, int fromPort, MessageView* view);
+
+/* Captures the record of the given meta message, which is about to be
+ * executed. MSG_META_CONN_EOF and MSG_META_WIRE_OFFER MUST only be given for
+ * connections the depot accepted. Does nothing if capture is NULL.
+ */
+void cap_meta(Capture* capture, Message* message);
+
+/* Ends the current batch with a CAP_FLUSH record, if anything was captured
+ * in it, and writes everything captured. Does nothing if capture is NULL.
+ */
+void cap_flush(Capture* capture);
+
+/* Checks that the given file, opened for reading, starts with CAP_MAGIC,
+ * leaving it at the first record. Returns false if it doesn't.
+ */
+bool cap_read_magic(FILE* file);
+
+/* Reads the next record of the given capture file into outRecord, whose data
+ * is kept in the given buffer. Records are read whatever their length, as
+ * cap_record writes them. Returns MS_OK if one was read, MS_EOF at the end of
+ * the file, or MS_INVALID if the record there is cut short or damaged, after
+ * which nothing more can be read.
+ */
+MessageStatus cap_read_record(FILE* file, StrBuffer* buffer,
+        CaptureRecord* outRecord);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <limits.h>
+
+#include "coalescer.h"
+#include "arrayHelpers.h"
+#include "util.h"
+
+// see header
+void co_init(Coalescer* coalescer) {
+    coalescer->held = calloc(1, sizeof(Array));
+    array_init(coalescer->held);
+    coalescer->index = calloc(1, sizeof(HashMap));
+    hashmap_init(coalescer->index, ah_held_mapper, ah_inthash, ah_intcmp);
+    coalescer->deadline = 0;
+}
+
+// see header
+void co_destroy(Coalescer* coalescer) {
+    if (coalescer == NULL) {
+        return;
+    }
+    if (coalescer->held != NULL) {
+        co_clear(coalescer);
+        array_destroy(coalescer->held);
+    }
+    TRY_FREE(coalescer->held);
+    hashmap_destroy(coalescer->index);
+    TRY_FREE(coalescer->index);
+}
+
+// see header
+bool co_hold(Coalescer* coalescer, SymId id, int quantity) {
+    HeldDeliver* held = hashmap_get(coalescer->index, &id);
+    if (held != NULL && held->quantity <= INT_MAX - quantity) {
+        held->quantity += quantity;
+        return true;
+    }
+    if (held != NULL) {
+        // full, so later Delivers go into a new one
+        hashmap_remove(coalescer->index, &id);
+    }
+    held = malloc(sizeof(HeldDeliver));
+    held->id = id;
+    held->quantity = quantity;
+    array_add(coalescer->held, held);
+    hashmap_put(coalescer->index, held);
+    return false;
+}
+
+// see header
+void co_clear(Coalescer* coalescer) {
+    for (int i = 0; i < coalescer->held->numItems; i++) {
+        HeldDeliver* held = coalescer->held->items[i];
+        // a full one may already be gone from the index
+        hashmap_remove(coalescer->index, &held->id);
+        free(held);
+    }
+    coalescer->held->numItems = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef COALESCER_H
+#define COALESCER_H
+
+#include <stdbool.h>
+
+#include "array.h"
+#include "hashMap.h"
+#include "symbols.h"
+
+/* A Deliver held back by a Coalescer, into which later Delivers of the same
+ * material are merged.
+ */
+typedef struct HeldDeliver {
+    SymId id; // interned material name
+    int quantity; // summed quantity of every Deliver merged so far
+} HeldDeliver;
+
+/* Delivers to one neighbour held back for a short window, so Delivers of the
+ * same material can be sent as one Deliver with their summed quantity. Since
+ * Delivers only add to the neighbour's stock, merging them and sending them
+ * in a different order to other materials' can't change what it ends up
+ * with.
+ */
+typedef struct Coalescer {
+    Array* held; // MALLOC'd HeldDeliver*'s, in the order first held
+    // the same HeldDeliver*'s, keyed by id. if a material's quantity
+    // would overflow, only its newest HeldDeliver is indexed
+    HashMap* index;
+    double deadline; // monotonic time to send them by, if any are held
+} Coalescer;
+
+/* Initialises a coalescer holding nothing.
+ */
+void co_init(Coalescer* coalescer);
+
+/* Destroys the coalescer, discarding anything it still holds.
+ */
+void co_destroy(Coalescer* coalescer);
+
+/* Holds a Deliver of quantity of the material with the given interned name
+ * id, merging it into the material's held Deliver if there is one and the
+ * sum fits in an int. Returns true if it was merged, saving a message.
+ */
+bool co_hold(Coalescer* coalescer, SymId id, int quantity);
+
+/* Discards every held Deliver, once they have been sent.
+ */
+void co_clear(Coalescer* coalescer);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "config.h"
+#include "channel.h"
+#include "connection.h"
+#include "flight.h"
+#include "inQueue.h"
+#include "network.h"
+#include "util.h"
+
+// default DEPOT_SNAPSHOT_EVERY
+#define CONFIG_SNAPSHOT_EVERY 100000
+
+/* Returns the value of the given environment variable as a non-negative
+ * integer, or fallback if the variable is unset or invalid.
+ */
+int config_env_int(char* name, int fallback) {
+    char* value = getenv(name);
+    if (value == NULL) {
+        return fallback;
+    }
+    int parsed = parse_int(value);
+    if (parsed < 0) {
+        DEBUG_PRINTF("ignoring invalid %s=%s\n", name, value);
+        return fallback;
+    }
+    return parsed;
+}
+
+// see header
+void config_load(DepotConfig* config) {
+    config->eventLoop = config_env_int("DEPOT_EVENT_LOOP", 0) != 0;
+    config->incomingSize = config_env_int("DEPOT_CHANNEL_SIZE", CHANNEL_SIZE);
+    if (config->incomingSize < 1) {
+        config->incomingSize = 1;
+    }
+    config->peerInMax = config_env_int("DEPOT_PEER_IN_MAX", IN_QUEUE_SIZE);
+    config->peerOutMax = config_env_int("DEPOT_PEER_OUT_MAX",
+            CONN_DEFAULT_OUT_MAX);
+    config->wire = config_env_int("DEPOT_WIRE", 0) != 0;
+    config->shards = config_env_int("DEPOT_SHARDS", 0);
+    config->walDir = getenv("DEPOT_WAL_DIR");
+    config->walFsync = wal_parse_fsync(getenv("DEPOT_WAL_FSYNC"),
+            WAL_FSYNC_BATCH);
+    config->snapshotEvery = config_env_int("DEPOT_SNAPSHOT_EVERY",
+            CONFIG_SNAPSHOT_EVERY);
+    config->statsName = getenv("DEPOT_STATS");
+    config->connectTimeoutMs = config_env_int("DEPOT_CONNECT_TIMEOUT_MS", 0);
+    config->handshakeTimeoutMs = config_env_int("DEPOT_HANDSHAKE_TIMEOUT_MS",
+            0);
+    config->connectionQueue = config_env_int("DEPOT_CONNECTION_QUEUE",
+            CONNECTION_QUEUE);
+    config->coalesceUs = config_env_int("DEPOT_COALESCE_US", -1);
+    config->flightEvents = config_env_int("DEPOT_FLIGHT_EVENTS",
+            FR_DEFAULT_EVENTS);
+    config->flightFile = getenv("DEPOT_FLIGHT_FILE");
+    config->captureFile = getenv("DEPOT_CAPTURE");
+    if (config->walDir != NULL && config->shards > 0) {
+        DEBUG_PRINT("DEPOT_WAL_DIR is set, not sharding");
+        config->shards = 0;
+    }
+    if (config->captureFile != NULL && config->shards > 0) {
+        DEBUG_PRINT("DEPOT_CAPTURE is set, not sharding");
+        config->shards = 0;
+    }
+}
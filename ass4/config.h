@@ -0,0 +1,77 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#include "wal.h"
+
+/* Runtime tuning options for the depot. The command line format is fixed by
+ * the spec, so these are read from DEPOT_* environment variables instead.
+ * Every option has a default which matches the original behaviour.
+ */
+typedef struct DepotConfig {
+    // DEPOT_EVENT_LOOP: if true, multiplex the listening socket, every peer
+    // socket and signals on one thread with epoll instead of starting a
+    // reader thread per peer.
+    bool eventLoop;
+    // DEPOT_CHANNEL_SIZE: capacity of the incoming message ring, rounded up
+    // to a power of 2.
+    int incomingSize;
+    // DEPOT_PEER_IN_MAX: capacity of each reader thread's InQueue, rounded
+    // up to a power of 2. a reader blocks once its peer has this many
+    // messages waiting for the main thread.
+    int peerInMax;
+    // DEPOT_PEER_OUT_MAX: most bytes queued for one peer. messages to a peer
+    // which is not reading are dropped beyond this.
+    int peerOutMax;
+    // DEPOT_WIRE: if true, offer peers the binary encoding in wire.h and
+    // switch to it with peers which offer it too.
+    bool wire;
+    // DEPOT_SHARDS: if non-zero, execute Deliver and Withdraw on this many
+    // threads, each owning a slice of the materials, see shard.h.
+    int shards;
+    // DEPOT_WAL_DIR: if set, log every change to the materials and defer
+    // groups in this directory and recover them on start, see wal.h. Turns
+    // off sharding, whose changes never pass through the main thread.
+    char* walDir; // BORROWED from the environment
+    // DEPOT_WAL_FSYNC: always, batch or none. see WalFsync.
+    WalFsync walFsync;
+    // DEPOT_SNAPSHOT_EVERY: records logged between snapshots, 0 for never.
+    int snapshotEvery;
+    // DEPOT_STATS: if set, keep counters in a shared memory segment with
+    // this name for depottop to read, see stats.h. a depot killed by a
+    // signal it doesn't handle leaves the segment behind until the name is
+    // next used.
+    char* statsName; // BORROWED from the environment
+    // DEPOT_CONNECT_TIMEOUT_MS: how long a Connect may take to reach its
+    // port before it is given up on. 0 waits as long as the kernel does.
+    int connectTimeoutMs;
+    // DEPOT_HANDSHAKE_TIMEOUT_MS: how long a peer has to send its IM once
+    // connected, either way, before it is dropped. 0 waits forever.
+    int handshakeTimeoutMs;
+    // DEPOT_CONNECTION_QUEUE: how many connections the listening socket
+    // holds until they are accepted, as for listen().
+    int connectionQueue;
+    // DEPOT_COALESCE_US: if set, Delivers to a neighbour are held for this
+    // many microseconds and those of the same material merged into one, see
+    // coalescer.h. 0 only merges Delivers queued by the same batch of
+    // messages, adding no delay. -1 (unset) sends every Deliver as is.
+    int coalesceUs;
+    // DEPOT_FLIGHT_EVENTS: events each thread's flight recorder ring holds,
+    // rounded up to a power of 2, or 0 to record nothing. see flight.h.
+    int flightEvents;
+    // DEPOT_FLIGHT_FILE: file the flight recorder is dumped to, by default
+    // depot-<pid>.flight in the working directory.
+    char* flightFile; // BORROWED from the environment
+    // DEPOT_CAPTURE: if set, capture everything the main thread executes
+    // into this file, for depotreplay to replay, see capture.h. Turns off
+    // sharding, as with DEPOT_WAL_DIR.
+    char* captureFile; // BORROWED from the environment
+} DepotConfig;
+
+/* Loads the depot configuration from the environment into the given config
+ * struct. Unset or unparseable variables take their default value.
+ */
+void config_load(DepotConfig* config);
+
+#endif
@@ -3,7 +3,9 @@
 
 #include "connection.h"
 #include "arrayHelpers.h"
+#include "coalescer.h"
 #include "messages.h"
+#include "wire.h"
 #include "util.h"
 
 
@@ -11,6 +13,12 @@
 void conn_init(Connection* connection, int port, char* name) {
     connection->port = port;
     connection->name = strdup(name);
+    connection->fd = -1;
+    connection->sink = NULL;
+    connection->switchPending = false;
+    connection->rejected = false;
+    oq_init(&connection->outQueue, CONN_DEFAULT_OUT_MAX);
+    sb_init(&connection->encodeBuffer);
 }
 
 // see header
@@ -19,6 +27,12 @@ void conn_destroy(Connection* connection) {
         return;
     }
     TRY_FREE(connection->name);
+    oq_destroy(&connection->outQueue);
+    sb_destroy(&connection->encodeBuffer);
+    wenc_destroy(connection->wire);
+    TRY_FREE(connection->wire);
+    co_destroy(connection->coalescer);
+    TRY_FREE(connection->coalescer);
 
     if (connection->readFile != NULL) {
         fclose(connection->readFile);
@@ -35,4 +49,75 @@ void conn_destroy(Connection* connection) {
 void conn_set_files(Connection* connection, FILE* readFile, FILE* writeFile) {
     connection->readFile = readFile;
     connection->writeFile = writeFile;
+    connection->fd = fileno(writeFile);
+}
+
+// see header
+void conn_set_sink(Connection* connection, OutSink sink, void* sinkData) {
+    connection->sink = sink;
+    connection->sinkData = sinkData;
+}
+
+/* Queues the pending WIRE_SWITCH line and starts encoding binary, unless the
+ * line is dropped, in which case the switch stays pending and text is sent.
+ */
+void conn_queue_switch(Connection* connection) {
+    char* line = WIRE_SWITCH "\n";
+    if (connection->broken ||
+            !oq_append(&connection->outQueue, line, strlen(line))) {
+        DEBUG_PRINTF("no room to switch %s to binary yet\n",
+                connection->name);
+        return;
+    }
+    connection->switchPending = false;
+    connection->wire = malloc(sizeof(WireEncoder));
+    wenc_init(connection->wire);
+}
+
+// see header
+bool conn_queue_message(Connection* connection, Message message) {
+    if (connection->broken) {
+        DEBUG_PRINTF("discarding message to broken %s\n", connection->name);
+        return false;
+    }
+    if (connection->switchPending) {
+        conn_queue_switch(connection);
+    }
+    StrBuffer* encoded = &connection->encodeBuffer;
+    sb_clear(encoded);
+    if (connection->wire != NULL) {
+        wenc_encode(connection->wire, message, encoded);
+        DEBUG_PRINTF("queueing %d binary bytes\n", encoded->len);
+    } else {
+        msg_encode_into(message, encoded);
+        DEBUG_PRINTF("queueing: %s\n", encoded->data);
+        sb_append_char(encoded, '\n');
+    }
+    return oq_append(&connection->outQueue, encoded->data, encoded->len);
+}
+
+// see header
+void conn_start_binary(Connection* connection) {
+    if (connection->wire != NULL) {
+        return;
+    }
+    DEBUG_PRINTF("switching %s to binary\n", connection->name);
+    connection->switchPending = true;
+    conn_queue_switch(connection);
+}
+
+// see header
+FlushStatus conn_flush(Connection* connection) {
+    if (connection->sink != NULL) {
+        oq_flush_to(&connection->outQueue, connection->sink,
+                connection->sinkData);
+        return FLUSH_EMPTY;
+    }
+    FlushStatus status = oq_flush(&connection->outQueue, connection->fd);
+    if (status == FLUSH_ERROR) {
+        DEBUG_PRINTF("write to %s failed, marking broken\n",
+                connection->name);
+        connection->broken = true;
+    }
+    return status;
 }
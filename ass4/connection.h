@@ -2,15 +2,51 @@
 #define CONNECTION_H
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <pthread.h>
 
 #include "channel.h"
+#include "outQueue.h"
+#include "strBuffer.h"
 
+// default cap on bytes queued for one connection
+#define CONN_DEFAULT_OUT_MAX (1 << 20)
+
+struct Message;
+struct WireEncoder;
+struct PeerStats;
+
+/* A verified connection to another depot. Writing is done only by the main
+ * thread, by queueing encoded messages in outQueue and flushing them to fd
+ * without blocking.
+ */
 typedef struct Connection {
     int port;
     char* name; // malloc!
     FILE* readFile;
     FILE* writeFile;
+
+    int fd; // fd of writeFile, written to directly by oq_flush
+    OutQueue outQueue; // encoded messages waiting to be written to fd
+    StrBuffer encodeBuffer; // scratch space messages are encoded into
+    struct WireEncoder* wire; // MALLOC! binary encoder, NULL while sending text
+    // the peer can take binary, but the WIRE_SWITCH line couldn't be queued
+    // yet, so messages are still sent as text until it is
+    bool switchPending;
+    bool flushPending; // whether this is in the depot's list to flush
+    // MALLOC! Delivers held back to be merged, see ds_send_message. NULL
+    // until the first is held
+    struct Coalescer* coalescer;
+    bool broken; // a write failed, further messages are discarded
+    // refused by the depot state as a duplicate, see MSG_META_CONN_NEW. it
+    // is left to whoever offered it, and is never used by the depot again
+    bool rejected;
+    // BORROWED slot in the depot's stats segment, NULL if there is none
+    struct PeerStats* stats;
+    // if set, flushing hands queued bytes to this instead of writing them to
+    // fd, see conn_set_sink. NULL for sockets
+    OutSink sink;
+    void* sinkData; // BORROWED, given to sink
 } Connection;
 
 /* Initialises a connection struct in the given location, with the given port
@@ -23,8 +59,34 @@ void conn_init(Connection* connection, int port, char* name);
 void conn_destroy(Connection* connection);
 
 /* Attaches the given files to the connection. Given files are for reading
- * or writing to the connection's socket, respectively.
+ * or writing to the connection's socket, respectively. readFile may be NULL.
  */
 void conn_set_files(Connection* connection, FILE* readFile, FILE* writeFile);
 
+/* Has the connection's queued bytes handed to the given sink with the given
+ * sinkData when flushed, instead of written to a socket. Used to connect
+ * depots without sockets, e.g. in a simulation (see depotsim.c).
+ */
+void conn_set_sink(Connection* connection, OutSink sink, void* sinkData);
+
+/* Encodes the given message and appends it to the connection's outbound
+ * queue. Nothing is written until the queue is flushed. Returns false if the
+ * message was discarded because the connection is broken or its queue is
+ * full.
+ */
+bool conn_queue_message(Connection* connection, struct Message message);
+
+/* Switches messages queued after this to the binary encoding, queueing the
+ * WIRE_SWITCH line which tells the peer. Does nothing if already switched.
+ * If the line doesn't fit in the queue, the connection keeps sending text
+ * and switches before the first message queued once it does fit.
+ */
+void conn_start_binary(Connection* connection);
+
+/* Writes as much of the connection's outbound queue as possible without
+ * blocking, or all of it to its sink if it has one. Marks the connection
+ * broken if the write fails.
+ */
+FlushStatus conn_flush(Connection* connection);
+
 #endif
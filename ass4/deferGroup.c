@@ -1,15 +1,25 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "deferGroup.h"
-#include "array.h"
 #include "util.h"
-#include "arrayHelpers.h"
+
+/* Fixed part of one message in a group's arena. It is followed directly by
+ * matLen bytes of material name then depotLen bytes of depot name. Headers
+ * are not aligned within the arena, so are always memcpy'd in and out.
+ */
+typedef struct DeferHeader {
+    MessageType type;
+    int quantity;
+    int matLen;
+    int depotLen; // 0 unless a Transfer
+} DeferHeader;
 
 // see header
 void dg_init(DeferGroup* deferGroup, int key) {
     deferGroup->key = key;
-    deferGroup->messages = calloc(1, sizeof(Array));
-    array_init(deferGroup->messages);
+    deferGroup->numMessages = 0;
+    sb_init(&deferGroup->arena);
 }
 
 // see header
@@ -17,16 +27,46 @@ void dg_destroy(DeferGroup* deferGroup) {
     if (deferGroup == NULL) {
         return;
     }
-    if (deferGroup->messages != NULL) {
-        array_foreach(deferGroup->messages, ah_msg_destroy);
-    }
-    array_destroy_and_free(deferGroup->messages);
-    TRY_FREE(deferGroup->messages);
+    sb_destroy(&deferGroup->arena);
+    deferGroup->numMessages = 0;
 }
 
 // see header
-void dg_add_message(DeferGroup* deferGroup, Message* message) {
+void dg_add_view(DeferGroup* deferGroup, MessageView* view) {
     DEBUG_PRINTF("adding message to defer key: %d\n", deferGroup->key);
-    array_add(deferGroup->messages, message);
+    DeferHeader header = {0};
+    header.type = view->type;
+    header.quantity = view->quantity;
+    header.matLen = view->matName.len;
+    if (view->type == MSG_TRANSFER) {
+        header.depotLen = view->depotName.len;
+    }
+    sb_append(&deferGroup->arena, (char*)&header, sizeof(DeferHeader));
+    sb_append(&deferGroup->arena, view->matName.start, header.matLen);
+    if (header.depotLen > 0) {
+        sb_append(&deferGroup->arena, view->depotName.start,
+                header.depotLen);
+    }
+    deferGroup->numMessages++;
 }
 
+// see header
+bool dg_next(DeferGroup* deferGroup, int* offset, MessageView* outView) {
+    if (*offset >= deferGroup->arena.len) {
+        return false;
+    }
+    char* record = deferGroup->arena.data + *offset;
+    DeferHeader header;
+    memcpy(&header, record, sizeof(DeferHeader));
+    char* names = record + sizeof(DeferHeader);
+
+    memset(outView, 0, sizeof(MessageView));
+    outView->type = header.type;
+    outView->quantity = header.quantity;
+    outView->matName.start = names;
+    outView->matName.len = header.matLen;
+    outView->depotName.start = names + header.matLen;
+    outView->depotName.len = header.depotLen;
+    *offset += sizeof(DeferHeader) + header.matLen + header.depotLen;
+    return true;
+}
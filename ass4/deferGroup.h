@@ -1,12 +1,19 @@
 #ifndef DEFERGROUP_H
 #define DEFERGROUP_H
 
-#include "array.h"
-#include "messages.h"
+#include <stdbool.h>
 
+#include "msgView.h"
+#include "strBuffer.h"
+
+/* The messages deferred under one key. Rather than a heap Message each, the
+ * messages are packed one after another into a single arena buffer, which is
+ * freed in one go once the group is executed.
+ */
 typedef struct DeferGroup {
     int key;
-    Array* messages;
+    int numMessages;
+    StrBuffer arena; // sb_destroy! packed messages, see deferGroup.c
 } DeferGroup;
 
 /* Initialises a defer group with the given defer key.
@@ -17,9 +24,16 @@ void dg_init(DeferGroup* deferGroup, int key);
  */ 
 void dg_destroy(DeferGroup* deferGroup);
 
-/* Appends the given message pointer to the messages of this group.
-   Message should be a MALLOC'd pointer, this takes ownership of the pointer.
+/* Appends a copy of the given Deliver, Withdraw or Transfer to the messages of
+ * this group. Nothing in the view is kept.
+ */
+void dg_add_view(DeferGroup* deferGroup, MessageView* view);
+
+/* Iterates over the group's messages in the order they were added. *offset
+ * should start at 0. Stores the next message into outView and returns true,
+ * or returns false once every message has been taken. Names in outView point
+ * into the group, so are only valid until it is next changed.
  */
-void dg_add_message(DeferGroup* deferGroup, Message* message);
+bool dg_next(DeferGroup* deferGroup, int* offset, MessageView* outView);
 
 #endif
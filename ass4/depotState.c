@@ -5,34 +5,72 @@
 #include "connection.h"
 #include "deferGroup.h"
 #include "material.h"
+#include "messages.h"
+#include "materialTable.h"
 #include "array.h"
-#include "channel.h"
+#include "ring.h"
 #include "util.h"
 #include "arrayHelpers.h"
 
 // see header
-void ds_init(DepotState* depotState, char* name) {
+void ds_init(DepotState* depotState, char* name, DepotConfig* config) {
     depotState->name = name;
+    depotState->config = *config;
 
-    depotState->incoming = calloc(1, sizeof(Channel));
-    chan_init(depotState->incoming);
+    depotState->incoming = calloc(1, sizeof(Ring));
+    ring_init(depotState->incoming, config->incomingSize);
 
-    // array of Material, keyed by material name
-    depotState->materials = calloc(1, sizeof(Array));
-    arraymap_init(depotState->materials, ah_mat_mapper, ah_strcmp);
+    // table of Material, keyed by material name
+    depotState->materials = calloc(1, sizeof(MaterialTable));
+    mt_init(depotState->materials);
 
-    // array of Connection, keyed by depot name
+    if (config->statsName != NULL &&
+            stats_create(&depotState->stats, config->statsName)) {
+        STATS_SET(depotState->stats->incomingCapacity,
+                (long)depotState->incoming->capacity);
+    }
+
+    // writes reports directly if it can't be started
+    depotState->reporter = calloc(1, sizeof(Reporter));
+    reporter_init(depotState->reporter);
+
+    if (config->shards > 0) {
+        depotState->shards = calloc(1, sizeof(ShardSet));
+        if (!shardset_init(depotState->shards, config->shards,
+                config->incomingSize)) {
+            DEBUG_PRINT("failed to start shards, not sharding");
+            shardset_destroy(depotState->shards);
+            TRY_FREE(depotState->shards);
+        }
+    }
+
+    // array of Connection, indexed by depot name and by port
     depotState->connections = calloc(1, sizeof(Array));
-    arraymap_init(depotState->connections, ah_conn_mapper, ah_strcmp);
+    array_init(depotState->connections);
+    depotState->connsByName = calloc(1, sizeof(HashMap));
+    hashmap_init(depotState->connsByName, ah_conn_mapper, ah_strhash,
+            ah_strcmp);
+    depotState->connsByPort = calloc(1, sizeof(HashMap));
+    hashmap_init(depotState->connsByPort, ah_conn_port_mapper, ah_inthash,
+            ah_intcmp);
 
-    // array of int*'s, each pointing to a port we have an unverified connect
+    // table of int*'s, each pointing to a port we have an unverified connect
     // to.
-    depotState->pending = calloc(1, sizeof(Array));
-    arraymap_init(depotState->pending, ah_noop_mapper, ah_intcmp);
+    depotState->pending = calloc(1, sizeof(HashMap));
+    hashmap_init(depotState->pending, ah_noop_mapper, ah_inthash, ah_intcmp);
+
+    // array of Connection*'s with queued output. BORROWED from connections
+    depotState->flushList = calloc(1, sizeof(Array));
+    array_init(depotState->flushList);
 
-    // array of DeferGroup, keyed by defer key (as integer)
-    depotState->deferGroups = calloc(1, sizeof(Array));
-    arraymap_init(depotState->deferGroups, ah_dg_mapper, ah_intcmp);
+    // array of Connection*'s holding Delivers to be merged. BORROWED too
+    depotState->coalesceList = calloc(1, sizeof(Array));
+    array_init(depotState->coalesceList);
+
+    // table of DeferGroup, keyed by defer key (as integer)
+    depotState->deferGroups = calloc(1, sizeof(HashMap));
+    hashmap_init(depotState->deferGroups, ah_dg_mapper, ah_inthash,
+            ah_intcmp);
 }
 
 // helper to execute the given destroy function on each item in the array
@@ -54,61 +92,103 @@ void ds_destroy(DepotState* depotState) {
     if (depotState == NULL) {
         return;
     }
+    // reports borrow from the materials and connections, so go first
+    reporter_destroy(depotState->reporter);
+    TRY_FREE(depotState->reporter);
 
     if (depotState->incoming != NULL) {
-        chan_foreach(depotState->incoming, ah_msg_destroy);
-        chan_foreach(depotState->incoming, free);
-        chan_destroy(depotState->incoming);
+        ring_foreach(depotState->incoming, ah_msg_release);
+        ring_destroy(depotState->incoming);
     }
     TRY_FREE(depotState->incoming);
 
-    array_destroy_and_free(depotState->pending);
+    shardset_destroy(depotState->shards);
+    TRY_FREE(depotState->shards);
+
+    wal_close(depotState->wal); // commits anything left
+    TRY_FREE(depotState->wal);
+
+    cap_close(depotState->capture); // writes anything left
+    TRY_FREE(depotState->capture);
+
+    if (depotState->pending != NULL) {
+        hashmap_foreach(depotState->pending, free);
+        hashmap_destroy(depotState->pending);
+    }
     TRY_FREE(depotState->pending);
 
-    destroy_helper(depotState->materials, ah_mat_destroy);
-    TRY_FREE(depotState->materials); // frees array
+    array_destroy(depotState->flushList); // connections are destroyed below
+    TRY_FREE(depotState->flushList);
+    array_destroy(depotState->coalesceList);
+    TRY_FREE(depotState->coalesceList);
+
+    mt_destroy(depotState->materials);
+    TRY_FREE(depotState->materials);
     
+    // the indexes borrow from connections
+    hashmap_destroy(depotState->connsByName);
+    TRY_FREE(depotState->connsByName);
+    hashmap_destroy(depotState->connsByPort);
+    TRY_FREE(depotState->connsByPort);
     destroy_helper(depotState->connections, ah_conn_destroy);
     TRY_FREE(depotState->connections);
 
-    destroy_helper(depotState->deferGroups, ah_dg_destroy);
+    if (depotState->deferGroups != NULL) {
+        hashmap_foreach(depotState->deferGroups, ah_dg_destroy);
+        hashmap_foreach(depotState->deferGroups, free);
+        hashmap_destroy(depotState->deferGroups);
+    }
     TRY_FREE(depotState->deferGroups);
+
+    if (depotState->stats != NULL) {
+        // reader threads may still be counting, so the segment stays mapped
+        // until we exit and only its name is removed
+        stats_unlink(depotState->config.statsName);
+        depotState->stats = NULL;
+    }
 }
 
 // see header
-Connection* ds_add_connection(DepotState* depotState, int port, char* name) {
-    Connection conn = {0};
-    conn_init(&conn, port, name);
+void ds_add_connection(DepotState* depotState, Connection* connection) {
+    DEBUG_PRINTF("adding connection to %s on %d\n", connection->name,
+            connection->port);
+    array_add(depotState->connections, connection);
+    hashmap_put(depotState->connsByName, connection);
+    hashmap_put(depotState->connsByPort, connection);
+}
 
-    DEBUG_PRINTF("adding connection to %s on %d\n", name, port);
-    Connection* newConn = array_add_copy(depotState->connections, &conn, 
-            sizeof(Connection));
-    arraymap_sort(depotState->connections);
-    return newConn;
+// see header
+Connection* ds_get_connection(DepotState* depotState, char* name) {
+    return hashmap_get(depotState->connsByName, name);
 }
 
 // see header
 Material* ds_ensure_mat(DepotState* depotState, char* matName) {
-    Material* oldMat = arraymap_get(depotState->materials, matName);
-    if (oldMat == NULL) {
-        // material not in list
-        Material mat = {0};
-        mat_init(&mat, 0, matName);
-        DEBUG_PRINTF("adding empty material: %s\n", matName);
-        Material* newMat = array_add_copy(depotState->materials, &mat, 
-                sizeof(Material));
-        arraymap_sort(depotState->materials);
-        return newMat;
-    } else {
-        return oldMat;
-    }
+    return mt_ensure(depotState->materials, matName);
 }
 
 // see header
 void ds_alter_mat(DepotState* depotState, char* matName, int delta) {
-    Material* mat = ds_ensure_mat(depotState, matName);
+    ds_alter_mat_view(depotState, sv_from(matName), delta);
+}
+
+// see header
+void ds_alter_mat_view(DepotState* depotState, StrView matName, int delta) {
+    ds_alter_mat_id(depotState, sym_intern(matName), delta);
+}
+
+// see header
+void ds_alter_mat_id(DepotState* depotState, SymId matId, int delta) {
+    if (depotState->shards != NULL) {
+        shardset_alter(depotState->shards, matId, delta);
+        return;
+    }
+    if (depotState->wal != NULL) {
+        wal_log_alter(depotState->wal, sym_view(matId), delta);
+    }
+    Material* mat = mt_ensure_id(depotState->materials, matId);
 
-    DEBUG_PRINTF("changing material %s by %d\n", matName, delta);
+    DEBUG_PRINTF("changing material %s by %d\n", mat->name, delta);
     assert(mat != NULL);
     mat->quantity += delta;
 }
@@ -116,34 +196,323 @@ void ds_alter_mat(DepotState* depotState, char* matName, int delta) {
 // see header
 DeferGroup* ds_ensure_defer_group(DepotState* depotState, int key) {
     // note & on key.
-    DeferGroup* dg = arraymap_get(depotState->deferGroups, &key);
+    DeferGroup* dg = hashmap_get(depotState->deferGroups, &key);
     if (dg != NULL) {
         return dg;
     }
 
     DEBUG_PRINTF("adding new defer group with key %d\n", key);
-    DeferGroup dgNew = {0};
-    dg_init(&dgNew, key);
-    return array_add_copy(depotState->deferGroups, &dgNew, sizeof(DeferGroup));
+    dg = malloc(sizeof(DeferGroup));
+    dg_init(dg, key);
+    hashmap_put(depotState->deferGroups, dg);
+    return dg;
+}
+
+// see header
+void ds_defer(DepotState* depotState, int key, MessageView* inner) {
+    if (depotState->wal != NULL) {
+        wal_log_defer(depotState->wal, key, inner);
+    }
+    dg_add_view(ds_ensure_defer_group(depotState, key), inner);
+}
+
+// see header
+DeferGroup* ds_take_defer_group(DepotState* depotState, int key) {
+    DeferGroup* dg = hashmap_remove(depotState->deferGroups, &key);
+    if (dg != NULL && depotState->wal != NULL) {
+        wal_log_execute(depotState->wal, key);
+    }
+    return dg;
+}
+
+// see header
+bool ds_open_wal(DepotState* depotState, bool* recovered) {
+    Wal* wal = malloc(sizeof(Wal));
+    if (!wal_open(wal, depotState->config.walDir, depotState->config.walFsync,
+            depotState->config.snapshotEvery)) {
+        wal_close(wal);
+        free(wal);
+        return false;
+    }
+    // replayed changes must not be logged again, so the wal is only
+    // attached once recovered
+    *recovered = wal_recover(wal, depotState);
+    depotState->wal = wal;
+    return true;
+}
+
+/* Captures the given material as the message which would deliver (or
+ * withdraw) it to an empty depot, if its quantity is not 0.
+ */
+void ds_capture_mat(Capture* capture, Material* mat) {
+    if (mat->quantity == 0) {
+        return;
+    }
+    Message message = {0};
+    message.type = mat->quantity > 0 ? MSG_DELIVER : MSG_WITHDRAW;
+    mat_init_id(&message.data.material, abs(mat->quantity), mat->id);
+    cap_message(capture, 0, &message);
+}
+
+// see header
+void ds_open_capture(DepotState* depotState) {
+    Capture* capture = malloc(sizeof(Capture));
+    if (!cap_open(capture, depotState->config.captureFile, depotState->port,
+            depotState->name)) {
+        DEBUG_PRINT("failed to open capture file, not capturing");
+        cap_close(capture);
+        free(capture);
+        return;
+    }
+    // the state so far, as the messages which would build it from nothing
+    Array* materials = depotState->materials->materials;
+    for (int i = 0; i < materials->numItems; i++) {
+        ds_capture_mat(capture, ARRAY_ITEM(Material, materials, i));
+    }
+    int index = 0;
+    DeferGroup* dg;
+    while ((dg = hashmap_next(depotState->deferGroups, &index)) != NULL) {
+        int offset = 0;
+        MessageView deferred;
+        while (dg_next(dg, &offset, &deferred)) {
+            Message inner = {0};
+            mv_to_message(&deferred, &inner);
+            Message message = {0};
+            message.type = MSG_DEFER;
+            message.data.deferKey = dg->key;
+            message.data.deferMessage = &inner;
+            cap_message(capture, 0, &message);
+            msg_destroy(&inner);
+        }
+    }
+    cap_flush(capture);
+    depotState->capture = capture;
+}
+
+// see header
+void ds_commit(DepotState* depotState) {
+    Wal* wal = depotState->wal;
+    if (wal == NULL) {
+        return;
+    }
+    if (wal_commit(wal) && wal_snapshot_due(wal)) {
+        wal_snapshot(wal, depotState);
+    }
+}
+
+/* Adds the connection to the list flushed by ds_flush_connections, unless
+ * it's already there.
+ */
+void ds_schedule_flush(DepotState* depotState, Connection* connection) {
+    if (!connection->flushPending) {
+        connection->flushPending = true;
+        array_add(depotState->flushList, connection);
+    }
+}
+
+/* Queues the given message to the connection's outbound queue, counting it
+ * as sent, or as dropped if the connection couldn't take it.
+ */
+void ds_queue_message(DepotState* depotState, Connection* connection,
+        Message message) {
+    bool queued = conn_queue_message(connection, message);
+    if (queued) {
+        ds_schedule_flush(depotState, connection);
+    }
+    DepotStats* stats = depotState->stats;
+    PeerStats* peer = connection->stats;
+    if (stats != NULL && queued) {
+        STATS_ADD(stats->sent[message.type], 1);
+    }
+    if (peer != NULL) {
+        STATS_ADD(*(queued ? &peer->messagesOut : &peer->dropped), 1);
+    }
+}
+
+/* Holds the given Deliver in the connection's coalescer until its window is
+ * over, merging it with any held Deliver of the same material.
+ */
+void ds_hold_deliver(DepotState* depotState, Connection* connection,
+        Message message) {
+    if (connection->coalescer == NULL) {
+        connection->coalescer = malloc(sizeof(Coalescer));
+        co_init(connection->coalescer);
+    }
+    Coalescer* coalescer = connection->coalescer;
+    if (coalescer->held->numItems == 0) {
+        // the window starts with the first Deliver held
+        int windowUs = depotState->config.coalesceUs;
+        coalescer->deadline = windowUs > 0 ?
+                monotonic_seconds() + windowUs / 1e6 : 0;
+        array_add(depotState->coalesceList, connection);
+    }
+    if (co_hold(coalescer, message.data.material.id,
+            message.data.material.quantity) && depotState->stats != NULL) {
+        STATS_ADD(depotState->stats->coalesced, 1);
+    }
+}
+
+/* Queues the held Delivers of every connection whose coalescing window is
+ * over. Returns how many milliseconds until the next window is over, or -1
+ * if no Delivers are held any more.
+ */
+int ds_release_held(DepotState* depotState) {
+    Array* coalesceList = depotState->coalesceList;
+    if (coalesceList->numItems == 0) {
+        return -1;
+    }
+    double now = depotState->config.coalesceUs > 0 ? monotonic_seconds() : 0;
+    double nextDeadline = 0;
+    // connections still in their window are compacted to the front
+    int numHolding = 0;
+    for (int i = 0; i < coalesceList->numItems; i++) {
+        Connection* conn = coalesceList->items[i];
+        Coalescer* coalescer = conn->coalescer;
+        if (coalescer->deadline > now) {
+            if (numHolding == 0 || coalescer->deadline < nextDeadline) {
+                nextDeadline = coalescer->deadline;
+            }
+            coalesceList->items[numHolding++] = conn;
+            continue;
+        }
+        for (int j = 0; j < coalescer->held->numItems; j++) {
+            HeldDeliver* held = coalescer->held->items[j];
+            Message deliver = {0};
+            deliver.type = MSG_DELIVER;
+            mat_init_id(&deliver.data.material, held->quantity, held->id);
+            ds_queue_message(depotState, conn, deliver);
+        }
+        co_clear(coalescer);
+    }
+    coalesceList->numItems = numHolding;
+    // rounded up, so we don't wake just before the deadline
+    return numHolding == 0 ? -1 : (int)((nextDeadline - now) * 1000) + 1;
+}
+
+// see header
+void ds_send_message(DepotState* depotState, Connection* connection,
+        Message message) {
+    if (depotState->config.coalesceUs >= 0 && message.type == MSG_DELIVER &&
+            !connection->broken) {
+        ds_hold_deliver(depotState, connection, message);
+        return;
+    }
+    ds_queue_message(depotState, connection, message);
+}
+
+// see header
+void ds_start_binary(DepotState* depotState, Connection* connection) {
+    conn_start_binary(connection);
+    ds_schedule_flush(depotState, connection); // for the switch line
+}
+
+/* Counts the given number of bytes written to the connection and updates its
+ * queued bytes gauge, if keeping stats.
+ */
+void ds_count_written(DepotState* depotState, Connection* connection,
+        long written) {
+    PeerStats* peer = connection->stats;
+    if (depotState->stats == NULL) {
+        return;
+    }
+    STATS_ADD(depotState->stats->bytesOut, written);
+    if (peer != NULL) {
+        STATS_ADD(peer->bytesOut, written);
+        STATS_SET(peer->queuedBytes, connection->outQueue.queuedBytes);
+    }
+}
+
+/* Samples the gauges in the stats segment, if keeping stats, and counts a
+ * batch. Cheap enough to do once per batch: every gauge is a count the
+ * depot state already keeps.
+ */
+void ds_publish_stats(DepotState* depotState) {
+    DepotStats* stats = depotState->stats;
+    if (stats == NULL) {
+        return;
+    }
+    STATS_ADD(stats->batches, 1);
+    long depth = ring_count(depotState->incoming);
+    STATS_SET(stats->incomingDepth, depth);
+    if (depth > stats->incomingHigh) { // only the main thread sets this
+        STATS_SET(stats->incomingHigh, depth);
+    }
+    if (depotState->shards != NULL) {
+        long shardDepth = 0;
+        for (int i = 0; i < depotState->shards->numShards; i++) {
+            shardDepth += ring_count(&depotState->shards->shards[i].inbox);
+        }
+        STATS_SET(stats->shardDepth, shardDepth);
+    }
+    STATS_SET(stats->inBusy, depotState->inQueues.numBusy);
+    STATS_SET(stats->connections, depotState->connections->numItems);
+    STATS_SET(stats->pending, depotState->pending->numItems);
+    STATS_SET(stats->materials, depotState->materials->materials->numItems);
+    STATS_SET(stats->deferGroups, depotState->deferGroups->numItems);
+}
+
+// see header
+int ds_flush_connections(DepotState* depotState) {
+    // nothing is sent for changes which could still be lost
+    ds_commit(depotState);
+    cap_flush(depotState->capture);
+    int heldMs = ds_release_held(depotState);
+
+    Array* flushList = depotState->flushList;
+    // connections which are still pending are compacted to the front
+    int numPending = 0;
+    for (int i = 0; i < flushList->numItems; i++) {
+        Connection* conn = flushList->items[i];
+        long queued = conn->outQueue.queuedBytes;
+        FlushStatus status = conn_flush(conn);
+        if (status != FLUSH_ERROR) {
+            ds_count_written(depotState, conn,
+                    queued - conn->outQueue.queuedBytes);
+        }
+        if (status == FLUSH_PENDING) {
+            flushList->items[numPending++] = conn;
+        } else {
+            conn->flushPending = false;
+        }
+    }
+    flushList->numItems = numPending;
+    ds_publish_stats(depotState);
+    if (numPending > 0 && (heldMs < 0 || FLUSH_RETRY_MS < heldMs)) {
+        return FLUSH_RETRY_MS;
+    }
+    return heldMs;
 }
 
 // see header
 void ds_print_info(DepotState* depotState) {
-    printf("Goods:\n");
-    for (int i = 0; i < depotState->materials->numItems; i++) {
-        Material* mat = ARRAY_ITEM(Material, depotState->materials, i);
+    Report* report = calloc(1, sizeof(Report));
+    MaterialTable* table = depotState->materials;
+    if (depotState->shards != NULL) {
+        // a table of copies, which the report takes ownership of
+        report->table = malloc(sizeof(MaterialTable));
+        mt_init(report->table);
+        shardset_report(depotState->shards, report->table);
+        table = report->table;
+    }
+
+    // only pointers are copied here, the reporter sorts and formats
+    Array* materials = table->materials;
+    report->goods = malloc(materials->numItems * sizeof(ReportEntry));
+    for (int i = 0; i < materials->numItems; i++) {
+        Material* mat = ARRAY_ITEM(Material, materials, i);
         // don't print materials with 0 quantity
-        if (mat->quantity == 0) {
-            DEBUG_PRINTF("%s %d\n", mat->name, mat->quantity);
-            continue;
+        if (mat->quantity != 0) {
+            ReportEntry entry = {mat->name, mat->quantity};
+            report->goods[report->numGoods++] = entry;
         }
-        printf("%s %d\n", mat->name, mat->quantity);
     }
 
-    printf("Neighbours:\n");
-    for (int i = 0; i < depotState->connections->numItems; i++) {
-        Connection* conn = ARRAY_ITEM(Connection, depotState->connections, i);
-        printf("%s\n", conn->name);
+    // the reporter sorts these by name
+    Array* connections = depotState->connections;
+    report->neighbours = malloc(connections->numItems * sizeof(char*));
+    for (int i = 0; i < connections->numItems; i++) {
+        Connection* conn = ARRAY_ITEM(Connection, connections, i);
+        report->neighbours[report->numNeighbours++] = conn->name;
     }
-    fflush(stdout);
+    reporter_post(depotState->reporter, report);
 }
@@ -6,7 +6,24 @@
 #include "deferGroup.h"
 #include "connection.h"
 #include "array.h"
-#include "channel.h"
+#include "materialTable.h"
+#include "hashMap.h"
+#include "strView.h"
+#include "messages.h"
+#include "ring.h"
+#include "inQueue.h"
+#include "shard.h"
+#include "wal.h"
+#include "reporter.h"
+#include "stats.h"
+#include "config.h"
+#include "coalescer.h"
+#include "capture.h"
+
+// how long to wait before retrying a flush to a peer that was full
+#define FLUSH_RETRY_MS 10
+
+struct EventLoop;
 
 /* State struct for storing the internal state of one depot, managing its own
  * resources and connections to other depots.
@@ -14,27 +31,59 @@
 typedef struct DepotState {
     char* name; // name of this depot, NOT malloc
     int port;
+    DepotConfig config; // runtime options, copied at init
 
-    Channel* incoming; // channel of incoming messages, as Message*
-    Array* materials; // array map of materials we store, keyed by name, sorted
-    Array* connections; // array map of open connections, keyed by name, sorted
-    Array* pending; // array map of unverified connections, keyed by port
-    Array* deferGroups; // array map of defer groups, keyed by key
+    // starts connecting to the given port, which is already pending, then
+    // verifying it, without blocking. if that fails before the peer is
+    // verified, a MSG_META_CONN_FAILED for the port is executed later. set
+    // by whichever IO model (reader threads or event loop) is running.
+    void (*startConnect)(struct DepotState* depotState, int port);
+    struct EventLoop* eventLoop; // BORROWED, NULL unless in event loop mode
+
+    // ring of incoming messages, as Message*. with reader threads, only
+    // carries meta messages, peers' messages wait in their own InQueues
+    Ring* incoming;
+    // reader threads only. InQueues of peers with messages waiting
+    InQueueSet inQueues;
+    MaterialTable* materials; // materials we store, keyed by interned name
+    // MALLOC! if sharded, the shards own our materials instead and materials
+    // stays empty. NULL otherwise
+    ShardSet* shards;
+    Wal* wal; // MALLOC! log of changes, NULL unless DEPOT_WAL_DIR is set
+    // MALLOC! capture of everything executed, NULL unless DEPOT_CAPTURE is
+    // set and the file could be created
+    Capture* capture;
+    Reporter* reporter; // MALLOC! writes SIGHUP reports in the background
+    // shared memory counters, NULL unless DEPOT_STATS is set. see stats.h
+    DepotStats* stats;
+    // MALLOC'd Connection*'s, in the order they were verified. closed
+    // connections stay, so a name or port is only ever used once
+    Array* connections;
+    HashMap* connsByName; // the same Connection*'s, keyed by name
+    HashMap* connsByPort; // the same Connection*'s, keyed by port
+    HashMap* pending; // MALLOC'd int*'s, ports with unverified connections
+    HashMap* deferGroups; // MALLOC'd DeferGroup*'s, keyed by key
+    Array* flushList; // array of Connection* with queued outbound messages
+    Array* coalesceList; // array of Connection* with Delivers held back
 } DepotState;
 
 /* Initialises the depot state struct, instantiating contained arrays.
- * Given name is the name of this depot.
+ * Given name is the name of this depot and config is copied into the state.
  */
-void ds_init(DepotState* depotState, char* name);
+void ds_init(DepotState* depotState, char* name, DepotConfig* config);
 
 /* Destroys the depot state, freeing memory used.
  */
 void ds_destroy(DepotState* depotState);
 
-/* Adds a connection to a depot at the given port and with the given
- * name. Returns the new connection.
+/* Adds the given verified connection, YIELDED to the depot state. No
+ * connection with the same name or port may have been added before.
  */
-Connection* ds_add_connection(DepotState* depotState, int port, char* name);
+void ds_add_connection(DepotState* depotState, Connection* connection);
+
+/* Returns the connection with the given name, or NULL if there is none.
+ */
+Connection* ds_get_connection(DepotState* depotState, char* name);
 
 /* Ensures the given material name is present in our materials, adding it with
  * 0 stock if it does not exist. Returns a pointer to the material.
@@ -43,17 +92,85 @@ Material* ds_ensure_mat(DepotState* depotState, char* matName);
 
 /* Changes the given material in the depot by the given delta, which can be
  * positive or negative.
- * This ensures material is present.
+ * This ensures material is present. If sharded, the change is posted to the
+ * material's shard and made later.
  */
 void ds_alter_mat(DepotState* depotState, char* matName, int delta);
 
+/* As ds_alter_mat, but the name is given as a view. The name is interned,
+ * as the material is about to be stored.
+ */
+void ds_alter_mat_view(DepotState* depotState, StrView matName, int delta);
+
+/* As ds_alter_mat, but the name is given by its interned id, which MUST NOT
+ * be SYM_NONE. Never hashes the name, and does not allocate unless the
+ * material is new.
+ */
+void ds_alter_mat_id(DepotState* depotState, SymId matId, int delta);
+
 /* Ensures a defer group with the given key is present in the defer group list
  * and adds it if not present. Returns a pointer to the defer group.
  */
 DeferGroup* ds_ensure_defer_group(DepotState* depotState, int key);
 
+/* Adds a copy of the given Deliver, Withdraw or Transfer to the defer group
+ * with the given key, creating the group if needed.
+ */
+void ds_defer(DepotState* depotState, int key, MessageView* inner);
+
+/* Removes the defer group with the given key and returns it, or returns NULL
+ * if there is none. The caller must destroy and free the group.
+ */
+DeferGroup* ds_take_defer_group(DepotState* depotState, int key);
+
+/* Opens the write-ahead log in config.walDir and recovers the materials and
+ * defer groups it holds, see wal.h. Stores whether anything was recovered
+ * into *recovered. Returns false if the log could not be opened.
+ */
+bool ds_open_wal(DepotState* depotState, bool* recovered);
+
+/* Commits every change logged since the last commit to the write-ahead log,
+ * if there is one, taking a snapshot if one is due. Called by
+ * ds_flush_connections before anything is written to peers.
+ */
+void ds_commit(DepotState* depotState);
+
+/* Queues the given message to be sent to the given connection when
+ * connections are next flushed. The message is encoded immediately, so the
+ * caller keeps ownership of it. If config.coalesceUs is set, a Deliver is
+ * instead held by the connection's coalescer until its window is over.
+ */
+void ds_send_message(DepotState* depotState, Connection* connection,
+        Message message);
+
+/* Switches the connection to the binary encoding, see conn_start_binary.
+ * The switch line is sent when connections are next flushed.
+ */
+void ds_start_binary(DepotState* depotState, Connection* connection);
+
+/* Starts capturing everything executed into the file named by
+ * config.captureFile, beginning with the materials and defer groups held
+ * now, see capture.h. MUST be called once our port is known. If the file
+ * can't be created, nothing is captured.
+ */
+void ds_open_capture(DepotState* depotState);
+
+/* Commits the write-ahead log with ds_commit, ends the capture's batch,
+ * queues the Delivers held by every connection whose coalescing window is
+ * over, then writes queued messages to every connection with queued
+ * messages, without blocking, then updates the gauges in the stats
+ * segment. Intended to be called once per batch of executed messages.
+ * Returns how many milliseconds until this should be called again, because
+ * some sockets were full (FLUSH_RETRY_MS) or Delivers are still held, or -1
+ * if it need not be.
+ */
+int ds_flush_connections(DepotState* depotState);
+
 /* Prints a goods and quantities, sorted by name and neighbours, sorted by
- * name. Format complies with SIGHUP format from spec.
+ * name. Format complies with SIGHUP format from spec. Only a copy of the
+ * materials and connections is taken here; it is sorted, formatted and
+ * written by the reporter thread. If sharded, this waits for every shard to
+ * report its materials.
  */
 void ds_print_info(DepotState* depotState);
 #endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flight.h"
+#include "messages.h"
+#include "util.h"
+
+/* Decoder for a flight recorder file dumped by a depot (see flight.h).
+ * Prints every event still in each thread's ring, merged in time order,
+ * one per line:
+ *
+ *   seconds before the dump, thread, kind, message type, port, value, name
+ *
+ * Threads which had already exited are marked with a *. With a thread
+ * given, only prints events of threads whose label starts with it.
+ *
+ * Usage: depotflight file [thread]
+ */
+
+// names of each kind of event, indexed by FlightKind
+static char* const kindNames[FR_NUM_KINDS] = {
+    [FR_RECEIVED] = "received",
+    [FR_EXECUTE] = "execute",
+    [FR_CONN_NEW] = "conn-new",
+    [FR_CONN_EOF] = "conn-eof",
+    [FR_STALL_BEGIN] = "stall",
+    [FR_STALL_END] = "unstall",
+    [FR_SIGNAL] = "signal",
+};
+
+/* One event of the file, with the ring it came from.
+ */
+typedef struct DecodedEvent {
+    FlightEvent* event; // BORROWED from its ring
+    FlightRingHeader* ring; // BORROWED
+} DecodedEvent;
+
+/* Compares two DecodedEvent's by time, for qsort.
+ */
+int decoded_cmp(const void* a, const void* b) {
+    uint64_t ticksA = ((DecodedEvent*)a)->event->ticks;
+    uint64_t ticksB = ((DecodedEvent*)b)->event->ticks;
+    return ticksA < ticksB ? -1 : ticksA > ticksB;
+}
+
+/* Returns the time of the given ticks in seconds relative to the dump, so
+ * negative for everything recorded before it.
+ */
+double ticks_to_seconds(FlightHeader* header, uint64_t ticks) {
+    double nsPerTick = header->ticks1 > header->ticks0 ?
+            (double)(header->ns1 - header->ns0) /
+            (header->ticks1 - header->ticks0) : 1;
+    return ((double)ticks - header->ticks1) * nsPerTick / 1e9;
+}
+
+/* Prints the given event, as from the given header's file.
+ */
+void print_event(FlightHeader* header, DecodedEvent* decoded) {
+    FlightEvent* event = decoded->event;
+    char* kind = event->kind < FR_NUM_KINDS ? kindNames[event->kind] : "?";
+    char* type = "-";
+    if (event->kind == FR_RECEIVED || event->kind == FR_EXECUTE) {
+        type = event->type < NUM_MESSAGE_TYPES_ALL ? msg_code(event->type) :
+                "?";
+    } else if (event->kind == FR_SIGNAL) {
+        type = strsignal(event->value);
+    }
+    printf("%12.6f %-24s%s %-8s %-16s %6d %10d %.*s\n",
+            ticks_to_seconds(header, event->ticks), decoded->ring->label,
+            decoded->ring->live ? " " : "*", kind, type, event->port,
+            event->value, FR_NAME_LEN, event->name);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: depotflight file [thread]\n");
+        return 1;
+    }
+    char* thread = argc > 2 ? argv[2] : "";
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    FlightHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, FR_MAGIC, sizeof(header.magic)) != 0 ||
+            header.numRings < 0 || header.eventsPerRing <= 0) {
+        fprintf(stderr, "depotflight: %s is not a flight recorder file\n",
+                argv[1]);
+        return 3;
+    }
+    printf("pid %d, dumped on %s, %d threads of %d events\n", header.pid,
+            strsignal(header.signal), header.numRings, header.eventsPerRing);
+
+    size_t ringSize = sizeof(FlightRing) +
+            header.eventsPerRing * sizeof(FlightEvent);
+    FlightRing* rings = malloc(ringSize * header.numRings);
+    DecodedEvent* events = malloc(sizeof(DecodedEvent) *
+            header.eventsPerRing * header.numRings);
+    int numEvents = 0;
+    for (int i = 0; i < header.numRings; i++) {
+        FlightRing* ring = (FlightRing*)((char*)rings + ringSize * i);
+        if (fread(&ring->header, sizeof(FlightRingHeader), 1, file) != 1 ||
+                fread(ring->events, sizeof(FlightEvent),
+                header.eventsPerRing, file) !=
+                (size_t)header.eventsPerRing) {
+            fprintf(stderr, "depotflight: %s is truncated\n", argv[1]);
+            return 3;
+        }
+        ring->header.label[FR_LABEL_LEN - 1] = '\0';
+        if (strncmp(ring->header.label, thread, strlen(thread)) != 0) {
+            continue;
+        }
+        // only the newest eventsPerRing are still there
+        uint64_t next = ring->header.next;
+        uint64_t first = next > (uint64_t)header.eventsPerRing ?
+                next - header.eventsPerRing : 0;
+        for (uint64_t j = first; j < next; j++) {
+            events[numEvents].event =
+                    &ring->events[j % header.eventsPerRing];
+            events[numEvents].ring = &ring->header;
+            numEvents++;
+        }
+    }
+    fclose(file);
+
+    qsort(events, numEvents, sizeof(DecodedEvent), decoded_cmp);
+    for (int i = 0; i < numEvents; i++) {
+        print_event(&header, &events[i]);
+    }
+    free(events);
+    free(rings);
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "capture.h"
+#include "config.h"
+#include "connection.h"
+#include "depotState.h"
+#include "execute.h"
+#include "messages.h"
+#include "msgView.h"
+#include "strBuffer.h"
+#include "util.h"
+
+/* Replays a capture written by a depot run with DEPOT_CAPTURE (see
+ * capture.h) through the same executor, as fast as it will go: messages go
+ * straight into execute_message, meta messages into execute_meta_message,
+ * and ds_flush_connections runs wherever the depot ran it. Peers are stubbed
+ * with connections whose output is counted then discarded, and Connect never
+ * connects, since whatever came of it is in the capture.
+ *
+ * Records are decoded REPLAY_CHUNK at a time and only executing them is
+ * timed, so the rate printed is that of the executor alone. SIGHUP reports
+ * are printed as the depot printed them, so the output can be compared with
+ * the original's. DEPOT_* options which change how messages are executed
+ * (e.g. DEPOT_WIRE, DEPOT_COALESCE_US) apply as they would to a depot, but
+ * Delivers held for a time are released by the replay's clock, not the
+ * capture's. A capture which ends in a record cut short or damaged is
+ * replayed up to that record, then reported, exiting with status 4.
+ *
+ * Usage: depotreplay file
+ */
+
+// records decoded before executing them
+#define REPLAY_CHUNK 4096
+
+/* One decoded record, ready to execute.
+ */
+typedef struct ReplayItem {
+    CaptureKind kind;
+    int value;
+    // the message for CAP_MESSAGE, or the meta message for CAP_CONN_NEW
+    // (whose connection is already made) and CAP_CONN_FAILED
+    Message message;
+} ReplayItem;
+
+/* Totals of a replay.
+ */
+typedef struct ReplayStats {
+    long messages; // peer messages executed
+    long metas; // meta messages executed
+    long invalid; // captured messages which didn't parse
+    long records; // records read after the CAP_START
+    bool damaged; // the replay stopped at a record cut short or damaged
+    double captured; // seconds between the first and last record
+    double executing; // seconds spent executing
+} ReplayStats;
+
+// bytes the depot wrote to its peers
+static long bytesOut = 0;
+
+/* Implements OutSink for every stub peer, counting what it is sent.
+ */
+void replay_discard(void* sinkData, char* data, int len) {
+    (void)sinkData;
+    (void)data;
+    bytesOut += len;
+}
+
+/* Implements DepotState.startConnect by doing nothing, as the connection or
+ * its failure is replayed from the capture.
+ */
+void replay_start_connect(DepotState* depotState, int port) {
+    (void)depotState;
+    (void)port;
+}
+
+/* Decodes the given record into item. Returns false if it can't be
+ * replayed.
+ */
+bool replay_decode(CaptureRecord* record, ReplayItem* item) {
+    memset(item, 0, sizeof(ReplayItem));
+    item->kind = record->kind;
+    item->value = record->value;
+    MessageView view;
+    switch (record->kind) {
+        case CAP_MESSAGE:
+            if (mv_parse(record->data, record->len, &view) != MS_OK) {
+                return false;
+            }
+            mv_to_message(&view, &item->message);
+            return true;
+        case CAP_CONN_NEW:
+            item->message.type = MSG_META_CONN_NEW;
+            item->message.data.connection = calloc(1, sizeof(Connection));
+            conn_init(item->message.data.connection, record->value,
+                    record->data);
+            conn_set_sink(item->message.data.connection, replay_discard,
+                    NULL);
+            return true;
+        case CAP_CONN_FAILED:
+            item->message.type = MSG_META_CONN_FAILED;
+            item->message.data.depotPort = record->value;
+            return true;
+        case CAP_CONN_EOF:
+        case CAP_WIRE_OFFER:
+        case CAP_FLUSH:
+            return true;
+        case CAP_SIGNAL:
+            // anything else only dumps diagnostics of the replay itself
+            return record->value == SIGHUP;
+        default:
+            return false;
+    }
+}
+
+/* Executes a meta message about the accepted connection on the given port,
+ * if there is one.
+ */
+void replay_conn_meta(DepotState* depotState, MessageType type, int port) {
+    Message message = {0};
+    message.type = type;
+    message.data.connection = hashmap_get(depotState->connsByPort, &port);
+    if (message.data.connection != NULL) {
+        execute_meta_message(depotState, &message);
+    }
+}
+
+/* Executes the given decoded item against the depot state.
+ */
+void replay_execute(DepotState* depotState, ReplayItem* item,
+        ReplayStats* stats) {
+    Message message = {0};
+    switch (item->kind) {
+        case CAP_MESSAGE:
+            execute_message(depotState, &item->message);
+            stats->messages++;
+            return;
+        case CAP_CONN_NEW:
+        case CAP_CONN_FAILED:
+            execute_meta_message(depotState, &item->message);
+            break;
+        case CAP_CONN_EOF:
+            replay_conn_meta(depotState, MSG_META_CONN_EOF, item->value);
+            break;
+        case CAP_WIRE_OFFER:
+            replay_conn_meta(depotState, MSG_META_WIRE_OFFER, item->value);
+            break;
+        case CAP_SIGNAL:
+            message.type = MSG_META_SIGNAL;
+            message.data.signal = item->value;
+            execute_meta_message(depotState, &message);
+            break;
+        case CAP_FLUSH:
+            ds_flush_connections(depotState);
+            return;
+        default:
+            return;
+    }
+    stats->metas++;
+}
+
+/* Replays every record of the given capture file after its CAP_START into
+ * the depot state, adding to stats. Stops at the end of the file or at the
+ * first record which is cut short or damaged.
+ */
+void replay_file(FILE* file, DepotState* depotState, ReplayStats* stats) {
+    ReplayItem* items = malloc(sizeof(ReplayItem) * REPLAY_CHUNK);
+    StrBuffer buffer;
+    sb_init(&buffer);
+    CaptureRecord record;
+    MessageStatus status = MS_OK;
+    while (status == MS_OK) {
+        int count = 0;
+        while (count < REPLAY_CHUNK && (status = cap_read_record(file,
+                &buffer, &record)) == MS_OK) {
+            stats->records++;
+            stats->captured += record.micros / 1e6;
+            if (replay_decode(&record, &items[count])) {
+                count++;
+            } else if (record.kind == CAP_MESSAGE) {
+                stats->invalid++;
+            }
+        }
+        double start = monotonic_seconds();
+        for (int i = 0; i < count; i++) {
+            replay_execute(depotState, &items[i], stats);
+        }
+        stats->executing += monotonic_seconds() - start;
+        for (int i = 0; i < count; i++) {
+            msg_destroy(&items[i].message); // rejected connections too
+        }
+    }
+    stats->damaged = status == MS_INVALID;
+    sb_destroy(&buffer);
+    free(items);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: depotreplay file\n");
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    StrBuffer buffer;
+    sb_init(&buffer);
+    CaptureRecord start;
+    if (!cap_read_magic(file) ||
+            cap_read_record(file, &buffer, &start) != MS_OK ||
+            start.kind != CAP_START || !is_name_valid(start.data)) {
+        fprintf(stderr, "depotreplay: %s is not a capture file\n", argv[1]);
+        return 3;
+    }
+    char* name = strdup(start.data);
+    sb_destroy(&buffer);
+
+    // options which would start threads or touch the outside are left off
+    DepotConfig config = {0};
+    config_load(&config);
+    config.eventLoop = false;
+    config.shards = 0;
+    config.walDir = NULL;
+    config.statsName = NULL;
+    config.captureFile = NULL;
+    DepotState depotState = {0};
+    ds_init(&depotState, name, &config);
+    depotState.port = start.value;
+    depotState.startConnect = replay_start_connect;
+
+    ReplayStats stats = {0};
+    replay_file(file, &depotState, &stats);
+    fclose(file);
+    ds_flush_connections(&depotState);
+    ds_destroy(&depotState); // waits for the last reports to be written
+    free(name);
+
+    fprintf(stderr, "replayed %ld messages and %ld meta messages in %.3fs, "
+            "%.0f messages/s (captured over %.3fs)\n", stats.messages,
+            stats.metas, stats.executing,
+            stats.executing > 0 ? stats.messages / stats.executing : 0,
+            stats.captured);
+    fprintf(stderr, "wrote %ld bytes to peers\n", bytesOut);
+    if (stats.invalid > 0) {
+        fprintf(stderr, "skipped %ld messages which didn't parse\n",
+                stats.invalid);
+    }
+    if (stats.damaged) {
+        fprintf(stderr, "depotreplay: record %ld of %s is cut short or "
+                "damaged, nothing after it was replayed\n",
+                stats.records + 2, argv[1]);
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "connection.h"
+#include "depotState.h"
+#include "execute.h"
+#include "materialTable.h"
+#include "messages.h"
+#include "msgView.h"
+#include "recvBuffer.h"
+#include "reporter.h"
+#include "util.h"
+#include "wire.h"
+
+/* Simulates a mesh of many depots in one process, without sockets or
+ * threads. Every depot is a DepotState of its own, executing messages with
+ * the same code as a real depot in event loop mode. Neighbours are connected
+ * by in-memory links: a Connection's queued bytes are handed to its link's
+ * receive buffer when flushed (see conn_set_sink), and one scheduler takes
+ * the links with bytes waiting in turn, executes everything complete in one
+ * at the depot reading it, then flushes that depot, as a depot does after
+ * each batch.
+ *
+ * The depots are d0 to d(n-1), each connected to the degree/2 depots either
+ * side of it in a ring, and each starting with SIM_STOCK of SIM_MATERIALS
+ * materials. Every round, Transfers of 1 of a random material to a random
+ * neighbour are executed at random depots, as if sent by clients, then the
+ * scheduler runs until every Deliver they caused has been executed. Prints
+ * how long each round took to converge, the overall rates, and whether the
+ * mesh still holds exactly the materials it started with.
+ *
+ * DEPOT_* options which change how messages are executed (e.g. DEPOT_WIRE,
+ * DEPOT_COALESCE_US) apply to every depot.
+ *
+ * Usage: depotsim [depots [degree [transfers [rounds]]]]
+ */
+
+// defaults of the arguments
+#define SIM_DEPOTS 1000
+#define SIM_DEGREE 4
+#define SIM_TRANSFERS 1000000
+#define SIM_ROUNDS 10
+// materials each depot starts with, and how much of each
+#define SIM_MATERIALS 16
+#define SIM_STOCK 1000000
+// longest depot or material name made, including the \0
+#define SIM_NAME_LEN 16
+
+struct SimNet;
+struct SimDepot;
+
+/* One direction of a connection between two depots, carrying the bytes one
+ * writes to the other.
+ */
+typedef struct SimLink {
+    struct SimNet* net; // BORROWED, whose run queue it joins
+    struct SimDepot* to; // BORROWED, the depot reading
+    int fromPort; // port of the depot writing
+    RecvBuffer recv; // rb_destroy! bytes written but not yet executed
+    WireDecoder wire; // wdec_destroy! how the writer is encoding
+    bool ready; // whether it is in the run queue
+} SimLink;
+
+/* One simulated depot.
+ */
+typedef struct SimDepot {
+    DepotState state; // ds_destroy!
+    char name[SIM_NAME_LEN];
+    bool dirty; // whether it has executed anything since it was flushed
+} SimDepot;
+
+/* The whole simulated mesh and its scheduler.
+ */
+typedef struct SimNet {
+    SimDepot* depots; // MALLOC! numDepots of them
+    int numDepots;
+    SimLink* links; // MALLOC! numLinks of them
+    int numLinks;
+    // FIFO of links with bytes waiting, as a ring of numLinks entries, since
+    // a link is in it at most once
+    SimLink** runQueue; // MALLOC!
+    int runHead;
+    int runCount;
+    long executed; // messages executed by every depot
+} SimNet;
+
+// names of the materials every depot holds, and their interned ids
+static char materialNames[SIM_MATERIALS][SIM_NAME_LEN];
+static SymId materialIds[SIM_MATERIALS];
+
+/* Implements OutSink for a link (sinkData), appending the bytes flushed to
+ * the reading depot's receive buffer and queueing the link to be run.
+ */
+void sim_link_sink(void* sinkData, char* data, int len) {
+    SimLink* link = sinkData;
+    rb_append(&link->recv, data, len);
+    if (!link->ready) {
+        SimNet* net = link->net;
+        link->ready = true;
+        net->runQueue[(net->runHead + net->runCount) % net->numLinks] = link;
+        net->runCount++;
+    }
+}
+
+/* Executes every complete message waiting in the given link at the depot
+ * reading it, then flushes that depot, as el_peer_readable then el_run do.
+ */
+void sim_run_link(SimNet* net, SimLink* link) {
+    link->ready = false;
+    DepotState* depotState = &link->to->state;
+    MessageView view;
+    while (wire_next_message(&link->recv, &link->wire,
+            depotState->config.wire, &view)) {
+        if (view.type == MSG_META_WIRE_OFFER) {
+            Message msg = {0};
+            msg.type = MSG_META_WIRE_OFFER;
+            msg.data.connection = hashmap_get(depotState->connsByPort,
+                    &link->fromPort);
+            if (msg.data.connection != NULL) { // only if it was accepted
+                execute_meta_message(depotState, &msg);
+            }
+        } else if (view.type != MSG_NULL) {
+            execute_message_view(depotState, &view);
+            net->executed++;
+        }
+    }
+    ds_flush_connections(depotState);
+}
+
+/* Runs the scheduler until nothing is left to execute: no link has bytes
+ * waiting and no depot is holding Delivers back (see coalescer.h). Depots
+ * executed at since they were last flushed are flushed first.
+ */
+void sim_run(SimNet* net) {
+    for (int i = 0; i < net->numDepots; i++) {
+        if (net->depots[i].dirty) {
+            ds_flush_connections(&net->depots[i].state);
+            net->depots[i].dirty = false;
+        }
+    }
+    bool held = true;
+    while (net->runCount > 0 || held) {
+        while (net->runCount > 0) {
+            SimLink* link = net->runQueue[net->runHead];
+            net->runHead = (net->runHead + 1) % net->numLinks;
+            net->runCount--;
+            sim_run_link(net, link);
+        }
+        // held Delivers are released once their window is over
+        held = false;
+        for (int i = 0; i < net->numDepots; i++) {
+            if (ds_flush_connections(&net->depots[i].state) >= 0) {
+                held = true;
+            }
+        }
+    }
+}
+
+/* Has the depot from accept a connection to the depot to, whose messages
+ * are carried by the given link.
+ */
+void sim_accept(SimNet* net, SimDepot* from, SimDepot* to, SimLink* link) {
+    link->net = net;
+    link->to = to;
+    link->fromPort = from->state.port;
+    rb_init(&link->recv);
+    wdec_init(&link->wire);
+    link->ready = false;
+
+    Message msg = {0};
+    msg.type = MSG_META_CONN_NEW;
+    msg.data.connection = calloc(1, sizeof(Connection));
+    conn_init(msg.data.connection, to->state.port, to->name);
+    conn_set_sink(msg.data.connection, sim_link_sink, link);
+    execute_meta_message(&from->state, &msg);
+    msg_destroy(&msg); // only if it was rejected
+}
+
+/* Creates the given number of depots, each with the given config and
+ * connected to the half depots either side of it.
+ */
+void sim_init(SimNet* net, int numDepots, int half, DepotConfig* config) {
+    memset(net, 0, sizeof(SimNet));
+    net->numDepots = numDepots;
+    net->depots = calloc(numDepots, sizeof(SimDepot));
+    for (int i = 0; i < numDepots; i++) {
+        SimDepot* depot = &net->depots[i];
+        snprintf(depot->name, SIM_NAME_LEN, "d%d", i);
+        ds_init(&depot->state, depot->name, config);
+        depot->state.port = i + 1;
+        // reports are written directly rather than by a thread per depot
+        reporter_destroy(depot->state.reporter);
+        for (int j = 0; j < SIM_MATERIALS; j++) {
+            ds_alter_mat(&depot->state, materialNames[j], SIM_STOCK);
+        }
+    }
+
+    net->numLinks = numDepots * half * 2;
+    net->links = calloc(net->numLinks, sizeof(SimLink));
+    net->runQueue = malloc(net->numLinks * sizeof(SimLink*));
+    SimLink* link = net->links;
+    for (int i = 0; i < numDepots; i++) {
+        for (int k = 1; k <= half; k++) {
+            SimDepot* a = &net->depots[i];
+            SimDepot* b = &net->depots[(i + k) % numDepots];
+            sim_accept(net, a, b, link++);
+            sim_accept(net, b, a, link++);
+        }
+    }
+    if (!config->wire) {
+        return;
+    }
+    // every depot offers the binary encoding, so each switches to it with
+    // every neighbour
+    for (int i = 0; i < numDepots; i++) {
+        DepotState* depotState = &net->depots[i].state;
+        for (int j = 0; j < depotState->connections->numItems; j++) {
+            Message offer = {0};
+            offer.type = MSG_META_WIRE_OFFER;
+            offer.data.connection = depotState->connections->items[j];
+            execute_meta_message(depotState, &offer);
+        }
+        net->depots[i].dirty = true;
+    }
+    sim_run(net);
+}
+
+/* Destroys every depot and link of the mesh.
+ */
+void sim_destroy(SimNet* net) {
+    for (int i = 0; i < net->numDepots; i++) {
+        ds_destroy(&net->depots[i].state);
+    }
+    for (int i = 0; i < net->numLinks; i++) {
+        rb_destroy(&net->links[i].recv);
+        wdec_destroy(&net->links[i].wire);
+    }
+    free(net->depots);
+    free(net->links);
+    free(net->runQueue);
+}
+
+/* Executes the given number of Transfers of 1 of a random material, each at
+ * a random depot and to a random one of its neighbours, which are the half
+ * depots either side of it.
+ */
+void sim_transfer(SimNet* net, int count, int half) {
+    for (int i = 0; i < count; i++) {
+        int from = rand() % net->numDepots;
+        int offset = 1 + rand() % half;
+        int to = (from + (rand() % 2 ? offset : net->numDepots - offset)) %
+                net->numDepots;
+        Message msg = {0};
+        msg.type = MSG_TRANSFER;
+        mat_init_id(&msg.data.material, 1,
+                materialIds[rand() % SIM_MATERIALS]);
+        msg.data.depotName = net->depots[to].name;
+        execute_message(&net->depots[from].state, &msg); // names BORROWED
+        net->depots[from].dirty = true;
+    }
+}
+
+/* Returns whether every material adds up to what the mesh started with
+ * across all of its depots, printing any which don't.
+ */
+bool sim_conserved(SimNet* net) {
+    bool conserved = true;
+    for (int j = 0; j < SIM_MATERIALS; j++) {
+        long total = 0;
+        for (int i = 0; i < net->numDepots; i++) {
+            Material* mat = mt_get(net->depots[i].state.materials,
+                    materialNames[j]);
+            total += mat != NULL ? mat->quantity : 0;
+        }
+        long expected = (long)SIM_STOCK * net->numDepots;
+        if (total != expected) {
+            printf("%s: %ld, expected %ld\n", materialNames[j], total,
+                    expected);
+            conserved = false;
+        }
+    }
+    return conserved;
+}
+
+/* Returns the argument at the given index as a positive integer, fallback if
+ * it is not given, or -1 if it is invalid.
+ */
+int sim_arg(int argc, char** argv, int index, int fallback) {
+    if (index >= argc) {
+        return fallback;
+    }
+    int value = parse_int(argv[index]);
+    return value > 0 ? value : -1;
+}
+
+int main(int argc, char** argv) {
+    int numDepots = sim_arg(argc, argv, 1, SIM_DEPOTS);
+    int degree = sim_arg(argc, argv, 2, SIM_DEGREE);
+    int transfers = sim_arg(argc, argv, 3, SIM_TRANSFERS);
+    int rounds = sim_arg(argc, argv, 4, SIM_ROUNDS);
+    int half = degree / 2;
+    if (argc > 5 || numDepots < 0 || transfers < 0 || rounds < 0 ||
+            half < 1 || half * 2 >= numDepots) {
+        fprintf(stderr, "Usage: depotsim [depots [degree [transfers "
+                "[rounds]]]]\n"
+                "degree must be at least 2 and less than depots\n");
+        return 1;
+    }
+    for (int j = 0; j < SIM_MATERIALS; j++) {
+        snprintf(materialNames[j], SIM_NAME_LEN, "m%d", j);
+        materialIds[j] = sym_intern_str(materialNames[j]);
+    }
+    srand(1); // the same Transfers every run
+
+    // options which would start threads or touch the outside are left off
+    DepotConfig config = {0};
+    config_load(&config);
+    config.eventLoop = false;
+    config.shards = 0;
+    config.walDir = NULL;
+    config.statsName = NULL;
+    config.captureFile = NULL;
+
+    SimNet net;
+    double start = monotonic_seconds();
+    sim_init(&net, numDepots, half, &config);
+    printf("%d depots, %d links, set up in %.3fs\n", numDepots,
+            net.numLinks, monotonic_seconds() - start);
+
+    start = monotonic_seconds();
+    long executedBefore = net.executed;
+    for (int round = 0; round < rounds; round++) {
+        int count = transfers / rounds +
+                (round < transfers % rounds ? 1 : 0);
+        double roundStart = monotonic_seconds();
+        sim_transfer(&net, count, half);
+        sim_run(&net);
+        printf("round %d: %d transfers converged in %.3fs\n", round, count,
+                monotonic_seconds() - roundStart);
+    }
+    double seconds = monotonic_seconds() - start;
+    long executed = net.executed - executedBefore;
+    printf("%d transfers, %ld messages executed in %.3fs: %.0f transfers/s, "
+            "%.0f messages/s\n", transfers, executed, seconds,
+            transfers / seconds, executed / seconds);
+
+    bool conserved = sim_conserved(&net);
+    printf(conserved ? "materials conserved\n" :
+            "materials NOT conserved\n");
+    sim_destroy(&net);
+    return conserved ? 0 : 2;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "messages.h"
+#include "stats.h"
+#include "util.h"
+
+// default milliseconds between refreshes
+#define DEFAULT_INTERVAL_MS 1000
+// clears the terminal and moves to the top left
+#define TERM_CLEAR "\x1b[H\x1b[2J"
+
+/* Live monitor for a depot started with DEPOT_STATS=name. Maps the depot's
+ * stats segment read only and every interval prints its counters as rates
+ * over the interval, alongside its gauges. Only reads shared memory, so the
+ * depot never knows it is being watched.
+ *
+ * With a count, prints that many samples one after another instead of
+ * redrawing the terminal, for logging.
+ *
+ * Usage: depottop name [intervalMs [count]]
+ */
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Copies every field of the live stats into sample, one atomic read each.
+ */
+void take_sample(DepotStats* live, DepotStats* sample) {
+    memset(sample, 0, sizeof(DepotStats));
+    sample->pid = STATS_READ(live->pid);
+    sample->port = STATS_READ(live->port);
+    sample->started = STATS_READ(live->started);
+    for (int i = 0; i < NUM_MESSAGE_TYPES_ALL; i++) {
+        sample->received[i] = STATS_READ(live->received[i]);
+    }
+    for (int i = 0; i < NUM_MESSAGE_TYPES; i++) {
+        sample->sent[i] = STATS_READ(live->sent[i]);
+    }
+    sample->bytesIn = STATS_READ(live->bytesIn);
+    sample->bytesOut = STATS_READ(live->bytesOut);
+    sample->deferGroupsExecuted = STATS_READ(live->deferGroupsExecuted);
+    sample->batches = STATS_READ(live->batches);
+    sample->handshakesRejected = STATS_READ(live->handshakesRejected);
+    sample->handshakesTimedOut = STATS_READ(live->handshakesTimedOut);
+    sample->coalesced = STATS_READ(live->coalesced);
+    sample->incomingDepth = STATS_READ(live->incomingDepth);
+    sample->incomingHigh = STATS_READ(live->incomingHigh);
+    sample->incomingCapacity = STATS_READ(live->incomingCapacity);
+    sample->shardDepth = STATS_READ(live->shardDepth);
+    sample->inBusy = STATS_READ(live->inBusy);
+    sample->connections = STATS_READ(live->connections);
+    sample->pending = STATS_READ(live->pending);
+    sample->materials = STATS_READ(live->materials);
+    sample->deferGroups = STATS_READ(live->deferGroups);
+    sample->handshakes = STATS_READ(live->handshakes);
+
+    int numPeers = STATS_READ(live->numPeers);
+    sample->numPeers = numPeers < STATS_MAX_PEERS ? numPeers : STATS_MAX_PEERS;
+    for (int i = 0; i < sample->numPeers; i++) {
+        PeerStats* from = &live->peers[i];
+        PeerStats* to = &sample->peers[i];
+        // name and port are only set before the state is
+        to->state = __atomic_load_n(&from->state, __ATOMIC_ACQUIRE);
+        if (to->state == PEER_FREE) {
+            continue;
+        }
+        to->port = from->port;
+        memcpy(to->name, from->name, STATS_NAME_LEN);
+        to->bytesIn = STATS_READ(from->bytesIn);
+        to->bytesOut = STATS_READ(from->bytesOut);
+        to->messagesIn = STATS_READ(from->messagesIn);
+        to->messagesOut = STATS_READ(from->messagesOut);
+        to->queuedBytes = STATS_READ(from->queuedBytes);
+        to->inDepth = STATS_READ(from->inDepth);
+        to->dropped = STATS_READ(from->dropped);
+    }
+}
+
+/* Prints the difference between two samples taken elapsed seconds apart as
+ * rates, with the gauges of the newer sample.
+ */
+void print_sample(char* name, DepotStats* old, DepotStats* new,
+        double elapsed) {
+    long up = time(NULL) - new->started;
+    printf("depot %s: pid %d port %d up %ld:%02ld:%02ld\n", name, new->pid,
+            new->port, up / 3600, up / 60 % 60, up % 60);
+    printf("batches/s %.0f  in KB/s %.1f  out KB/s %.1f  "
+            "defer groups executed/s %.0f\n",
+            (new->batches - old->batches) / elapsed,
+            (new->bytesIn - old->bytesIn) / elapsed / 1024,
+            (new->bytesOut - old->bytesOut) / elapsed / 1024,
+            (new->deferGroupsExecuted - old->deferGroupsExecuted) / elapsed);
+    printf("delivers coalesced %ld (%.0f/s)\n", new->coalesced,
+            (new->coalesced - old->coalesced) / elapsed);
+    printf("handshakes %ld  rejected %ld (%.0f/s)  timed out %ld (%.0f/s)\n",
+            new->handshakes, new->handshakesRejected,
+            (new->handshakesRejected - old->handshakesRejected) / elapsed,
+            new->handshakesTimedOut,
+            (new->handshakesTimedOut - old->handshakesTimedOut) / elapsed);
+    printf("incoming %ld/%ld (high %ld)  busy peers %ld  shard inboxes %ld"
+            "  connections %ld  pending %ld  materials %ld  defer groups %ld"
+            "\n\n", new->incomingDepth, new->incomingCapacity,
+            new->incomingHigh, new->inBusy, new->shardDepth,
+            new->connections, new->pending, new->materials,
+            new->deferGroups);
+
+    printf("%-20s %12s %10s %12s %10s\n", "type", "received", "/s", "sent",
+            "/s");
+    for (int i = 0; i < NUM_MESSAGE_TYPES_ALL; i++) {
+        if (new->received[i] == 0 && (i >= NUM_MESSAGE_TYPES ||
+                new->sent[i] == 0)) {
+            continue; // never seen
+        }
+        printf("%-20s %12ld %10.0f", msg_code(i), new->received[i],
+                (new->received[i] - old->received[i]) / elapsed);
+        if (i < NUM_MESSAGE_TYPES) {
+            printf(" %12ld %10.0f", new->sent[i],
+                    (new->sent[i] - old->sent[i]) / elapsed);
+        }
+        printf("\n");
+    }
+
+    printf("\n%-16s %6s %6s %9s %9s %6s %9s %9s %9s %7s\n", "peer", "port",
+            "state", "msgs in/s", "KB in/s", "in q", "msgs out/s",
+            "KB out/s", "queued", "dropped");
+    for (int i = 0; i < new->numPeers; i++) {
+        PeerStats* peer = &new->peers[i];
+        PeerStats* before = &old->peers[i];
+        if (peer->state == PEER_FREE) {
+            continue;
+        }
+        printf("%-16.16s %6d %6s %9.0f %9.1f %6ld %9.0f %9.1f %9ld %7ld\n",
+                peer->name, peer->port,
+                peer->state == PEER_OPEN ? "open" : "closed",
+                (peer->messagesIn - before->messagesIn) / elapsed,
+                (peer->bytesIn - before->bytesIn) / elapsed / 1024,
+                peer->inDepth,
+                (peer->messagesOut - before->messagesOut) / elapsed,
+                (peer->bytesOut - before->bytesOut) / elapsed / 1024,
+                peer->queuedBytes, peer->dropped);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: depottop name [intervalMs [count]]\n");
+        return 1;
+    }
+    int intervalMs = argc > 2 ? parse_int(argv[2]) : DEFAULT_INTERVAL_MS;
+    int count = argc > 3 ? parse_int(argv[3]) : -1;
+    if (intervalMs <= 0) {
+        intervalMs = DEFAULT_INTERVAL_MS;
+    }
+
+    DepotStats* live;
+    if (!stats_attach(&live, argv[1])) {
+        fprintf(stderr, "depottop: no depot stats named %s\n", argv[1]);
+        return 1;
+    }
+    // samples are too big for the stack
+    DepotStats* old = malloc(sizeof(DepotStats));
+    DepotStats* new = malloc(sizeof(DepotStats));
+    take_sample(live, old);
+    double lastTime = now_seconds();
+    for (int i = 0; count < 0 || i < count; i++) {
+        usleep(intervalMs * 1000);
+        // the segment outlives a depot which was killed
+        if (kill(old->pid, 0) != 0) {
+            fprintf(stderr, "depottop: depot %d has exited\n", old->pid);
+            break;
+        }
+        take_sample(live, new);
+        double time = now_seconds();
+        if (count < 0) {
+            printf(TERM_CLEAR);
+        } else if (i > 0) {
+            printf("\n");
+        }
+        print_sample(argv[1], old, new, time - lastTime);
+        DepotStats* swap = old;
+        old = new;
+        new = swap;
+        lastTime = time;
+    }
+    free(old);
+    free(new);
+    stats_detach(live);
+    return 0;
+}
@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#include "eventLoop.h"
+#include "capture.h"
+#include "execute.h"
+#include "flight.h"
+#include "latency.h"
+#include "messages.h"
+#include "msgView.h"
+#include "network.h"
+#include "util.h"
+
+/* Adds (op EPOLL_CTL_ADD) or changes (EPOLL_CTL_MOD) the registration of the
+ * given watch with the event loop's epoll instance, for the given events.
+ * Returns true on success.
+ */
+bool el_watch_for(EventLoop* eventLoop, Watch* watch, int op,
+        unsigned int events) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = events;
+    event.data.ptr = watch;
+    if (epoll_ctl(eventLoop->epollFd, op, watch->fd, &event) != 0) {
+        DEBUG_PERROR("epoll_ctl()");
+        return false;
+    }
+    return true;
+}
+
+/* Registers the given watch with the event loop's epoll instance for read
+ * readiness. Returns true on success.
+ */
+bool el_watch(EventLoop* eventLoop, Watch* watch) {
+    return el_watch_for(eventLoop, watch, EPOLL_CTL_ADD, EPOLLIN);
+}
+
+// see header
+bool el_init(EventLoop* eventLoop, DepotState* depotState, int server) {
+    eventLoop->depotState = depotState;
+    eventLoop->peers = NULL;
+    eventLoop->timed = NULL;
+    eventLoop->timedLast = NULL;
+    eventLoop->server.kind = WATCH_SERVER;
+    eventLoop->server.fd = server;
+    eventLoop->signal.kind = WATCH_SIGNAL;
+    eventLoop->signal.fd = -1;
+
+    depotState->eventLoop = eventLoop;
+    depotState->startConnect = el_connect;
+
+    eventLoop->epollFd = epoll_create1(0);
+    if (eventLoop->epollFd < 0) {
+        DEBUG_PERROR("epoll_create1()");
+        return false;
+    }
+    // signals are already blocked, so they are only delivered via this fd
+    sigset_t sigset = blocked_sigset();
+    eventLoop->signal.fd = signalfd(-1, &sigset, 0);
+    if (eventLoop->signal.fd < 0) {
+        DEBUG_PERROR("signalfd()");
+        return false;
+    }
+    return el_watch(eventLoop, &eventLoop->server) &&
+            el_watch(eventLoop, &eventLoop->signal);
+}
+
+/* Sets the given peer's deadline, 0 for never, moving it to its place in
+ * the timed list. New deadlines are usually the latest, so the place is
+ * searched for from the end.
+ */
+void el_set_deadline(EventLoop* eventLoop, Watch* watch, double deadline) {
+    if (watch->deadline != 0) {
+        if (watch->prevTimed != NULL) {
+            watch->prevTimed->nextTimed = watch->nextTimed;
+        } else {
+            eventLoop->timed = watch->nextTimed;
+        }
+        if (watch->nextTimed != NULL) {
+            watch->nextTimed->prevTimed = watch->prevTimed;
+        } else {
+            eventLoop->timedLast = watch->prevTimed;
+        }
+    }
+    watch->deadline = deadline;
+    if (deadline == 0) {
+        return;
+    }
+    Watch* before = eventLoop->timedLast;
+    while (before != NULL && before->deadline > deadline) {
+        before = before->prevTimed;
+    }
+    watch->prevTimed = before;
+    watch->nextTimed = before != NULL ? before->nextTimed : eventLoop->timed;
+    if (before != NULL) {
+        before->nextTimed = watch;
+    } else {
+        eventLoop->timed = watch;
+    }
+    if (watch->nextTimed != NULL) {
+        watch->nextTimed->prevTimed = watch;
+    } else {
+        eventLoop->timedLast = watch;
+    }
+}
+
+/* Stops watching the given peer and frees it. The socket is closed only if
+ * the peer never became a connection.
+ */
+void el_close_peer(EventLoop* eventLoop, Watch* watch) {
+    DEBUG_PRINTF("closing peer socket %d\n", watch->fd);
+    epoll_ctl(eventLoop->epollFd, EPOLL_CTL_DEL, watch->fd, NULL);
+    el_set_deadline(eventLoop, watch, 0);
+    // the socket is closed with the write file. once verified, it belongs to
+    // the connection and stays open until the depot state is destroyed.
+    if (watch->writeFile != NULL) {
+        fclose(watch->writeFile);
+    }
+    rb_destroy(&watch->recv);
+    wdec_destroy(&watch->wire);
+
+    if (watch->prev != NULL) {
+        watch->prev->next = watch->next;
+    } else {
+        eventLoop->peers = watch->next;
+    }
+    if (watch->next != NULL) {
+        watch->next->prev = watch->prev;
+    }
+    free(watch);
+}
+
+// see header
+void el_destroy(EventLoop* eventLoop) {
+    if (eventLoop == NULL || eventLoop->depotState == NULL) {
+        return;
+    }
+    while (eventLoop->peers != NULL) {
+        el_close_peer(eventLoop, eventLoop->peers);
+    }
+    if (eventLoop->signal.fd >= 0) {
+        close(eventLoop->signal.fd);
+    }
+    if (eventLoop->epollFd >= 0) {
+        close(eventLoop->epollFd);
+    }
+    close(eventLoop->server.fd);
+
+    eventLoop->depotState->eventLoop = NULL;
+    eventLoop->depotState = NULL;
+}
+
+/* Tells the depot state that connecting out to the given port failed, so it
+ * is no longer pending.
+ */
+void el_connect_failed(DepotState* depotState, int port) {
+    Message msg = {0};
+    msg.type = MSG_META_CONN_FAILED;
+    msg.data.depotPort = port;
+    execute_meta_message(depotState, &msg);
+    msg_destroy(&msg);
+}
+
+/* Returns the deadline for something starting now which may take at most
+ * timeoutMs milliseconds, or 0 (never) if timeoutMs is 0.
+ */
+double el_deadline(int timeoutMs) {
+    return timeoutMs > 0 ? monotonic_seconds() + timeoutMs / 1000.0 : 0;
+}
+
+/* Starts the given peer's handshake, giving it DEPOT_HANDSHAKE_TIMEOUT_MS
+ * to send its IM.
+ */
+void el_start_handshake(EventLoop* eventLoop, Watch* watch) {
+    DepotState* depotState = eventLoop->depotState;
+    watch->handshaking = true;
+    el_set_deadline(eventLoop, watch,
+            el_deadline(depotState->config.handshakeTimeoutMs));
+    stats_handshake_start(depotState->stats);
+}
+
+/* Ends the given peer's handshake in the given way, if it is handshaking.
+ */
+void el_end_handshake(EventLoop* eventLoop, Watch* watch, HandshakeEnd end) {
+    if (!watch->handshaking) {
+        return;
+    }
+    watch->handshaking = false;
+    el_set_deadline(eventLoop, watch, 0);
+    stats_handshake_end(eventLoop->depotState->stats, end);
+}
+
+/* As el_close_peer, but if the peer was connected out to and never
+ * verified, first tells the depot state the connect failed. A peer still
+ * handshaking counts as rejected.
+ */
+void el_drop_peer(EventLoop* eventLoop, Watch* watch) {
+    el_end_handshake(eventLoop, watch, HANDSHAKE_REJECTED);
+    if (watch->connectPort != 0 && watch->connection == NULL) {
+        el_connect_failed(eventLoop->depotState, watch->connectPort);
+    }
+    el_close_peer(eventLoop, watch);
+}
+
+/* Creates a peer watch of the given kind on fd, taking ownership of it, and
+ * links it into the list of open peers. Does not register it with epoll.
+ */
+Watch* el_new_peer(EventLoop* eventLoop, int fd, WatchKind kind) {
+    Watch* watch = calloc(1, sizeof(Watch));
+    watch->kind = kind;
+    watch->fd = fd;
+    rb_init(&watch->recv);
+    wdec_init(&watch->wire);
+    // unlike reader threads, we read the fd directly and only need a FILE*
+    // for writing. this saves a dup'd fd per peer.
+    watch->writeFile = fdopen(fd, "w");
+
+    // link in before anything can fail, el_close_peer unlinks it
+    watch->next = eventLoop->peers;
+    if (eventLoop->peers != NULL) {
+        eventLoop->peers->prev = watch;
+    }
+    eventLoop->peers = watch;
+    return watch;
+}
+
+/* Starts the handshake with the given peer by sending our IM, and offer if
+ * enabled, on its socket, then watches it for reading with the given epoll
+ * op (adding, or changing from watching a connect). Drops the peer if
+ * either fails.
+ */
+void el_greet_peer(EventLoop* eventLoop, Watch* watch, int op) {
+    DepotState* depotState = eventLoop->depotState;
+    el_start_handshake(eventLoop, watch);
+    Message msg = msg_im(depotState->port, depotState->name);
+    MessageStatus status = msg_send(watch->writeFile, msg);
+    msg_destroy(&msg);
+    if (status == MS_OK && depotState->config.wire &&
+            (fprintf(watch->writeFile, "%s\n", WIRE_OFFER) < 0 ||
+            fflush(watch->writeFile) != 0)) {
+        status = MS_EOF;
+    }
+    if (status != MS_OK ||
+            !el_watch_for(eventLoop, watch, op, EPOLLIN)) {
+        DEBUG_PRINT("sending IM failed. closing");
+        el_drop_peer(eventLoop, watch);
+    }
+}
+
+// see header
+void el_add_socket(DepotState* depotState, int fd) {
+    EventLoop* eventLoop = depotState->eventLoop;
+    el_greet_peer(eventLoop, el_new_peer(eventLoop, fd, WATCH_PEER),
+            EPOLL_CTL_ADD);
+}
+
+// see header
+void el_connect(DepotState* depotState, int port) {
+    EventLoop* eventLoop = depotState->eventLoop;
+    int fd;
+    if (!start_connect(&fd, port)) {
+        el_connect_failed(depotState, port);
+        return;
+    }
+    Watch* watch = el_new_peer(eventLoop, fd, WATCH_CONNECTING);
+    watch->connectPort = port;
+    el_set_deadline(eventLoop, watch,
+            el_deadline(depotState->config.connectTimeoutMs));
+    if (!el_watch_for(eventLoop, watch, EPOLL_CTL_ADD, EPOLLOUT)) {
+        el_drop_peer(eventLoop, watch);
+    }
+}
+
+/* Handles a connecting socket becoming writable, meaning the connect has
+ * finished, greeting the peer if it succeeded or dropping it if not.
+ */
+void el_connect_ready(EventLoop* eventLoop, Watch* watch) {
+    watch->kind = WATCH_PEER;
+    el_set_deadline(eventLoop, watch, 0); // the handshake gets its own
+    errno = finish_connect(watch->fd);
+    if (errno != 0) {
+        DEBUG_PERROR("connect()");
+        el_drop_peer(eventLoop, watch);
+        return;
+    }
+    DEBUG_PRINTF("connected to port %d, verifying\n", watch->connectPort);
+    el_greet_peer(eventLoop, watch, EPOLL_CTL_MOD);
+}
+
+/* Drops every connecting or handshaking peer whose deadline has passed.
+ */
+void el_expire_deadlines(EventLoop* eventLoop) {
+    if (eventLoop->timed == NULL) {
+        return;
+    }
+    double now = monotonic_seconds();
+    while (eventLoop->timed != NULL && eventLoop->timed->deadline <= now) {
+        Watch* watch = eventLoop->timed;
+        if (watch->kind == WATCH_CONNECTING) {
+            DEBUG_PRINTF("connect to port %d timed out\n",
+                    watch->connectPort);
+        } else {
+            DEBUG_PRINTF("handshake on socket %d timed out\n", watch->fd);
+            el_end_handshake(eventLoop, watch, HANDSHAKE_TIMED_OUT);
+        }
+        el_drop_peer(eventLoop, watch);
+    }
+}
+
+/* Returns how long epoll_wait may wait, in milliseconds: until the nearest
+ * connect or handshake deadline, or flushTimeout as returned by
+ * ds_flush_connections, whichever is sooner. -1 (forever) if neither.
+ */
+int el_next_timeout(EventLoop* eventLoop, int flushTimeout) {
+    if (eventLoop->timed == NULL) {
+        return flushTimeout;
+    }
+    // rounded up, so we don't wake just before the deadline
+    double now = monotonic_seconds();
+    int untilDeadline = (int)((eventLoop->timed->deadline - now) * 1000) + 1;
+    if (untilDeadline < 0) {
+        untilDeadline = 0;
+    }
+    return flushTimeout < 0 || untilDeadline < flushTimeout ?
+            untilDeadline : flushTimeout;
+}
+
+/* Handles the first message received from an unverified peer, which must
+ * be a valid IM. Passes the resulting connection to the depot state. Returns
+ * false if the peer should be closed.
+ */
+bool el_verify_peer(EventLoop* eventLoop, Watch* watch, MessageView* view) {
+    if (view->type != MSG_IM || !is_name_view_valid(view->depotName)) {
+        DEBUG_PRINT("invalid IM or bad depot name. closing.");
+        return false;
+    }
+    // even if the depot state rejects it as a duplicate, the IM was valid
+    el_end_handshake(eventLoop, watch, HANDSHAKE_VERIFIED);
+    Connection* conn = calloc(1, sizeof(Connection));
+    char* name = sv_dup(view->depotName);
+    conn_init(conn, view->depotPort, name);
+    free(name);
+    conn_set_files(conn, NULL, watch->writeFile);
+    conn->stats = stats_add_peer(eventLoop->depotState->stats, conn->port,
+            conn->name);
+    watch->writeFile = NULL; // YIELDED to connection
+    DEBUG_PRINTF("acknowledged by %s on %d\n", conn->name, conn->port);
+
+    Message msg = {0};
+    msg.type = MSG_META_CONN_NEW;
+    msg.data.connection = conn;
+    execute_meta_message(eventLoop->depotState, &msg);
+    // connection is left in the message if the depot state rejected it
+    bool accepted = msg.data.connection == NULL;
+    msg_destroy(&msg);
+    if (accepted) {
+        watch->connection = conn;
+    }
+    return accepted;
+}
+
+/* Handles one line or frame received from the given peer, parsed into the
+ * given view, executing it if valid. Returns false if the peer should be
+ * closed.
+ */
+bool el_handle_view(EventLoop* eventLoop, Watch* watch, MessageView* view) {
+    if (watch->connection == NULL) {
+        return el_verify_peer(eventLoop, watch, view);
+    }
+    stats_received(eventLoop->depotState->stats, watch->connection->stats,
+            view->type);
+    // executed straight away, so only recorded once
+    fr_record_view(FR_RECEIVED, watch->connection->port, view);
+    if (view->type == MSG_META_WIRE_OFFER) {
+        Message msg = {0};
+        msg.type = MSG_META_WIRE_OFFER;
+        msg.data.connection = watch->connection;
+        execute_meta_message(eventLoop->depotState, &msg);
+    } else if (view->type != MSG_NULL) {
+        cap_view(eventLoop->depotState->capture, watch->connection->port,
+                view);
+        execute_message_view(eventLoop->depotState, view);
+    }
+    return true;
+}
+
+/* Handles a peer socket becoming readable or closed. Reads what is
+ * available and executes complete lines, closing the peer on EOF.
+ */
+void el_peer_readable(EventLoop* eventLoop, Watch* watch) {
+    int bytes = rb_fill(&watch->recv, watch->fd);
+    if (bytes < 0) {
+        return; // spurious wakeup, wait for the next event
+    }
+    stats_bytes_in(eventLoop->depotState->stats, watch->connection != NULL ?
+            watch->connection->stats : NULL, bytes);
+    bool offered = eventLoop->depotState->config.wire;
+    MessageView view;
+#ifdef LATENCY
+    // executed as soon as parsed, so never posted or queued
+    uint64_t latStamps[LAT_NUM_STAMPS] = {0};
+    latStamps[LAT_READ] = lat_now();
+#endif
+    while (wire_next_message(&watch->recv, &watch->wire, offered, &view)) {
+        LAT_STAMP(latStamps, LAT_RECEIVED);
+        LAT_STAMP(latStamps, LAT_DEQUEUED);
+        if (!el_handle_view(eventLoop, watch, &view)) {
+            el_drop_peer(eventLoop, watch);
+            return;
+        }
+        LAT_RECORD(view.type, latStamps);
+    }
+    if (!watch->recv.eof) {
+        return;
+    }
+
+    if (watch->connection != NULL) {
+        DEBUG_PRINTF("conn %d:%s LOST connection!\n",
+                watch->connection->port, watch->connection->name);
+        Message msg = {0};
+        msg.type = MSG_META_CONN_EOF;
+        msg.data.connection = watch->connection;
+        execute_meta_message(eventLoop->depotState, &msg);
+        msg_destroy(&msg);
+    }
+    el_drop_peer(eventLoop, watch);
+}
+
+/* Reads one pending signal from the signalfd and executes it, unless it
+ * stops the depot (see is_stop_signal), when it stops the event loop.
+ */
+void el_signal_readable(EventLoop* eventLoop) {
+    struct signalfd_siginfo info;
+    if (read(eventLoop->signal.fd, &info, sizeof(info)) != sizeof(info)) {
+        return;
+    }
+    int sig = info.ssi_signo;
+    DEBUG_PRINTF("signal %d: %s\n", sig, strsignal(sig));
+    if (is_stop_signal(sig)) {
+        eventLoop->running = false; // debug exit on other signals
+        return;
+    }
+    Message msg = {0};
+    msg.type = MSG_META_SIGNAL;
+    msg.data.signal = sig;
+    execute_meta_message(eventLoop->depotState, &msg);
+}
+
+// see header
+void el_run(EventLoop* eventLoop) {
+    struct epoll_event events[EVENT_BATCH];
+    int flushTimeout = -1; // ms until flushing again, -1 if not needed
+    eventLoop->running = true;
+    while (eventLoop->running) {
+        // if a peer was full, wake up in a while to retry writing to it, and
+        // in time to send held Delivers or give up on any connect or
+        // handshake taking too long
+        int numEvents = epoll_wait(eventLoop->epollFd, events, EVENT_BATCH,
+                el_next_timeout(eventLoop, flushTimeout));
+        if (numEvents < 0 && errno != EINTR) {
+            DEBUG_PERROR("epoll_wait()");
+            return;
+        }
+        for (int i = 0; i < numEvents && eventLoop->running; i++) {
+            Watch* watch = events[i].data.ptr;
+            int fd;
+            switch (watch->kind) {
+                case WATCH_SERVER:
+                    fd = accept(watch->fd, 0, 0);
+                    if (fd >= 0) {
+                        DEBUG_PRINT("server got new connection, verifying");
+                        el_add_socket(eventLoop->depotState, fd);
+                    }
+                    break;
+                case WATCH_SIGNAL:
+                    el_signal_readable(eventLoop);
+                    break;
+                case WATCH_CONNECTING:
+                    el_connect_ready(eventLoop, watch);
+                    break;
+                case WATCH_PEER:
+                    el_peer_readable(eventLoop, watch);
+                    break;
+            }
+        }
+        el_expire_deadlines(eventLoop);
+        // write everything queued by this batch, one syscall per peer
+        flushTimeout = ds_flush_connections(eventLoop->depotState);
+    }
+    DEBUG_PRINT("event loop stopped due to signal");
+}
@@ -0,0 +1,100 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "connection.h"
+#include "depotState.h"
+#include "recvBuffer.h"
+#include "wire.h"
+
+// maximum number of epoll events handled per wakeup
+#define EVENT_BATCH 64
+
+/* Kinds of file descriptors watched by the event loop.
+ */
+typedef enum WatchKind {
+    WATCH_SERVER, // listening socket, readable when a peer is waiting
+    WATCH_SIGNAL, // signalfd receiving the signals in blocked_sigset()
+    WATCH_CONNECTING, // socket connecting out, writable once it finishes
+    WATCH_PEER // socket to another depot
+} WatchKind;
+
+/* A file descriptor registered with the event loop. The epoll data of every
+ * registration points to one of these.
+ */
+typedef struct Watch {
+    WatchKind kind;
+    int fd; // file descriptor being watched. for peers, owned by writeFile
+
+    // peer only fields below.
+
+    // NULL until the peer's IM has been received, then BORROWED from the
+    // depot state's connections.
+    Connection* connection;
+    // write file on fd. OWNED until verified, then YIELDED to connection
+    FILE* writeFile;
+    RecvBuffer recv; // rb_destroy! bytes received but not yet executed
+    WireDecoder wire; // wdec_destroy! how the peer is encoding messages
+    // port we connected out to, or 0 if the socket was accepted. if
+    // connecting or verifying fails, MSG_META_CONN_FAILED is executed
+    int connectPort;
+    bool handshaking; // connected and greeted, but no IM received yet
+    // when the connect or handshake is given up on, 0 for never. set with
+    // el_set_deadline, which keeps watches with one in the timed list
+    double deadline;
+    struct Watch* prevTimed;
+    struct Watch* nextTimed;
+
+    // open peers form a doubly linked list so they can be closed on exit
+    struct Watch* prev;
+    struct Watch* next;
+} Watch;
+
+/* State struct for running a depot with a single thread. The listening
+ * socket, every peer socket and a signalfd are multiplexed with epoll, and
+ * messages are executed on this thread as soon as they are parsed, with no
+ * incoming channel in between.
+ */
+typedef struct EventLoop {
+    DepotState* depotState; // BORROWED
+    int epollFd;
+    Watch server; // server.fd is OWNED
+    Watch signal;
+    Watch* peers; // MALLOC! linked list of open peer sockets
+    // BORROWED from peers, those with a deadline, soonest first
+    Watch* timed;
+    Watch* timedLast; // BORROWED, the latest deadline in timed
+    bool running;
+} EventLoop;
+
+/* Initialises the event loop for the given depot state, taking ownership of
+ * the given listening socket. Registers itself as the depot's
+ * startConnect handler. Signals in blocked_sigset() MUST already be
+ * blocked. Returns false if any epoll or signalfd setup fails.
+ */
+bool el_init(EventLoop* eventLoop, DepotState* depotState, int server);
+
+/* Destroys the event loop, closing the listening socket and any unverified
+ * peer sockets. Verified connections remain owned by the depot state.
+ */
+void el_destroy(EventLoop* eventLoop);
+
+/* Runs the event loop, accepting peers, verifying them with IM and executing
+ * their messages. Returns when a signal which stops the depot is received.
+ */
+void el_run(EventLoop* eventLoop);
+
+/* Sends our IM on the given accepted socket and starts watching it for the
+ * peer's IM, for at most DEPOT_HANDSHAKE_TIMEOUT_MS. Takes ownership of fd.
+ */
+void el_add_socket(DepotState* depotState, int fd);
+
+/* Implements DepotState.startConnect. Starts connecting to the given port
+ * and watches for the connect to finish, sending our IM once it does. Gives
+ * up after DEPOT_CONNECT_TIMEOUT_MS, then DEPOT_HANDSHAKE_TIMEOUT_MS.
+ */
+void el_connect(DepotState* depotState, int port);
+
+#endif
@@ -0,0 +1,352 @@
+// xvim: foldmethod=marker:foldlevelstart=0 foldenable
+
+/* includes {{{1 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+
+#include "execute.h"
+#include "capture.h"
+#include "connection.h"
+#include "flight.h"
+#include "latency.h"
+#include "material.h"
+#include "messages.h"
+#include "msgView.h"
+#include "network.h"
+#include "stats.h"
+#include "util.h"
+
+#define BANNED_NAME_CHARS " \n\r:"
+
+/* validation methods {{{1 */
+
+// see header
+bool is_name_valid(char* name) {
+    return is_name_view_valid(sv_from(name));
+}
+
+// see header
+bool is_name_view_valid(StrView name) {
+    char* banned = BANNED_NAME_CHARS;
+    for (int i = 0; i < name.len; i++) {
+        // check if any char in name appears in banned list.
+        if (strchr(banned, name.start[i]) != NULL) {
+            DEBUG_PRINTF("name invalid: |%.*s|\n", name.len, name.start);
+            return false;
+        }
+    }
+    return name.len > 0; // ensure name non-empty
+}
+
+// see header
+bool is_mat_valid(Material material) {
+    if (!is_name_valid(material.name)) {
+        DEBUG_PRINT("invalid mat name");
+        return false;
+    }
+    if (material.quantity <= 0) {
+        DEBUG_PRINT("invalid mat quantity");
+        return false;
+    }
+    return true;
+}
+
+// see header
+bool is_port_connected(DepotState* depotState, int port) {
+    if (port == depotState->port) {
+        DEBUG_PRINT("rejecting connection to our own port");
+        return true;
+    }
+    if (hashmap_get(depotState->connsByPort, &port) != NULL) {
+        DEBUG_PRINT("active connection already exists");
+        return true;
+    }
+    if (hashmap_get(depotState->pending, &port) != NULL) {
+        DEBUG_PRINT("unverified connection already exists");
+        return true;
+    }
+    return false;
+}
+
+/* Removes the given port from the pending ports, if it is there.
+ */
+void remove_pending(DepotState* depotState, int port) {
+    int* pendingPort = hashmap_remove(depotState->pending, &port);
+    if (pendingPort != NULL) {
+        DEBUG_PRINTF("port %d no longer pending\n", port);
+        free(pendingPort);
+    }
+}
+
+/* execute methods {{{1 */
+/* execute normal messages {{{2 */
+
+/* The execute family of functions will each execute a particular message type,
+ * given the depot state and message instance. Particular execute_ functions
+ * should only by called with the correct tyle. execute_message and
+ * execute_meta_message can be called with any message of normal / meta type
+ * respectively. Because invalid messages are silently ignored, these functions
+ * do not return anything.
+ */
+
+// executes a Connect:port message
+void execute_connect(DepotState* depotState, Message* message) {
+    int portNum = message->data.depotPort;
+    if (is_port_connected(depotState, portNum)) {
+        DEBUG_PRINTF("connection exists to port %d\n", portNum);
+        return;
+    }
+
+    // pending until verified, or until MSG_META_CONN_FAILED if not. this
+    // is what stops a second Connect to the port while the first is going
+    DEBUG_PRINTF("trying to connect to port %d\n", portNum);
+    int* pendingPort = malloc(sizeof(int));
+    *pendingPort = portNum;
+    hashmap_put(depotState->pending, pendingPort);
+    // whichever IO model is running this depot connects without blocking us
+    depotState->startConnect(depotState, portNum);
+}
+
+// executes a Deliver or Withdraw of the given material. shared by messages
+// and message views, so takes the material apart.
+void execute_deliver_withdraw(DepotState* depotState, MessageType type,
+        int quantity, StrView name) {
+    if (quantity <= 0 || !is_name_view_valid(name)) {
+        DEBUG_PRINT("ignoring invalid material");
+        return;
+    }
+
+    int delta = quantity;
+    if (type != MSG_DELIVER) {
+        delta = -delta; // negative change to represent withdraw
+    }
+    ds_alter_mat_view(depotState, name, delta);
+}
+
+// executes a Transfer message. queues a message to a connection!
+void execute_transfer(DepotState* depotState, Message* message) {
+    Material mat = message->data.material;
+    if (!is_mat_valid(mat)) {
+        DEBUG_PRINT("ignoring invalid material");
+        return;
+    }
+
+    Connection* conn = ds_get_connection(depotState,
+            message->data.depotName);
+    if (conn == NULL) {
+        DEBUG_PRINTF("depot not found: %s\n", message->data.depotName);
+        return;
+    }
+
+    DEBUG_PRINTF("withdrawing, then delivering to %s\n", conn->name);
+    // only now is the material stored, so its name interned
+    SymId matId = mat_intern(&mat);
+    ds_alter_mat_id(depotState, matId, -mat.quantity);
+
+    Message msg = msg_deliver(mat.quantity, matId);
+    // queue Deliver to given depot, written when connections are flushed
+    ds_send_message(depotState, conn, msg);
+    msg_destroy(&msg);
+}
+
+// executes a Defer of the given deferred message. only deliver, withdraw and
+// transfer messages can be deferred. shared by messages and message views.
+void execute_defer(DepotState* depotState, int key, MessageView* inner) {
+    // restrict types of messages which can be deferred
+    MessageType deferType = inner->type;
+    if (!(deferType == MSG_DELIVER || deferType == MSG_WITHDRAW ||
+            deferType == MSG_TRANSFER)) {
+        DEBUG_PRINT("unsupported deferred message type");
+        return; // silently ignore
+    }
+
+    ds_defer(depotState, key, inner); // copied into the group's arena
+}
+
+// executes an Execute message
+void execute_execute(DepotState* depotState, Message* message) {
+    // admittedly not the best naming
+
+    DeferGroup* dg = ds_take_defer_group(depotState, message->data.deferKey);
+    if (dg == NULL) {
+        DEBUG_PRINT("defer key not found");
+        return;
+    }
+    DEBUG_PRINTF("executing defer group, key: %d, %d messages\n",
+            message->data.deferKey, dg->numMessages);
+    if (depotState->stats != NULL) {
+        STATS_ADD(depotState->stats->deferGroupsExecuted, 1);
+    }
+
+    // the group is already removed, and deferred messages can't add to it
+    int offset = 0;
+    MessageView deferred;
+    while (dg_next(dg, &offset, &deferred)) {
+        execute_message_view(depotState, &deferred); // recursion!
+    }
+
+    // frees every deferred message at once
+    dg_destroy(dg);
+    free(dg);
+}
+
+// executes each Deliver and Withdraw of a Batch in order, each exactly as
+// if it had been sent alone
+void execute_batch_ops(DepotState* depotState, Batch* batch) {
+    for (int i = 0; i < batch->numOps; i++) {
+        BatchOp* op = &batch->ops[i];
+        execute_deliver_withdraw(depotState, op->type, op->quantity,
+                op->matName);
+    }
+}
+
+/* }}}2 */
+
+// see header
+void execute_message(DepotState* depotState, Message* message) {
+    MessageView inner;
+    switch (message->type) {
+        case MSG_CONNECT:
+            execute_connect(depotState, message);
+            break;
+        case MSG_IM: // ignore improperly sequenced IM
+            DEBUG_PRINT("ignoring unexpected IM");
+            break;
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+            execute_deliver_withdraw(depotState, message->type,
+                    message->data.material.quantity,
+                    sv_from(message->data.material.name));
+            break;
+        case MSG_TRANSFER:
+            execute_transfer(depotState, message);
+            break;
+        case MSG_DEFER:
+            mv_from_message(message->data.deferMessage, &inner);
+            execute_defer(depotState, message->data.deferKey, &inner);
+            break;
+        case MSG_EXECUTE:
+            execute_execute(depotState, message);
+            break;
+        case MSG_BATCH_OPS:
+            execute_batch_ops(depotState, message->data.batch);
+            break;
+        default:
+            DEBUG_PRINT("invalid normal message type");
+            assert(0);
+    }
+}
+
+// see header
+void execute_message_view(DepotState* depotState, MessageView* view) {
+    if (view->type == MSG_DELIVER || view->type == MSG_WITHDRAW) {
+        // fast path, nothing is copied out of the line
+        execute_deliver_withdraw(depotState, view->type, view->quantity,
+                view->matName);
+        return;
+    }
+    if (view->type == MSG_DEFER) {
+        // also straight from the view, into the defer group
+        MessageView inner;
+        mv_parse_deferred(view, &inner);
+        execute_defer(depotState, view->deferKey, &inner);
+        return;
+    }
+    if (view->type == MSG_BATCH_OPS) {
+        // each op straight from the line or frame too
+        OpCursor cursor;
+        MessageView op;
+        mv_start_ops(view, &cursor);
+        while (mv_next_op(&cursor, &op)) {
+            execute_deliver_withdraw(depotState, op.type, op.quantity,
+                    op.matName);
+        }
+        return;
+    }
+    Message message;
+    mv_to_message(view, &message);
+    execute_message(depotState, &message);
+    msg_destroy(&message);
+}
+
+// see header
+bool is_stop_signal(int sig) {
+    return sig != SIGHUP && sig != LAT_DUMP_SIGNAL && sig != FR_DUMP_SIGNAL;
+}
+
+// see header
+void execute_meta_message(DepotState* depotState, Message* message) {
+    Connection* conn = message->data.connection;
+    int signal = message->data.signal;
+    stats_received(depotState->stats, NULL, message->type);
+    switch (message->type) {
+        case MSG_META_SIGNAL:
+            DEBUG_PRINTF("received signal %d: %s\n", signal,
+                    strsignal(signal));
+            fr_record(FR_SIGNAL, 0, 0, signal, NULL, 0);
+            cap_meta(depotState->capture, message);
+            if (signal == SIGHUP) {
+                ds_print_info(depotState);
+            } else if (signal == LAT_DUMP_SIGNAL) {
+                lat_dump(stderr);
+            } else if (signal == FR_DUMP_SIGNAL && fr_dump(signal)) {
+                fprintf(stderr, "flight recorder dumped to %s\n",
+                        fr_path());
+            }
+            break;
+        case MSG_META_CONN_NEW:
+            DEBUG_PRINTF("new connection to %d:%s, %p\n", conn->port,
+                    conn->name, (void*)conn);
+            fr_record(FR_CONN_NEW, 0, conn->port, 0, conn->name,
+                    strlen(conn->name));
+            cap_meta(depotState->capture, message); // even if rejected
+            remove_pending(depotState, conn->port); // verified
+            if (ds_get_connection(depotState, conn->name) != NULL ||
+                    is_port_connected(depotState, conn->port)) {
+                DEBUG_PRINT("connection to name or port exists, ignoring.");
+                stats_close_peer(conn->stats);
+                conn->rejected = true;
+                break; // left in the message for its poster to cleanup
+            }
+
+            DEBUG_PRINT("accepting new connection");
+            conn->outQueue.maxBytes = depotState->config.peerOutMax;
+            // YIELD connection to connections array
+            ds_add_connection(depotState, conn);
+            message->data.connection = NULL; // don't destroy conn
+            break;
+        case MSG_META_CONN_EOF:
+            // only ever posted for accepted connections
+            cap_meta(depotState->capture, message);
+            message->data.connection = NULL; // don't destroy conn
+            DEBUG_PRINTF("conn %d:%s, %p LOST connection!\n", conn->port,
+                    conn->name, (void*)conn);
+            fr_record(FR_CONN_EOF, 0, conn->port, 0, conn->name,
+                    strlen(conn->name));
+            //array_remove(depotState->connections, conn);
+            // edit: as of 4.2, do not remove closed connections. keep FILES's
+            // open, will fail on writing.
+            stats_close_peer(conn->stats);
+            break;
+        case MSG_META_CONN_FAILED:
+            DEBUG_PRINTF("connecting to port %d failed\n",
+                    message->data.depotPort);
+            cap_meta(depotState->capture, message);
+            remove_pending(depotState, message->data.depotPort);
+            break;
+        case MSG_META_WIRE_OFFER:
+            // as with eof, only ever posted for accepted connections
+            cap_meta(depotState->capture, message);
+            if (depotState->config.wire) {
+                ds_start_binary(depotState, conn);
+            }
+            message->data.connection = NULL; // never owned
+            break;
+        default:
+            DEBUG_PRINT("invalid meta message type");
+            assert(0);
+    }
+}
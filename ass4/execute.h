@@ -0,0 +1,64 @@
+#ifndef EXECUTE_H
+#define EXECUTE_H
+
+#include <stdbool.h>
+
+#include "depotState.h"
+#include "material.h"
+#include "messages.h"
+#include "msgView.h"
+#include "strView.h"
+
+/* Returns whether the given string is a valid depot or material name,
+ * according to rules in spec.
+ */
+bool is_name_valid(char* name);
+
+/* As is_name_valid, but for a name given as a view.
+ */
+bool is_name_view_valid(StrView name);
+
+/* Returns whether the givne material is a valid message argument. 
+ * That is, its name is valid and its quantity is strictly positive.
+ */
+bool is_mat_valid(Material material);
+
+/* Returns true if a connection to the given port exists, verified or still
+ * pending, false otherwise.
+ * If the given port is this depot's port, returns true.
+ */
+bool is_port_connected(DepotState* depotState, int port);
+
+/* Executes an arbitrary normal message (those defined in spec) against the
+ * given depot state. Invalid messages are silently ignored.
+ *
+ * Deferred messages are executed recursively by Execute. Connect marks the
+ * port pending and has depotState->startConnect connect to it in the
+ * background. Transfer queues a Deliver for the destination, which is
+ * written by ds_flush_connections.
+ */
+void execute_message(DepotState* depotState, Message* message);
+
+/* As execute_message, but for a message parsed into a view. Deliver and
+ * Withdraw are executed straight from the view; anything else is converted
+ * to a Message first.
+ */
+void execute_message_view(DepotState* depotState, MessageView* view);
+
+/* Returns whether the given signal, picked up from blocked_sigset(), stops
+ * the depot rather than being executed as a MSG_META_SIGNAL: every signal
+ * but SIGHUP, LAT_DUMP_SIGNAL and FR_DUMP_SIGNAL.
+ */
+bool is_stop_signal(int sig);
+
+/* Executes a single META message. These messages affect the state of
+ * connections / signals of the depot, not the actual materials.
+ *
+ * Ownership of a MSG_META_CONN_NEW connection is taken by setting
+ * message->data.connection to NULL; otherwise it is marked rejected and left
+ * for the caller to destroy with the message. MSG_META_CONN_EOF and
+ * MSG_META_WIRE_OFFER MUST only be given for accepted connections.
+ */
+void execute_meta_message(DepotState* depotState, Message* message);
+
+#endif
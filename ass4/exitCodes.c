@@ -13,6 +13,7 @@ const char* depot_message(DepotExitCode code) {
     messages[D_INCORRECT_ARGS] = "Usage: 2310depot name {goods qty}\n";
     messages[D_INVALID_NAME] = "Invalid name(s)\n";
     messages[D_INVALID_QUANTITY] = "Invalid quantity\n";
+    messages[D_WAL_FAILED] = "Cannot open write-ahead log\n";
     // string literals are always static
     return messages[code];
 }
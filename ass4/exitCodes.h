@@ -1,14 +1,16 @@
 #ifndef EXITCODES_H
 #define EXITCODES_H
 
-#define NUM_EXIT_CODES 4
+#define NUM_EXIT_CODES 5
 
 /* Exit codes for the depot, defined in spec. */
 typedef enum DepotExitCode {
     D_NORMAL = 0,
     D_INCORRECT_ARGS = 1,
     D_INVALID_NAME = 2,
-    D_INVALID_QUANTITY = 3
+    D_INVALID_QUANTITY = 3,
+    // not in spec. DEPOT_WAL_DIR is set but the log can't be opened
+    D_WAL_FAILED = 4
 } DepotExitCode;
 
 /* Returns the depot error message associated with the given code.
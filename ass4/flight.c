@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flight.h"
+#include "util.h"
+
+// events per ring, a power of 2, or 0 if the recorder is off
+static int frEvents = 0;
+// every ring allocated so far, of which the first frNumRings are set
+static FlightRing* frRings[FR_MAX_RINGS];
+static int frNumRings = 0;
+// held while handing out rings, never while recording or dumping
+static pthread_mutex_t frLock = PTHREAD_MUTEX_INITIALIZER;
+// gives a thread's ring back when it exits
+static pthread_key_t frKey;
+static char* frDumpPath = NULL; // MALLOC'd once, never freed
+// readings of both clocks at start up, see FlightHeader
+static uint64_t frTicks0 = 0;
+static uint64_t frNs0 = 0;
+// the calling thread's ring, or NULL if it records nothing
+static __thread FlightRing* frThreadRing = NULL;
+
+// signals on which the rings are dumped before dying
+static const int fatalSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+/* Returns the current time in ticks, as cheaply as the CPU allows. On x86
+ * this is the time stamp counter, elsewhere CLOCK_MONOTONIC nanoseconds.
+ */
+uint64_t fr_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t fr_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Destructor of frKey, marking the exiting thread's ring as free to be given
+ * to a new thread.
+ */
+void fr_thread_end(void* ring) {
+    __atomic_store_n(&((FlightRing*)ring)->header.live, 0, __ATOMIC_RELEASE);
+}
+
+/* Handler of fatal signals, which dumps the rings then dies of the signal
+ * as it would have without the handler.
+ */
+void fr_fatal(int sig) {
+    fr_dump(sig);
+    raise(sig); // the handler was reset to the default on entry
+}
+
+// see header
+void fr_init(int eventsPerRing, char* path) {
+    if (eventsPerRing <= 0) {
+        return;
+    }
+    frEvents = 1;
+    while (frEvents < eventsPerRing) {
+        frEvents <<= 1;
+    }
+    frDumpPath = path != NULL ? strdup(path) :
+            asprintf("depot-%d.flight", (int)getpid());
+    frTicks0 = fr_ticks();
+    frNs0 = fr_ns();
+    pthread_key_create(&frKey, fr_thread_end);
+    fr_thread_start("main");
+
+    struct sigaction sa = new_sigaction();
+    sa.sa_handler = fr_fatal;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    int numFatal = sizeof(fatalSignals) / sizeof(fatalSignals[0]);
+    for (int i = 0; i < numFatal; i++) {
+        sigaction(fatalSignals[i], &sa, NULL);
+    }
+}
+
+/* Returns a ring no live thread owns, allocating one if there are fewer
+ * than FR_MAX_RINGS, or NULL if every ring is taken. MUST be called with
+ * frLock held.
+ */
+FlightRing* fr_free_ring(void) {
+    for (int i = 0; i < frNumRings; i++) {
+        if (!__atomic_load_n(&frRings[i]->header.live, __ATOMIC_ACQUIRE)) {
+            return frRings[i];
+        }
+    }
+    if (frNumRings == FR_MAX_RINGS) {
+        return NULL;
+    }
+    FlightRing* ring = calloc(1, sizeof(FlightRing) +
+            frEvents * sizeof(FlightEvent));
+    if (ring == NULL) {
+        return NULL;
+    }
+    frRings[frNumRings] = ring;
+    // dumps read the count without the lock, so it is published last
+    __atomic_store_n(&frNumRings, frNumRings + 1, __ATOMIC_RELEASE);
+    return ring;
+}
+
+// see header
+void fr_thread_start(char* label) {
+    if (frEvents == 0) {
+        return;
+    }
+    pthread_mutex_lock(&frLock);
+    FlightRing* ring = fr_free_ring();
+    if (ring != NULL) {
+        // a reused ring's old events are overwritten from the start
+        __atomic_store_n(&ring->header.next, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->header.live, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&frLock);
+    if (ring == NULL) {
+        DEBUG_PRINTF("no flight recorder ring left for %s\n", label);
+        return;
+    }
+    frThreadRing = ring;
+    fr_thread_label(label);
+    pthread_setspecific(frKey, ring);
+}
+
+// see header
+void fr_thread_label(char* label) {
+    if (frThreadRing != NULL) {
+        snprintf(frThreadRing->header.label, FR_LABEL_LEN, "%s", label);
+    }
+}
+
+// see header
+void fr_record(FlightKind kind, int type, int port, int value, char* name,
+        int nameLen) {
+    FlightRing* ring = frThreadRing;
+    if (ring == NULL) {
+        return;
+    }
+    uint64_t next = ring->header.next; // only we write it
+    FlightEvent* event = &ring->events[next & (frEvents - 1)];
+    event->ticks = fr_ticks();
+    event->kind = kind;
+    event->type = type;
+    event->port = port;
+    event->value = value;
+    if (nameLen > FR_NAME_LEN) {
+        nameLen = FR_NAME_LEN;
+    }
+    if (nameLen > 0) {
+        memcpy(event->name, name, nameLen);
+    }
+    if (nameLen < FR_NAME_LEN) {
+        event->name[nameLen] = '\0';
+    }
+    __atomic_store_n(&ring->header.next, next + 1, __ATOMIC_RELEASE);
+}
+
+// see header
+void fr_record_view(FlightKind kind, int port, MessageView* view) {
+    if (frThreadRing == NULL) {
+        return; // don't bother picking out the fields
+    }
+    // only the fields for its type are set, the rest may be garbage
+    int value = 0;
+    StrView name = {NULL, 0};
+    switch (view->type) {
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+        case MSG_TRANSFER:
+            value = view->quantity;
+            name = view->matName;
+            break;
+        case MSG_CONNECT:
+        case MSG_IM:
+            value = view->depotPort;
+            name = view->depotName;
+            break;
+        case MSG_DEFER:
+        case MSG_EXECUTE:
+            value = view->deferKey;
+            break;
+        case MSG_BATCH_OPS:
+            value = view->numOps;
+            break;
+        default:
+            break;
+    }
+    fr_record(kind, view->type, port, value, name.start, name.len);
+}
+
+// see header
+void fr_record_message(FlightKind kind, int port, Message* message) {
+    if (frThreadRing == NULL) {
+        return;
+    }
+    MessageData* data = &message->data;
+    int value = 0;
+    char* name = NULL;
+    switch (message->type) {
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+        case MSG_TRANSFER:
+            value = data->material.quantity;
+            name = data->material.name;
+            break;
+        case MSG_CONNECT:
+        case MSG_IM:
+            value = data->depotPort;
+            name = data->depotName;
+            break;
+        case MSG_DEFER:
+        case MSG_EXECUTE:
+            value = data->deferKey;
+            break;
+        case MSG_BATCH_OPS:
+            value = data->batch != NULL ? data->batch->numOps : 0;
+            break;
+        default:
+            break;
+    }
+    fr_record(kind, message->type, port, value, name,
+            name != NULL ? strnlen(name, FR_NAME_LEN) : 0);
+}
+
+/* Writes all len bytes of buffer to fd, returning false on error.
+ * Async-signal-safe.
+ */
+bool fr_write_all(int fd, void* buffer, size_t len) {
+    char* bytes = buffer;
+    while (len > 0) {
+        ssize_t wrote = write(fd, bytes, len);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote <= 0) {
+            return false;
+        }
+        bytes += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+// see header
+bool fr_dump(int sig) {
+    if (frEvents == 0) {
+        return false;
+    }
+    int savedErrno = errno; // may be called from a signal handler
+    int fd = open(frDumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        errno = savedErrno;
+        return false;
+    }
+    FlightHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FR_MAGIC, sizeof(header.magic));
+    header.pid = getpid();
+    header.signal = sig;
+    header.numRings = __atomic_load_n(&frNumRings, __ATOMIC_ACQUIRE);
+    header.eventsPerRing = frEvents;
+    header.ticks0 = frTicks0;
+    header.ns0 = frNs0;
+    header.ticks1 = fr_ticks();
+    header.ns1 = fr_ns();
+    bool ok = fr_write_all(fd, &header, sizeof(header));
+    for (int i = 0; ok && i < header.numRings; i++) {
+        FlightRing* ring = frRings[i];
+        FlightRingHeader ringHeader = ring->header;
+        ringHeader.next = __atomic_load_n(&ring->header.next,
+                __ATOMIC_ACQUIRE);
+        ringHeader.live = __atomic_load_n(&ring->header.live,
+                __ATOMIC_ACQUIRE);
+        ok = fr_write_all(fd, &ringHeader, sizeof(ringHeader)) &&
+                fr_write_all(fd, ring->events,
+                frEvents * sizeof(FlightEvent));
+    }
+    ok = close(fd) == 0 && ok;
+    errno = savedErrno;
+    return ok;
+}
+
+// see header
+char* fr_path(void) {
+    return frEvents > 0 ? frDumpPath : NULL;
+}
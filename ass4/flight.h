@@ -0,0 +1,151 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+#include <signal.h>
+
+#include "messages.h"
+#include "msgView.h"
+
+/* An always-on flight recorder: each thread of the depot keeps a fixed-size
+ * ring of its most recent events in compact binary form, overwriting the
+ * oldest. Recording an event is a few stores into memory only the thread
+ * itself writes, with no locks or system calls, so it can be left on in
+ * production where DEBUG_PRINTF never could be.
+ *
+ * The rings are written to a file (see DEPOT_FLIGHT_FILE) on SIGQUIT, and
+ * on a fatal signal before the depot dies. depotflight decodes the file
+ * into the events of every thread, merged in time order.
+ *
+ * Only threads which called fr_thread_start record anything, into one of at
+ * most FR_MAX_RINGS rings. A ring is kept once its thread exits, so the
+ * last events of closed connections survive until a new thread needs it.
+ * Dumping reads rings while their threads may still be writing, so the
+ * newest events of a running thread may be torn.
+ */
+
+// identifies (and versions) a flight recorder file
+#define FR_MAGIC "DEPOTFR1"
+// default DEPOT_FLIGHT_EVENTS
+#define FR_DEFAULT_EVENTS 1024
+// most threads recording at once, later threads record nothing
+#define FR_MAX_RINGS 256
+// bytes of a thread's label kept, including the \0
+#define FR_LABEL_LEN 32
+// bytes of a name kept in an event, not \0 terminated if it fills them
+#define FR_NAME_LEN 12
+// signal which dumps the rings and carries on
+#define FR_DUMP_SIGNAL SIGQUIT
+
+/* Kinds of events recorded.
+ */
+typedef enum FlightKind {
+    FR_RECEIVED, // a line or frame received from a peer, after parsing
+    FR_EXECUTE, // a message about to be executed by main or a shard
+    FR_CONN_NEW, // a verified connection accepted by main
+    FR_CONN_EOF, // a connection closed
+    FR_STALL_BEGIN, // a thread found a ring full and is waiting to post
+    FR_STALL_END, // the post went through, value is the wait in us
+    FR_SIGNAL, // a signal picked up by main
+    FR_NUM_KINDS
+} FlightKind;
+
+/* One recorded event, 32 bytes. What port, value and name hold depends on
+ * the kind, and for messages on their type:
+ *   messages      port is the peer's (0 if unknown), value the quantity,
+ *                 deferKey, depotPort or number of Batch ops, name the
+ *                 material (or depot for IM)
+ *   connections   port and name are the peer's
+ *   stalls        value is the ring's capacity, then the microseconds
+ *                 waited
+ *   signals       value is the signal number
+ */
+typedef struct FlightEvent {
+    uint64_t ticks; // see FlightHeader for converting to nanoseconds
+    uint8_t kind; // FlightKind
+    uint8_t type; // MessageType, for messages
+    uint16_t unused;
+    int32_t port;
+    int32_t value;
+    char name[FR_NAME_LEN];
+} FlightEvent;
+
+/* Header of one ring, followed by its eventsPerRing events in the file.
+ * Event i (counting from the thread's first) is at index i % eventsPerRing.
+ */
+typedef struct FlightRingHeader {
+    char label[FR_LABEL_LEN]; // which thread, \0 terminated
+    uint64_t next; // events ever recorded, so the next index to write
+    int32_t live; // whether its thread was still running
+    int32_t unused;
+} FlightRingHeader;
+
+/* A thread's ring of events, as allocated.
+ */
+typedef struct FlightRing {
+    FlightRingHeader header; // next is only written by the owning thread
+    FlightEvent events[]; // eventsPerRing of them
+} FlightRing;
+
+/* Header of a flight recorder file, followed by numRings rings. Ticks
+ * convert to nanoseconds of CLOCK_MONOTONIC as
+ *   ns0 + (ticks - ticks0) * (ns1 - ns0) / (ticks1 - ticks0)
+ * from two readings taken at start up and when dumping.
+ */
+typedef struct FlightHeader {
+    char magic[8]; // FR_MAGIC, not \0 terminated
+    int32_t pid;
+    int32_t signal; // signal which caused the dump
+    int32_t numRings;
+    int32_t eventsPerRing;
+    uint64_t ticks0;
+    uint64_t ns0;
+    uint64_t ticks1;
+    uint64_t ns1;
+} FlightHeader;
+
+/* Starts the flight recorder with rings of at least the given number of
+ * events (rounded up to a power of 2), 0 to record nothing, dumping to the
+ * given path (which is copied), or depot-<pid>.flight if NULL. Registers
+ * the calling thread as "main" and installs handlers which dump the rings
+ * on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT. MUST be called before any
+ * other thread is started.
+ */
+void fr_init(int eventsPerRing, char* path);
+
+/* Gives the calling thread a ring labelled with the given label, if the
+ * recorder is on and one is free. The ring is given up when the thread
+ * exits.
+ */
+void fr_thread_start(char* label);
+
+/* Changes the label of the calling thread's ring, if it has one.
+ */
+void fr_thread_label(char* label);
+
+/* Records an event of the given kind into the calling thread's ring, if it
+ * has one. nameLen bytes of name are kept, up to FR_NAME_LEN.
+ */
+void fr_record(FlightKind kind, int type, int port, int value, char* name,
+        int nameLen);
+
+/* Records an event about the message in the given parsed view, received
+ * from or sent by the peer on the given port.
+ */
+void fr_record_view(FlightKind kind, int port, MessageView* view);
+
+/* Records an event about the given message, as fr_record_view.
+ */
+void fr_record_message(FlightKind kind, int port, Message* message);
+
+/* Writes every ring to the dump file, replacing it, noting the given signal
+ * as the cause. Only makes async-signal-safe calls. Returns false if the
+ * recorder is off or the file could not be written.
+ */
+bool fr_dump(int sig);
+
+/* Returns the path rings are dumped to, or NULL if the recorder is off.
+ */
+char* fr_path(void);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "hashMap.h"
+#include "util.h"
+
+// marks a slot whose item was removed. probing must continue past it.
+#define HASHMAP_TOMBSTONE ((ArrayItem)&hashmap_tombstone)
+
+// only used for its address
+static char hashmap_tombstone;
+
+// see header
+void hashmap_init(HashMap* hashMap, ArrayMapper mapper, HashFunction hasher,
+        ArraySorter sorter) {
+    hashMap->slots = calloc(HASHMAP_INITIAL_SIZE, sizeof(HashSlot));
+    assert(hashMap->slots != NULL);
+    hashMap->numSlots = HASHMAP_INITIAL_SIZE;
+    hashMap->numItems = 0;
+    hashMap->numUsed = 0;
+    hashMap->mapper = mapper;
+    hashMap->hasher = hasher;
+    hashMap->sorter = sorter;
+}
+
+// see header
+void hashmap_destroy(HashMap* hashMap) {
+    if (hashMap == NULL) {
+        return;
+    }
+    TRY_FREE(hashMap->slots);
+}
+
+/* Returns the slot holding the item with the given key and hash, or NULL if
+ * there is no such item. Item keys are compared with key using sorter.
+ */
+HashSlot* hashmap_find(HashMap* hashMap, void* key, unsigned int hash,
+        ArraySorter sorter) {
+    int mask = hashMap->numSlots - 1;
+    for (int i = hash & mask; ; i = (i + 1) & mask) {
+        HashSlot* slot = &hashMap->slots[i];
+        if (slot->item == NULL) {
+            return NULL; // reached end of this probe sequence
+        }
+        if (slot->item != HASHMAP_TOMBSTONE && slot->hash == hash &&
+                sorter(hashMap->mapper(slot->item), key) == 0) {
+            return slot;
+        }
+    }
+}
+
+/* Stores the item with the given hash into the first empty slot of its probe
+ * sequence. There must be at least one empty slot.
+ */
+void hashmap_insert(HashMap* hashMap, void* item, unsigned int hash) {
+    int mask = hashMap->numSlots - 1;
+    int i = hash & mask;
+    while (hashMap->slots[i].item != NULL) {
+        i = (i + 1) & mask;
+    }
+    hashMap->slots[i].hash = hash;
+    hashMap->slots[i].item = item;
+}
+
+/* Reallocates the slots to the given size, which must be a power of 2 at
+ * least twice the number of items. Tombstones are discarded.
+ */
+void hashmap_resize(HashMap* hashMap, int numSlots) {
+    HashSlot* oldSlots = hashMap->slots;
+    int oldNumSlots = hashMap->numSlots;
+
+    hashMap->slots = calloc(numSlots, sizeof(HashSlot));
+    assert(hashMap->slots != NULL);
+    hashMap->numSlots = numSlots;
+    hashMap->numUsed = hashMap->numItems;
+    for (int i = 0; i < oldNumSlots; i++) {
+        ArrayItem item = oldSlots[i].item;
+        if (item != NULL && item != HASHMAP_TOMBSTONE) {
+            hashmap_insert(hashMap, item, oldSlots[i].hash);
+        }
+    }
+    free(oldSlots);
+}
+
+// see header
+void* hashmap_get(HashMap* hashMap, void* key) {
+    HashSlot* slot = hashmap_find(hashMap, key, hashMap->hasher(key),
+            hashMap->sorter);
+    return slot == NULL ? NULL : slot->item;
+}
+
+// see header
+void* hashmap_get_by(HashMap* hashMap, void* key, unsigned int hash,
+        ArraySorter sorter) {
+    HashSlot* slot = hashmap_find(hashMap, key, hash, sorter);
+    return slot == NULL ? NULL : slot->item;
+}
+
+// see header
+void hashmap_put(HashMap* hashMap, void* item) {
+    assert(item != NULL);
+    // keep at most half the slots used so probe sequences stay short. if
+    // mostly tombstones, rehashing at the same size is enough.
+    if (2 * (hashMap->numUsed + 1) > hashMap->numSlots) {
+        int numSlots = hashMap->numSlots;
+        if (4 * (hashMap->numItems + 1) > numSlots) {
+            numSlots *= 2;
+        }
+        hashmap_resize(hashMap, numSlots);
+    }
+    void* key = hashMap->mapper(item);
+    hashmap_insert(hashMap, item, hashMap->hasher(key));
+    hashMap->numItems++;
+    hashMap->numUsed++;
+}
+
+// see header
+void* hashmap_remove(HashMap* hashMap, void* key) {
+    HashSlot* slot = hashmap_find(hashMap, key, hashMap->hasher(key),
+            hashMap->sorter);
+    if (slot == NULL) {
+        return NULL;
+    }
+    void* item = slot->item;
+    slot->item = HASHMAP_TOMBSTONE; // numUsed is unchanged
+    hashMap->numItems--;
+    return item;
+}
+
+// see header
+void hashmap_foreach(HashMap* hashMap, void (*func)(void*)) {
+    for (int i = 0; i < hashMap->numSlots; i++) {
+        ArrayItem item = hashMap->slots[i].item;
+        if (item != NULL && item != HASHMAP_TOMBSTONE) {
+            func(item);
+        }
+    }
+}
+
+// see header
+void* hashmap_next(HashMap* hashMap, int* index) {
+    while (*index < hashMap->numSlots) {
+        ArrayItem item = hashMap->slots[(*index)++].item;
+        if (item != NULL && item != HASHMAP_TOMBSTONE) {
+            return item;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h>
+
+#include "array.h"
+
+#define HASHMAP_INITIAL_SIZE 32
+
+/* Hash function for the hash map. Takes an item key, as returned by the
+ * mapper function, and returns its hash. Keys which compare equal with the
+ * sorter MUST have equal hashes.
+ */
+typedef unsigned int (*HashFunction)(ArrayKey);
+
+/* One slot of a hash map. The hash of the item's key is kept alongside it so
+ * most probes can skip calling the sorter.
+ */
+typedef struct HashSlot {
+    unsigned int hash;
+    ArrayItem item; // NULL if empty, or HASHMAP_TOMBSTONE if removed
+} HashSlot;
+
+/* Open addressing hash map storing void*'s, with linear probing. Like an
+ * array map, items are mapped to keys by mapper and keys are compared with
+ * sorter (only equality is used). Does not own its items.
+ */
+typedef struct HashMap {
+    HashSlot* slots; // MALLOC! array of numSlots slots
+    int numSlots; // always a power of 2
+    int numItems; // number of items in map
+    int numUsed; // number of non-empty slots, including tombstones
+    ArrayMapper mapper; // maps items to some key.
+    HashFunction hasher; // hashes keys.
+    ArraySorter sorter; // comparison function on the keys.
+} HashMap;
+
+/* Initialises an empty hash map with the given mapper, hash and sorter
+ * functions.
+ */
+void hashmap_init(HashMap* hashMap, ArrayMapper mapper, HashFunction hasher,
+        ArraySorter sorter);
+
+/* Destroys the hash map, freeing its slots. Does not free any of the items.
+ */
+void hashmap_destroy(HashMap* hashMap);
+
+/* Returns the item whose key compares equal to the given key, or NULL if
+ * nothing matched.
+ */
+void* hashmap_get(HashMap* hashMap, void* key);
+
+/* As hashmap_get, but for a key of some other type. hash MUST be what the
+ * map's hasher would return for an equal item key, and sorter is called with
+ * an item key and the given key, returning 0 if they are equal.
+ */
+void* hashmap_get_by(HashMap* hashMap, void* key, unsigned int hash,
+        ArraySorter sorter);
+
+/* Adds the given non-NULL item to the map. An item with an equal key MUST
+ * NOT already be present.
+ */
+void hashmap_put(HashMap* hashMap, void* item);
+
+/* Removes the item whose key compares equal to the given key, returning it,
+ * or returns NULL if nothing matched.
+ */
+void* hashmap_remove(HashMap* hashMap, void* key);
+
+/* Calls the given function once for every item in the map, in no particular
+ * order. The function must not add or remove items.
+ */
+void hashmap_foreach(HashMap* hashMap, void (*func)(void*));
+
+/* Iterates over the items in the map, in no particular order. *index should
+ * start at 0. Returns the next item, or NULL once every item has been
+ * returned. Items must not be added or removed while iterating.
+ */
+void* hashmap_next(HashMap* hashMap, int* index);
+
+#endif
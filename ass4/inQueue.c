@@ -0,0 +1,152 @@
+#include <stdlib.h>
+
+#include "inQueue.h"
+#include "arrayHelpers.h"
+#include "util.h"
+
+// see header
+InQueue* iq_create(int capacity, PeerStats* peer) {
+    InQueue* queue = calloc(1, sizeof(InQueue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    if (!ring_init(&queue->queue, capacity)) {
+        DEBUG_PERROR("eventfd()");
+        ring_destroy(&queue->queue);
+        free(queue);
+        return NULL;
+    }
+    queue->peer = peer;
+    return queue;
+}
+
+// see header
+void iq_destroy(InQueue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+    ring_foreach(&queue->queue, ah_msg_release);
+    ring_destroy(&queue->queue);
+    if (queue->peer != NULL) {
+        STATS_SET(queue->peer->inDepth, 0);
+    }
+    free(queue);
+}
+
+// see header
+void iq_post(InQueue* queue, Message* message, Ring* incoming,
+        MsgSlab* slab) {
+    ring_post(&queue->queue, message);
+    // pairs with the exchange in iqset_idle: either main sees this message
+    // before it lets the queue go idle, or we see it idle and announce it
+    if (__atomic_exchange_n(&queue->scheduled, 1, __ATOMIC_SEQ_CST)) {
+        return; // main already knows
+    }
+    Message* ready = msgslab_take(slab);
+    ready->type = MSG_META_IN_READY;
+    ready->data.inQueue = queue;
+    ring_post(incoming, ready);
+}
+
+/* Appends the given queue to the given list.
+ */
+void iql_push(InQueueList* list, InQueue* queue) {
+    queue->next = NULL;
+    if (list->tail != NULL) {
+        list->tail->next = queue;
+    } else {
+        list->head = queue;
+    }
+    list->tail = queue;
+}
+
+/* Unlinks the queue after prev (or the head if prev is NULL) from the given
+ * list.
+ */
+void iql_unlink(InQueueList* list, InQueue* prev, InQueue* queue) {
+    if (prev == NULL) {
+        list->head = queue->next;
+    } else {
+        prev->next = queue->next;
+    }
+    if (list->tail == queue) {
+        list->tail = prev;
+    }
+    queue->next = NULL;
+}
+
+/* Removes the given queue from the given list if it is there. Returns true
+ * if it was.
+ */
+bool iql_remove(InQueueList* list, InQueue* queue) {
+    InQueue* prev = NULL;
+    for (InQueue* busy = list->head; busy != NULL; busy = busy->next) {
+        if (busy == queue) {
+            iql_unlink(list, prev, queue);
+            return true;
+        }
+        prev = busy;
+    }
+    return false;
+}
+
+// see header
+void iqset_add(InQueueSet* set, InQueue* queue) {
+    queue->deficit = 0;
+    iql_push(&set->newQueues, queue);
+    set->numBusy++;
+}
+
+// see header
+void iqset_remove(InQueueSet* set, InQueue* queue) {
+    if (iql_remove(&set->newQueues, queue) ||
+            iql_remove(&set->oldQueues, queue)) {
+        set->numBusy--;
+    }
+}
+
+/* Marks a queue which was found empty as idle, unless its reader posted
+ * again in the meantime. Returns true if it is now idle.
+ */
+bool iqset_idle(InQueue* queue) {
+    __atomic_store_n(&queue->scheduled, 0, __ATOMIC_SEQ_CST);
+    if (ring_count(&queue->queue) == 0) {
+        return true;
+    }
+    // the reader may already have seen it idle and be posting a notice
+    return __atomic_exchange_n(&queue->scheduled, 1, __ATOMIC_SEQ_CST) != 0;
+}
+
+// see header
+int iqset_take(InQueueSet* set, void** items, int maxItems) {
+    int taken = 0;
+    while (taken < maxItems && set->numBusy > 0) {
+        InQueueList* list = set->newQueues.head != NULL ?
+                &set->newQueues : &set->oldQueues;
+        InQueue* queue = list->head;
+        if (queue->deficit == 0) {
+            queue->deficit = IN_QUANTUM; // a new turn
+        }
+        int wanted = queue->deficit < maxItems - taken ?
+                queue->deficit : maxItems - taken;
+        int got = ring_take(&queue->queue, items + taken, wanted);
+        taken += got;
+        queue->deficit -= got;
+        if (queue->peer != NULL) {
+            STATS_SET(queue->peer->inDepth, ring_count(&queue->queue));
+        }
+
+        if (got == wanted && queue->deficit > 0) {
+            continue; // the batch is full, the turn carries on next time
+        }
+        // the turn is over, either used up or because the queue is empty
+        queue->deficit = 0;
+        iql_unlink(list, NULL, queue);
+        if (got < wanted && iqset_idle(queue)) {
+            set->numBusy--;
+        } else {
+            iql_push(&set->oldQueues, queue);
+        }
+    }
+    return taken;
+}
@@ -0,0 +1,97 @@
+#ifndef INQUEUE_H
+#define INQUEUE_H
+
+#include <stdbool.h>
+
+#include "messages.h"
+#include "msgSlab.h"
+#include "ring.h"
+#include "stats.h"
+
+// default DEPOT_PEER_IN_MAX, messages one reader may have waiting for main
+#define IN_QUEUE_SIZE 64
+// messages one queue may have executed per turn of the round robin
+#define IN_QUANTUM 16
+
+/* Messages from one reader thread waiting to be executed by the main thread.
+ * Each reader posts into its own queue, so a peer sending faster than main
+ * executes only fills (and then blocks on) its own queue, rather than the
+ * incoming ring which every reader and the signal thread share.
+ *
+ * An idle queue is announced to main with a MSG_META_IN_READY posted to the
+ * incoming ring, after which main drains it with the other busy queues (see
+ * InQueueSet) until it is empty again. So the incoming ring only carries one
+ * notice per burst from a peer, and signals and connection changes posted
+ * there never wait behind a peer's messages.
+ */
+typedef struct InQueue {
+    Ring queue; // Message*'s in the order the reader posted them
+    // set by the reader when it posts a notice and cleared by main once the
+    // queue is empty, so at most one notice is on its way at a time
+    int scheduled;
+    PeerStats* peer; // BORROWED peer's stats or NULL, for the depth gauge
+
+    // main thread only
+    int deficit; // messages left in this queue's current turn
+    struct InQueue* next; // next in its InQueueList
+} InQueue;
+
+/* A list of busy queues, linked through InQueue.next.
+ */
+typedef struct InQueueList {
+    InQueue* head; // next queue to be served, NULL if empty
+    InQueue* tail;
+} InQueueList;
+
+/* The queues with messages waiting, drained by the main thread with deficit
+ * round robin. Each busy queue in turn may have up to IN_QUANTUM messages
+ * executed, so one peer's burst waits behind at most a quantum from every
+ * other busy peer. Messages all cost the same, so a turn cut short by the
+ * end of a batch carries its remaining deficit into the next batch.
+ *
+ * As in fq_codel, queues which have just become busy are served before
+ * the rest, for one turn. A peer sending a message now and then (such as
+ * a Transfer waiting on its reply) is then served in the next batch,
+ * while peers which keep their queues full share what is left.
+ */
+typedef struct InQueueSet {
+    InQueueList newQueues; // busy since their last turn, served first
+    InQueueList oldQueues; // still busy after a turn
+    int numBusy;
+} InQueueSet;
+
+/* Creates an empty queue holding at least capacity messages, whose depth is
+ * published to the given peer stats (which may be NULL). Returns a MALLOC'd
+ * queue, or NULL if its ring could not be created.
+ */
+InQueue* iq_create(int capacity, PeerStats* peer);
+
+/* Releases every message still in the queue and frees it. MUST only be
+ * called by main, once the reader has posted its last message and the
+ * queue is no longer in a set, or by a reader which never posted into it.
+ */
+void iq_destroy(InQueue* queue);
+
+/* Posts the given message to the queue, blocking while it is full. If the
+ * queue was idle, also posts a MSG_META_IN_READY taken from the given slab
+ * to incoming. MUST only be called by the queue's reader thread.
+ */
+void iq_post(InQueue* queue, Message* message, Ring* incoming,
+        MsgSlab* slab);
+
+/* Adds the queue named by a MSG_META_IN_READY to the set, to be served
+ * before the queues which have already had a turn.
+ */
+void iqset_add(InQueueSet* set, InQueue* queue);
+
+/* Removes the given queue from the set, if it is there.
+ */
+void iqset_remove(InQueueSet* set, InQueue* queue);
+
+/* Takes up to maxItems messages from the busy queues in deficit round robin
+ * order, storing them into items. Queues found empty leave the set. Returns
+ * the number of messages taken, 0 if no queue is busy.
+ */
+int iqset_take(InQueueSet* set, void** items, int maxItems);
+
+#endif
@@ -0,0 +1,128 @@
+#include <time.h>
+
+#include "latency.h"
+#include "messages.h"
+
+// histograms of every peer message type and stage, main thread only
+static LatHistogram latTable[NUM_MESSAGE_TYPES][LAT_NUM_STAGES];
+
+// names of each stage as dumped, indexed by LatStage
+static char* const stageNames[LAT_NUM_STAGES] = {
+    [LAT_STAGE_PARSE] = "parse",
+    [LAT_STAGE_POST] = "post",
+    [LAT_STAGE_QUEUE] = "queue",
+    [LAT_STAGE_EXECUTE] = "execute",
+    [LAT_STAGE_TOTAL] = "total",
+};
+
+// stamps each stage starts and ends at, indexed by LatStage, where
+// LAT_NUM_STAMPS stands for when the message was executed
+static const LatStamp stageBounds[LAT_NUM_STAGES][2] = {
+    [LAT_STAGE_PARSE] = {LAT_READ, LAT_RECEIVED},
+    [LAT_STAGE_POST] = {LAT_RECEIVED, LAT_POSTED},
+    [LAT_STAGE_QUEUE] = {LAT_POSTED, LAT_DEQUEUED},
+    [LAT_STAGE_EXECUTE] = {LAT_DEQUEUED, LAT_NUM_STAMPS},
+    [LAT_STAGE_TOTAL] = {LAT_READ, LAT_NUM_STAMPS},
+};
+
+// percentiles dumped for each histogram
+static const double dumpPercentiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// see header
+uint64_t lat_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // 0 means not stamped, so never return it
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec + 1;
+}
+
+// see header
+int lat_bucket(uint64_t value) {
+    if (value < (2 << LAT_SUB_BITS)) {
+        return (int)value; // small values have a bucket each
+    }
+    int shift = 63 - __builtin_clzll(value) - LAT_SUB_BITS;
+    int sub = (int)(value >> shift) & ((1 << LAT_SUB_BITS) - 1);
+    int bucket = ((shift + 1) << LAT_SUB_BITS) + sub;
+    return bucket < LAT_BUCKETS ? bucket : LAT_BUCKETS - 1;
+}
+
+// see header
+uint64_t lat_bucket_max(int bucket) {
+    if (bucket < (2 << LAT_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (bucket >> LAT_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1 << LAT_SUB_BITS) - 1);
+    return (((1 << LAT_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+// see header
+void lat_add(LatHistogram* histogram, uint64_t value) {
+    histogram->counts[lat_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+// see header
+uint64_t lat_percentile(LatHistogram* histogram, double fraction) {
+    // the rank of the value wanted, counting from 1
+    long rank = (long)(fraction * histogram->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    long seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            uint64_t value = lat_bucket_max(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max; // only if empty
+}
+
+// see header
+void lat_record(int type, uint64_t* stamps) {
+    if (type < 0 || type >= NUM_MESSAGE_TYPES) {
+        return;
+    }
+    uint64_t now = lat_now();
+    for (int stage = 0; stage < LAT_NUM_STAGES; stage++) {
+        uint64_t start = stamps[stageBounds[stage][0]];
+        LatStamp endStamp = stageBounds[stage][1];
+        uint64_t end = endStamp == LAT_NUM_STAMPS ? now : stamps[endStamp];
+        if (start != 0 && end >= start) {
+            lat_add(&latTable[type][stage], end - start);
+        }
+    }
+}
+
+// see header
+void lat_dump(FILE* file) {
+    fprintf(file, "latency in microseconds, by message type and stage:\n");
+    fprintf(file, "%-9s %-8s %9s %9s %9s %9s %9s %9s %9s\n", "type",
+            "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int type = 0; type < NUM_MESSAGE_TYPES; type++) {
+        for (int stage = 0; stage < LAT_NUM_STAGES; stage++) {
+            LatHistogram* histogram = &latTable[type][stage];
+            if (histogram->count == 0) {
+                continue;
+            }
+            fprintf(file, "%-9s %-8s %9ld %9.1f", msg_code(type),
+                    stageNames[stage], histogram->count,
+                    histogram->sum / 1000.0 / histogram->count);
+            int numPercentiles = sizeof(dumpPercentiles) /
+                    sizeof(dumpPercentiles[0]);
+            for (int i = 0; i < numPercentiles; i++) {
+                fprintf(file, " %9.1f", lat_percentile(histogram,
+                        dumpPercentiles[i]) / 1000.0);
+            }
+            fprintf(file, " %9.1f\n", histogram->max / 1000.0);
+        }
+    }
+    fflush(file);
+}
@@ -0,0 +1,120 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+/* Latency histograms of the depot's pipeline, per message type and stage.
+ * Only built with LATENCY=1 (make LATENCY=1, after a make clean), since
+ * every message then carries its timestamps and reads the clock several
+ * times. Otherwise messages have no timestamps and the macros below expand
+ * to nothing, so it costs nothing at all.
+ *
+ * Each peer message is stamped as it passes through the pipeline:
+ *   LAT_READ      the read() which returned the last of its bytes returned
+ *   LAT_RECEIVED  it was parsed into a view (msg_receive completing)
+ *   LAT_POSTED    it was copied into a Message and is about to be posted to
+ *                 its reader's InQueue (or the incoming ring)
+ *   LAT_DEQUEUED  main took it up to execute it
+ * and recorded once it has been executed. The event loop executes messages
+ * as soon as they are parsed, so its messages have no LAT_POSTED and skip
+ * the post and queue stages. A message blocked on a full InQueue counts
+ * that time in its queue stage, since it can't be stamped once posted
+ * without racing with main. Deliver and Withdraw sent straight to a shard
+ * (see shard.h) are never recorded.
+ *
+ * Histograms are written and dumped only by the main thread, so need no
+ * locking. Values are bucketed as in HdrHistogram: 8 buckets per power of
+ * two, so a percentile is at most 12.5% above the true value.
+ */
+
+// signal which dumps the histograms to stderr, or 0 if not built with them,
+// in which case SIGUSR1 stops the depot like any other signal but SIGHUP
+#ifdef LATENCY
+#define LAT_DUMP_SIGNAL SIGUSR1
+#else
+#define LAT_DUMP_SIGNAL 0
+#endif
+
+// log2 of the buckets per power of two
+#define LAT_SUB_BITS 3
+// buckets per histogram, enough for 2^42ns (about 73 minutes). anything
+// longer counts in the last one
+#define LAT_BUCKETS 320
+
+/* Times a message is stamped at, as indices into its latStamps.
+ */
+typedef enum LatStamp {
+    LAT_READ,
+    LAT_RECEIVED,
+    LAT_POSTED,
+    LAT_DEQUEUED,
+    LAT_NUM_STAMPS
+} LatStamp;
+
+/* Stages of the pipeline each histogram measures, between two stamps (or
+ * the end of execution).
+ */
+typedef enum LatStage {
+    LAT_STAGE_PARSE, // read to received
+    LAT_STAGE_POST, // received to posted
+    LAT_STAGE_QUEUE, // posted to dequeued
+    LAT_STAGE_EXECUTE, // dequeued to executed
+    LAT_STAGE_TOTAL, // read to executed
+    LAT_NUM_STAGES
+} LatStage;
+
+/* Durations in nanoseconds, bucketed logarithmically.
+ */
+typedef struct LatHistogram {
+    long counts[LAT_BUCKETS];
+    long count;
+    uint64_t sum;
+    uint64_t max;
+} LatHistogram;
+
+#ifdef LATENCY
+// stamps the given time of a message (or stamp array) as now
+#define LAT_STAMP(stamps, stamp) ((stamps)[stamp] = lat_now())
+// records a message of the given type, with the given stamps, as executed
+#define LAT_RECORD(type, stamps) lat_record((type), (stamps))
+#else
+#define LAT_STAMP(stamps, stamp) ((void)0)
+#define LAT_RECORD(type, stamps) ((void)0)
+#endif
+
+/* Returns the current CLOCK_MONOTONIC time in nanoseconds, never 0.
+ */
+uint64_t lat_now(void);
+
+/* Returns the bucket a duration of the given nanoseconds is counted in.
+ */
+int lat_bucket(uint64_t value);
+
+/* Returns the largest duration counted in the given bucket.
+ */
+uint64_t lat_bucket_max(int bucket);
+
+/* Counts a duration of the given nanoseconds into the histogram.
+ */
+void lat_add(LatHistogram* histogram, uint64_t value);
+
+/* Returns the duration which the given fraction (0 to 1) of the histogram's
+ * values are at or below, to within a bucket. Returns 0 if it is empty.
+ */
+uint64_t lat_percentile(LatHistogram* histogram, double fraction);
+
+/* Records a peer message of the given type as executed now, counting each
+ * stage whose stamps were both taken. Types of meta messages are ignored.
+ * MUST only be called by the main thread.
+ */
+void lat_record(int type, uint64_t* stamps);
+
+/* Writes a table of every non-empty histogram's count, mean and percentiles
+ * (in microseconds) to the given file. MUST only be called by the main
+ * thread.
+ */
+void lat_dump(FILE* file);
+
+#endif
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "messages.h"
+#include "msgView.h"
+#include "network.h"
+#include "outQueue.h"
+#include "recvBuffer.h"
+#include "strBuffer.h"
+#include "util.h"
+
+// fake ports given in our IMs start here, outside the valid port range so
+// they can never clash with the depot's own port
+#define FAKE_PORT_BASE 70000
+// Transfers in flight are timed in this many slots, reused in turn
+#define LOAD_SLOTS 65536
+// distinct materials Deliver, Withdraw and Defer pick from
+#define LOAD_MATERIALS 1000
+// defer keys of peer i are i * LOAD_KEY_STRIDE up to the next peer's
+#define LOAD_KEY_STRIDE 100000
+// most bytes queued for one peer before we stop generating for it
+#define LOAD_OUT_MAX (64 * 1024)
+// messages generated per peer per loop when the rate is unlimited
+#define LOAD_BURST 32
+// when the rate is unlimited, most Transfers each peer has in flight
+#define LOAD_WINDOW 16
+// longest wait for the depot to execute everything once sending stops
+#define LOAD_DRAIN_SECONDS 10.0
+// defaults for the options
+#define DEFAULT_PEERS 100
+#define DEFAULT_SECONDS 5
+#define DEFAULT_MIX "deliver=40,withdraw=20,transfer=20,defer=15,execute=5"
+
+/* Load generator for a running depot. Connects as many simulated depots,
+ * each completing the IM handshake, then has them send a random mix of
+ * Deliver, Withdraw, Transfer, Defer and Execute at a target total rate,
+ * spread round robin over the peers. Sockets are driven by one thread with
+ * epoll, queueing with OutQueue as the depot does, so a slow depot shows up
+ * as messages we fell behind on rather than as a stalled generator.
+ *
+ * Every Transfer sends material lat<slot> to a random simulated peer, and
+ * the time it was generated is kept in that slot. The depot executes it by
+ * delivering lat<slot> to that peer, which timestamps the Deliver on
+ * arrival, so the difference is the end-to-end latency of the Transfer,
+ * including every message queued ahead of it on its connection. Other
+ * message types have no reply, so are timed through the Transfers behind
+ * them.
+ *
+ * With no target rate, each peer keeps at most LOAD_WINDOW Transfers in
+ * flight, so the depot is kept busy without the socket buffers filling up
+ * and the latencies measuring nothing but our own backlog. A mix without
+ * Transfers is only limited by LOAD_OUT_MAX.
+ *
+ * Once the duration is up, each peer sends a final Transfer of material
+ * fence to itself. When every fence is back, the depot has executed
+ * everything, which gives the executed throughput.
+ *
+ * Prints one line of key=value results, as bench_conns does.
+ *
+ * Usage: load_gen [-c peers] [-r msgs/s] [-d seconds] [-m mix]
+ *                 [-H pid [-i hupMs]] port
+ *   -r 0 (the default) sends as fast as the depot takes messages. mix is a
+ *   comma separated list of type=weight, e.g. the default DEFAULT_MIX. With
+ *   -H, the depot with the given pid is sent SIGHUP every hupMs (default
+ *   1000) milliseconds, as stress.sh did.
+ */
+
+/* One simulated depot connected to the depot under test.
+ */
+typedef struct LoadPeer {
+    int index; // named load<index>
+    int fd;
+    RecvBuffer recv; // rb_destroy!
+    OutQueue out; // oq_destroy! generated messages not yet written
+    int deferGroup; // Defers go into this group until it is executed
+    int inFlight; // Transfers sent which haven't come back yet
+    bool greeted; // the depot's IM has arrived
+    bool fenced; // the final fence has come back
+} LoadPeer;
+
+/* Options and running state of the generator.
+ */
+typedef struct LoadGen {
+    char* port; // BORROWED from argv
+    int numPeers;
+    double rate; // messages per second over all peers, 0 for unlimited
+    double seconds;
+    int weights[NUM_MESSAGE_TYPES]; // of each type in the mix
+    int totalWeight;
+    int hupPid; // sent SIGHUP every hupMs if non-zero
+    int hupMs;
+
+    LoadPeer* peers; // MALLOC! numPeers peers
+    int epollFd;
+    unsigned int seed;
+    StrBuffer line; // sb_destroy! scratch space for one message
+
+    double* sendTimes; // MALLOC! LOAD_SLOTS, generation time or 0 if free
+    int* senders; // MALLOC! LOAD_SLOTS, index of the peer which sent each
+    long nextSlot;
+    long overruns; // slots reused before their Deliver came back
+    double* latencies; // MALLOC! seconds, one per returned Transfer
+    long numLatencies;
+    long latencyCapacity;
+
+    long sent[NUM_MESSAGE_TYPES]; // messages generated by type
+    long totalSent;
+    long behind; // messages owed at the target rate but not generated
+} LoadGen;
+
+/* Returns the current monotonic time in seconds.
+ */
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* options {{{1 */
+
+/* Parses a mix like DEFAULT_MIX into the generator's weights. Returns false
+ * if a type is unknown or no weight is positive.
+ */
+bool parse_mix(LoadGen* gen, char* mix) {
+    char* copy = strdup(mix);
+    memset(gen->weights, 0, sizeof(gen->weights));
+    gen->totalWeight = 0;
+    bool valid = true;
+    for (char* item = strtok(copy, ","); item != NULL && valid;
+            item = strtok(NULL, ",")) {
+        char* tokens[2];
+        valid = tokenise(item, '=', tokens, 2) == 2 &&
+                parse_int(tokens[1]) >= 0;
+        int type = MSG_DELIVER;
+        while (valid && type <= MSG_EXECUTE &&
+                strcasecmp(tokens[0], msg_code(type)) != 0) {
+            type++;
+        }
+        if (valid && type <= MSG_EXECUTE) {
+            gen->weights[type] = parse_int(tokens[1]);
+            gen->totalWeight += gen->weights[type];
+        } else {
+            valid = false;
+        }
+    }
+    free(copy);
+    return valid && gen->totalWeight > 0;
+}
+
+/* Parses the command line into the generator's options. Returns false on a
+ * usage error.
+ */
+bool parse_options(LoadGen* gen, int argc, char** argv) {
+    gen->numPeers = DEFAULT_PEERS;
+    gen->seconds = DEFAULT_SECONDS;
+    gen->hupMs = 1000;
+    char* mix = DEFAULT_MIX;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:d:m:H:i:")) != -1) {
+        switch (opt) {
+            case 'c':
+                gen->numPeers = parse_int(optarg);
+                break;
+            case 'r':
+                gen->rate = parse_int(optarg);
+                break;
+            case 'd':
+                gen->seconds = parse_int(optarg);
+                break;
+            case 'm':
+                mix = optarg;
+                break;
+            case 'H':
+                gen->hupPid = parse_int(optarg);
+                break;
+            case 'i':
+                gen->hupMs = parse_int(optarg);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind != argc - 1 || gen->numPeers <= 0 || gen->rate < 0 ||
+            gen->seconds <= 0 || gen->hupPid < 0 || gen->hupMs <= 0 ||
+            !parse_mix(gen, mix)) {
+        return false;
+    }
+    gen->port = argv[optind];
+    return true;
+}
+
+/* connecting {{{1 */
+
+/* Connects peer i to the depot and sends its IM, then watches its socket.
+ * Returns false if it could not connect.
+ */
+bool connect_peer(LoadGen* gen, int i) {
+    LoadPeer* peer = &gen->peers[i];
+    peer->index = i;
+    rb_init(&peer->recv);
+    oq_init(&peer->out, LOAD_OUT_MAX * 2);
+    if (!start_active_socket(&peer->fd, gen->port)) {
+        peer->fd = -1;
+        return false;
+    }
+    char* im = asprintf("IM:%d:load%d\n", FAKE_PORT_BASE + i, i);
+    oq_append(&peer->out, im, strlen(im));
+    free(im);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = peer};
+    return epoll_ctl(gen->epollFd, EPOLL_CTL_ADD, peer->fd, &event) == 0;
+}
+
+/* Destroys every peer, closing its socket.
+ */
+void close_peers(LoadGen* gen) {
+    for (int i = 0; i < gen->numPeers; i++) {
+        LoadPeer* peer = &gen->peers[i];
+        if (peer->fd >= 0) {
+            close(peer->fd);
+        }
+        rb_destroy(&peer->recv);
+        oq_destroy(&peer->out);
+    }
+}
+
+/* generating {{{1 */
+
+/* Picks a message type at random according to the mix.
+ */
+MessageType pick_type(LoadGen* gen) {
+    int pick = rand_r(&gen->seed) % gen->totalWeight;
+    MessageType type = MSG_DELIVER;
+    while (pick >= gen->weights[type]) {
+        pick -= gen->weights[type];
+        type++;
+    }
+    return type;
+}
+
+/* Appends a Transfer of one lat<slot> from the given peer to a random peer
+ * into the scratch line, timing it from now.
+ */
+void build_transfer(LoadGen* gen, LoadPeer* peer, double now) {
+    int slot = gen->nextSlot++ % LOAD_SLOTS;
+    if (gen->sendTimes[slot] != 0) {
+        gen->overruns++; // that Transfer never came back in time
+        gen->peers[gen->senders[slot]].inFlight--;
+    }
+    gen->sendTimes[slot] = now;
+    gen->senders[slot] = peer->index;
+    peer->inFlight++;
+    int to = rand_r(&gen->seed) % gen->numPeers;
+    sb_append_str(&gen->line, "Transfer:1:lat");
+    sb_append_int(&gen->line, slot);
+    sb_append_str(&gen->line, ":load");
+    sb_append_int(&gen->line, to);
+}
+
+/* Generates one message from the mix and queues it on the given peer.
+ */
+void generate(LoadGen* gen, LoadPeer* peer, double now) {
+    MessageType type = pick_type(gen);
+    int key = peer->index * LOAD_KEY_STRIDE + peer->deferGroup;
+    StrBuffer* line = &gen->line;
+    sb_clear(line);
+    switch (type) {
+        case MSG_DEFER:
+            sb_append_str(line, "Defer:");
+            sb_append_int(line, key);
+            sb_append_str(line, ":Deliver:1:mat");
+            sb_append_int(line, rand_r(&gen->seed) % LOAD_MATERIALS);
+            break;
+        case MSG_EXECUTE:
+            sb_append_str(line, "Execute:");
+            sb_append_int(line, key);
+            peer->deferGroup = (peer->deferGroup + 1) % LOAD_KEY_STRIDE;
+            break;
+        case MSG_TRANSFER:
+            build_transfer(gen, peer, now);
+            break;
+        default: // Deliver or Withdraw
+            sb_append_str(line, msg_code(type));
+            sb_append_char(line, ':');
+            sb_append_int(line, 1 + rand_r(&gen->seed) % 10);
+            sb_append_str(line, ":mat");
+            sb_append_int(line, rand_r(&gen->seed) % LOAD_MATERIALS);
+    }
+    sb_append_char(line, '\n');
+    oq_append(&peer->out, line->data, line->len);
+    gen->sent[type]++;
+    gen->totalSent++;
+}
+
+/* Generates up to count messages round robin over the peers, starting after
+ * the peer *next, skipping peers with LOAD_OUT_MAX bytes already queued, or
+ * with a full window if the rate is unlimited. Returns the number generated.
+ */
+long generate_round(LoadGen* gen, int* next, long count, double now) {
+    long generated = 0;
+    int skipped = 0;
+    while (generated < count && skipped < gen->numPeers) {
+        LoadPeer* peer = &gen->peers[*next];
+        *next = (*next + 1) % gen->numPeers;
+        if (peer->out.queuedBytes >= LOAD_OUT_MAX ||
+                (gen->rate == 0 && peer->inFlight >= LOAD_WINDOW)) {
+            skipped++;
+            continue;
+        }
+        skipped = 0;
+        generate(gen, peer, now);
+        generated++;
+    }
+    return generated;
+}
+
+/* Writes as much of every peer's queue as its socket takes. Returns false
+ * if a socket broke.
+ */
+bool flush_peers(LoadGen* gen) {
+    for (int i = 0; i < gen->numPeers; i++) {
+        if (oq_flush(&gen->peers[i].out, gen->peers[i].fd) == FLUSH_ERROR) {
+            fprintf(stderr, "load_gen: peer %d's socket broke\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* receiving {{{1 */
+
+/* Records the latency of a returned Transfer, growing the array if needed.
+ */
+void add_latency(LoadGen* gen, double latency) {
+    if (gen->numLatencies == gen->latencyCapacity) {
+        gen->latencyCapacity = gen->latencyCapacity * 2 + 1024;
+        gen->latencies = realloc(gen->latencies,
+                gen->latencyCapacity * sizeof(double));
+    }
+    gen->latencies[gen->numLatencies++] = latency;
+}
+
+/* Handles one line the depot sent to the given peer at the given time.
+ */
+void handle_line(LoadGen* gen, LoadPeer* peer, char* line, int len,
+        double now) {
+    MessageView view;
+    if (mv_parse(line, len, &view) != MS_OK) {
+        return; // e.g. a binary encoding offer, which we ignore
+    }
+    if (view.type == MSG_IM) {
+        peer->greeted = true;
+    }
+    if (view.type != MSG_DELIVER) {
+        return;
+    }
+    StrView mat = view.matName;
+    if (mat.len > 3 && strncmp(mat.start, "lat", 3) == 0) {
+        int slot = 0;
+        for (int i = 3; i < mat.len; i++) {
+            slot = slot * 10 + mat.start[i] - '0';
+        }
+        if (slot < LOAD_SLOTS && gen->sendTimes[slot] != 0) {
+            add_latency(gen, now - gen->sendTimes[slot]);
+            gen->sendTimes[slot] = 0;
+            gen->peers[gen->senders[slot]].inFlight--;
+        }
+    } else if (sv_equals(mat, "fence")) {
+        peer->fenced = true;
+    }
+}
+
+/* Waits up to timeoutMs for the depot to send anything and handles every
+ * complete line received. Returns false if the depot closed a socket.
+ */
+bool poll_peers(LoadGen* gen, int timeoutMs) {
+    struct epoll_event events[64];
+    int numEvents = epoll_wait(gen->epollFd, events, 64, timeoutMs);
+    double now = now_seconds();
+    for (int i = 0; i < numEvents; i++) {
+        LoadPeer* peer = events[i].data.ptr;
+        if (rb_fill(&peer->recv, peer->fd) < 0) {
+            continue;
+        }
+        char* line;
+        int len;
+        while (rb_next_line(&peer->recv, &line, &len)) {
+            handle_line(gen, peer, line, len, now);
+        }
+        if (peer->recv.eof) {
+            fprintf(stderr, "load_gen: depot closed peer %d\n",
+                    peer->index);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Waits until every peer has the depot's IM, then a little longer so the
+ * depot has registered all of them before any Transfer names one.
+ */
+bool wait_greeted(LoadGen* gen) {
+    bool greeted = false;
+    while (!greeted) {
+        if (!flush_peers(gen) || !poll_peers(gen, 100)) {
+            return false;
+        }
+        greeted = true;
+        for (int i = 0; i < gen->numPeers; i++) {
+            greeted = greeted && gen->peers[i].greeted;
+        }
+    }
+    usleep(200000);
+    return true;
+}
+
+/* running {{{1 */
+
+/* Sends messages for the configured duration. Returns false if the depot
+ * went away.
+ */
+bool run_load(LoadGen* gen, double start) {
+    int next = 0;
+    double nextHup = start + gen->hupMs / 1000.0;
+    double now = start;
+    while (now < start + gen->seconds) {
+        long owed = gen->rate > 0 ?
+                (long)((now - start) * gen->rate) - gen->totalSent -
+                gen->behind : (long)gen->numPeers * LOAD_BURST;
+        if (owed < 0) {
+            owed = 0;
+        }
+        long generated = generate_round(gen, &next, owed, now);
+        if (gen->rate > 0) {
+            gen->behind += owed - generated; // never caught up on
+        }
+        if (!flush_peers(gen) || !poll_peers(gen, generated < owed ||
+                gen->rate > 0 ? 1 : 0)) {
+            return false;
+        }
+        now = now_seconds();
+        if (gen->hupPid > 0 && now >= nextHup) {
+            kill(gen->hupPid, SIGHUP);
+            nextHup += gen->hupMs / 1000.0;
+        }
+    }
+    return true;
+}
+
+/* Sends each peer's fence and waits for all of them to come back, up to
+ * LOAD_DRAIN_SECONDS. Returns false if they didn't.
+ */
+bool drain(LoadGen* gen) {
+    for (int i = 0; i < gen->numPeers; i++) {
+        char* fence = asprintf("Transfer:1:fence:load%d\n", i);
+        oq_append(&gen->peers[i].out, fence, strlen(fence));
+        free(fence);
+    }
+    double giveUp = now_seconds() + LOAD_DRAIN_SECONDS;
+    int fenced = 0;
+    while (fenced < gen->numPeers && now_seconds() < giveUp) {
+        if (!flush_peers(gen) || !poll_peers(gen, 10)) {
+            return false;
+        }
+        fenced = 0;
+        for (int i = 0; i < gen->numPeers; i++) {
+            fenced += gen->peers[i].fenced;
+        }
+    }
+    return fenced == gen->numPeers;
+}
+
+/* Comparator of doubles for qsort.
+ */
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns the given percentile (0 to 100) of the sorted latencies, in
+ * microseconds, or 0 if there are none.
+ */
+double percentile_us(LoadGen* gen, double percent) {
+    if (gen->numLatencies == 0) {
+        return 0;
+    }
+    long index = (long)(percent / 100 * gen->numLatencies);
+    if (index >= gen->numLatencies) {
+        index = gen->numLatencies - 1;
+    }
+    return gen->latencies[index] * 1e6;
+}
+
+/* Prints the results of a run which sent for sendSeconds and had everything
+ * executed after doneSeconds.
+ */
+void print_results(LoadGen* gen, double sendSeconds, double doneSeconds) {
+    qsort(gen->latencies, gen->numLatencies, sizeof(double),
+            compare_doubles);
+    printf("peers=%d target_msgs/s=%.0f seconds=%.3f sent=%ld "
+            "sent_msgs/s=%.0f executed_msgs/s=%.0f behind=%ld",
+            gen->numPeers, gen->rate, sendSeconds, gen->totalSent,
+            gen->totalSent / sendSeconds, gen->totalSent / doneSeconds,
+            gen->behind);
+    for (int type = MSG_DELIVER; type <= MSG_EXECUTE; type++) {
+        printf(" %s=%ld", msg_code(type), gen->sent[type]);
+    }
+    printf(" timed=%ld overruns=%ld p50_us=%.0f p90_us=%.0f p99_us=%.0f "
+            "p999_us=%.0f max_us=%.0f\n", gen->numLatencies, gen->overruns,
+            percentile_us(gen, 50), percentile_us(gen, 90),
+            percentile_us(gen, 99), percentile_us(gen, 99.9),
+            percentile_us(gen, 100));
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    LoadGen gen = {0};
+    if (!parse_options(&gen, argc, argv)) {
+        fprintf(stderr, "Usage: load_gen [-c peers] [-r msgs/s] "
+                "[-d seconds] [-m mix] [-H pid [-i hupMs]] port\n");
+        return 1;
+    }
+    ignore_sigpipe();
+    gen.seed = getpid();
+    sb_init(&gen.line);
+    gen.sendTimes = calloc(LOAD_SLOTS, sizeof(double));
+    gen.senders = calloc(LOAD_SLOTS, sizeof(int));
+    gen.peers = calloc(gen.numPeers, sizeof(LoadPeer));
+    gen.epollFd = epoll_create1(0);
+
+    int status = 0;
+    for (int i = 0; i < gen.numPeers && status == 0; i++) {
+        if (!connect_peer(&gen, i)) {
+            fprintf(stderr, "load_gen: peer %d could not connect\n", i);
+            gen.numPeers = i + 1; // only these need closing
+            status = 2;
+        }
+    }
+    double start = 0;
+    double sent = 0;
+    if (status == 0 && !wait_greeted(&gen)) {
+        status = 3;
+    }
+    if (status == 0) {
+        start = now_seconds();
+        if (!run_load(&gen, start)) {
+            status = 3;
+        }
+        sent = now_seconds();
+    }
+    if (status == 0 && !drain(&gen)) {
+        fprintf(stderr, "load_gen: depot did not catch up\n");
+        status = 4;
+    }
+    if (status == 0) {
+        print_results(&gen, sent - start, now_seconds() - start);
+    }
+
+    close_peers(&gen);
+    close(gen.epollFd);
+    free(gen.peers);
+    free(gen.sendTimes);
+    free(gen.senders);
+    free(gen.latencies);
+    sb_destroy(&gen.line);
+    return status;
+}
@@ -6,46 +6,85 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <semaphore.h>
 #include <errno.h>
 #include <assert.h>
 
+#include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 
+#include "array.h"
+#include "capture.h"
 #include "exitCodes.h"
+#include "config.h"
 #include "connection.h"
 #include "material.h"
 #include "depotState.h"
 #include "messages.h"
 #include "network.h"
+#include "execute.h"
+#include "eventLoop.h"
+#include "flight.h"
+#include "inQueue.h"
+#include "latency.h"
+#include "ring.h"
+#include "recvBuffer.h"
+#include "msgView.h"
+#include "msgSlab.h"
+#include "shard.h"
+#include "stats.h"
+#include "wire.h"
 #include "util.h"
 
-#define BANNED_NAME_CHARS " \n\r:"
+// maximum number of incoming messages executed per wakeup of the main loop
+#define INCOMING_BATCH 64
 
 /* type declarations {{{1 */
 
 /* Main function performs basic checks and manages the DepotState.
- * Modifications on the DepotState are performed ONLY by the main thread,
- * messages are received via a single incoming message channel which is used
- * for regular depot messages, connection state changes and signals.
+ * Modifications on the DepotState are performed ONLY by the main thread.
+ * Each reader thread posts its peer's messages into its own InQueue, which
+ * main drains fairly with the other busy queues (see inQueue.h). A single
+ * incoming message channel carries connection state changes, signals and
+ * notices of queues becoming busy, and is always drained first.
  *
  * Threads are initialised for receiving signals and starting new connections.
  *
- * When a connection is connected, a reader_thread is started to send and 
- * receive IM messages. If successful, this sends a MSG_META_CONN_NEW down the
- * incoming channel and it starts processing messages from that socket.
- * Writing to sockets is done exclusively by the main thread.
+ * The server thread accepts connections, sends our IM on each and polls them
+ * all until the peer's IM arrives (or its deadline passes), so peers which
+ * never send one cost no thread. Then a reader_thread is started to verify
+ * the IM (connecting out, the reader thread does all of this itself). If
+ * successful, this sends a MSG_META_CONN_NEW down the incoming channel and it
+ * starts processing messages from that socket.
+ * Writing to sockets is done exclusively by the main thread. Messages are
+ * queued per connection while executing a batch, then flushed without
+ * blocking once the batch is done.
  *
  * In general, functions which take a DepotState parameter should ONLY be
  * called by the main thread.
+ *
+ * With DEPOT_SHARDS set, reader threads post Deliver and Withdraw messages
+ * straight to the shard owning the material instead, see shard.h.
+ *
+ * With DEPOT_EVENT_LOOP set, none of these threads are started. Instead the
+ * main thread runs an epoll event loop (see eventLoop.h) which does all of
+ * the above itself and executes messages as soon as they are parsed.
  */
 
-// struct for passing information into server_thread
+// struct for passing information into server_thread. also holds the
+// settings every reader thread is started with, see new_reader_data.
 typedef struct ServerData {
     int ourPort; // this depot's port
     char* ourName; // BORROWED this depot's name
     int fd; // file descriptor of the server
-    Channel* incoming; // BORROWED incoming message channel
+    Ring* incoming; // BORROWED incoming message channel
+    bool offerWire; // whether readers offer the binary encoding
+    ShardSet* shards; // BORROWED shards to route to, or NULL
+    DepotStats* stats; // BORROWED stats segment, or NULL
+    int connectTimeoutMs; // see DepotConfig
+    int handshakeTimeoutMs; // see DepotConfig
+    int peerInMax; // see DepotConfig
 } ServerData;
 
 // struct for passing data into reader_thread. this owns the FILE*'s but if
@@ -55,423 +94,520 @@ typedef struct ReaderData {
     int ourPort;
     char* ourName; // BORROW
 
-    FILE* readFile; // OWNED
+    int fd; // socket, owned by the files once they are opened
+    // port we are connecting out to, or 0 if the socket was accepted. if
+    // connecting or verifying fails, main is sent MSG_META_CONN_FAILED
+    int connectPort;
+    int connectTimeoutMs;
+    int handshakeTimeoutMs;
+    // when verifying is given up on, 0 for never. cleared once verified
+    double deadline;
+    bool timedOut; // whether the deadline passed while verifying
+    bool greeted; // whether our IM has been sent
+
+    FILE* readFile; // OWNED. the fd is read directly into recv
     FILE* writeFile; // OWNED
-    Channel* incoming; // BORROW
+    Ring* incoming; // BORROW
+    // queue our peer's messages are posted into, NULL until verified (or if
+    // it could not be created, when they go to incoming). belongs to main
+    // once our MSG_META_CONN_EOF is posted
+    InQueue* inQueue;
+    int inQueueSize;
+    ShardSet* shards; // BORROW, shards to route to or NULL if not sharded
+    sem_t executed; // posted by main once a fenced message is executed
+    DepotStats* stats; // BORROW, stats segment or NULL
+    PeerStats* peer; // BORROW, our peer's slot in stats or NULL
+    // our peer's port once verified. main destroys the connection if it
+    // rejects it, so this is kept rather than read from it
+    int peerPort;
+
+    bool offerWire; // whether to offer the binary encoding after our IM
+    RecvBuffer recv; // rb_destroy! bytes received but not yet parsed
+    WireDecoder wire; // wdec_destroy! how the peer is encoding messages
+#ifdef LATENCY
+    uint64_t lastRead; // when bytes were last read, see LAT_READ
+#endif
 } ReaderData;
 
-// see implementation
-void start_reader_thread(int port, char* name, Channel* incoming, int fd);
-// see implementaiton
-void execute_message(DepotState* depotState, Message* message);
-
-/* util methods {{{1 */
-
-/* Constructs and returns a set of signals which should be blocked and picked
- * up via sigwait. Contains at least SIGHUP.
- */
-sigset_t blocked_sigset(void) {
-    sigset_t sigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGHUP);
-    sigaddset(&sigset, SIGUSR1);
-    return sigset;
-}
+/* reader/writer threads {{{1 */
 
-/* Returns whether the given string is a valid depot or material name,
- * according to rules in spec.
+/* Waits for the reader's socket to become readable, returning false (and
+ * setting timedOut) if its deadline passes first. Returns true straight away
+ * if it has no deadline.
  */
-bool is_name_valid(char* name) {
-    int len = strlen(name);
-    char* banned = BANNED_NAME_CHARS;
-    for (int i = 0; i < len; i++) {
-        // check if any char in name appears in banned list.
-        if (strchr(banned, name[i]) != NULL) {
-            DEBUG_PRINTF("name invalid: |%s|\n", name);
+bool reader_wait(ReaderData* readerData) {
+    if (readerData->deadline == 0) {
+        return true;
+    }
+    struct pollfd readable = {.fd = readerData->fd, .events = POLLIN};
+    while (1) {
+        double remaining = readerData->deadline - monotonic_seconds();
+        if (remaining <= 0) {
+            readerData->timedOut = true;
             return false;
         }
+        if (poll(&readable, 1, (int)(remaining * 1000) + 1) > 0) {
+            return true;
+        }
     }
-    return len > 0; // ensure name non-empty
 }
 
-/* Returns whether the givne material is a valid message argument. 
- * That is, its name is valid and its quantity is strictly positive.
+/* Receives the next line or frame from the reader's socket into outView,
+ * reading more as needed. outView->type is MSG_NULL if it held no message,
+ * see wire_next_message. Returns false once the socket reaches EOF, or its
+ * deadline passes.
  */
-bool is_mat_valid(Material material) {
-    if (!is_name_valid(material.name)) {
-        DEBUG_PRINT("invalid mat name");
-        return false;
-    }
-    if (material.quantity <= 0) {
-        DEBUG_PRINT("invalid mat quantity");
-        return false;
+bool reader_next(ReaderData* readerData, MessageView* outView) {
+    int fd = fileno(readerData->readFile);
+    while (!wire_next_message(&readerData->recv, &readerData->wire,
+            readerData->offerWire, outView)) {
+        if (readerData->recv.eof || !reader_wait(readerData)) {
+            return false;
+        }
+        stats_bytes_in(readerData->stats, readerData->peer,
+                rb_fill(&readerData->recv, fd));
+#ifdef LATENCY
+        readerData->lastRead = lat_now();
+#endif
     }
     return true;
 }
 
-/* Returns true if a connection to the given port exists, false otherwise.
- * If the given port is this depot's port, returns true.
+/* Posts the given message from the reader to wherever it is executed. If
+ * sharded, Deliver, Withdraw and Batch go straight to their shards and
+ * Transfer and Execute are fenced, see shard.h. Everything else goes to main
+ * through our InQueue, whose notices are taken from the given slab.
  */
-bool is_port_connected(DepotState* depotState, int port) {
-    if (port == depotState->port) {
-        DEBUG_PRINT("rejecting connection to our own port");
-        return true;
-    }
-    bool portExists = false;
-    for (int i = 0; i < depotState->connections->numItems; i++) {
-        if (ARRAY_ITEM(Connection, depotState->connections, i)->port
-                == port) {
-            DEBUG_PRINT("active connection already exists");
-            portExists = true;
-            break;
-        }
-    }
-    for (int i = 0; i < depotState->pending->numItems; i++) {
-        if (*(int*)array_get_at(depotState->pending, i) == port) {
-            DEBUG_PRINT("unverified connection already exists");
-            portExists = true;
-            break;
+void reader_post(ReaderData* readerData, Message* message, MsgSlab* slab) {
+    ShardSet* shards = readerData->shards;
+    MessageType type = message->type;
+    if (shards != NULL && (type == MSG_DELIVER || type == MSG_WITHDRAW)) {
+        // shards trust their messages, so invalid ones are dropped here
+        if (message->data.material.quantity > 0 &&
+                is_name_valid(message->data.material.name)) {
+            shardset_post(shards, message);
+        } else {
+            DEBUG_PRINT("ignoring invalid material");
+            msg_release(message);
         }
-    }
-    return portExists;
-}
-
-/* execute methods {{{1 */
-/* execute normal messages {{{2 */
-
-/* The execute family of functions will each execute a particular message type,
- * given the depot state and message instance. Particular execute_ functions
- * should only by called with the correct tyle. execute_message and
- * execute_meta_message can be called with any message of normal / meta type
- * respectively. Because invalid messages are silently ignored, these functions
- * do not return anything.
- */
-
-// executes a Connect:port message
-void execute_connect(DepotState* depotState, Message* message) {
-    int portNum = message->data.depotPort;
-    if (is_port_connected(depotState, portNum)) {
-        DEBUG_PRINTF("connection exists to port %d\n", portNum);
         return;
     }
-
-    char* port = asprintf("%d", portNum);
-    DEBUG_PRINTF("trying to connect to port %s\n", port);
-    int fd;
-    bool started = start_active_socket(&fd, port);
-    free(port);
-
-    if (started) {
-        DEBUG_PRINT("connection established, verifying...");
-        array_add_copy(depotState->pending, &portNum, sizeof(int));
-        start_reader_thread(depotState->port, depotState->name, 
-                depotState->incoming, fd);
-    } else {
-        DEBUG_PRINT("failed to connect");
-    }
-}
-
-// executes a Deliver or Withdraw message
-void execute_deliver_withdraw(DepotState* depotState, Message* message) {
-    if (!is_mat_valid(message->data.material)) {
-        DEBUG_PRINT("ignoring invalid material");
+    if (shards != NULL && type == MSG_BATCH_OPS) {
+        shardset_post_batch(shards, message, slab);
         return;
     }
-
-    int delta = message->data.material.quantity;
-    if (message->type != MSG_DELIVER) {
-        delta = -delta; // negative change to represent withdraw
+    bool fenced = shards != NULL &&
+            (type == MSG_TRANSFER || type == MSG_EXECUTE);
+    if (fenced) {
+        message->executed = &readerData->executed;
     }
-    char* name = message->data.material.name;
-
-    ds_alter_mat(depotState, name, delta);
-}
-
-// executes a Transfer message. writes to a socket file!
-void execute_transfer(DepotState* depotState, Message* message) {
-    Material mat = message->data.material;
-    if (!is_mat_valid(mat)) {
-        DEBUG_PRINT("ignoring invalid material");
-        return;
+    // stamped before posting, as main may release it as soon as it's posted
+    LAT_STAMP(message->latStamps, LAT_POSTED);
+    // YIELD received message to channel
+    if (readerData->inQueue != NULL) {
+        iq_post(readerData->inQueue, message, readerData->incoming, slab);
+    } else {
+        ring_post(readerData->incoming, message);
     }
-
-    Connection* conn = arraymap_get(depotState->connections,
-            message->data.depotName);
-    if (conn == NULL) {
-        DEBUG_PRINTF("depot not found: %s\n", message->data.depotName);
-        return;
+    if (fenced) {
+        while (sem_wait(&readerData->executed) != 0 && errno == EINTR) {
+            // interrupted, wait again
+        }
     }
-
-    DEBUG_PRINTF("withdrawing, then delivering to %s\n", conn->name);
-    ds_alter_mat(depotState, mat.name, -mat.quantity);
-
-    Message msg = msg_deliver(mat.quantity, mat.name);
-    msg_send(conn->writeFile, msg); // send Deliver to given depot
-    msg_destroy(&msg);
-}
-
-// executes a Defer message. only deliver, withdraw and transfer messages can
-// be deferred
-void execute_defer(DepotState* depotState, Message* message) {
-    Message* deferMessage = message->data.deferMessage;
-
-    // restrict types of messages which can be deferred
-    MessageType deferType = deferMessage->type;
-    if (!(deferType == MSG_DELIVER || deferType == MSG_WITHDRAW ||
-            deferType == MSG_TRANSFER)) {
-        DEBUG_PRINT("unsupported deferred message type");
-        return; // silently ignore
-    }
-
-    DeferGroup* dg = ds_ensure_defer_group(depotState, message->data.deferKey);
-    dg_add_message(dg, message->data.deferMessage);
-    // deferMessage now owned by defer group. delete our reference.
-    message->data.deferMessage = NULL;
-    // we can destroy message now because the sub-message has been copied
-    // and its reference in *message is set to NULL.
 }
 
-// executes an Execute message
-void execute_execute(DepotState* depotState, Message* message) {
-    // admittedly not the best naming
-
-    DeferGroup* dg = arraymap_get(depotState->deferGroups, 
-            &message->data.deferKey);
-    if (dg == NULL) {
-        DEBUG_PRINT("defer key not found");
-        return;
-    }
-    DEBUG_PRINTF("executing defer group, key: %d\n", message->data.deferKey);
+/* Parses messages from the given conn (as a Connection*) and posts them,
+ * see reader_post. Returns on EOF of the socket.
+ */
+void reader_thread_loop(ReaderData* readerData, Connection* connection,
+        MsgSlab* slab) {
+    Connection* conn = connection;
+    DEBUG_PRINTF("reader loop started for %d:%s\n", conn->port, conn->name);
 
-    for (int i = 0; i < dg->messages->numItems; i++) {
-        DEBUG_PRINTF("executing deferred message %d\n", i);
-        Message* msg = ARRAY_ITEM(Message, dg->messages, i);
-        msg_debug(msg);
-        execute_message(depotState, msg); // recursion!
+    MessageView view;
+    while (reader_next(readerData, &view)) { // loop until EOF
+        stats_received(readerData->stats, readerData->peer, view.type);
+        fr_record_view(FR_RECEIVED, readerData->peerPort, &view);
+        if (view.type == MSG_NULL) {
+            continue; // invalid messages are ignored
+        }
+#ifdef LATENCY
+        uint64_t received = lat_now();
+#endif
+        // the message outlives the line, so is copied into our slab
+        Message* msgNew = msgslab_take_view(slab, &view);
+#ifdef LATENCY
+        msgNew->latStamps[LAT_READ] = readerData->lastRead;
+        msgNew->latStamps[LAT_RECEIVED] = received;
+#endif
+        msgNew->fromPort = readerData->peerPort;
+        if (view.type == MSG_META_WIRE_OFFER) {
+            msgNew->data.connection = conn; // main decides whether to switch
+        }
+        DEBUG_PRINTF("posting message: %p\n", (void*)msgNew);
+        reader_post(readerData, msgNew, slab);
     }
-
-    // frees messages and destroys messages array
-    dg_destroy(dg);
-
-    // remove defer group from array of defer groups
-    array_remove(depotState->deferGroups, dg);
-    // and free memory
-    free(dg);
+    DEBUG_PRINTF("reader reached EOF for %d:%s\n", conn->port, conn->name);
 }
 
-/* }}}2 */
-
-// executes an arbitrary normal message (those defined in spec)
-void execute_message(DepotState* depotState, Message* message) {
-    switch (message->type) {
-        case MSG_CONNECT:
-            execute_connect(depotState, message);
-            break;
-        case MSG_IM: // ignore improperly sequenced IM
-            DEBUG_PRINT("ignoring unexpected IM");
-            break;
-        case MSG_DELIVER:
-        case MSG_WITHDRAW:
-            execute_deliver_withdraw(depotState, message);
-            break;
-        case MSG_TRANSFER:
-            execute_transfer(depotState, message);
-            break;
-        case MSG_DEFER:
-            execute_defer(depotState, message);
-            break;
-        case MSG_EXECUTE:
-            execute_execute(depotState, message);
-            break;
-        default:
-            DEBUG_PRINT("invalid normal message type");
-            assert(0);
-    }
+/* Opens the reader's files on its connected socket and starts its
+ * handshake, which must be verified within its handshake timeout.
+ */
+void reader_open(ReaderData* readerData) {
+    // the socket is read directly, readFile is only kept to own the fd
+    readerData->readFile = fdopen(readerData->fd, "r");
+    readerData->writeFile = fdopen(dup(readerData->fd), "w");
+    rb_init(&readerData->recv);
+    wdec_init(&readerData->wire);
+    int timeoutMs = readerData->handshakeTimeoutMs;
+    readerData->deadline = timeoutMs > 0 ?
+            monotonic_seconds() + timeoutMs / 1000.0 : 0;
+    readerData->timedOut = false;
+    readerData->greeted = false;
+    stats_handshake_start(readerData->stats);
 }
 
-// executes a single METE message. these messages affect the state of
-// connections / signals of the depot, not the actual materials
-void execute_meta_message(DepotState* depotState, Message* message) {
-    Connection* conn = message->data.connection;
-    int signal = message->data.signal;
-    switch (message->type) {
-        case MSG_META_SIGNAL:
-            DEBUG_PRINTF("received signal %d: %s\n", signal,
-                    strsignal(signal));
-            if (signal == SIGHUP) {
-                ds_print_info(depotState);
-            }
-            break;
-        case MSG_META_CONN_NEW:
-            DEBUG_PRINTF("new connection to %d:%s, %p\n", conn->port,
-                    conn->name, (void*)conn);
-            int* pendingPort = arraymap_get(depotState->pending, &conn->port);
-            if (pendingPort != NULL) {
-                DEBUG_PRINTF("connection verified on port %d\n", conn->port);
-                array_remove(depotState->pending, pendingPort);
-                free(pendingPort);
-            }
-            if (arraymap_get(depotState->connections, conn->name) != NULL ||
-                    is_port_connected(depotState, conn->port)) {
-                DEBUG_PRINT("connection to name or port exists, ignoring.");
-                break; // main thread will cleanup
-            }
-
-            DEBUG_PRINT("accepting new connection");
-            // YIELD connection to connections array
-            array_add(depotState->connections, conn);
-            arraymap_sort(depotState->connections);
-            message->data.connection = NULL; // don't destroy conn
-            // start reader thread to get incoming messages
-            //start_reader_thread(conn, depotState->incoming);
-            break;
-        case MSG_META_CONN_EOF:
-            DEBUG_PRINTF("conn %d:%s, %p LOST connection!\n", conn->port,
-                    conn->name, (void*)conn);
-            //array_remove(depotState->connections, conn);
-            // edit: as of 4.2, do not remove closed connections. keep FILES's
-            // open, will fail on writing.
-            message->data.connection = NULL; // don't destroy conn
-            break;
-        default:
-            DEBUG_PRINT("invalid meta message type");
-            assert(0);
-    }
+/* Closes a reader opened with reader_open which was never verified, counting
+ * its handshake as timed out or rejected.
+ */
+void reader_close(ReaderData* readerData) {
+    stats_handshake_end(readerData->stats, readerData->timedOut ?
+            HANDSHAKE_TIMED_OUT : HANDSHAKE_REJECTED);
+    rb_destroy(&readerData->recv);
+    wdec_destroy(&readerData->wire);
+    fclose(readerData->readFile);
+    fclose(readerData->writeFile);
 }
 
-/* reader/writer threads {{{1 */
-
-/* Parses messages from the given conn (as a Connection*) and writes the
- * messages into the given incoming Channel. Returns on EOF of read file.
+/* Sends our IM, and offer if enabled, on the reader's socket. Returns false
+ * if sending failed.
  */
-void reader_thread_loop(Connection* connection, Channel* incoming) {
-    Connection* conn = connection;
-    DEBUG_PRINTF("reader loop started for %d:%s\n", conn->port, conn->name);
-
-    MessageStatus status = MS_OK;
-    while (status != MS_EOF) { // loop until EOF
-        Message msg = {0};
-        status = msg_receive(conn->readFile, &msg);
-        if (status != MS_OK) {
-            DEBUG_PRINT("message invalid or eof, continuing");
-            continue;
-        }
-        // wrap received message in a heap-allocated struct
-        Message* msgNew = calloc(1, sizeof(Message));
-        *msgNew = msg;
-        DEBUG_PRINTF("posting to incoming channel: %p\n", (void*)msgNew);
-        // YIELD received message to channel
-        chan_post(incoming, msgNew);
-        DEBUG_PRINTF("message posted: %p\n", (void*)msgNew);
-    }
-    DEBUG_PRINTF("reader reached EOF for %d:%s\n", conn->port, conn->name);
+bool reader_greet(ReaderData* readerData) {
+    Message msg = msg_im(readerData->ourPort, readerData->ourName);
+    bool sent = msg_send(readerData->writeFile, msg) == MS_OK &&
+            (!readerData->offerWire ||
+            fprintf(readerData->writeFile, "%s\n", WIRE_OFFER) >= 0) &&
+            fflush(readerData->writeFile) == 0;
+    msg_destroy(&msg); // destroy the msg_im()
+    readerData->greeted = true;
+    return sent;
 }
 
-/* Verifies the connection by sending and receiving IM messages, using files
- * inside readerData. If successful, returns true and stores the received IM
- * into *outMessage, otherwise returns false.
+/* Verifies the connection by sending (unless already greeted) and receiving
+ * IM messages, using files inside readerData. If successful, returns true
+ * and stores the received IM into *outMessage, otherwise returns false.
+ * Anything received after the IM is left in readerData->recv.
  */
 bool verify_connection(ReaderData* readerData, Message* outMessage) {
-    Message msg = msg_im(readerData->ourPort, readerData->ourName);
-    if (msg_send(readerData->writeFile, msg) != MS_OK) {
+    if (!readerData->greeted && !reader_greet(readerData)) {
         DEBUG_PRINT("sending IM failed. closing");
-        msg_destroy(&msg);
         return false;
     }
-    msg_destroy(&msg); // destroy the msg_im()
-    if (msg_receive(readerData->readFile, &msg) != MS_OK ||
-            msg.type != MSG_IM || !is_name_valid(msg.data.depotName)) {
+
+    // unlike later messages, an invalid first line fails verification
+    MessageView view;
+    if (!reader_next(readerData, &view) || view.type != MSG_IM ||
+            !is_name_view_valid(view.depotName)) {
         DEBUG_PRINT("invalid IM or bad depot name. closing.");
-        msg_destroy(&msg);
         return false;
     }
-    *outMessage = msg;
+    mv_to_message(&view, outMessage);
+    readerData->deadline = 0;
+    stats_handshake_end(readerData->stats, HANDSHAKE_VERIFIED);
+    return true;
+}
+
+/* Connects the reader's socket out to its connectPort, giving up after its
+ * connect timeout. Returns false if it didn't connect.
+ */
+bool reader_connect(ReaderData* readerData) {
+    DEBUG_PRINTF("connecting to port %d\n", readerData->connectPort);
+    if (!start_connect(&readerData->fd, readerData->connectPort)) {
+        return false;
+    }
+    if (!wait_connect(readerData->fd, readerData->connectTimeoutMs)) {
+        close(readerData->fd);
+        return false;
+    }
     return true;
 }
 
+/* Tells main that connecting out to the reader's connectPort failed, so it
+ * is no longer pending. Does nothing for accepted sockets.
+ */
+void reader_post_failed(ReaderData* readerData) {
+    if (readerData->connectPort == 0) {
+        return;
+    }
+    Message* msg = calloc(1, sizeof(Message)); // freed by msg_release
+    msg->type = MSG_META_CONN_FAILED;
+    msg->data.depotPort = readerData->connectPort;
+    ring_post(readerData->incoming, msg);
+}
+
 /* Worker thread for establishing and maintaining communication with one
  * socket. Accepts argument of ReaderData* cast to void*, return value unused.
- * Verifies connection with IM, then sends MSG_META_CONN_NEW, then reads
- * incoming messages, then sends MSG_META_CONN_EOF. Returns when the connection
- * is closed.
+ * Connects and opens the reader first if connecting out, otherwise the
+ * server thread already has. Verifies connection with IM, then sends
+ * MSG_META_CONN_NEW, then reads incoming messages, then sends
+ * MSG_META_CONN_EOF. Returns when the connection is closed.
  */
 void* reader_thread(void* readerArg) {
     ReaderData readerData = *(ReaderData*)readerArg;
     free(readerArg);
-    DEBUG_PRINT("verifying connection");
     // prevents becoming a thread zombie. success is indicated to main via
-    // channel. on failure, thread ends silently.
+    // channel. on failure, thread ends, telling main only if we connected
+    // out.
     pthread_detach(pthread_self());
-
+    fr_thread_start("reader");
+    if (readerData.connectPort != 0) {
+        if (!reader_connect(&readerData)) {
+            DEBUG_PRINT("connect failed");
+            reader_post_failed(&readerData);
+            return NULL;
+        }
+        reader_open(&readerData);
+    }
+    DEBUG_PRINT("verifying connection");
     Message msg;
     if (!verify_connection(&readerData, &msg)) {
         DEBUG_PRINT("acknowledge failed");
-        fclose(readerData.readFile);
-        fclose(readerData.writeFile);
+        reader_close(&readerData);
+        reader_post_failed(&readerData);
         return NULL;
     }
+    sem_init(&readerData.executed, 0, 0);
     Connection* conn = calloc(1, sizeof(Connection));
     conn_init(conn, msg.data.depotPort, msg.data.depotName);
     conn_set_files(conn, readerData.readFile, readerData.writeFile);
+    conn->stats = stats_add_peer(readerData.stats, conn->port, conn->name);
+    readerData.peer = conn->stats;
+    readerData.peerPort = conn->port;
+    readerData.inQueue = iq_create(readerData.inQueueSize, conn->stats);
     DEBUG_PRINTF("acknowledged by %s on %d\n", conn->name, conn->port);
     msg_destroy(&msg); // copied into conneciton
+    char label[FR_LABEL_LEN];
+    snprintf(label, sizeof(label), "reader %d:%s", conn->port, conn->name);
+    fr_thread_label(label);
+
+    // every message this thread posts comes from its own slab
+    MsgSlab* slab = msgslab_create();
 
     // inform main of the new connection
-    msg = (Message) {0};
-    msg.type = MSG_META_CONN_NEW;
-    // YIELDS connection struct and contained files to main thread.
-    msg.data.connection = conn;
-    Message* msgNew = malloc(sizeof(Message));
-    *msgNew = msg;
-    chan_post(readerData.incoming, msgNew);
+    Message* msgNew = msgslab_take(slab);
+    msgNew->type = MSG_META_CONN_NEW;
+    // YIELDS connection struct and contained files to main thread, unless
+    // it is rejected. fenced so we know which before posting anything else
+    msgNew->data.connection = conn;
+    msgNew->executed = &readerData.executed;
+    ring_post(readerData.incoming, msgNew);
+    while (sem_wait(&readerData.executed) != 0 && errno == EINTR) {
+        // interrupted, wait again
+    }
+    if (conn->rejected) {
+        // main has forgotten conn, so no eof or anything else is posted
+        DEBUG_PRINT("rejected as a duplicate, closing");
+        rb_destroy(&readerData.recv);
+        wdec_destroy(&readerData.wire);
+        sem_destroy(&readerData.executed);
+        iq_destroy(readerData.inQueue); // never posted into
+        conn_destroy(conn);
+        free(conn);
+        msgslab_retire(slab);
+        return NULL;
+    }
 
     // loop and post incoming messages down channel
-    reader_thread_loop(conn, readerData.incoming);
-
-    // send meta eof message to managing thread.
-    msg.type = MSG_META_CONN_EOF; // keep msg.data.connection from previous msg
-    msgNew = malloc(sizeof(Message));
-    *msgNew = msg;
-    chan_post(readerData.incoming, msgNew);
+    reader_thread_loop(&readerData, conn, slab);
+    rb_destroy(&readerData.recv);
+    wdec_destroy(&readerData.wire);
+    sem_destroy(&readerData.executed);
+
+    // send meta eof message to managing thread, which executes whatever is
+    // left in our queue first. YIELDS the queue.
+    msgNew = msgslab_take(slab);
+    msgNew->type = MSG_META_CONN_EOF;
+    msgNew->data.connection = conn;
+    msgNew->data.inQueue = readerData.inQueue;
+    ring_post(readerData.incoming, msgNew);
+    msgslab_retire(slab); // freed once main has released our messages
     return NULL;
 }
 
-/* Starts a reader thread which communicates with the given fd.
- * Also takes port and name of THIS depot to send in IM message, and channel
- * to send MSG_META_CONN_NEW to.
+/* Returns MALLOC'd data for a reader which communicates with the given fd,
+ * or if connectPort is non-zero, with a new socket connected to that port.
+ * The port and name of THIS depot to send in IM message, channel to send
+ * MSG_META_CONN_NEW to, shards to route to (or NULL), stats to count into
+ * (or NULL), whether to offer the binary encoding, the timeouts and the
+ * InQueue size are copied from the given settings. The reader's files are
+ * not opened yet.
  */
-void start_reader_thread(int port, char* name, Channel* incoming, int fd) {
+ReaderData* new_reader_data(ServerData* settings, int fd, int connectPort) {
     ReaderData* readerData = malloc(sizeof(ReaderData));
-    readerData->ourPort = port;
-    readerData->ourName = name;
-    readerData->incoming = incoming;
-
-    int fdRead = fd;
-    int fdWrite = dup(fd);
-    readerData->readFile = fdopen(fdRead, "r");
-    readerData->writeFile = fdopen(fdWrite, "w");
+    readerData->ourPort = settings->ourPort;
+    readerData->ourName = settings->ourName;
+    readerData->incoming = settings->incoming;
+    readerData->shards = settings->shards;
+    readerData->stats = settings->stats;
+    readerData->peer = NULL; // until verified
+    readerData->peerPort = 0;
+    readerData->offerWire = settings->offerWire;
+    readerData->fd = fd;
+    readerData->connectPort = connectPort;
+    readerData->connectTimeoutMs = settings->connectTimeoutMs;
+    readerData->handshakeTimeoutMs = settings->handshakeTimeoutMs;
+    readerData->inQueue = NULL; // until verified
+    readerData->inQueueSize = settings->peerInMax;
+#ifdef LATENCY
+    readerData->lastRead = 0; // messages read with the IM aren't timed
+#endif
+    return readerData;
+}
 
+/* Starts a reader thread with the given reader data, which it takes
+ * ownership of.
+ */
+void start_reader_thread(ReaderData* readerData) {
     pthread_t readerThread;
     pthread_create(&readerThread, NULL, reader_thread, readerData);
 }
 
+/* Fills in the given server data with the depot's reader settings. The
+ * server's fd is left unset.
+ */
+void reader_settings(DepotState* depotState, ServerData* settings) {
+    settings->ourName = depotState->name;
+    settings->ourPort = depotState->port;
+    settings->incoming = depotState->incoming;
+    settings->offerWire = depotState->config.wire;
+    settings->shards = depotState->shards;
+    settings->stats = depotState->stats;
+    settings->connectTimeoutMs = depotState->config.connectTimeoutMs;
+    settings->handshakeTimeoutMs = depotState->config.handshakeTimeoutMs;
+    settings->peerInMax = depotState->config.peerInMax;
+}
+
+/* Implements DepotState.startConnect for the reader thread model by
+ * starting a reader thread which connects to the given port itself, so
+ * only that thread waits for the connect.
+ */
+void start_reader_connect(DepotState* depotState, int port) {
+    ServerData settings;
+    reader_settings(depotState, &settings);
+    start_reader_thread(new_reader_data(&settings, -1, port));
+}
+
 /* server / signal threads {{{1 */
 
-/* Thread which listens passively for incoming connections, starting a verify
- * thread for each new connection. Argument contains fd of listening socket,
- * port and name of this depot and incoming channel. Return value unused.
+/* Accepts the next connection waiting on the server's socket and greets it
+ * with our IM, adding its reader data to the given handshakes to be polled
+ * until the peer's IM arrives.
+ */
+void server_accept(ServerData* serverData, Array* handshakes) {
+    int fd = accept(serverData->fd, 0, 0);
+    if (fd < 0) {
+        DEBUG_PERROR("accept()");
+        return;
+    }
+    DEBUG_PRINT("server got new connection, verifying...");
+    ReaderData* readerData = new_reader_data(serverData, fd, 0);
+    reader_open(readerData);
+    if (!reader_greet(readerData)) {
+        DEBUG_PRINT("sending IM failed. closing");
+        reader_close(readerData);
+        free(readerData);
+        return;
+    }
+    array_add(handshakes, readerData);
+}
+
+/* Reads what has arrived on the socket of a peer being handshaken with.
+ * Returns true once its first line is complete or it has hung up, when a
+ * reader thread can verify it without waiting.
+ */
+bool server_read_handshake(ServerData* serverData, ReaderData* readerData) {
+    RecvBuffer* recv = &readerData->recv;
+    stats_bytes_in(serverData->stats, NULL, rb_fill(recv, readerData->fd));
+    // the IM is always a line, even when offering the binary encoding
+    return recv->eof || memchr(recv->data + recv->start, '\n',
+            recv->used - recv->start) != NULL;
+}
+
+/* Closes every handshake whose deadline has passed. Returns how long until
+ * the next deadline in milliseconds, for poll, or -1 if there is none.
+ */
+int server_expire_handshakes(Array* handshakes) {
+    int timeout = -1;
+    double now = monotonic_seconds();
+    // back to front, so removing one doesn't skip the next
+    for (int i = handshakes->numItems - 1; i >= 0; i--) {
+        ReaderData* readerData = ARRAY_ITEM(ReaderData, handshakes, i);
+        if (readerData->deadline == 0) {
+            continue;
+        }
+        if (now >= readerData->deadline) {
+            DEBUG_PRINTF("handshake on socket %d timed out\n",
+                    readerData->fd);
+            readerData->timedOut = true;
+            reader_close(readerData);
+            free(readerData);
+            array_remove_at(handshakes, i);
+            continue;
+        }
+        // rounded up, so we don't wake just before the deadline
+        int untilDeadline = (int)((readerData->deadline - now) * 1000) + 1;
+        if (timeout < 0 || untilDeadline < timeout) {
+            timeout = untilDeadline;
+        }
+    }
+    return timeout;
+}
+
+/* Thread which listens passively for incoming connections and handshakes
+ * with them, polling the listening socket and every handshake at once.
+ * Once a peer's IM arrives, starts a reader thread to verify it. Argument
+ * contains fd of listening socket and the settings for reader threads.
+ * Return value unused.
  */
 void* server_thread(void* serverArg) {
     ServerData serverData = *(ServerData*)serverArg;
     free(serverArg);
     DEBUG_PRINT("server thread started");
+    // reader data of peers we have greeted, in the same order as their
+    // entries in fds after the listening socket
+    Array handshakes;
+    array_init(&handshakes);
+    struct pollfd* fds = NULL;
+    int fdsAllocated = 0;
 
     while (1) {
-        // listen for connections
-        int fd = accept(serverData.fd, 0, 0);
-        DEBUG_PRINT("server got new connection, verifying...");
-        start_reader_thread(serverData.ourPort, serverData.ourName,
-                serverData.incoming, fd);
+        int timeout = server_expire_handshakes(&handshakes);
+        int numFds = handshakes.numItems + 1;
+        if (numFds > fdsAllocated) {
+            fdsAllocated = numFds * 2;
+            fds = realloc(fds, fdsAllocated * sizeof(struct pollfd));
+        }
+        fds[0].fd = serverData.fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < handshakes.numItems; i++) {
+            fds[i + 1].fd = ARRAY_ITEM(ReaderData, &handshakes, i)->fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, numFds, timeout) <= 0) {
+            continue; // a deadline passed
+        }
+        // back to front, so removing one doesn't move the rest
+        for (int i = handshakes.numItems - 1; i >= 0; i--) {
+            ReaderData* readerData = ARRAY_ITEM(ReaderData, &handshakes, i);
+            if (fds[i + 1].revents != 0 &&
+                    server_read_handshake(&serverData, readerData)) {
+                array_remove_at(&handshakes, i);
+                start_reader_thread(readerData);
+            }
+        }
+        if (fds[0].revents != 0) {
+            server_accept(&serverData, &handshakes);
+        }
     }
     assert(0);
 }
@@ -482,10 +618,8 @@ void* server_thread(void* serverArg) {
 pthread_t start_server_thread(DepotState* depotState, int fdServer) {
     // start server listener thread. data argument is allocated on stack!
     ServerData* serverData = malloc(sizeof(ServerData));
+    reader_settings(depotState, serverData);
     serverData->fd = fdServer;
-    serverData->ourName = depotState->name;
-    serverData->ourPort = depotState->port;
-    serverData->incoming = depotState->incoming;
 
     pthread_t serverThread;
     pthread_create(&serverThread, NULL, server_thread, serverData);
@@ -493,27 +627,117 @@ pthread_t start_server_thread(DepotState* depotState, int fdServer) {
 }
 
 /* Signal thread to wait for signals specified in blocked_sigset(). For each
- * signal received, sends a MSG_META_SIGNAL to the given incoming Channel*,
+ * signal received, sends a MSG_META_SIGNAL to the given incoming Ring*,
  * passed as the sole argument. Return value unused.
  */
 void* signal_thread(void* signalArg) {
-    Channel* incoming = signalArg;
+    Ring* incoming = signalArg;
     sigset_t sigset = blocked_sigset();
+    MsgSlab* slab = msgslab_create(); // lives until the process exits
+    fr_thread_start("signal");
 
     while (1) {
         int sig; // 'signal' is the name of a function
         sigwait(&sigset, &sig);
         DEBUG_PRINTF("signal %d: %s\n", sig, strsignal(sig));
-        Message* msg = calloc(1, sizeof(Message));
+        Message* msg = msgslab_take(slab);
         msg->type = MSG_META_SIGNAL;
         msg->data.signal = sig;
         // post to incoming messages channel
-        chan_post(incoming, msg);
+        ring_post(incoming, msg);
     }
 }
 
 /* main functions {{{1*/
 
+/* Runs the depot in event loop mode on the given listening socket. Returns
+ * when a signal which stops the depot is received, always returning
+ * D_NORMAL.
+ */
+DepotExitCode exec_event_loop(DepotState* depotState, int server) {
+    EventLoop eventLoop = {0};
+    if (!el_init(&eventLoop, depotState, server)) {
+        DEBUG_PRINT("failed to start event loop");
+        el_destroy(&eventLoop);
+        return D_NORMAL;
+    }
+    printf("%d\n", depotState->port); // print port once we can accept
+    fflush(stdout);
+
+    el_run(&eventLoop);
+    el_destroy(&eventLoop);
+    return D_NORMAL;
+}
+
+// see implementation
+bool execute_incoming(DepotState* depotState, Message* msg);
+
+/* Executes every message left in a reader's InQueue once the reader has hung
+ * up, so none are lost or overtaken by its MSG_META_CONN_EOF, then destroys
+ * the queue. Does nothing if queue is NULL.
+ */
+void close_in_queue(DepotState* depotState, InQueue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+    iqset_remove(&depotState->inQueues, queue);
+    void* rest[INCOMING_BATCH];
+    int count;
+    while ((count = ring_take(&queue->queue, rest, INCOMING_BATCH)) > 0) {
+        for (int i = 0; i < count; i++) {
+            execute_incoming(depotState, rest[i]);
+        }
+    }
+    iq_destroy(queue);
+}
+
+/* Executes one message from the incoming channel or an InQueue, then gives
+ * it back to its slab. Returns false if it was a signal to exit.
+ */
+bool execute_incoming(DepotState* depotState, Message* msg) {
+    bool running = true;
+    LAT_STAMP(msg->latStamps, LAT_DEQUEUED);
+    if (msg->type == MSG_META_SIGNAL && is_stop_signal(msg->data.signal)) {
+        running = false; // debug exit on other signals
+    } else if (msg->type == MSG_META_IN_READY) {
+        iqset_add(&depotState->inQueues, msg->data.inQueue);
+    } else if (msg->type == MSG_META_CONN_EOF) {
+        close_in_queue(depotState, msg->data.inQueue);
+        execute_meta_message(depotState, msg);
+    } else if (msg->type == MSG_META_CONN_NEW) {
+        execute_meta_message(depotState, msg);
+        // a rejected connection goes back to its reader, see reader_thread
+        msg->data.connection = NULL;
+    } else if (msg->type >= MSG_NULL) { // meta messages >= MSG_NULL
+        execute_meta_message(depotState, msg);
+    } else {
+        fr_record_message(FR_EXECUTE, msg->fromPort, msg);
+        cap_message(depotState->capture, msg->fromPort, msg);
+        execute_message(depotState, msg);
+        LAT_RECORD(msg->type, msg->latStamps);
+    }
+    if (msg->executed != NULL) {
+        sem_post(msg->executed); // the reader may carry on
+    }
+    msg_release(msg); // back to the reader's slab
+    return running;
+}
+
+/* Executes the given batch of messages in order. Once a signal to exit is
+ * executed, the rest are only released. Returns false if there was one.
+ */
+bool execute_batch(DepotState* depotState, void** batch, int count) {
+    bool running = true;
+    for (int i = 0; i < count; i++) {
+        if (running) {
+            running = execute_incoming(depotState, batch[i]);
+        } else {
+            msg_release(batch[i]); // discard the rest of the batch
+        }
+    }
+    return running;
+}
+
 /* Starts and runs the main loop of the depot. Starts server and signal threads
  * and processes all messages arriving on the depot state's incoming messages
  * channel. 
@@ -531,11 +755,23 @@ DepotExitCode exec_depot_loop(DepotState* depotState) {
     // start this server thing
     int server;
     int port;
-    if (!start_passive_socket(&server, &port)) {
+    if (!start_passive_socket(&server, &port,
+            depotState->config.connectionQueue)) {
         DEBUG_PRINT("failed to start passive socket");
         return D_NORMAL; // no special exit code
     }
     depotState->port = port; // store our port number
+    if (depotState->stats != NULL) {
+        STATS_SET(depotState->stats->port, port);
+    }
+    if (depotState->config.captureFile != NULL) {
+        ds_open_capture(depotState);
+    }
+
+    if (depotState->config.eventLoop) {
+        return exec_event_loop(depotState, server);
+    }
+    depotState->startConnect = start_reader_connect;
 
     // start thread to listen for signals
     pthread_t signalThread;
@@ -546,26 +782,38 @@ DepotExitCode exec_depot_loop(DepotState* depotState) {
     printf("%d\n", port); // IMPORTANT: print ports after threads started
     fflush(stdout);
 
-    // main loop of the depot. acts on incoming messages
-    bool breakMain = false;
-    while (!breakMain) {
-        Message* msg = chan_wait(depotState->incoming);
-        int numItems;
-        sem_getvalue(&depotState->incoming->numItems, &numItems);
-        DEBUG_PRINTF("received %s message, %d messages remain\n", 
-                msg_code(msg->type), numItems);
-        if (msg->type == MSG_META_SIGNAL && msg->data.signal != SIGHUP) {
-            breakMain = true; // debug exit on non-sighup messages
-        } else if (msg->type >= MSG_NULL) { // meta messages >= MSG_NULL
-            execute_meta_message(depotState, msg);
+    // main loop of the depot. each wakeup, acts on everything waiting on
+    // the incoming channel (up to INCOMING_BATCH), then on up to
+    // INCOMING_BATCH messages from peers' queues, shared out fairly.
+    bool running = true;
+    int flushTimeout = -1; // ms until flushing again, -1 if not needed
+    void* batch[INCOMING_BATCH];
+    while (running) {
+        int count;
+        if (depotState->inQueues.numBusy > 0) {
+            count = ring_take(depotState->incoming, batch, INCOMING_BATCH);
         } else {
-            execute_message(depotState, msg);
+            // if a peer was full, wake up in a while to retry writing to it,
+            // or when held Delivers are due
+            count = ring_wait_batch_timeout(depotState->incoming, batch,
+                    INCOMING_BATCH, flushTimeout);
         }
-        msg_destroy(msg);
-        free(msg);
+        DEBUG_PRINTF("received %d messages, %d messages remain\n", count,
+                ring_count(depotState->incoming));
+        running = execute_batch(depotState, batch, count);
+        if (running) {
+            count = iqset_take(&depotState->inQueues, batch, INCOMING_BATCH);
+            running = execute_batch(depotState, batch, count);
+        }
+        // write everything queued by this batch, one syscall per peer
+        flushTimeout = ds_flush_connections(depotState);
     }
     // WARNING: only works correctly when no connections are open
     DEBUG_PRINT("terminating program due to signal");
+    long slabHits, slabMisses;
+    msgslab_stats(&slabHits, &slabMisses);
+    DEBUG_PRINTF("message slabs: %ld hits, %ld misses\n", slabHits,
+            slabMisses);
     pthread_cancel(serverThread); // terminate and cleanup threads
     pthread_cancel(signalThread);
     pthread_join(serverThread, NULL);
@@ -585,23 +833,33 @@ DepotExitCode exec_main(int argc, char** argv, DepotState* depotState) {
     if (!is_name_valid(argv[1])) {
         return D_INVALID_NAME;
     }
-    ds_init(depotState, argv[1]); // depotState BORROWS argv[1]
+    DepotConfig config = {0};
+    config_load(&config);
+    // before ds_init, which may start threads
+    fr_init(config.flightEvents, config.flightFile);
+    ds_init(depotState, argv[1], &config); // depotState BORROWS argv[1]
     // first 2 args are program name and depot name. iterate in steps of 2
     for (int i = 2; i < argc; i += 2) {
         assert(i + 1 < argc);
-        char* matName = argv[i];
-        int quantity = parse_int(argv[i + 1]);
-
-        if (!is_name_valid(matName)) {
+        if (!is_name_valid(argv[i])) {
             return D_INVALID_NAME;
         }
-        if (quantity < 0) {
+        if (parse_int(argv[i + 1]) < 0) {
             DEBUG_PRINT("invalid quantity");
             return D_INVALID_QUANTITY;
         }
+    }
+
+    // a recovered depot already has its goods, and more
+    bool recovered = false;
+    if (config.walDir != NULL && !ds_open_wal(depotState, &recovered)) {
+        return D_WAL_FAILED;
+    }
+    for (int i = 2; i < argc && !recovered; i += 2) {
         // has side effect of summing repeated materials
-        ds_alter_mat(depotState, matName, +quantity);
+        ds_alter_mat(depotState, argv[i], +parse_int(argv[i + 1]));
     }
+    ds_commit(depotState);
 
     return exec_depot_loop(depotState);
 }
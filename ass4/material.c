@@ -9,6 +9,22 @@
 void mat_init(Material* material, int quantity, char* name) {
     material->quantity = quantity;
     material->name = strdup(name); // malloc's copy of name
+    material->id = SYM_NONE;
+}
+
+// see header
+void mat_init_id(Material* material, int quantity, SymId id) {
+    material->quantity = quantity;
+    material->name = sym_name(id);
+    material->id = id;
+}
+
+// see header
+SymId mat_intern(Material* material) {
+    if (material->id != SYM_NONE) {
+        return material->id;
+    }
+    return sym_intern_str(material->name);
 }
 
 // see header
@@ -16,6 +32,9 @@ void mat_destroy(Material* material) {
     if (material == NULL) {
         return;
     }
-    TRY_FREE(material->name);
+    if (material->id == SYM_NONE) {
+        TRY_FREE(material->name);
+    }
+    material->name = NULL;
+    material->id = SYM_NONE;
 }
-
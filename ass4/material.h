@@ -1,12 +1,19 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include "symbols.h"
+
 /* Material struct. Can also be used as a delta by specifying quantity as
  * a relative positive or negative value.
+ *
+ * A material in a MaterialTable (or made from one) has its name interned:
+ * id is set and name is the BORROWED interned name. Any other material, such
+ * as one just parsed from a message, has id SYM_NONE and a MALLOC'd name.
  */
 typedef struct Material {
     int quantity;
-    char* name; // MALLOC!
+    char* name; // MALLOC! unless id is set, then BORROWED, see symbols.h
+    SymId id; // interned id of name, or SYM_NONE if not interned
 } Material;
 
 /* Initialises a new material with the given quantity and material name.
@@ -14,7 +21,17 @@ typedef struct Material {
  */
 void mat_init(Material* material, int quantity, char* name);
 
-/* Destroys the material and frees its memory.
+/* Initialises a new material with the given quantity and interned name id.
+ * Nothing is allocated.
+ */
+void mat_init_id(Material* material, int quantity, SymId id);
+
+/* Returns the interned id of the material's name, interning it if it has
+ * not been already. The material itself is not changed.
+ */
+SymId mat_intern(Material* material);
+
+/* Destroys the material and frees its name, unless it is interned.
  */
 void mat_destroy(Material* material);
 
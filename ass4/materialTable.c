@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "materialTable.h"
+#include "arrayHelpers.h"
+#include "util.h"
+
+// see header
+void mt_init(MaterialTable* table) {
+    // a plain array, since lookups use the index and the reporter sorts
+    // the Goods listing itself
+    table->materials = calloc(1, sizeof(Array));
+    array_init(table->materials);
+
+    table->index = calloc(1, sizeof(HashMap));
+    hashmap_init(table->index, ah_mat_id_mapper, ah_symhash, ah_intcmp);
+}
+
+// see header
+void mt_destroy(MaterialTable* table) {
+    if (table == NULL) {
+        return;
+    }
+    hashmap_destroy(table->index);
+    TRY_FREE(table->index);
+
+    if (table->materials != NULL) {
+        DEBUG_PRINTF("at time of destroy, table had %d materials\n",
+                table->materials->numItems);
+        array_foreach(table->materials, ah_mat_destroy);
+        array_destroy_and_free(table->materials);
+    }
+    TRY_FREE(table->materials);
+}
+
+// see header
+Material* mt_get(MaterialTable* table, char* name) {
+    SymId id = sym_find(sv_from(name));
+    return id == SYM_NONE ? NULL : mt_get_id(table, id);
+}
+
+// see header
+Material* mt_get_id(MaterialTable* table, SymId id) {
+    return hashmap_get(table->index, &id);
+}
+
+// see header
+Material* mt_ensure(MaterialTable* table, char* name) {
+    return mt_ensure_view(table, sv_from(name));
+}
+
+// see header
+Material* mt_ensure_view(MaterialTable* table, StrView name) {
+    return mt_ensure_id(table, sym_intern(name));
+}
+
+// see header
+Material* mt_ensure_id(MaterialTable* table, SymId id) {
+    assert(id != SYM_NONE);
+    Material* mat = mt_get_id(table, id);
+    if (mat != NULL) {
+        return mat;
+    }
+    // material not in table. its name is already interned
+    Material newMat;
+    mat_init_id(&newMat, 0, id);
+    DEBUG_PRINTF("adding empty material: %s\n", newMat.name);
+    mat = array_add_copy(table->materials, &newMat, sizeof(Material));
+    hashmap_put(table->index, mat);
+    return mat;
+}
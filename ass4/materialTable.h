@@ -0,0 +1,57 @@
+#ifndef MATERIALTABLE_H
+#define MATERIALTABLE_H
+
+#include <stdbool.h>
+
+#include "array.h"
+#include "hashMap.h"
+#include "material.h"
+#include "strView.h"
+#include "symbols.h"
+
+/* State struct for a set of materials, keyed by interned name id. A name is
+ * only interned once its material is added to a table. Lookups go through a
+ * hash index of this table's ids, so the table stays as small as its own
+ * materials however many names the process has interned. The materials are
+ * also kept in an array, in the order they were added. Materials are never
+ * removed.
+ */
+typedef struct MaterialTable {
+    Array* materials; // array of MALLOC'd Material*, in the order added
+    HashMap* index; // the same Material*'s, keyed by interned name id
+} MaterialTable;
+
+/* Initialises an empty material table.
+ */
+void mt_init(MaterialTable* table);
+
+/* Destroys the material table, destroying and freeing every material.
+ */
+void mt_destroy(MaterialTable* table);
+
+/* Returns the material with the given name, or NULL if not present. Never
+ * interns the name.
+ */
+Material* mt_get(MaterialTable* table, char* name);
+
+/* Returns the material with the given interned name id, or NULL if not
+ * present.
+ */
+Material* mt_get_id(MaterialTable* table, SymId id);
+
+/* Returns the material with the given name, adding it with 0 quantity if
+ * not present.
+ */
+Material* mt_ensure(MaterialTable* table, char* name);
+
+/* As mt_ensure, but the name is given as a view. The name is interned, so
+ * is only copied the first time any table sees it.
+ */
+Material* mt_ensure_view(MaterialTable* table, StrView name);
+
+/* As mt_ensure, but the name is given by its interned id, which MUST NOT be
+ * SYM_NONE. Only allocates if the material has to be added.
+ */
+Material* mt_ensure_id(MaterialTable* table, SymId id);
+
+#endif
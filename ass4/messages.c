@@ -4,9 +4,10 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <errno.h>
-#include <ctype.h>
 
 #include "messages.h"
+#include "msgView.h"
+#include "msgSlab.h"
 #include "util.h"
 
 // message part separator
@@ -17,13 +18,22 @@ void msg_destroy(Message* message) {
     if (message == NULL) {
         return;
     }
+    // names stored inline belong to the slab slot, not the heap
+    if (message->inlineNames & MSG_INLINE_DEPOT) {
+        message->data.depotName = NULL;
+    }
+    if (message->inlineNames & MSG_INLINE_MAT) {
+        message->data.material.name = NULL;
+    }
+    message->inlineNames = 0;
     TRY_FREE(message->data.depotName);
 
     // free recursive defer message.
     msg_destroy(message->data.deferMessage);
     TRY_FREE(message->data.deferMessage);
+    TRY_FREE(message->data.batch); // names are in the same allocation
 
-    // Material struct is stored wholly inside Message, so no malloc here
+    // Material struct is stored wholly inside Message, so only its name
     mat_destroy(&message->data.material);
 
     conn_destroy(message->data.connection);
@@ -31,228 +41,45 @@ void msg_destroy(Message* message) {
 }
 
 // see header
-char* msg_code(MessageType type) {
-    char* msgCodes[NUM_MESSAGE_TYPES_ALL];
-    msgCodes[MSG_CONNECT] = "Connect";
-    msgCodes[MSG_IM] = "IM";
-    msgCodes[MSG_DELIVER] = "Deliver";
-    msgCodes[MSG_WITHDRAW] = "Withdraw";
-    msgCodes[MSG_TRANSFER] = "Transfer";
-    msgCodes[MSG_DEFER] = "Defer";
-    msgCodes[MSG_EXECUTE] = "Execute";
-
-    msgCodes[MSG_NULL] = "(null msg type)";
-    msgCodes[MSG_META_CONN_NEW] = "(meta conn new)";
-    msgCodes[MSG_META_CONN_EOF] = "(meta conn eof)";
-    msgCodes[MSG_META_SIGNAL] = "(meta signal)";
-
-    assert(0 <= type && type < NUM_MESSAGE_TYPES_ALL);
-    // this is safe because string literals have static lifetime
-    return msgCodes[type];
-}
-
-// The consume_ family of functions take arguments of a pointer to a pointer
-// to the start of the current payload. Each function will modify the value of
-// *start to point _after_ the part it consumes. They will store the parsed
-// object in the location of the second parameter.
-// They return a bool of true in success or false on failure.
-
-// consumes a single colon
-bool consume_colon(char** start) {
-    if (**start != COLON) {
-        DEBUG_PRINT("expected colon");
-        return false;
-    }
-    (*start)++; // advance one character
-    return true;
-}
-
-// consumes a non-negative integer
-bool consume_int(char** start, int* output) {
-    // we can't use parse_int because the number may not span the entire
-    // string.
-    char* end = NULL;
-
-    // ensures no leading whitespace and number is non-negative
-    if (!isdigit(**start)) {
-        DEBUG_PRINT("does not start with digit");
-        return false; // string does not start with digit
-    }
-    errno = 0;
-    int val = strtol(*start, &end, 10); // base 10
-    if (end == *start || errno != 0) {
-        DEBUG_PRINT("strtol error");
-        return false; // no digits were parsed or error occured.
-    }
-    // integer was valid
-    *start = end; // move start past the integer parsed.
-    *output = val;
-    return true;
-}
-
-// consumes a string until the next colon or end of the string. method is
-// sufficiently general to use parameter name outStr.
-// MALLOC's the string stored in outStr
-bool consume_str(char** start, char** output) {
-    int len; // length of the string to consume
-    
-    // search for colon in the string.
-    char* colon = strchr(*start, COLON);
-    if (colon == NULL) { // no colon, consume to end of string.
-        len = strlen(*start);
-    } else { // else, consume up to the colon.
-        len = colon - *start;
-    }
-
-    if (len == 0) { // empty strings are invalid.
-        DEBUG_PRINT("empty string");
-        return false;
-    }
-
-    // allocate space for a copy of the consumed string.
-    char* copy = calloc(len + 1, sizeof(char));
-    // copy exactly len bytes into the new string, and \0.
-    strncpy(copy, *start, len);
-    copy[len] = '\0'; // null terminate new string
-
-    *output = copy;
-    *start = *start + len; // move past this string.
-    return true;
-}
-
-// consumes a quantity:name pair representing a material.
-bool consume_material(char** start, Material* output) {
-    // note we do not use mat_init here because we directly write to 
-    // outMaterial.
-    return consume_int(start, &output->quantity) && 
-            consume_colon(start) &&
-            consume_str(start, &output->name);
-}
-
-// consumes an entire message. useful for recursive messages (Defer).
-// MALLOC's a message to store into *outMessage.
-bool consume_message(char** start, Message** output) {
-    // allocate on stack until we validate the message.
-    Message message;
-    MessageStatus status = msg_parse(*start, &message);
-    if (status != MS_OK) {
-        return false;
+void msg_release(Message* message) {
+    if (message == NULL) {
+        return;
     }
-
-    // if we get here, message was valid. store new message in heap.
-    Message* newMsg = malloc(sizeof(Message));
-    *newMsg = message;
-    // update the out param with the new message location
-    *output = newMsg;
-    *start = *start + strlen(*start); // entire string is consumed.
-    return true;
-}
-
-// consumes the eof, fails if *start is not pointing to \0.
-bool consume_eof(char** start) {
-    bool valid = **start == '\0';
-    if (!valid) {
-        DEBUG_PRINT("junk at end of message");
+    msg_destroy(message);
+    if (message->slab != NULL) {
+        msgslab_give(message);
+    } else {
+        free(message);
     }
-    return valid;
-}
-
-// the parse_ family of functions will parse the payload for particular
-// message types, storing them into the appropriate fields of the given data
-// struct.
-
-/* Parses a Connect message into the given data struct, returning true on
- * success.
- */
-bool parse_connect(char* payload, MessageData* data) {
-    char** start = &payload;
-    return consume_colon(start) && consume_int(start, &data->depotPort) &&
-            consume_eof(start);
-}
-
-/* Parses a IM message into the given data struct, returning true on
- * success.
- */
-bool parse_im(char* payload, MessageData* data) {
-    char** start = &payload;
-    return consume_colon(start) && 
-            consume_int(start, &data->depotPort) &&
-            consume_colon(start) && 
-            consume_str(start, &data->depotName) &&
-            consume_eof(start);
-}
-
-/* Parses a Deliver/Withdraw message into the given data struct, 
- * returning true on success.
- */
-bool parse_deliver_withdraw(char* payload, MessageData* data) {
-    char** start = &payload;
-    return consume_colon(start) && 
-            consume_material(start, &data->material) &&
-            consume_eof(start);
-}
-
-/* Parses a Transfer message into the given data struct, returning true on 
- * success.
- */
-bool parse_transfer(char* payload, MessageData* data) {
-    char** start = &payload;
-    return consume_colon(start) && 
-            consume_material(start, &data->material) &&
-            consume_colon(start) &&
-            consume_str(start, &data->depotName) &&
-            consume_eof(start);
-}
-
-/* Parses a Defer message into the given data struct, returning true on
- * success.
- */
-bool parse_defer(char* payload, MessageData* data) {
-    char** start = &payload;
-    DEBUG_PRINTF("parsing DEFER payload: %s\n", payload);
-    return consume_colon(start) &&
-            consume_int(start, &data->deferKey) &&
-            consume_colon(start) &&
-            consume_message(start, &data->deferMessage) &&
-            consume_eof(start);
 }
 
-/* Parses an Execute message into the given data struct, returning true on 
- * success.
- */
-bool parse_execute(char* payload, MessageData* data) {
-    char** start = &payload;
-    return consume_colon(start) && consume_int(start, &data->deferKey) &&
-            consume_eof(start);
-}
+// message codes, indexed by MessageType
+static char* const msgCodes[NUM_MESSAGE_TYPES_ALL] = {
+    [MSG_CONNECT] = "Connect",
+    [MSG_IM] = "IM",
+    [MSG_DELIVER] = "Deliver",
+    [MSG_WITHDRAW] = "Withdraw",
+    [MSG_TRANSFER] = "Transfer",
+    [MSG_DEFER] = "Defer",
+    [MSG_EXECUTE] = "Execute",
+    [MSG_BATCH_OPS] = "Batch",
+
+    [MSG_NULL] = "(null msg type)",
+    [MSG_META_CONN_NEW] = "(meta conn new)",
+    [MSG_META_CONN_EOF] = "(meta conn eof)",
+    [MSG_META_CONN_FAILED] = "(meta conn failed)",
+    [MSG_META_SIGNAL] = "(meta signal)",
+    [MSG_META_WIRE_OFFER] = "(meta wire offer)",
+    [MSG_META_IN_READY] = "(meta in ready)",
+    [MSG_META_SHARD_REPORT] = "(meta shard report)",
+    [MSG_META_SHARD_STOP] = "(meta shard stop)"
+};
 
 // see header
-bool msg_payload_decode(MessageType type, char* payload, MessageData* data) {
-    bool valid = false;
-    switch (type) {
-        case MSG_CONNECT:
-            valid = parse_connect(payload, data);
-            break;
-        case MSG_IM:
-            valid = parse_im(payload, data);
-            break;
-        case MSG_DELIVER:
-        case MSG_WITHDRAW:
-            valid = parse_deliver_withdraw(payload, data);
-            break;
-        case MSG_TRANSFER:
-            valid = parse_transfer(payload, data);
-            break;
-        case MSG_DEFER:
-            valid = parse_defer(payload, data);
-            break;
-        case MSG_EXECUTE:
-            valid = parse_execute(payload, data);
-            break;
-        default: // shouldn't reach this
-            assert(0);
-    }
-    return valid;
+char* msg_code(MessageType type) {
+    assert(0 <= type && type < NUM_MESSAGE_TYPES_ALL);
+    // this is safe because string literals have static lifetime
+    return msgCodes[type];
 }
 
 // see header
@@ -291,33 +118,11 @@ MessageStatus msg_parse(char* line, Message* outMessage) {
     message.type = MSG_NULL;
     *outMessage = message; // zero outMessage for safety
 
-    MessageType type = MSG_NULL;
-    char* payload = NULL;
-    for (int t = 0; t < NUM_MESSAGE_TYPES; t++) {
-        char* code = msg_code(t); // get string code expected for this type
-
-        // check prefix of line.
-        if (strncmp(line, code, strlen(code)) == 0) {
-            type = t;
-            // payload is everything after message code.
-            payload = line + strlen(code);
-            break;
-        }
-    }
-    if (type == MSG_NULL) {
-        DEBUG_PRINT("no matched code");
-        return MS_INVALID;
-    }
-
-    if (!msg_payload_decode(type, payload, &message.data)) {
-        DEBUG_PRINT("invalid payload");
-        // some incomplete data may be stored, free memory.
-        msg_destroy(&message);
+    MessageView view;
+    if (mv_parse(line, strlen(line), &view) != MS_OK) {
         return MS_INVALID;
     }
-
-    message.type = type; // type found
-    *outMessage = message; // store parsed message in out param
+    mv_to_message(&view, outMessage);
     return MS_OK;
 }
 
@@ -333,6 +138,57 @@ char* msg_encode(Message message) {
     return ret;
 }
 
+// see header
+void msg_encode_into(Message message, StrBuffer* buffer) {
+    MessageData* data = &message.data;
+    sb_append_str(buffer, msg_code(message.type));
+    sb_append_char(buffer, COLON);
+    switch (message.type) {
+        case MSG_CONNECT:
+            sb_append_int(buffer, data->depotPort);
+            break;
+        case MSG_IM:
+            sb_append_int(buffer, data->depotPort);
+            sb_append_char(buffer, COLON);
+            sb_append_str(buffer, data->depotName);
+            break;
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+        case MSG_TRANSFER:
+            sb_append_int(buffer, data->material.quantity);
+            sb_append_char(buffer, COLON);
+            sb_append_str(buffer, data->material.name);
+            if (message.type == MSG_TRANSFER) {
+                sb_append_char(buffer, COLON);
+                sb_append_str(buffer, data->depotName);
+            }
+            break;
+        case MSG_DEFER:
+            sb_append_int(buffer, data->deferKey);
+            sb_append_char(buffer, COLON);
+            // nested message goes straight into the same buffer
+            msg_encode_into(*data->deferMessage, buffer);
+            break;
+        case MSG_EXECUTE:
+            sb_append_int(buffer, data->deferKey);
+            break;
+        case MSG_BATCH_OPS:
+            sb_append_int(buffer, data->batch->numOps);
+            for (int i = 0; i < data->batch->numOps; i++) {
+                BatchOp* op = &data->batch->ops[i];
+                sb_append_char(buffer, COLON);
+                sb_append_str(buffer, msg_code(op->type));
+                sb_append_char(buffer, COLON);
+                sb_append_int(buffer, op->quantity);
+                sb_append_char(buffer, COLON);
+                sb_append_str(buffer, op->matName.start); // terminated
+            }
+            break;
+        default:
+            assert(0); // no message matched
+    }
+}
+
 // see header
 MessageStatus msg_receive(FILE* file, Message* outMessage) {
     char* line;
@@ -392,10 +248,9 @@ Message msg_im(int port, char* name) {
 }
 
 // see header
-Message msg_deliver(int quantity, char* name) {
+Message msg_deliver(int quantity, SymId matId) {
     Message msg = {0};
     msg.type = MSG_DELIVER;
-    msg.data.material.quantity = quantity;
-    msg.data.material.name = strdup(name);
+    mat_init_id(&msg.data.material, quantity, matId);
     return msg;
 }
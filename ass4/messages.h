@@ -3,15 +3,19 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <semaphore.h>
 
 #include "channel.h"
 #include "material.h"
 #include "connection.h"
+#include "latency.h"
+#include "strBuffer.h"
+#include "strView.h"
 
 // number of valid message types
-#define NUM_MESSAGE_TYPES 7
+#define NUM_MESSAGE_TYPES 8
 // number of all message types
-#define NUM_MESSAGE_TYPES_ALL 11
+#define NUM_MESSAGE_TYPES_ALL 17
 
 /* Possible message types we can receive and other special flags for
  * indicating specific state transitions
@@ -25,6 +29,8 @@ typedef enum MessageType {
     MSG_TRANSFER, 
     MSG_DEFER, 
     MSG_EXECUTE, 
+    // not in the spec. many Deliver and Withdraw operations in one message
+    MSG_BATCH_OPS,
     
     // past this are various meta messages
     
@@ -33,7 +39,18 @@ typedef enum MessageType {
     // write _to_ this connection.
     MSG_META_CONN_NEW, 
     MSG_META_CONN_EOF, // connection terminated
-    MSG_META_SIGNAL // signal received. data contains signal number
+    // connecting out to a port failed, timed out or was never verified.
+    // data.depotPort is the port, which is no longer pending
+    MSG_META_CONN_FAILED,
+    MSG_META_SIGNAL, // signal received. data contains signal number
+    // connection's peer offered the binary encoding. data contains the
+    // connection, which is NOT owned by the message.
+    MSG_META_WIRE_OFFER,
+    // a reader's idle InQueue has messages again. data.inQueue is the queue
+    MSG_META_IN_READY,
+    // posted to every shard to have it copy its materials, see shard.h
+    MSG_META_SHARD_REPORT,
+    MSG_META_SHARD_STOP // posted to a shard to end its thread
 } MessageType;
 
 /* Status which could occur when reading or writing messages.
@@ -44,6 +61,23 @@ typedef enum MessageStatus {
     MS_INVALID // message received was of an invalid format
 } MessageStatus;
 
+/* One operation of a Batch message, a Deliver or Withdraw.
+ */
+typedef struct BatchOp {
+    MessageType type; // MSG_DELIVER or MSG_WITHDRAW
+    int quantity;
+    StrView matName; // points into the Batch holding this op
+} BatchOp;
+
+/* The operations of a Batch message, in the order they are applied. Names
+ * are stored after the ops in the same allocation, so a Batch is freed with
+ * a single free.
+ */
+typedef struct Batch {
+    int numOps;
+    BatchOp ops[];
+} Batch;
+
 /* Possible extra data associated with a message, type depends on message type
  * Contains all fields always, but only the appropriate fields will be set
  * depending on message type.
@@ -56,20 +90,40 @@ typedef struct MessageData {
 
     int deferKey; // key for defer/execute
     struct Message* deferMessage; // MALLOC! submessage for deferred messages
+    Batch* batch; // MALLOC! operations of a Batch
     
     // meta message things
 
     // MALLOC! connection associated with new connection meta msg.
     Connection* connection;
     int signal; // signal received
+    // BORROWED queue the reader posts into, for MSG_META_IN_READY and
+    // MSG_META_CONN_EOF
+    struct InQueue* inQueue;
 } MessageData;
 
+// flags for Message.inlineNames
+#define MSG_INLINE_DEPOT 1 // data.depotName is not MALLOC'd
+#define MSG_INLINE_MAT 2 // data.material.name is not MALLOC'd
+
 /* A message which can be sent or received. Has the given type and data
  * depending on message type.
  */
 typedef struct Message {
     MessageType type;
     struct MessageData data; // data is undefined if type has no extra data!
+
+    // slab this message was taken from, or NULL if on the stack or malloc'd
+    struct MsgSlab* slab;
+    // MSG_INLINE_ flags of names stored in the slab rather than malloc'd
+    unsigned char inlineNames;
+    // if set, posted by the main thread once it has executed the message
+    sem_t* executed;
+    // port of the peer whose reader received the message, 0 if unknown
+    int fromPort;
+#ifdef LATENCY
+    uint64_t latStamps[LAT_NUM_STAMPS]; // 0 where not stamped, see latency.h
+#endif
 } Message;
 
 /* Returns the string message code associated with the given message type.
@@ -100,6 +154,9 @@ MessageStatus msg_receive(FILE* file, Message* outMessage);
 /* Parses the given message into outMessage. As above but input is taken from
  * given string instead of the file. Returns status of message parsing, MS_EOF 
  * will never be returned.
+ *
+ * This copies every name out of the line, see msgView.h to parse without
+ * allocating.
  */
 MessageStatus msg_parse(char* line, Message* outMessage);
 
@@ -108,11 +165,23 @@ MessageStatus msg_parse(char* line, Message* outMessage);
  */
 char* msg_encode(Message message);
 
+/* Encodes the given message as msg_encode would, appending the line (without
+ * a newline) to the given buffer. The whole line, including any deferred
+ * message, is written in one pass without intermediate strings, so this does
+ * not allocate unless the buffer has to grow.
+ */
+void msg_encode_into(Message message, StrBuffer* buffer);
+
 /* Destroys the given message, freeing its contained structures and setting
  * pointers to NULL.
  */
 void msg_destroy(Message* message);
 
+/* Destroys the given heap message as msg_destroy, then frees it, or gives it
+ * back to its slab if it was taken from one. Can be called from any thread.
+ */
+void msg_release(Message* message);
+
 
 ///* Initialises a new MessageFrom with the given port, name and message.
 // * Copies name into a new MALLOC'd string and takes ownership of the given
@@ -125,13 +194,6 @@ void msg_destroy(Message* message);
 // */
 //void msgfrom_destroy(MessageFrom* messageFrom);
 
-/* Decodes the given payload string into the given data struct, assuming
- * the message is of the given type.
- *
- * Returns true on success, false for any formatting errors.
- */
-bool msg_payload_decode(MessageType type, char* payload, MessageData* data);
-
 /* Encodes the data of the given message into a payload string, returning
  * the payload string. Message type and data are contained in the message
  * struct.
@@ -150,8 +212,9 @@ void msg_debug(Message* message);
  */
 Message msg_im(int port, char* name);
 
-/* Creates a new Deliver message for the given material, returning the message
+/* Creates a new Deliver message for the material with the given interned
+ * name id, returning the message. Nothing is allocated.
  */
-Message msg_deliver(int quantity, char* name);
+Message msg_deliver(int quantity, SymId matId);
 
 #endif
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "msgSlab.h"
+#include "util.h"
+
+// hit and miss counts of all slabs, added to in batches
+static long totalHits;
+static long totalMisses;
+
+// see header
+MsgSlab* msgslab_create(void) {
+    MsgSlab* slab = calloc(1, sizeof(MsgSlab));
+    assert(slab != NULL);
+    // slots are only touched once handed out, so an idle slab's pages are
+    // never actually backed by memory
+    slab->slots = calloc(SLAB_SIZE, sizeof(SlabSlot));
+    assert(slab->slots != NULL);
+    slab->refs = 1; // the owner
+    return slab;
+}
+
+/* Adds the slab's counts to the global totals and resets them.
+ */
+void msgslab_flush_stats(MsgSlab* slab) {
+    __atomic_add_fetch(&totalHits, slab->hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totalMisses, slab->misses, __ATOMIC_RELAXED);
+    slab->hits = 0;
+    slab->misses = 0;
+}
+
+/* Drops one reference to the slab, freeing it if that was the last.
+ */
+void msgslab_unref(MsgSlab* slab) {
+    if (__atomic_sub_fetch(&slab->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        DEBUG_PRINTF("freeing slab %p\n", (void*)slab);
+        free(slab->slots);
+        free(slab);
+    }
+}
+
+// see header
+void msgslab_retire(MsgSlab* slab) {
+    if (slab == NULL) {
+        return;
+    }
+    msgslab_flush_stats(slab);
+    msgslab_unref(slab);
+}
+
+// see header
+Message* msgslab_take(MsgSlab* slab) {
+    SlabSlot* slot = slab->freeList;
+    if (slot == NULL) {
+        // take everything given back so far in one go
+        slot = __atomic_exchange_n(&slab->returned, NULL, __ATOMIC_ACQUIRE);
+    }
+    if (slot == NULL && slab->numBumped < SLAB_SIZE) {
+        slot = &slab->slots[slab->numBumped++]; // next is already NULL
+    }
+    if (slot == NULL) {
+        slab->misses++;
+    } else {
+        slab->hits++;
+    }
+    if (slab->hits + slab->misses >= SLAB_STATS_EVERY) {
+        msgslab_flush_stats(slab);
+    }
+    if (slot == NULL) {
+        DEBUG_PRINT("slab exhausted, allocating message");
+        return calloc(1, sizeof(Message));
+    }
+    slab->freeList = slot->next;
+    __atomic_add_fetch(&slab->refs, 1, __ATOMIC_RELAXED);
+
+    memset(&slot->message, 0, sizeof(Message));
+    slot->message.slab = slab;
+    return &slot->message;
+}
+
+/* Returns a copy of the given name, stored in the inline buffer if it fits
+ * and the message has one. Otherwise it is MALLOC'd. If stored inline, flag
+ * is set in message->inlineNames.
+ */
+char* msgslab_name(Message* message, char* inlineBuffer, StrView name,
+        unsigned char flag) {
+    if (message->slab == NULL || name.len >= SLAB_NAME_INLINE) {
+        return sv_dup(name);
+    }
+    memcpy(inlineBuffer, name.start, name.len);
+    inlineBuffer[name.len] = '\0';
+    message->inlineNames |= flag;
+    return inlineBuffer;
+}
+
+// see header
+Message* msgslab_take_view(MsgSlab* slab, MessageView* view) {
+    Message* message = msgslab_take(slab);
+    SlabSlot* slot = (SlabSlot*)message; // only used if from the slab
+    MessageData* data = &message->data;
+
+    message->type = view->type;
+    data->depotPort = view->depotPort;
+    data->material.quantity = view->quantity;
+    data->deferKey = view->deferKey;
+    // unused views are zeroed, so have length 0
+    if (view->depotName.len > 0) {
+        data->depotName = msgslab_name(message, slot->depotName,
+                view->depotName, MSG_INLINE_DEPOT);
+    }
+    if (view->matName.len > 0) {
+        data->material.name = msgslab_name(message, slot->matName,
+                view->matName, MSG_INLINE_MAT);
+    }
+    if (view->type == MSG_DEFER) {
+        // deferred messages are kept by defer groups, so stay on the heap
+        MessageView inner;
+        mv_parse_deferred(view, &inner);
+        data->deferMessage = malloc(sizeof(Message));
+        mv_to_message(&inner, data->deferMessage);
+    }
+    if (view->type == MSG_BATCH_OPS) {
+        data->batch = mv_copy_batch(view); // one allocation for every op
+    }
+    return message;
+}
+
+// see header
+void msgslab_give(Message* message) {
+    MsgSlab* slab = message->slab;
+    SlabSlot* slot = (SlabSlot*)message;
+    slot->next = __atomic_load_n(&slab->returned, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slab->returned, &slot->next, slot,
+            true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // slot->next was updated to the current top, try again
+    }
+    msgslab_unref(slab);
+}
+
+// see header
+void msgslab_stats(long* hits, long* misses) {
+    *hits = __atomic_load_n(&totalHits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&totalMisses, __ATOMIC_RELAXED);
+}
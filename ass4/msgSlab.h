@@ -0,0 +1,84 @@
+#ifndef MSGSLAB_H
+#define MSGSLAB_H
+
+#include "messages.h"
+#include "msgView.h"
+#include "ring.h"
+
+// number of messages in one slab
+#define SLAB_SIZE 256
+// names shorter than this are stored inside the slab instead of malloc'd
+#define SLAB_NAME_INLINE 32
+// takes between adding a slab's hit and miss counts to the global totals
+#define SLAB_STATS_EVERY 1024
+
+/* One message in a slab, with space for its names alongside it.
+ */
+typedef struct SlabSlot {
+    Message message; // MUST be first, so a slot's Message* is the slot
+    struct SlabSlot* next; // next free slot while on a free list
+    char depotName[SLAB_NAME_INLINE];
+    char matName[SLAB_NAME_INLINE];
+} SlabSlot;
+
+/* A fixed pool of messages owned by one producer thread. Only the owner takes
+ * messages from the slab, but they are given back by whichever thread is
+ * done with them (usually the main thread, after executing them). Given back
+ * messages are pushed onto a lock-free stack, which the owner empties in one
+ * exchange when its own free list runs out, so no locks are taken either
+ * way.
+ *
+ * If the slab is exhausted, messages are calloc'd as before and counted as
+ * misses. Since messages can outlive the thread which made them, the slab is
+ * reference counted and freed by whoever drops the last reference.
+ */
+typedef struct MsgSlab {
+    SlabSlot* slots; // MALLOC! SLAB_SIZE slots, only the first numBumped used
+    int numBumped; // slots which have ever been handed out
+    SlabSlot* freeList; // owner only
+
+    // written by other threads
+    char padReturned[CACHE_LINE];
+    SlabSlot* returned; // stack of slots given back since the owner looked
+    int refs; // 1 for the owner until retired, plus 1 per slot taken
+    char padEnd[CACHE_LINE];
+
+    long hits; // owner only. takes served from the slab, since last flush
+    long misses; // owner only. takes which fell back to calloc
+} MsgSlab;
+
+/* Creates an empty slab owned by the calling thread. Returns a MALLOC'd slab
+ * which MUST be released with msgslab_retire, not freed.
+ */
+MsgSlab* msgslab_create(void);
+
+/* Drops the owner's reference to the slab. MUST be called by the owner once
+ * it will take no more messages. The slab is freed once every message taken
+ * from it has also been given back.
+ */
+void msgslab_retire(MsgSlab* slab);
+
+/* Takes a zeroed message from the slab, or calloc's one if the slab is
+ * exhausted. MUST only be called by the slab's owner. The message MUST be
+ * disposed of with msg_release.
+ */
+Message* msgslab_take(MsgSlab* slab);
+
+/* Takes a message as msgslab_take and fills it from the given successfully
+ * parsed view. Names which fit are copied into the slot itself instead of
+ * being malloc'd.
+ */
+Message* msgslab_take_view(MsgSlab* slab, MessageView* view);
+
+/* Gives a destroyed message back to the slab it was taken from. Can be
+ * called from any thread. Use msg_release rather than calling this directly.
+ */
+void msgslab_give(Message* message);
+
+/* Stores the total slab hits and misses of all slabs so far into the given
+ * locations. Counts are added to the totals in batches, so recent takes may
+ * not be included yet.
+ */
+void msgslab_stats(long* hits, long* misses);
+
+#endif
@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "msgView.h"
+#include "wire.h"
+#include "util.h"
+
+// message part separator
+#define COLON ':'
+
+/* Cursor over the unparsed remainder of a line. The mv_take_ functions
+ * below each consume one part of a message from the front of the cursor,
+ * returning false if that part is malformed.
+ */
+typedef struct LineCursor {
+    char* pos;
+    char* end;
+} LineCursor;
+
+// consumes a single colon
+bool mv_take_colon(LineCursor* cursor) {
+    if (cursor->pos == cursor->end || *cursor->pos != COLON) {
+        DEBUG_PRINT("expected colon");
+        return false;
+    }
+    cursor->pos++;
+    return true;
+}
+
+// consumes a non-empty run of decimal digits which fits in an int
+bool mv_take_int(LineCursor* cursor, int* output) {
+    char* start = cursor->pos;
+    int value = 0;
+    while (cursor->pos < cursor->end &&
+            '0' <= *cursor->pos && *cursor->pos <= '9') {
+        int digit = *cursor->pos - '0';
+        if (value > (INT_MAX - digit) / 10) {
+            DEBUG_PRINT("integer out of range");
+            return false;
+        }
+        value = value * 10 + digit;
+        cursor->pos++;
+    }
+    if (cursor->pos == start) {
+        DEBUG_PRINT("does not start with digit");
+        return false;
+    }
+    *output = value;
+    return true;
+}
+
+// consumes a non-empty string up to the next colon or the end of the line
+bool mv_take_str(LineCursor* cursor, StrView* output) {
+    char* colon = memchr(cursor->pos, COLON, cursor->end - cursor->pos);
+    char* end = colon == NULL ? cursor->end : colon;
+    if (end == cursor->pos) {
+        DEBUG_PRINT("empty string");
+        return false;
+    }
+    output->start = cursor->pos;
+    output->len = end - cursor->pos;
+    cursor->pos = end;
+    return true;
+}
+
+// consumes the rest of the line, which must be a valid message by itself
+bool mv_take_message(LineCursor* cursor, StrView* output) {
+    MessageView inner;
+    if (mv_parse(cursor->pos, cursor->end - cursor->pos, &inner) != MS_OK) {
+        return false;
+    }
+    output->start = cursor->pos;
+    output->len = cursor->end - cursor->pos;
+    cursor->pos = cursor->end;
+    return true;
+}
+
+// succeeds only if the whole line has been consumed
+bool mv_take_end(LineCursor* cursor) {
+    if (cursor->pos != cursor->end) {
+        DEBUG_PRINT("junk at end of message");
+        return false;
+    }
+    return true;
+}
+
+/* Identifies the message code of len characters at the start of a line,
+ * returning its type or MSG_NULL if it is not a known code. Codes are told
+ * apart by their first character and length, then checked in full.
+ */
+MessageType mv_code_type(char* code, int len) {
+    MessageType type = MSG_NULL;
+    switch (code[0]) {
+        case 'C':
+            type = MSG_CONNECT;
+            break;
+        case 'I':
+            type = MSG_IM;
+            break;
+        case 'D':
+            type = len == 5 ? MSG_DEFER : MSG_DELIVER;
+            break;
+        case 'W':
+            type = MSG_WITHDRAW;
+            break;
+        case 'T':
+            type = MSG_TRANSFER;
+            break;
+        case 'E':
+            type = MSG_EXECUTE;
+            break;
+        case 'B':
+            type = MSG_BATCH_OPS;
+            break;
+        default:
+            return MSG_NULL;
+    }
+    char* expected = msg_code(type);
+    if ((int)strlen(expected) != len || memcmp(code, expected, len) != 0) {
+        return MSG_NULL;
+    }
+    return type;
+}
+
+// consumes one operation of a Batch, a Deliver or Withdraw without its
+// newline
+bool mv_take_op(LineCursor* cursor, MessageView* output) {
+    MessageView op = {0};
+    char* colon = memchr(cursor->pos, COLON, cursor->end - cursor->pos);
+    if (colon == NULL || colon == cursor->pos) {
+        DEBUG_PRINT("no op code");
+        return false;
+    }
+    op.type = mv_code_type(cursor->pos, colon - cursor->pos);
+    if (op.type != MSG_DELIVER && op.type != MSG_WITHDRAW) {
+        DEBUG_PRINT("batch op is not Deliver or Withdraw");
+        return false;
+    }
+    cursor->pos = colon + 1;
+    if (!mv_take_int(cursor, &op.quantity) || !mv_take_colon(cursor) ||
+            !mv_take_str(cursor, &op.matName)) {
+        return false;
+    }
+    *output = op;
+    return true;
+}
+
+// consumes the rest of the line, which must be exactly count colon
+// separated Batch operations
+bool mv_take_ops(LineCursor* cursor, int count, StrView* output) {
+    char* start = cursor->pos;
+    MessageView op;
+    for (int i = 0; i < count; i++) {
+        if ((i > 0 && !mv_take_colon(cursor)) || !mv_take_op(cursor, &op)) {
+            return false;
+        }
+    }
+    if (!mv_take_end(cursor)) {
+        return false;
+    }
+    output->start = start;
+    output->len = cursor->pos - start;
+    return true;
+}
+
+// see header
+MessageStatus mv_parse(char* line, int len, MessageView* outView) {
+    MessageView view = {0};
+    view.type = MSG_NULL;
+    *outView = view; // zero outView for safety
+
+    // the code is everything before the first colon
+    char* colon = memchr(line, COLON, len);
+    if (colon == NULL || colon == line) {
+        DEBUG_PRINT("no matched code");
+        return MS_INVALID;
+    }
+    MessageType type = mv_code_type(line, colon - line);
+    LineCursor cursor = {colon + 1, line + len};
+    LineCursor* c = &cursor;
+
+    bool valid;
+    switch (type) {
+        case MSG_CONNECT:
+            valid = mv_take_int(c, &view.depotPort) && mv_take_end(c);
+            break;
+        case MSG_IM:
+            valid = mv_take_int(c, &view.depotPort) && mv_take_colon(c) &&
+                    mv_take_str(c, &view.depotName) && mv_take_end(c);
+            break;
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+            valid = mv_take_int(c, &view.quantity) && mv_take_colon(c) &&
+                    mv_take_str(c, &view.matName) && mv_take_end(c);
+            break;
+        case MSG_TRANSFER:
+            valid = mv_take_int(c, &view.quantity) && mv_take_colon(c) &&
+                    mv_take_str(c, &view.matName) && mv_take_colon(c) &&
+                    mv_take_str(c, &view.depotName) && mv_take_end(c);
+            break;
+        case MSG_DEFER:
+            valid = mv_take_int(c, &view.deferKey) && mv_take_colon(c) &&
+                    mv_take_message(c, &view.deferLine);
+            break;
+        case MSG_EXECUTE:
+            valid = mv_take_int(c, &view.deferKey) && mv_take_end(c);
+            break;
+        case MSG_BATCH_OPS:
+            valid = mv_take_int(c, &view.numOps) && view.numOps > 0 &&
+                    mv_take_colon(c) &&
+                    mv_take_ops(c, view.numOps, &view.batchOps);
+            break;
+        default:
+            DEBUG_PRINT("no matched code");
+            return MS_INVALID;
+    }
+    if (!valid) {
+        DEBUG_PRINT("invalid payload");
+        return MS_INVALID;
+    }
+    view.type = type;
+    *outView = view;
+    return MS_OK;
+}
+
+// see header
+void mv_parse_deferred(MessageView* view, MessageView* outInner) {
+    // already known to be valid when the outer view was parsed
+    if (view->deferWire != NULL) {
+        wdec_parse(view->deferWire, view->deferLine.start,
+                view->deferLine.len, outInner);
+    } else {
+        mv_parse(view->deferLine.start, view->deferLine.len, outInner);
+    }
+}
+
+// see header
+void mv_start_ops(MessageView* view, OpCursor* cursor) {
+    cursor->batch = view;
+    cursor->pos = view->batchOps.start;
+    cursor->left = view->numOps;
+}
+
+// see header
+bool mv_next_op(OpCursor* cursor, MessageView* outOp) {
+    if (cursor->left == 0) {
+        return false;
+    }
+    MessageView* batch = cursor->batch;
+    char* end = batch->batchOps.start + batch->batchOps.len;
+    // already known to be valid when the batch was parsed
+    if (batch->batchWire != NULL) {
+        wdec_parse_op(batch->batchWire, &cursor->pos, end, outOp);
+    } else {
+        LineCursor line = {cursor->pos, end};
+        mv_take_op(&line, outOp);
+        cursor->pos = line.pos < end ? line.pos + 1 : end; // past the colon
+    }
+    cursor->left--;
+    return true;
+}
+
+// see header
+Batch* mv_copy_batch(MessageView* view) {
+    // names go after the ops. in a line each name is followed by a colon or
+    // the end, so the ops' length is room for every name and terminator, but
+    // binary names come from the decoder so have to be measured first
+    size_t size = sizeof(Batch) + view->numOps * sizeof(BatchOp);
+    OpCursor cursor;
+    MessageView op;
+    if (view->batchWire == NULL) {
+        size += view->batchOps.len + 1;
+    } else {
+        mv_start_ops(view, &cursor);
+        while (mv_next_op(&cursor, &op)) {
+            size += op.matName.len + 1;
+        }
+    }
+
+    Batch* batch = malloc(size);
+    batch->numOps = 0;
+    char* names = (char*)&batch->ops[view->numOps];
+    mv_start_ops(view, &cursor);
+    while (mv_next_op(&cursor, &op)) {
+        // terminated, so names can also be used as char*'s
+        memcpy(names, op.matName.start, op.matName.len);
+        names[op.matName.len] = '\0';
+        BatchOp* copy = &batch->ops[batch->numOps++];
+        copy->type = op.type;
+        copy->quantity = op.quantity;
+        copy->matName = (StrView) {names, op.matName.len};
+        names += op.matName.len + 1;
+    }
+    return batch;
+}
+
+// see header
+void mv_to_message(MessageView* view, Message* outMessage) {
+    Message message = {0};
+    message.type = view->type;
+    MessageData* data = &message.data;
+    switch (view->type) {
+        case MSG_CONNECT:
+            data->depotPort = view->depotPort;
+            break;
+        case MSG_IM:
+            data->depotPort = view->depotPort;
+            data->depotName = sv_dup(view->depotName);
+            break;
+        case MSG_TRANSFER:
+            data->depotName = sv_dup(view->depotName);
+            // fall through
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+            data->material.quantity = view->quantity;
+            data->material.name = sv_dup(view->matName);
+            break;
+        case MSG_DEFER:
+            data->deferKey = view->deferKey;
+            MessageView inner;
+            mv_parse_deferred(view, &inner);
+            data->deferMessage = malloc(sizeof(Message));
+            mv_to_message(&inner, data->deferMessage);
+            break;
+        case MSG_EXECUTE:
+            data->deferKey = view->deferKey;
+            break;
+        case MSG_BATCH_OPS:
+            data->batch = mv_copy_batch(view);
+            break;
+        default:
+            break;
+    }
+    *outMessage = message;
+}
+
+// see header
+void mv_from_message(Message* message, MessageView* outView) {
+    MessageView view;
+    memset(&view, 0, sizeof(MessageView));
+    MessageData* data = &message->data;
+    view.type = message->type;
+    view.depotPort = data->depotPort;
+    view.quantity = data->material.quantity;
+    view.deferKey = data->deferKey;
+    // unset names stay empty views
+    if (data->depotName != NULL) {
+        view.depotName = sv_from(data->depotName);
+    }
+    if (data->material.name != NULL) {
+        view.matName = sv_from(data->material.name);
+    }
+    *outView = view;
+}
@@ -0,0 +1,86 @@
+#ifndef MSGVIEW_H
+#define MSGVIEW_H
+
+#include <stdbool.h>
+
+#include "messages.h"
+#include "strView.h"
+
+/* A parsed message which points into the line it was parsed from instead of
+ * copying anything out of it. Parsing into a view never allocates, so it is
+ * used for every received line; a Message is only built from it with
+ * mv_to_message when the message has to outlive its line.
+ *
+ * As with MessageData, only the fields for type are set.
+ */
+typedef struct MessageView {
+    MessageType type;
+
+    int depotPort; // Connect, IM
+    StrView depotName; // IM, Transfer
+
+    int quantity; // Deliver, Withdraw, Transfer
+    StrView matName; // Deliver, Withdraw, Transfer
+
+    int deferKey; // Defer, Execute
+    // Defer only. the deferred message, already checked to parse correctly.
+    StrView deferLine;
+    // Defer only. if not NULL, deferLine is a binary frame body to be
+    // decoded by this decoder (see wire.h) rather than a text line.
+    struct WireDecoder* deferWire;
+
+    // Batch only. its number of operations and the operations themselves,
+    // already checked to parse correctly, and as with deferWire, the decoder
+    // to decode them with if binary
+    int numOps;
+    StrView batchOps;
+    struct WireDecoder* batchWire;
+} MessageView;
+
+/* Cursor over the operations of a parsed Batch view, see mv_next_op.
+ */
+typedef struct OpCursor {
+    MessageView* batch; // BORROWED
+    char* pos; // start of the next op
+    int left; // ops not yet returned
+} OpCursor;
+
+/* Parses the given line of len characters, which need not be \0
+ * terminated, into outView. Returns MS_OK on success or MS_INVALID if the
+ * line is not a valid message. Views in outView point into line.
+ */
+MessageStatus mv_parse(char* line, int len, MessageView* outView);
+
+/* Parses the deferred message of the given successfully parsed Defer view
+ * into outInner, whichever encoding it is in.
+ */
+void mv_parse_deferred(MessageView* view, MessageView* outInner);
+
+/* Starts a cursor over the operations of the given successfully parsed
+ * Batch view.
+ */
+void mv_start_ops(MessageView* view, OpCursor* cursor);
+
+/* Parses the cursor's next operation into outOp, a Deliver or Withdraw view
+ * pointing into the batch. Returns false once every op has been returned.
+ */
+bool mv_next_op(OpCursor* cursor, MessageView* outOp);
+
+/* Copies the operations of the given successfully parsed Batch view into a
+ * MALLOC'd Batch, with its names, in one allocation.
+ */
+Batch* mv_copy_batch(MessageView* view);
+
+/* Builds a Message equivalent to the given successfully parsed view, copying
+ * names into MALLOC'd strings. This is the slow path used whenever a message
+ * must be kept beyond the lifetime of its line.
+ */
+void mv_to_message(MessageView* view, Message* outMessage);
+
+/* Builds a view of the given message, the reverse of mv_to_message. Views in
+ * outView point into the message's names. A Defer's deferred message is not
+ * included.
+ */
+void mv_from_message(Message* message, MessageView* outView);
+
+#endif
@@ -1,3 +1,9 @@
+#include <errno.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
 #include "network.h"
 #include "util.h"
 
@@ -41,7 +47,65 @@ bool start_active_socket(int* fdOut, char* port) {
 }
 
 // see header
-bool start_passive_socket(int* fdOut, int* portOut) {
+bool start_connect(int* fdOut, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        DEBUG_PERROR("socket()");
+        return false;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    // the address is always numeric, so getaddrinfo (which may block) isn't
+    // needed
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(struct sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr*)&address, sizeof(address)) != 0 &&
+            errno != EINPROGRESS) {
+        DEBUG_PERROR("connect()");
+        close(sock);
+        return false;
+    }
+    *fdOut = sock;
+    return true;
+}
+
+// see header
+int finish_connect(int fd) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+        return errno;
+    }
+    if (error == 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    return error;
+}
+
+// see header
+bool wait_connect(int fd, int timeoutMs) {
+    struct pollfd pollFd = {.fd = fd, .events = POLLOUT};
+    int ready;
+    do {
+        ready = poll(&pollFd, 1, timeoutMs > 0 ? timeoutMs : -1);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) {
+        DEBUG_PRINT("connect timed out");
+        return false;
+    }
+    errno = finish_connect(fd);
+    if (errno != 0) {
+        DEBUG_PERROR("connect()");
+        return false;
+    }
+    return true;
+}
+
+// see header
+bool start_passive_socket(int* fdOut, int* portOut, int backlog) {
     struct addrinfo* ai;
     int server;
     // init new socket()
@@ -66,7 +130,7 @@ bool start_passive_socket(int* fdOut, int* portOut) {
     DEBUG_PRINTF("bound to address %s port %d\n", inet_ntoa(ad.sin_addr),
             ntohs(ad.sin_port));
 
-    if (listen(server, CONNECTION_QUEUE) != 0) {
+    if (listen(server, backlog) != 0) {
         DEBUG_PERROR("listen()");
         return false;
     }
@@ -9,7 +9,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-// server listen queue length
+// default server listen queue length, see DEPOT_CONNECTION_QUEUE
 #define CONNECTION_QUEUE 32
 
 /* Creates a new TCP socket. Also retrives address info for localhost on the
@@ -25,11 +25,32 @@ bool new_socket(char* port, int* fdOut, struct addrinfo** aiOut);
  */
 bool start_active_socket(int* fdOut, char* port);
 
-/* Starts a new passive socket which will listen on an ephemeral port.
+/* Starts connecting a new socket to the given port on localhost without
+ * blocking, and without any name lookup. Stores the socket's fd into fdOut
+ * and returns true if the connect is in progress (or already done), in which
+ * case the fd becomes writable once it finishes, see finish_connect. Returns
+ * false if it failed straight away.
+ */
+bool start_connect(int* fdOut, int port);
+
+/* Finishes a connect started by start_connect once its fd is writable.
+ * Returns 0 and puts the socket back in blocking mode if it connected,
+ * otherwise returns the error it failed with.
+ */
+int finish_connect(int fd);
+
+/* Waits for a connect started by start_connect to finish, for at most
+ * timeoutMs milliseconds (forever if 0), then finishes it as
+ * finish_connect does. Returns true if it connected.
+ */
+bool wait_connect(int fd, int timeoutMs);
+
+/* Starts a new passive socket which will listen on an ephemeral port, with
+ * the given length of queue for connections not yet accepted.
  * If successful, returns true and stores socket's fd into fdOut and stores
  * port number (as int) into portOut.
  * Returns false on fail.
  */
-bool start_passive_socket(int* fdOut, int* portOut);
+bool start_passive_socket(int* fdOut, int* portOut, int backlog);
 
 #endif
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "outQueue.h"
+#include "util.h"
+
+// see header
+void oq_init(OutQueue* queue, long maxBytes) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->headOffset = 0;
+    queue->queuedBytes = 0;
+    queue->maxBytes = maxBytes;
+    queue->droppedMessages = 0;
+}
+
+/* Frees every chunk in the queue, leaving it empty.
+ */
+void oq_clear(OutQueue* queue) {
+    while (queue->head != NULL) {
+        OutChunk* next = queue->head->next;
+        free(queue->head);
+        queue->head = next;
+    }
+    queue->tail = NULL;
+    queue->headOffset = 0;
+    queue->queuedBytes = 0;
+}
+
+// see header
+void oq_destroy(OutQueue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+    oq_clear(queue);
+}
+
+// see header
+bool oq_pending(OutQueue* queue) {
+    return queue->queuedBytes > 0;
+}
+
+// see header
+bool oq_append(OutQueue* queue, char* data, int len) {
+    if (queue->queuedBytes + len > queue->maxBytes) {
+        DEBUG_PRINTF("outbound queue full, dropping %d bytes\n", len);
+        queue->droppedMessages++;
+        return false;
+    }
+    while (len > 0) {
+        if (queue->tail == NULL || queue->tail->used == OUT_CHUNK_SIZE) {
+            OutChunk* chunk = malloc(sizeof(OutChunk));
+            chunk->next = NULL;
+            chunk->used = 0;
+            if (queue->tail == NULL) {
+                queue->head = chunk;
+            } else {
+                queue->tail->next = chunk;
+            }
+            queue->tail = chunk;
+        }
+        int space = OUT_CHUNK_SIZE - queue->tail->used;
+        int copy = len < space ? len : space;
+        memcpy(queue->tail->data + queue->tail->used, data, copy);
+        queue->tail->used += copy;
+        queue->queuedBytes += copy;
+        data += copy;
+        len -= copy;
+    }
+    return true;
+}
+
+/* Removes the given number of written bytes from the front of the queue,
+ * freeing chunks which have been completely written.
+ */
+void oq_consume(OutQueue* queue, long written) {
+    queue->queuedBytes -= written;
+    while (written > 0) {
+        int left = queue->head->used - queue->headOffset;
+        if (written < left) {
+            queue->headOffset += written;
+            return;
+        }
+        written -= left;
+        OutChunk* next = queue->head->next;
+        free(queue->head);
+        queue->head = next;
+        queue->headOffset = 0;
+    }
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+}
+
+// see header
+FlushStatus oq_flush(OutQueue* queue, int fd) {
+    while (oq_pending(queue)) {
+        struct iovec iov[OUT_MAX_IOV];
+        int numIov = 0;
+        int offset = queue->headOffset;
+        for (OutChunk* chunk = queue->head; chunk != NULL &&
+                numIov < OUT_MAX_IOV; chunk = chunk->next) {
+            iov[numIov].iov_base = chunk->data + offset;
+            iov[numIov].iov_len = chunk->used - offset;
+            numIov++;
+            offset = 0;
+        }
+
+        // sendmsg is writev with flags. MSG_DONTWAIT makes only this call
+        // non-blocking, since the fd may be shared with a blocking reader.
+        struct msghdr header;
+        memset(&header, 0, sizeof(struct msghdr));
+        header.msg_iov = iov;
+        header.msg_iovlen = numIov;
+        ssize_t written = sendmsg(fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return FLUSH_PENDING;
+            }
+            DEBUG_PERROR("sendmsg()");
+            oq_clear(queue);
+            return FLUSH_ERROR;
+        }
+        oq_consume(queue, written);
+    }
+    return FLUSH_EMPTY;
+}
+
+// see header
+void oq_flush_to(OutQueue* queue, OutSink sink, void* sinkData) {
+    int offset = queue->headOffset;
+    for (OutChunk* chunk = queue->head; chunk != NULL; chunk = chunk->next) {
+        sink(sinkData, chunk->data + offset, chunk->used - offset);
+        offset = 0;
+    }
+    oq_clear(queue);
+}
@@ -0,0 +1,75 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <stdbool.h>
+
+// size of the data area of each chunk of an outbound queue
+#define OUT_CHUNK_SIZE 4096
+// maximum number of chunks written by one flush
+#define OUT_MAX_IOV 64
+
+/* Result of flushing an outbound queue.
+ */
+typedef enum FlushStatus {
+    FLUSH_EMPTY, // everything queued has been written
+    FLUSH_PENDING, // the socket is full, some bytes remain queued
+    FLUSH_ERROR // the socket is broken, queue has been discarded
+} FlushStatus;
+
+/* Takes len bytes of data written to something other than a socket, see
+ * oq_flush_to. Must take all of them.
+ */
+typedef void (*OutSink)(void* sinkData, char* data, int len);
+
+/* One fixed-size block of queued bytes.
+ */
+typedef struct OutChunk {
+    struct OutChunk* next;
+    int used; // bytes of data in use
+    char data[OUT_CHUNK_SIZE];
+} OutChunk;
+
+/* A FIFO of bytes waiting to be written to a socket, stored as a linked list
+ * of chunks so a flush can hand all of them to the kernel in one writev
+ * style call. Total size is capped so a peer which stops reading can't make
+ * us buffer without limit.
+ */
+typedef struct OutQueue {
+    OutChunk* head; // MALLOC! oldest chunk, written from headOffset
+    OutChunk* tail; // last chunk, appended to
+    int headOffset; // bytes of head already written
+    long queuedBytes; // bytes currently queued
+    long maxBytes; // cap on queuedBytes
+
+    long droppedMessages; // appends refused because of the cap
+} OutQueue;
+
+/* Initialises an empty outbound queue holding at most maxBytes bytes.
+ */
+void oq_init(OutQueue* queue, long maxBytes);
+
+/* Destroys the queue, discarding anything still queued.
+ */
+void oq_destroy(OutQueue* queue);
+
+/* Returns true if the queue has bytes waiting to be written.
+ */
+bool oq_pending(OutQueue* queue);
+
+/* Appends len bytes of data to the queue. If that would take the queue past
+ * its cap, nothing is appended and false is returned.
+ */
+bool oq_append(OutQueue* queue, char* data, int len);
+
+/* Writes as much of the queue as the socket fd will take without blocking,
+ * using a single scatter/gather send of up to OUT_MAX_IOV chunks at a time.
+ * On a socket error the queue is emptied and FLUSH_ERROR is returned.
+ */
+FlushStatus oq_flush(OutQueue* queue, int fd);
+
+/* Hands everything queued to the given sink, chunk by chunk and in order,
+ * with the given sinkData, leaving the queue empty.
+ */
+void oq_flush_to(OutQueue* queue, OutSink sink, void* sinkData);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <unistd.h>
+
+#include "recvBuffer.h"
+#include "util.h"
+
+// see header
+void rb_init(RecvBuffer* buffer) {
+    buffer->data = malloc(RECV_BUFFER * sizeof(char));
+    assert(buffer->data != NULL);
+    buffer->start = 0;
+    buffer->used = 0;
+    buffer->size = RECV_BUFFER;
+    buffer->eof = false;
+}
+
+// see header
+void rb_destroy(RecvBuffer* buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    TRY_FREE(buffer->data);
+}
+
+// see header
+int rb_fill(RecvBuffer* buffer, int fd) {
+    // move the partial line to the front, only when there's one to move
+    if (buffer->start > 0) {
+        buffer->used -= buffer->start;
+        memmove(buffer->data, buffer->data + buffer->start, buffer->used);
+        buffer->start = 0;
+    }
+    // keep one byte spare so a line at EOF can always be terminated
+    if (buffer->used >= buffer->size - 1) {
+        buffer->size *= 2;
+        buffer->data = realloc(buffer->data, buffer->size);
+        assert(buffer->data != NULL);
+    }
+    ssize_t got = read(fd, buffer->data + buffer->used,
+            buffer->size - 1 - buffer->used);
+    if (got < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return -1;
+    }
+    if (got <= 0) {
+        DEBUG_PRINT("read reached EOF");
+        buffer->eof = true;
+        return 0;
+    }
+    buffer->used += got;
+    return got;
+}
+
+// see header
+void rb_append(RecvBuffer* buffer, char* data, int len) {
+    if (buffer->start > 0) {
+        buffer->used -= buffer->start;
+        memmove(buffer->data, buffer->data + buffer->start, buffer->used);
+        buffer->start = 0;
+    }
+    // keeping the spare byte, as rb_fill does
+    while (buffer->used + len > buffer->size - 1) {
+        buffer->size *= 2;
+        buffer->data = realloc(buffer->data, buffer->size);
+        assert(buffer->data != NULL);
+    }
+    memcpy(buffer->data + buffer->used, data, len);
+    buffer->used += len;
+}
+
+// see header
+bool rb_next_line(RecvBuffer* buffer, char** line, int* len) {
+    while (buffer->start < buffer->used) {
+        char* start = buffer->data + buffer->start;
+        char* end = buffer->data + buffer->used;
+        char* newline = memchr(start, '\n', end - start);
+        if (newline == NULL) {
+            if (!buffer->eof) {
+                return false; // wait for the rest of this line
+            }
+            newline = end; // there is always a spare byte, see rb_fill
+        }
+        *newline = '\0';
+        buffer->start = newline + 1 - buffer->data;
+        if (buffer->start > buffer->used) {
+            buffer->start = buffer->used;
+        }
+        if (memchr(start, '\0', newline - start) != NULL) {
+            DEBUG_PRINT("discarding line containing \\0");
+            continue;
+        }
+        *line = start;
+        *len = newline - start;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+#ifndef RECVBUFFER_H
+#define RECVBUFFER_H
+
+#include <stdbool.h>
+
+// initial size of a receive buffer
+#define RECV_BUFFER 4096
+
+/* Bytes read from a socket which have not yet been split into lines. Lines
+ * are framed in place, so a complete line is handed out as a pointer into
+ * the buffer without copying it.
+ */
+typedef struct RecvBuffer {
+    char* data; // MALLOC! size bytes
+    int start; // offset of the first byte not yet framed into a line
+    int used; // offset just past the last byte read
+    int size;
+    bool eof; // the socket has reached EOF or failed
+} RecvBuffer;
+
+/* Initialises an empty receive buffer.
+ */
+void rb_init(RecvBuffer* buffer);
+
+/* Destroys the receive buffer, freeing its memory.
+ */
+void rb_destroy(RecvBuffer* buffer);
+
+/* Reads once from fd into the buffer, growing it if it is full of one
+ * partial line. Returns the number of bytes read, 0 if the socket is at EOF
+ * or failed (setting buffer->eof) or -1 if the read should be retried later
+ * (EINTR or EAGAIN). Lines previously returned by rb_next_line are
+ * invalidated.
+ */
+int rb_fill(RecvBuffer* buffer, int fd);
+
+/* Appends len bytes of data to the buffer as if read by rb_fill, growing it
+ * as needed. Lines previously returned by rb_next_line are invalidated.
+ */
+void rb_append(RecvBuffer* buffer, char* data, int len);
+
+/* Frames the next complete line out of the buffer, storing a pointer to it
+ * in *line and its length, excluding the newline, in *len. The newline is
+ * replaced with \0. At EOF, a trailing line without a newline is also
+ * returned as safe_read_line would. Like safe_read_line, lines containing \0
+ * are skipped. Returns false if there is no complete line.
+ */
+bool rb_next_line(RecvBuffer* buffer, char** line, int* len);
+
+#endif
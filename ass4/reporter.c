@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "reporter.h"
+#include "strBuffer.h"
+#include "util.h"
+
+// see header
+void report_free(Report* report) {
+    if (report == NULL) {
+        return;
+    }
+    TRY_FREE(report->goods);
+    TRY_FREE(report->neighbours);
+    mt_destroy(report->table);
+    TRY_FREE(report->table);
+    free(report);
+}
+
+/* Orders ReportEntry's by name, for qsort.
+ */
+int report_entry_cmp(const void* a, const void* b) {
+    return strcmp(((ReportEntry*)a)->name, ((ReportEntry*)b)->name);
+}
+
+/* Orders char*'s, for qsort.
+ */
+int report_name_cmp(const void* a, const void* b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+/* Formats the report into the buffer, in the SIGHUP format from the spec.
+ */
+void report_format(Report* report, StrBuffer* buffer) {
+    qsort(report->goods, report->numGoods, sizeof(ReportEntry),
+            report_entry_cmp);
+    qsort(report->neighbours, report->numNeighbours, sizeof(char*),
+            report_name_cmp);
+    sb_append_str(buffer, "Goods:\n");
+    for (int i = 0; i < report->numGoods; i++) {
+        sb_append_str(buffer, report->goods[i].name);
+        sb_append_char(buffer, ' ');
+        sb_append_int(buffer, report->goods[i].quantity);
+        sb_append_char(buffer, '\n');
+    }
+    sb_append_str(buffer, "Neighbours:\n");
+    for (int i = 0; i < report->numNeighbours; i++) {
+        sb_append_str(buffer, report->neighbours[i]);
+        sb_append_char(buffer, '\n');
+    }
+}
+
+/* Formats and writes the report to stdout, then frees it.
+ */
+void report_write(Report* report, StrBuffer* buffer) {
+    sb_clear(buffer);
+    report_format(report, buffer);
+    report_free(report);
+    // one write per report, however slow stdout is
+    fwrite(buffer->data, 1, buffer->len, stdout);
+    fflush(stdout);
+}
+
+/* Reporter thread, taking the Reporter* as its argument. Writes each posted
+ * report until a stop report is posted. Return value unused.
+ */
+void* reporter_thread(void* reporterArg) {
+    Reporter* reporter = reporterArg;
+    StrBuffer buffer;
+    sb_init(&buffer);
+    while (true) {
+        Report* report = ring_wait(&reporter->queue);
+        if (report->stop) {
+            report_free(report);
+            break;
+        }
+        report_write(report, &buffer);
+    }
+    sb_destroy(&buffer);
+    return NULL;
+}
+
+// see header
+bool reporter_init(Reporter* reporter) {
+    reporter->started = false;
+    if (!ring_init(&reporter->queue, REPORTER_QUEUE)) {
+        return false;
+    }
+    // may be started before main blocks signals, and never takes any
+    errno = start_quiet_thread(&reporter->thread, reporter_thread, reporter);
+    if (errno != 0) {
+        DEBUG_PERROR("pthread_create()");
+        ring_destroy(&reporter->queue);
+        return false;
+    }
+    reporter->started = true;
+    return true;
+}
+
+// see header
+void reporter_destroy(Reporter* reporter) {
+    if (reporter == NULL || !reporter->started) {
+        return;
+    }
+    Report* stop = calloc(1, sizeof(Report));
+    stop->stop = true;
+    ring_post(&reporter->queue, stop);
+    pthread_join(reporter->thread, NULL);
+    ring_destroy(&reporter->queue);
+    reporter->started = false;
+}
+
+// see header
+void reporter_post(Reporter* reporter, Report* report) {
+    if (reporter->started) {
+        ring_post(&reporter->queue, report);
+        return;
+    }
+    StrBuffer buffer;
+    sb_init(&buffer);
+    report_write(report, &buffer);
+    sb_destroy(&buffer);
+}
@@ -0,0 +1,66 @@
+#ifndef REPORTER_H
+#define REPORTER_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "materialTable.h"
+#include "ring.h"
+
+// most reports waiting to be written before ds_print_info blocks
+#define REPORTER_QUEUE 16
+
+/* One material in a report. The name is BORROWED from the depot's material
+ * table (or Report.table), which never frees names while the depot runs.
+ */
+typedef struct ReportEntry {
+    char* name;
+    int quantity;
+} ReportEntry;
+
+/* A point in time copy of what a SIGHUP report lists. Only the pointers are
+ * copied: materials and connections are never removed, and their names never
+ * change, so the names stay valid until the depot is destroyed.
+ */
+typedef struct Report {
+    ReportEntry* goods; // MALLOC! non-zero materials, in no particular order
+    int numGoods;
+    char** neighbours; // MALLOC! BORROWED names of connections, unsorted
+    int numNeighbours;
+    // MALLOC! if not NULL, the table goods were copied from, which is owned
+    // by the report (as when sharded) rather than by the depot
+    MaterialTable* table;
+    bool stop; // if set, the reporter thread stops instead
+} Report;
+
+/* Background thread which formats and writes reports to stdout, so the main
+ * thread only pays for copying a Report, not for sorting, formatting or a
+ * slow reader of stdout. Reports are written in the order they are posted.
+ */
+typedef struct Reporter {
+    Ring queue; // reports to write, as MALLOC'd Report*
+    pthread_t thread;
+    bool started; // whether thread is running
+} Reporter;
+
+/* Starts the reporter thread. Returns false if it could not be started.
+ */
+bool reporter_init(Reporter* reporter);
+
+/* Writes every report posted so far, then stops the reporter thread. MUST be
+ * called before the materials and connections reports borrow from are
+ * destroyed. Safe to call on a reporter which failed to start.
+ */
+void reporter_destroy(Reporter* reporter);
+
+/* Posts the given report to be written, which the reporter takes ownership
+ * of. Blocks only if REPORTER_QUEUE reports are already waiting. If the
+ * reporter failed to start, the report is written straight away instead.
+ */
+void reporter_post(Reporter* reporter, Report* report);
+
+/* Destroys and frees the given report.
+ */
+void report_free(Report* report);
+
+#endif
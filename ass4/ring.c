@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "ring.h"
+#include "flight.h"
+#include "util.h"
+
+// This is Dmitry Vyukov's bounded queue, specialised for one consumer.
+// Every slot has a sequence number. A slot at position pos is free for the
+// producer claiming pos when sequence == pos, and holds an item for the
+// consumer reading pos when sequence == pos + 1. After reading, the consumer
+// sets sequence to pos + capacity, which frees it for the next lap.
+//
+// Sleeping uses the usual flag + recheck pattern. Both sides publish their
+// own change, issue a full fence, then look at the other side's state, so at
+// least one of them always sees the other.
+
+// see header
+bool ring_init(Ring* ring, int capacity) {
+    // with one slot, a published item (sequence == pos + 1) would look free
+    // to the producer of pos + 1, so at least 2 slots are needed.
+    unsigned long size = 2;
+    while (size < (unsigned long)capacity) {
+        size *= 2;
+    }
+    ring->capacity = size;
+    ring->mask = size - 1;
+    ring->insertPos = 0;
+    ring->readPos = 0;
+    ring->consumerSleeping = 0;
+    ring->producersWaiting = 0;
+
+    ring->slots = calloc(size, sizeof(RingSlot));
+    for (unsigned long i = 0; i < size; i++) {
+        ring->slots[i].sequence = i; // every slot free for the first lap
+    }
+
+    ring->wakeFd = eventfd(0, 0);
+    pthread_mutex_init(&ring->fullLock, NULL);
+    pthread_cond_init(&ring->notFull, NULL);
+    ring->initialised = true;
+    return ring->wakeFd >= 0;
+}
+
+// see header
+void ring_destroy(Ring* ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->initialised) {
+        if (ring->wakeFd >= 0) {
+            close(ring->wakeFd);
+        }
+        pthread_mutex_destroy(&ring->fullLock);
+        pthread_cond_destroy(&ring->notFull);
+        ring->initialised = false;
+    }
+    TRY_FREE(ring->slots);
+}
+
+// see header
+void ring_foreach(Ring* ring, void (*consumer)(void*)) {
+    for (unsigned long pos = ring->readPos; ; pos++) {
+        RingSlot* slot = &ring->slots[pos & ring->mask];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+        consumer(slot->item);
+    }
+}
+
+// see header
+int ring_count(Ring* ring) {
+    unsigned long insert = __atomic_load_n(&ring->insertPos,
+            __ATOMIC_RELAXED);
+    unsigned long read = __atomic_load_n(&ring->readPos, __ATOMIC_RELAXED);
+    // a producer may have claimed past the capacity while we looked
+    long count = (long)(insert - read);
+    if (count < 0) {
+        return 0;
+    }
+    return count > (long)ring->capacity ? (int)ring->capacity : (int)count;
+}
+
+/* Tries to post the item without blocking. Returns false if the ring is
+ * full.
+ */
+bool ring_try_post(Ring* ring, void* item) {
+    unsigned long pos = __atomic_load_n(&ring->insertPos, __ATOMIC_RELAXED);
+    RingSlot* slot;
+    while (1) {
+        slot = &ring->slots[pos & ring->mask];
+        unsigned long seq = __atomic_load_n(&slot->sequence,
+                __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+        if (diff == 0) {
+            // slot is free for this lap, try to claim it. on failure, pos is
+            // updated to the current insertPos.
+            if (__atomic_compare_exchange_n(&ring->insertPos, &pos, pos + 1,
+                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // consumer has not freed this slot yet
+        } else {
+            // another producer claimed pos first
+            pos = __atomic_load_n(&ring->insertPos, __ATOMIC_RELAXED);
+        }
+    }
+    slot->item = item;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// see header
+void ring_post(Ring* ring, void* item) {
+    if (!ring_try_post(ring, item)) {
+        // slow path, the ring is full
+        fr_record(FR_STALL_BEGIN, 0, 0, (int)ring->capacity, NULL, 0);
+        double stalled = monotonic_seconds();
+        pthread_mutex_lock(&ring->fullLock);
+        __atomic_add_fetch(&ring->producersWaiting, 1, __ATOMIC_SEQ_CST);
+        while (!ring_try_post(ring, item)) {
+            pthread_cond_wait(&ring->notFull, &ring->fullLock);
+        }
+        __atomic_sub_fetch(&ring->producersWaiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&ring->fullLock);
+        fr_record(FR_STALL_END, 0, 0,
+                (int)((monotonic_seconds() - stalled) * 1e6), NULL, 0);
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ring->consumerSleeping, 0, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        while (write(ring->wakeFd, &one, sizeof(one)) < 0 &&
+                errno == EINTR) {
+        }
+    }
+}
+
+// see header
+int ring_take(Ring* ring, void** items, int maxItems) {
+    int taken = 0;
+    unsigned long pos = ring->readPos;
+    while (taken < maxItems) {
+        RingSlot* slot = &ring->slots[pos & ring->mask];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            break; // empty, or the producer has not finished writing
+        }
+        items[taken++] = slot->item;
+        // free the slot for the producer one lap ahead
+        __atomic_store_n(&slot->sequence, pos + ring->capacity,
+                __ATOMIC_RELEASE);
+        pos++;
+    }
+    __atomic_store_n(&ring->readPos, pos, __ATOMIC_RELAXED);
+
+    if (taken > 0) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int waiting = __atomic_load_n(&ring->producersWaiting,
+                __ATOMIC_RELAXED);
+        if (waiting > 0) {
+            // wake one producer per freed slot, avoiding a thundering herd
+            // when many producers are waiting on a nearly full ring.
+            pthread_mutex_lock(&ring->fullLock);
+            if (taken >= waiting) {
+                pthread_cond_broadcast(&ring->notFull);
+            } else {
+                for (int i = 0; i < taken; i++) {
+                    pthread_cond_signal(&ring->notFull);
+                }
+            }
+            pthread_mutex_unlock(&ring->fullLock);
+        }
+    }
+    return taken;
+}
+
+// see header
+int ring_wait_batch_timeout(Ring* ring, void** items, int maxItems,
+        int timeoutMs) {
+    double deadline = timeoutMs >= 0 ?
+            monotonic_seconds() + timeoutMs / 1e3 : 0;
+    while (1) {
+        int taken = ring_take(ring, items, maxItems);
+        if (taken > 0) {
+            return taken;
+        }
+        // announce we are about to sleep, then look again in case a producer
+        // posted before it could see the announcement.
+        __atomic_store_n(&ring->consumerSleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        taken = ring_take(ring, items, maxItems);
+        if (taken > 0) {
+            __atomic_store_n(&ring->consumerSleeping, 0, __ATOMIC_RELAXED);
+            return taken;
+        }
+        if (timeoutMs >= 0) {
+            // what is left of the timeout, rounded up, as a signal may have
+            // cut an earlier poll short
+            double left = deadline - monotonic_seconds();
+            int leftMs = left > 0 ? (int)(left * 1000) + 1 : 0;
+            struct pollfd pfd = {ring->wakeFd, POLLIN, 0};
+            int ready = poll(&pfd, 1, leftMs);
+            if (ready < 0 && errno == EINTR && leftMs > 0) {
+                continue; // never fall through to a blocking read
+            }
+            if (ready <= 0) {
+                if (ready < 0) {
+                    DEBUG_PERROR("poll(eventfd)");
+                }
+                // a producer which sees the flag later just makes the next
+                // sleep return early, which is harmless.
+                return ring_take(ring, items, maxItems);
+            }
+        }
+        uint64_t count;
+        if (read(ring->wakeFd, &count, sizeof(count)) < 0 &&
+                errno != EINTR) {
+            DEBUG_PERROR("read(eventfd)");
+        }
+    }
+}
+
+// see header
+int ring_wait_batch(Ring* ring, void** items, int maxItems) {
+    return ring_wait_batch_timeout(ring, items, maxItems, -1);
+}
+
+// see header
+void* ring_wait(Ring* ring) {
+    void* item;
+    ring_wait_batch(ring, &item, 1);
+    return item;
+}
@@ -0,0 +1,96 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+// size of a cache line, used to keep producer and consumer state apart
+#define CACHE_LINE 64
+
+/* One slot of a ring. sequence tells producers and the consumer whose turn
+ * it is to use the slot, see ring.c.
+ */
+typedef struct RingSlot {
+    unsigned long sequence;
+    void* item;
+} RingSlot;
+
+/* A bounded lock-free FIFO for an arbitrary number of writers (producers)
+ * and exactly ONE reader (consumer). Used in place of Channel for the
+ * depot's incoming messages.
+ *
+ * Posting and receiving never take a lock while the ring is neither empty nor
+ * full. The consumer only sleeps, on an eventfd, when the ring is empty and
+ * producers only sleep when it is full.
+ */
+typedef struct Ring {
+    RingSlot* slots; // MALLOC! array of capacity slots
+    unsigned long capacity; // always a power of 2
+    unsigned long mask; // capacity - 1
+
+    // claimed with compare and swap by producers
+    char padInsert[CACHE_LINE];
+    unsigned long insertPos;
+    // only touched by the consumer
+    char padRead[CACHE_LINE];
+    unsigned long readPos;
+    char padEnd[CACHE_LINE];
+
+    bool initialised; // flag indicating if below fields are initialised
+    int wakeFd; // eventfd the consumer sleeps on when the ring is empty
+    int consumerSleeping; // non-zero if the consumer may be sleeping
+    int producersWaiting; // number of producers waiting for space
+    pthread_mutex_t fullLock; // lock for notFull
+    pthread_cond_t notFull; // signalled when space is freed
+} Ring;
+
+/* Initialises a ring which can hold at least the given number of items,
+ * rounded up to a power of 2 (minimum 2). Initially empty. Returns false if
+ * the eventfd could not be created.
+ */
+bool ring_init(Ring* ring, int capacity);
+
+/* Destroys the ring, freeing its memory. Does not destroy contained items.
+ */
+void ring_destroy(Ring* ring);
+
+/* Applies the given consumer function to each item in the ring, from oldest
+ * to newest. Must only be called when no producers are running.
+ */
+void ring_foreach(Ring* ring, void (*consumer)(void*));
+
+/* Returns the approximate number of items currently in the ring.
+ */
+int ring_count(Ring* ring);
+
+/* Posts the given item to the ring, blocking while the ring is full. Can be
+ * called from any thread. As with chan_post, the ring should be considered
+ * the owner of the item until it is received.
+ */
+void ring_post(Ring* ring, void* item);
+
+/* Takes up to maxItems items from the ring without blocking, storing them
+ * into items in FIFO order. Returns the number taken, 0 if the ring is
+ * empty. MUST only be called by the ring's single consumer thread.
+ */
+int ring_take(Ring* ring, void** items, int maxItems);
+
+/* Waits for an item in the ring. Blocks until an item is available. MUST
+ * only be called by the ring's single consumer thread.
+ */
+void* ring_wait(Ring* ring);
+
+/* Waits until at least one item is in the ring, then takes up to maxItems
+ * items without blocking again, storing them into items in FIFO order.
+ * Returns the number of items taken. MUST only be called by the ring's
+ * single consumer thread.
+ */
+int ring_wait_batch(Ring* ring, void** items, int maxItems);
+
+/* As ring_wait_batch, but gives up and returns 0 if no item arrives within
+ * timeoutMs milliseconds. A negative timeout waits forever.
+ */
+int ring_wait_batch_timeout(Ring* ring, void** items, int maxItems,
+        int timeoutMs);
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "shard.h"
+#include "arrayHelpers.h"
+#include "execute.h"
+#include "flight.h"
+#include "util.h"
+
+/* Copies the shard's materials into a new shard->report array.
+ */
+void shard_fill_report(Shard* shard) {
+    Array* materials = shard->materials.materials;
+    shard->report = calloc(1, sizeof(Array));
+    array_init(shard->report);
+    for (int i = 0; i < materials->numItems; i++) {
+        Material* mat = ARRAY_ITEM(Material, materials, i);
+        Material copy;
+        mat_init_id(&copy, mat->quantity, mat->id);
+        array_add_copy(shard->report, &copy, sizeof(Material));
+    }
+}
+
+/* Executes one message posted to the shard. Returns false if the shard
+ * should stop.
+ */
+bool shard_execute(Shard* shard, Message* message) {
+    Material* mat;
+    Batch* batch;
+    switch (message->type) {
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+            // interned here, as readers post names straight from the line
+            mat = mt_ensure_id(&shard->materials,
+                    mat_intern(&message->data.material));
+            if (message->type == MSG_DELIVER) {
+                mat->quantity += message->data.material.quantity;
+            } else {
+                mat->quantity -= message->data.material.quantity;
+            }
+            return true;
+        case MSG_BATCH_OPS:
+            batch = message->data.batch;
+            for (int i = 0; i < batch->numOps; i++) {
+                BatchOp* op = &batch->ops[i];
+                mat = mt_ensure_view(&shard->materials, op->matName);
+                if (op->type == MSG_DELIVER) {
+                    mat->quantity += op->quantity;
+                } else {
+                    mat->quantity -= op->quantity;
+                }
+            }
+            return true;
+        case MSG_META_SHARD_REPORT:
+            shard_fill_report(shard);
+            sem_post(shard->reported);
+            return true;
+        case MSG_META_SHARD_STOP:
+            return false;
+        default:
+            DEBUG_PRINT("invalid shard message type");
+            assert(0);
+            return true;
+    }
+}
+
+/* Executor thread of one shard, taking the Shard* as its argument. Returns
+ * once a MSG_META_SHARD_STOP is received. Return value unused.
+ */
+void* shard_thread(void* shardArg) {
+    Shard* shard = shardArg;
+    void* batch[SHARD_BATCH];
+    bool running = true;
+    fr_thread_start("shard");
+    while (running) {
+        int count = ring_wait_batch(&shard->inbox, batch, SHARD_BATCH);
+        for (int i = 0; i < count; i++) {
+            fr_record_message(FR_EXECUTE, 0, batch[i]);
+            // nothing is posted after the stop message
+            running = shard_execute(shard, batch[i]) && running;
+            msg_release(batch[i]); // back to the poster's slab
+        }
+    }
+    return NULL;
+}
+
+// see header
+bool shardset_init(ShardSet* set, int numShards, int inboxSize) {
+    set->numShards = 0;
+    set->shards = calloc(numShards, sizeof(Shard));
+    set->slab = msgslab_create();
+    sem_init(&set->reported, 0, 0);
+    bool started = true;
+    for (int i = 0; i < numShards; i++) {
+        Shard* shard = &set->shards[i];
+        mt_init(&shard->materials);
+        shard->reported = &set->reported;
+        if (!ring_init(&shard->inbox, inboxSize)) {
+            mt_destroy(&shard->materials);
+            started = false;
+            break;
+        }
+        // shards are started before main blocks signals, and never take any
+        errno = start_quiet_thread(&shard->thread, shard_thread, shard);
+        if (errno != 0) {
+            DEBUG_PERROR("pthread_create()");
+            ring_destroy(&shard->inbox);
+            mt_destroy(&shard->materials);
+            started = false;
+            break;
+        }
+        set->numShards++; // only counts shards which need stopping
+    }
+    DEBUG_PRINTF("started %d of %d shards\n", set->numShards, numShards);
+    return started;
+}
+
+/* Takes a message of the given type from the main thread's slab and posts it
+ * to the given shard.
+ */
+void shardset_post_meta(ShardSet* set, Shard* shard, MessageType type) {
+    Message* message = msgslab_take(set->slab);
+    message->type = type;
+    ring_post(&shard->inbox, message);
+}
+
+// see header
+void shardset_destroy(ShardSet* set) {
+    if (set == NULL) {
+        return;
+    }
+    for (int i = 0; i < set->numShards; i++) {
+        shardset_post_meta(set, &set->shards[i], MSG_META_SHARD_STOP);
+    }
+    for (int i = 0; i < set->numShards; i++) {
+        Shard* shard = &set->shards[i];
+        pthread_join(shard->thread, NULL);
+        ring_foreach(&shard->inbox, ah_msg_release);
+        ring_destroy(&shard->inbox);
+        mt_destroy(&shard->materials);
+    }
+    set->numShards = 0;
+    TRY_FREE(set->shards);
+    msgslab_retire(set->slab);
+    set->slab = NULL;
+    sem_destroy(&set->reported);
+}
+
+/* Returns the index of the shard owning the material with the given name.
+ * Names rather than ids are hashed, so readers need not intern to post.
+ */
+int shardset_owner(ShardSet* set, StrView matName) {
+    return sv_hash(matName) % set->numShards;
+}
+
+// see header
+void shardset_post(ShardSet* set, Message* message) {
+    int owner = shardset_owner(set, sv_from(message->data.material.name));
+    ring_post(&set->shards[owner].inbox, message);
+}
+
+/* Returns true if the given Batch operation can be executed by a shard.
+ */
+bool shardset_op_valid(BatchOp* op) {
+    return op->quantity > 0 && is_name_view_valid(op->matName);
+}
+
+// see header
+void shardset_post_batch(ShardSet* set, Message* message, MsgSlab* slab) {
+    Batch* batch = message->data.batch;
+    int first = shardset_owner(set, batch->ops[0].matName);
+    bool whole = true;
+    size_t nameBytes = 0;
+    for (int i = 0; i < batch->numOps; i++) {
+        BatchOp* op = &batch->ops[i];
+        whole = whole && shardset_op_valid(op) &&
+                shardset_owner(set, op->matName) == first;
+        nameBytes += op->matName.len + 1;
+    }
+    if (whole) {
+        // the usual case for a producer batching one material
+        ring_post(&set->shards[first].inbox, message);
+        return;
+    }
+
+    // parts[i] holds the operations for shard i, in batch order, laid out
+    // as mv_copy_batch does with room for every op and name. names[i] is
+    // where the next name of parts[i] goes
+    Batch** parts = calloc(set->numShards, sizeof(Batch*));
+    char** names = calloc(set->numShards, sizeof(char*));
+    for (int i = 0; i < batch->numOps; i++) {
+        BatchOp* op = &batch->ops[i];
+        if (!shardset_op_valid(op)) {
+            DEBUG_PRINT("ignoring invalid material");
+            continue;
+        }
+        int owner = shardset_owner(set, op->matName);
+        Batch* part = parts[owner];
+        if (part == NULL) {
+            part = malloc(sizeof(Batch) + batch->numOps * sizeof(BatchOp) +
+                    nameBytes);
+            part->numOps = 0;
+            parts[owner] = part;
+            names[owner] = (char*)&part->ops[batch->numOps];
+        }
+        BatchOp* copy = &part->ops[part->numOps++];
+        *copy = *op;
+        // the original batch and its names are released below
+        copy->matName.start = names[owner];
+        memcpy(names[owner], op->matName.start, op->matName.len + 1);
+        names[owner] += op->matName.len + 1;
+    }
+    for (int i = 0; i < set->numShards; i++) {
+        if (parts[i] != NULL) {
+            Message* post = msgslab_take(slab);
+            post->type = MSG_BATCH_OPS;
+            post->fromPort = message->fromPort;
+            post->data.batch = parts[i];
+            ring_post(&set->shards[i].inbox, post);
+        }
+    }
+    free(parts);
+    free(names);
+    msg_release(message);
+}
+
+// see header
+void shardset_alter(ShardSet* set, SymId matId, int delta) {
+    if (delta == 0) {
+        return; // the material would be reported the same without it
+    }
+    Message* message = msgslab_take(set->slab);
+    message->type = delta > 0 ? MSG_DELIVER : MSG_WITHDRAW;
+    mat_init_id(&message->data.material, delta > 0 ? delta : -delta, matId);
+    shardset_post(set, message);
+}
+
+// see header
+void shardset_report(ShardSet* set, MaterialTable* out) {
+    for (int i = 0; i < set->numShards; i++) {
+        shardset_post_meta(set, &set->shards[i], MSG_META_SHARD_REPORT);
+    }
+    for (int i = 0; i < set->numShards; i++) {
+        while (sem_wait(&set->reported) != 0 && errno == EINTR) {
+            // interrupted, wait again
+        }
+    }
+    // every report is filled, and no shard touches them again
+    for (int i = 0; i < set->numShards; i++) {
+        Array* report = set->shards[i].report;
+        for (int j = 0; j < report->numItems; j++) {
+            Material* mat = ARRAY_ITEM(Material, report, j);
+            mt_ensure_id(out, mat->id)->quantity = mat->quantity;
+        }
+        array_foreach(report, ah_mat_destroy);
+        array_destroy_and_free(report);
+        free(report);
+        set->shards[i].report = NULL;
+    }
+}
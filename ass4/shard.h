@@ -0,0 +1,96 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "array.h"
+#include "materialTable.h"
+#include "messages.h"
+#include "msgSlab.h"
+#include "ring.h"
+#include "strView.h"
+
+// most messages a shard takes from its inbox per wakeup
+#define SHARD_BATCH 64
+
+/* One executor thread of a ShardSet, owning every material whose name
+ * hashes to it. Only Deliver, Withdraw and Batch messages (already
+ * validated) and the shard meta messages are ever posted to a shard.
+ */
+typedef struct Shard {
+    Ring inbox; // messages for this shard's materials, as Message*
+    MaterialTable materials; // ONLY touched by this shard's thread
+    // MALLOC'd copies of materials, made for MSG_META_SHARD_REPORT. belongs
+    // to the main thread once the report is posted
+    Array* report;
+    sem_t* reported; // BORROWED, posted once report is filled
+    pthread_t thread;
+} Shard;
+
+/* Splits the depot's materials across a fixed number of executor threads by
+ * name hash, so Deliver and Withdraw are executed off the main thread. Names
+ * are interned by the shard, once it stores the material.
+ *
+ * Reader threads post Deliver and Withdraw straight to the owning shard, and
+ * split a Batch into one Batch per shard owning any of its materials. Every
+ * other message still goes through the main thread, which posts any material
+ * changes it makes (Transfer, deferred messages run by Execute, goods given on
+ * the command line) to the owning shard too. Since a material is only ever
+ * changed by one shard, in inbox order, changes to one material from one
+ * producer are applied in the order they were posted.
+ *
+ * A reader which hands main a Transfer or Execute waits for main to execute
+ * it before posting anything else, see Message.executed. Otherwise the
+ * reader's later messages could reach a shard ahead of the changes made by
+ * that Transfer or Execute.
+ *
+ * Reports (SIGHUP) are a barrier: main posts a report request to every shard
+ * and waits for all of them to copy their materials. Each material is
+ * reported as of some point in its shard's inbox, so every change posted to a
+ * shard before the request is included.
+ */
+typedef struct ShardSet {
+    Shard* shards; // MALLOC! numShards shards
+    int numShards;
+    MsgSlab* slab; // messages posted by the main thread
+    sem_t reported; // posted by each shard once its report is ready
+} ShardSet;
+
+/* Initialises the shard set with the given number of shards, each with an
+ * inbox of at least inboxSize messages, and starts their threads. Returns
+ * false if a shard could not be started.
+ */
+bool shardset_init(ShardSet* set, int numShards, int inboxSize);
+
+/* Stops every shard thread and destroys the shards, their materials and any
+ * messages left in their inboxes. Safe to call on a partly initialised set.
+ */
+void shardset_destroy(ShardSet* set);
+
+/* Posts the given Deliver or Withdraw to the shard owning its material. Can
+ * be called from any thread; the shard owns the message from now on and
+ * releases it once executed. The message MUST be valid.
+ */
+void shardset_post(ShardSet* set, Message* message);
+
+/* Posts the given Batch to the shards owning its materials, as one Batch per
+ * shard holding that shard's operations in their original order. Invalid
+ * operations are dropped. Any new messages are taken from the given slab,
+ * which MUST be owned by the calling thread. The set owns the message from
+ * now on.
+ */
+void shardset_post_batch(ShardSet* set, Message* message, MsgSlab* slab);
+
+/* Changes the material with the given interned name id by delta by posting
+ * to its shard. MUST only be called by the main thread.
+ */
+void shardset_alter(ShardSet* set, SymId matId, int delta);
+
+/* Copies every shard's materials into the given table, waiting for all
+ * shards to reach the report. MUST only be called by the main thread.
+ */
+void shardset_report(ShardSet* set, MaterialTable* out);
+
+#endif
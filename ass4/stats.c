@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "util.h"
+
+/* Returns the given segment name as a MALLOC'd string with a leading /.
+ */
+char* stats_shm_name(char* name) {
+    return asprintf(name[0] == '/' ? "%s" : "/%s", name);
+}
+
+// see header
+bool stats_create(DepotStats** out, char* name) {
+    char* shmName = stats_shm_name(name);
+    shm_unlink(shmName); // a depot which died leaves its segment behind
+    int fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0644);
+    free(shmName);
+    if (fd < 0) {
+        DEBUG_PERROR("shm_open()");
+        return false;
+    }
+    // new pages of the segment are zeroed
+    DepotStats* stats = MAP_FAILED;
+    if (ftruncate(fd, sizeof(DepotStats)) == 0) {
+        stats = mmap(NULL, sizeof(DepotStats), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    }
+    close(fd); // the mapping keeps the segment
+    if (stats == MAP_FAILED) {
+        DEBUG_PERROR("mmap()");
+        stats_unlink(name);
+        return false;
+    }
+    stats->pid = getpid();
+    stats->started = time(NULL);
+    // readers check the magic, so it goes last
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(stats->magic, STATS_MAGIC, sizeof(stats->magic));
+    *out = stats;
+    return true;
+}
+
+// see header
+void stats_unlink(char* name) {
+    char* shmName = stats_shm_name(name);
+    shm_unlink(shmName);
+    free(shmName);
+}
+
+// see header
+bool stats_attach(DepotStats** out, char* name) {
+    char* shmName = stats_shm_name(name);
+    int fd = shm_open(shmName, O_RDONLY, 0);
+    free(shmName);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    DepotStats* stats = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size == sizeof(DepotStats)) {
+        stats = mmap(NULL, sizeof(DepotStats), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (stats == MAP_FAILED) {
+        return false;
+    }
+    if (memcmp(stats->magic, STATS_MAGIC, sizeof(stats->magic)) != 0) {
+        stats_detach(stats);
+        return false;
+    }
+    *out = stats;
+    return true;
+}
+
+// see header
+void stats_detach(DepotStats* stats) {
+    munmap(stats, sizeof(DepotStats));
+}
+
+// see header
+PeerStats* stats_add_peer(DepotStats* stats, int port, char* name) {
+    if (stats == NULL) {
+        return NULL;
+    }
+    // slots are only handed out, never returned, so a counter is enough
+    int slot = __atomic_fetch_add(&stats->numPeers, 1, __ATOMIC_RELAXED);
+    if (slot >= STATS_MAX_PEERS) {
+        return NULL;
+    }
+    PeerStats* peer = &stats->peers[slot];
+    peer->port = port;
+    snprintf(peer->name, STATS_NAME_LEN, "%s", name);
+    __atomic_store_n(&peer->state, PEER_OPEN, __ATOMIC_RELEASE);
+    return peer;
+}
+
+// see header
+void stats_close_peer(PeerStats* peer) {
+    if (peer != NULL) {
+        STATS_SET(peer->state, PEER_CLOSED);
+    }
+}
+
+// see header
+void stats_received(DepotStats* stats, PeerStats* peer, MessageType type) {
+    if (stats == NULL) {
+        return;
+    }
+    STATS_ADD(stats->received[type], 1);
+    if (peer != NULL) {
+        STATS_ADD(peer->messagesIn, 1);
+    }
+}
+
+// see header
+void stats_handshake_start(DepotStats* stats) {
+    if (stats != NULL) {
+        STATS_ADD(stats->handshakes, 1);
+    }
+}
+
+// see header
+void stats_handshake_end(DepotStats* stats, HandshakeEnd end) {
+    if (stats == NULL) {
+        return;
+    }
+    STATS_ADD(stats->handshakes, -1);
+    if (end == HANDSHAKE_REJECTED) {
+        STATS_ADD(stats->handshakesRejected, 1);
+    } else if (end == HANDSHAKE_TIMED_OUT) {
+        STATS_ADD(stats->handshakesTimedOut, 1);
+    }
+}
+
+// see header
+void stats_bytes_in(DepotStats* stats, PeerStats* peer, long bytes) {
+    if (stats == NULL || bytes <= 0) {
+        return;
+    }
+    STATS_ADD(stats->bytesIn, bytes);
+    if (peer != NULL) {
+        STATS_ADD(peer->bytesIn, bytes);
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+#include "messages.h"
+
+// identifies (and versions) a stats segment
+#define STATS_MAGIC "DEPOTST5"
+// most peers given their own counters, later peers only count in the totals
+#define STATS_MAX_PEERS 64
+// bytes of a peer's name kept in its counters, including the \0
+#define STATS_NAME_LEN 32
+
+// lock-free updates of a counter or gauge in the segment. every field is
+// written with these and read by depottop with STATS_READ, so a reader
+// never sees a torn value. nothing orders one field against another.
+#define STATS_ADD(field, n) __atomic_add_fetch(&(field), (n), __ATOMIC_RELAXED)
+#define STATS_SET(field, n) __atomic_store_n(&(field), (n), __ATOMIC_RELAXED)
+#define STATS_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+/* States of a slot in DepotStats.peers.
+ */
+typedef enum PeerState {
+    PEER_FREE, // slot not handed out yet
+    PEER_OPEN, // peer verified, its name and port are set
+    PEER_CLOSED // peer hung up or was rejected as a duplicate
+} PeerState;
+
+/* Ways a handshake can end. A handshake starts once a socket to a peer is
+ * connected, either way, and ends when the peer's IM has been received.
+ */
+typedef enum HandshakeEnd {
+    HANDSHAKE_VERIFIED, // the peer sent a valid IM
+    HANDSHAKE_REJECTED, // the peer hung up or sent something else first
+    HANDSHAKE_TIMED_OUT // see DEPOT_HANDSHAKE_TIMEOUT_MS
+} HandshakeEnd;
+
+/* Counters of one verified peer. bytesIn and messagesIn are written by
+ * whichever thread reads the peer, everything else by the main thread.
+ */
+typedef struct PeerStats {
+    int state; // PeerState, set to PEER_OPEN once name and port are set
+    int port;
+    char name[STATS_NAME_LEN]; // truncated to fit
+    long bytesIn;
+    long bytesOut;
+    long messagesIn; // lines or frames received, valid or not
+    long messagesOut;
+    long queuedBytes; // gauge: bytes waiting to be written to the peer
+    long inDepth; // gauge: messages waiting in the peer's InQueue
+    long dropped; // messages dropped because the peer's queue was full
+} PeerStats;
+
+/* Counters and gauges of a running depot, kept in a shared memory segment
+ * (see DEPOT_STATS) so a monitor like depottop can read them at any time
+ * without asking the depot anything. Counters only ever increase, so rates
+ * come from reading them twice. Gauges are sampled by the main thread once
+ * per batch of executed messages.
+ *
+ * Everything is updated with atomic adds and stores (no locks), mostly by
+ * the main thread, so keeping the segment up to date costs a few relaxed
+ * atomic operations per message.
+ */
+typedef struct DepotStats {
+    char magic[8]; // STATS_MAGIC, not \0 terminated. set last
+    int pid;
+    int port; // listening port, 0 until listening
+    long started; // CLOCK_REALTIME seconds when the segment was created
+
+    // lines or frames received from peers by type, where MSG_NULL counts
+    // invalid ones, plus meta messages executed by the main thread
+    long received[NUM_MESSAGE_TYPES_ALL];
+    long sent[NUM_MESSAGE_TYPES]; // messages queued to peers by type
+    long bytesIn; // from every peer, including ones not yet verified
+    long bytesOut;
+    long deferGroupsExecuted;
+    long batches; // batches of messages executed by the main thread
+    long handshakesRejected;
+    long handshakesTimedOut;
+    // Delivers merged into another by coalescing, so never sent
+    long coalesced;
+
+    // gauges, see ds_publish_stats
+    long incomingDepth; // messages waiting in the incoming ring
+    long incomingHigh; // most messages ever seen waiting there
+    long incomingCapacity;
+    long shardDepth; // messages waiting in every shard inbox
+    long inBusy; // peers' InQueues with messages waiting
+    long connections;
+    long pending; // outgoing connections waiting for the peer's IM
+    long materials; // size of the main thread's table, 0 when sharded
+    long deferGroups;
+    // peers connected but not yet verified. unlike the gauges above, kept up
+    // to date by whichever thread handles the handshake
+    long handshakes;
+
+    // slots of peers handed out. keeps counting past STATS_MAX_PEERS, so
+    // only the first STATS_MAX_PEERS are real
+    int numPeers;
+    PeerStats peers[STATS_MAX_PEERS];
+} DepotStats;
+
+/* Creates (replacing any old one) and maps the shared memory segment with
+ * the given name, as for shm_open, and stores the zeroed stats in it into
+ * *out. A name without a leading / has one added. Returns false if the
+ * segment could not be created.
+ */
+bool stats_create(DepotStats** out, char* name);
+
+/* Removes the name of the segment created by stats_create, so it is freed
+ * once unmapped. The depot's own mapping is left until it exits, since
+ * reader threads may count into it up to then.
+ */
+void stats_unlink(char* name);
+
+/* Maps an existing segment read only, as depottop does, storing the stats
+ * into *out. Returns false if there is no such segment or it isn't one of
+ * ours.
+ */
+bool stats_attach(DepotStats** out, char* name);
+
+/* Unmaps a segment mapped by stats_attach.
+ */
+void stats_detach(DepotStats* stats);
+
+/* Hands out the next free peer slot to the peer with the given port and
+ * name, returning it, or NULL if stats is NULL or the slots have run out.
+ * Can be called from any thread.
+ */
+PeerStats* stats_add_peer(DepotStats* stats, int port, char* name);
+
+/* Marks the given peer slot closed. Does nothing if peer is NULL.
+ */
+void stats_close_peer(PeerStats* peer);
+
+/* Counts one line or frame of the given type received from the given peer,
+ * which may be NULL if the peer has no slot. Does nothing if stats is NULL.
+ */
+void stats_received(DepotStats* stats, PeerStats* peer, MessageType type);
+
+/* Counts a handshake starting. Can be called from any thread. Does nothing
+ * if stats is NULL.
+ */
+void stats_handshake_start(DepotStats* stats);
+
+/* Counts a handshake started with stats_handshake_start ending in the given
+ * way. Can be called from any thread. Does nothing if stats is NULL.
+ */
+void stats_handshake_end(DepotStats* stats, HandshakeEnd end);
+
+/* Counts bytes read from the given peer, which may be NULL. Does nothing if
+ * stats is NULL.
+ */
+void stats_bytes_in(DepotStats* stats, PeerStats* peer, long bytes);
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "strBuffer.h"
+#include "util.h"
+
+// enough digits for any int, including sign
+#define INT_DIGITS 12
+
+// see header
+void sb_init(StrBuffer* buffer) {
+    buffer->data = malloc(STR_BUFFER_INITIAL * sizeof(char));
+    assert(buffer->data != NULL);
+    buffer->data[0] = '\0';
+    buffer->len = 0;
+    buffer->size = STR_BUFFER_INITIAL;
+}
+
+// see header
+void sb_destroy(StrBuffer* buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    TRY_FREE(buffer->data);
+}
+
+// see header
+void sb_clear(StrBuffer* buffer) {
+    buffer->len = 0;
+    buffer->data[0] = '\0';
+}
+
+/* Ensures there is space for extra more characters and the terminator.
+ */
+void sb_reserve(StrBuffer* buffer, int extra) {
+    if (buffer->len + extra < buffer->size) {
+        return;
+    }
+    while (buffer->len + extra >= buffer->size) {
+        buffer->size *= 2;
+    }
+    buffer->data = realloc(buffer->data, buffer->size);
+    assert(buffer->data != NULL);
+}
+
+// see header
+void sb_append(StrBuffer* buffer, char* str, int len) {
+    sb_reserve(buffer, len);
+    memcpy(buffer->data + buffer->len, str, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+}
+
+// see header
+void sb_insert(StrBuffer* buffer, int pos, char* str, int len) {
+    sb_reserve(buffer, len);
+    // includes the terminator
+    memmove(buffer->data + pos + len, buffer->data + pos,
+            buffer->len - pos + 1);
+    memcpy(buffer->data + pos, str, len);
+    buffer->len += len;
+}
+
+// see header
+void sb_append_str(StrBuffer* buffer, char* str) {
+    sb_append(buffer, str, strlen(str));
+}
+
+// see header
+void sb_append_char(StrBuffer* buffer, char c) {
+    sb_reserve(buffer, 1);
+    buffer->data[buffer->len++] = c;
+    buffer->data[buffer->len] = '\0';
+}
+
+// see header
+void sb_append_int(StrBuffer* buffer, int number) {
+    // digits are produced backwards, from the end of this array
+    char digits[INT_DIGITS];
+    int pos = INT_DIGITS;
+    // work with the magnitude as unsigned so INT_MIN doesn't overflow
+    unsigned int magnitude = number;
+    if (number < 0) {
+        magnitude = -magnitude;
+    }
+    do {
+        digits[--pos] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (number < 0) {
+        digits[--pos] = '-';
+    }
+    sb_append(buffer, digits + pos, INT_DIGITS - pos);
+}
@@ -0,0 +1,50 @@
+#ifndef STRBUFFER_H
+#define STRBUFFER_H
+
+// initial size of a string buffer
+#define STR_BUFFER_INITIAL 128
+
+/* A growable string which is appended to in place. The contents are always
+ * \0 terminated. Meant to be cleared and reused, so that once it has grown
+ * to fit the longest string built in it, appending never allocates.
+ */
+typedef struct StrBuffer {
+    char* data; // MALLOC! size bytes, \0 terminated
+    int len; // length of the string, excluding the terminator
+    int size;
+} StrBuffer;
+
+/* Initialises an empty string buffer.
+ */
+void sb_init(StrBuffer* buffer);
+
+/* Destroys the string buffer, freeing its memory.
+ */
+void sb_destroy(StrBuffer* buffer);
+
+/* Empties the buffer, keeping its memory for reuse.
+ */
+void sb_clear(StrBuffer* buffer);
+
+/* Appends len bytes of str to the buffer.
+ */
+void sb_append(StrBuffer* buffer, char* str, int len);
+
+/* Inserts len bytes of str at offset pos, moving everything after pos up.
+ */
+void sb_insert(StrBuffer* buffer, int pos, char* str, int len);
+
+/* Appends the given \0 terminated string to the buffer.
+ */
+void sb_append_str(StrBuffer* buffer, char* str);
+
+/* Appends one character to the buffer.
+ */
+void sb_append_char(StrBuffer* buffer, char c);
+
+/* Appends the decimal representation of number to the buffer, as %d would
+ * but without going through printf.
+ */
+void sb_append_int(StrBuffer* buffer, int number);
+
+#endif
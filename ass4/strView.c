@@ -0,0 +1,33 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "strView.h"
+
+// FNV-1a parameters for 32-bit hashes
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// see header
+StrView sv_from(char* str) {
+    StrView view = {str, strlen(str)};
+    return view;
+}
+
+// see header
+bool sv_equals(StrView view, char* str) {
+    return strncmp(view.start, str, view.len) == 0 && str[view.len] == '\0';
+}
+
+// see header
+unsigned int sv_hash(StrView view) {
+    unsigned int hash = FNV_OFFSET;
+    for (int i = 0; i < view.len; i++) {
+        hash = (hash ^ (unsigned char)view.start[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// see header
+char* sv_dup(StrView view) {
+    return strndup(view.start, view.len);
+}
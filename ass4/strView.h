@@ -0,0 +1,33 @@
+#ifndef STRVIEW_H
+#define STRVIEW_H
+
+#include <stdbool.h>
+
+/* A string which is NOT \0 terminated, given by a pointer into some other
+ * buffer and a length. Views are BORROWED and only valid for as long as the
+ * buffer they point into.
+ */
+typedef struct StrView {
+    char* start;
+    int len;
+} StrView;
+
+/* Returns a view of the whole of the given \0 terminated string.
+ */
+StrView sv_from(char* str);
+
+/* Returns true if the view has exactly the same characters as the given \0
+ * terminated string.
+ */
+bool sv_equals(StrView view, char* str);
+
+/* Hashes the characters of the view with FNV-1a. Equal to ah_strhash of the
+ * same characters as a \0 terminated string.
+ */
+unsigned int sv_hash(StrView view);
+
+/* Returns a copy of the view as a MALLOC'd \0 terminated string.
+ */
+char* sv_dup(StrView view);
+
+#endif
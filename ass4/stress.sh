@@ -1,4 +1,8 @@
 #!/bin/bash
+# Puts a running depot under load with load_gen: 100 simulated depots send
+# the default message mix as fast as the depot takes it for 10 seconds,
+# while the depot is sent SIGHUP every second. Further arguments are passed
+# on to load_gen, e.g. -r 50000 for a fixed rate.
 
 port="$1"
 pid="$2"
@@ -6,24 +10,7 @@ if [[ -z "$port" ]] || [[ -z "$pid" ]]; then
     echo "invalid port or pid"
     exit 1
 fi
+shift 2
 
-arg=-N
-if [[ "$(hostname)" = 'moss.labs.eait.uq.edu.au' ]]; then
-    arg=--send-only
-fi
-
-for i in {1..100}; do
-    p=$((i + 1000))
-    nc $arg localhost $port <<EOF &
-IM:$p:nc$i
-Deliver:1:mat
-Withdraw:2:mat
-Defer:10:Deliver:1:mat
-Withdraw:1:diamond
-Execute:10
-Deliver:1:mat$i
-Transfer:1:mat$i:nc$i
-Deliver:1:0mat$i
-EOF
-    kill -hup $pid
-done
+make -s load_gen || exit 1
+exec ./load_gen -c 100 -d 10 -H "$pid" "$@" "$port"
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "symbols.h"
+#include "util.h"
+
+// names are kept in chunks of this many, so they never move
+#define SYM_CHUNK_BITS 12
+#define SYM_CHUNK_SIZE (1 << SYM_CHUNK_BITS)
+// chunks the first directory has room for
+#define SYM_FIRST_CHUNKS 16
+// slots in the first index table. always a power of 2
+#define SYM_FIRST_SLOTS 1024
+
+/* An interned name.
+ */
+typedef struct SymEntry {
+    char* name; // MALLOC'd once, never freed
+    int len;
+} SymEntry;
+
+/* One generation of the index. Each slot is 0 if empty, otherwise the
+ * name's hash in the high 32 bits and its id in the low 32 bits, so a slot
+ * is published with a single store.
+ */
+typedef struct SymTable {
+    uint64_t* slots; // MALLOC! capacity slots
+    unsigned int mask; // capacity - 1
+    struct SymTable* retired; // the table this one replaced, kept for readers
+} SymTable;
+
+/* One generation of the chunk directory. chunks[id >> SYM_CHUNK_BITS] holds
+ * the entry of id. Replaced by one twice the size when full, like SymTable.
+ */
+typedef struct SymChunks {
+    SymEntry** chunks; // MALLOC! numChunks chunks, NULL until first used
+    unsigned int numChunks;
+    struct SymChunks* retired; // the directory this one replaced
+} SymChunks;
+
+// the current index, replaced (never changed in place) when it grows
+static SymTable* symTable = NULL;
+// the current chunk directory, replaced (never changed in place) when it
+// grows. chunks are never moved, only the pointers to them are copied
+static SymChunks* symChunks = NULL;
+// ids handed out so far, all below this. only changed under symLock
+static SymId symNextId = 1;
+static pthread_mutex_t symLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns the entry of the given id, which MUST have been handed out.
+ */
+SymEntry* sym_entry(SymId id) {
+    // the id was published after a directory holding its chunk was
+    SymChunks* dir = __atomic_load_n(&symChunks, __ATOMIC_ACQUIRE);
+    return &dir->chunks[id >> SYM_CHUNK_BITS][id & (SYM_CHUNK_SIZE - 1)];
+}
+
+/* Ensures the chunk holding the entry of the given id exists, growing the
+ * directory if needed. MUST be called with symLock held.
+ */
+void sym_ensure_chunk(SymId id) {
+    unsigned int index = id >> SYM_CHUNK_BITS;
+    SymChunks* dir = symChunks;
+    if (dir == NULL || index >= dir->numChunks) {
+        SymChunks* grown = malloc(sizeof(SymChunks));
+        grown->numChunks = dir == NULL ? SYM_FIRST_CHUNKS : dir->numChunks * 2;
+        grown->chunks = calloc(grown->numChunks, sizeof(SymEntry*));
+        if (dir != NULL) {
+            memcpy(grown->chunks, dir->chunks,
+                    dir->numChunks * sizeof(SymEntry*));
+        }
+        grown->retired = dir;
+        dir = grown;
+    }
+    if (dir->chunks[index] == NULL) {
+        dir->chunks[index] = malloc(SYM_CHUNK_SIZE * sizeof(SymEntry));
+    }
+    __atomic_store_n(&symChunks, dir, __ATOMIC_RELEASE);
+}
+
+/* Probes the given table for the name with the given hash. Returns its id,
+ * or SYM_NONE if it is not in the table.
+ */
+SymId sym_lookup(SymTable* table, StrView name, unsigned int hash) {
+    for (unsigned int i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        // acquire, so the entry of the id is visible before it is read
+        uint64_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == 0) {
+            return SYM_NONE;
+        }
+        SymId id = (SymId)slot;
+        if ((unsigned int)(slot >> 32) != hash) {
+            continue;
+        }
+        SymEntry* entry = sym_entry(id);
+        if (entry->len == name.len &&
+                memcmp(entry->name, name.start, name.len) == 0) {
+            return id;
+        }
+    }
+}
+
+/* Stores the given slot in the first free place of its probe sequence.
+ */
+void sym_place(SymTable* table, uint64_t slot) {
+    unsigned int i = (unsigned int)(slot >> 32) & table->mask;
+    while (table->slots[i] != 0) {
+        i = (i + 1) & table->mask;
+    }
+    __atomic_store_n(&table->slots[i], slot, __ATOMIC_RELEASE);
+}
+
+/* Returns a new table with capacity slots, holding every slot of the given
+ * table if there is one, which is retired rather than freed.
+ */
+SymTable* sym_grow(SymTable* old, unsigned int capacity) {
+    SymTable* table = malloc(sizeof(SymTable));
+    table->slots = calloc(capacity, sizeof(uint64_t));
+    table->mask = capacity - 1;
+    table->retired = old;
+    if (old != NULL) {
+        for (unsigned int i = 0; i <= old->mask; i++) {
+            if (old->slots[i] != 0) {
+                sym_place(table, old->slots[i]);
+            }
+        }
+    }
+    return table;
+}
+
+/* Slow path of sym_intern, under the lock: checks the name is still not
+ * there, then adds it.
+ */
+SymId sym_add(StrView name, unsigned int hash) {
+    SymTable* table = symTable;
+    if (table == NULL) {
+        table = sym_grow(NULL, SYM_FIRST_SLOTS);
+        __atomic_store_n(&symTable, table, __ATOMIC_RELEASE);
+    }
+    SymId id = sym_lookup(table, name, hash); // another thread may have won
+    if (id != SYM_NONE) {
+        return id;
+    }
+    id = symNextId++;
+    sym_ensure_chunk(id);
+    SymEntry* entry = sym_entry(id);
+    entry->name = sv_dup(name);
+    entry->len = name.len;
+
+    // at most half full, so probes stay short and always end
+    if ((id + 1) * 2 > table->mask + 1) {
+        table = sym_grow(table, (table->mask + 1) * 2);
+        __atomic_store_n(&symTable, table, __ATOMIC_RELEASE);
+    }
+    sym_place(table, ((uint64_t)hash << 32) | id);
+    return id;
+}
+
+// see header
+SymId sym_intern(StrView name) {
+    if (name.len <= 0) {
+        return SYM_NONE;
+    }
+    unsigned int hash = sv_hash(name);
+    SymTable* table = __atomic_load_n(&symTable, __ATOMIC_ACQUIRE);
+    SymId id = table == NULL ? SYM_NONE : sym_lookup(table, name, hash);
+    if (id != SYM_NONE) {
+        return id;
+    }
+    pthread_mutex_lock(&symLock);
+    id = sym_add(name, hash);
+    pthread_mutex_unlock(&symLock);
+    return id;
+}
+
+// see header
+SymId sym_intern_str(char* name) {
+    return sym_intern(sv_from(name));
+}
+
+// see header
+SymId sym_find(StrView name) {
+    SymTable* table = __atomic_load_n(&symTable, __ATOMIC_ACQUIRE);
+    if (table == NULL || name.len <= 0) {
+        return SYM_NONE;
+    }
+    // a name added since the table was loaded is missed, as if added after
+    return sym_lookup(table, name, sv_hash(name));
+}
+
+// see header
+char* sym_name(SymId id) {
+    return id == SYM_NONE ? "" : sym_entry(id)->name;
+}
+
+// see header
+StrView sym_view(SymId id) {
+    if (id == SYM_NONE) {
+        return (StrView) {"", 0};
+    }
+    SymEntry* entry = sym_entry(id);
+    return (StrView) {entry->name, entry->len};
+}
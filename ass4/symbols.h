@@ -0,0 +1,55 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "strView.h"
+
+/* Process-wide table of interned material names. Each distinct name is
+ * copied once, the first time it is interned, and given a small integer id
+ * which never changes and is never reused, so names can be keyed and
+ * compared by id. Ids are dense, starting from 1. Interned names are never
+ * freed, so names are only interned once a material is actually stored (see
+ * MaterialTable); parsing a message, deferring it or ignoring it never does.
+ *
+ * Any thread can intern. Looking up a name already interned takes no lock:
+ * the index is an open addressing table whose slots are published with
+ * release stores, and a table outgrown by an insert is replaced rather than
+ * freed, so a reader still probing it is never left with freed memory. The
+ * directory of chunks holding the names grows the same way. Adding a name
+ * takes a mutex.
+ *
+ * Ids are only meaningful within one process, so anything written out (the
+ * WAL, captures, the wire) still carries names.
+ */
+
+/* Id of an interned name. */
+typedef unsigned int SymId;
+
+// never the id of a name. its name is the empty string
+#define SYM_NONE 0
+
+/* Returns the id of the given name, interning a copy of it if it has not
+ * been seen before. Returns SYM_NONE for an empty name.
+ */
+SymId sym_intern(StrView name);
+
+/* As sym_intern, for a \0 terminated name.
+ */
+SymId sym_intern_str(char* name);
+
+/* Returns the id of the given name if it has been interned, otherwise
+ * SYM_NONE. Never allocates.
+ */
+SymId sym_find(StrView name);
+
+/* Returns the interned name of the given id, which MUST have been returned
+ * by sym_intern, as a BORROWED \0 terminated string valid for the life of
+ * the process. Returns "" for SYM_NONE, so names of messages with no (or an
+ * empty) material can still be printed.
+ */
+char* sym_name(SymId id);
+
+/* As sym_name, as a view.
+ */
+StrView sym_view(SymId id);
+
+#endif
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <time.h>
 
 #define LINE_BUFFER 10
 
@@ -141,6 +142,42 @@ void ignore_sigpipe(void) {
     sigaction(SIGPIPE, &sa, NULL);
 }
 
+// see header
+sigset_t blocked_sigset(void) {
+    sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGHUP);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGUSR2);
+    sigaddset(&sigset, SIGQUIT);
+    return sigset;
+}
+
+// see header
+int start_quiet_thread(pthread_t* thread, void* (*func)(void*), void* arg) {
+    sigset_t all, old;
+    sigfillset(&all);
+    // faults are delivered to the faulting thread, so the flight recorder's
+    // handler can only run if they are left unblocked
+    sigdelset(&all, SIGSEGV);
+    sigdelset(&all, SIGBUS);
+    sigdelset(&all, SIGFPE);
+    sigdelset(&all, SIGILL);
+    sigdelset(&all, SIGABRT);
+    // the new thread inherits our mask, which is then put back
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int error = pthread_create(thread, NULL, func, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return error;
+}
+
+// see header
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 // see header
 unsigned int hash_djb2(unsigned long int number) {
     // unsigned long int is probably 32 bits (4 bytes)
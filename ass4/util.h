@@ -123,6 +123,26 @@ struct sigaction new_sigaction(void);
  */
 void ignore_sigpipe(void);
 
+/* Constructs and returns a set of signals which should be blocked and picked
+ * up via sigwait or a signalfd. Contains at least SIGHUP, plus SIGUSR1,
+ * SIGUSR2 and SIGQUIT. SIGUSR2 always stops the depot, as SIGUSR1 does
+ * unless it dumps latency histograms (see LAT_DUMP_SIGNAL). SIGQUIT dumps
+ * the flight recorder (see FR_DUMP_SIGNAL).
+ */
+sigset_t blocked_sigset(void);
+
+/* Starts a thread as pthread_create does, but with every signal blocked in
+ * the new thread, for threads which may be started before the main thread
+ * blocks signals. Synchronous fatal signals (SIGSEGV, SIGBUS, SIGFPE, SIGILL
+ * and SIGABRT) are left unblocked so faults still reach their handlers.
+ * Returns 0 on success or an error number.
+ */
+int start_quiet_thread(pthread_t* thread, void* (*func)(void*), void* arg);
+
+/* Returns the current CLOCK_MONOTONIC time in seconds, for deadlines.
+ */
+double monotonic_seconds(void);
+
 /* Hash function using djb2 algorithm by Dan Bernstein. Takes an input integer
  * and returns its hash.
  */
@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "depotState.h"
+#include "deferGroup.h"
+#include "util.h"
+
+// bytes before a log record's body: its length and hash
+#define WAL_RECORD_HEADER 8
+// length of WAL_SNAPSHOT_MAGIC, which is not \0 terminated in the file
+#define WAL_MAGIC_LEN 8
+
+/* Position within a log or snapshot being read back.
+ */
+typedef struct WalReader {
+    char* pos;
+    char* end;
+} WalReader;
+
+/* encoding {{{1 */
+
+// appends size bytes of the given value to the buffer
+void wal_put(StrBuffer* buffer, void* value, int size) {
+    sb_append(buffer, value, size);
+}
+
+void wal_put_u8(StrBuffer* buffer, unsigned char value) {
+    wal_put(buffer, &value, sizeof(value));
+}
+
+void wal_put_u32(StrBuffer* buffer, unsigned int value) {
+    wal_put(buffer, &value, sizeof(value));
+}
+
+void wal_put_i32(StrBuffer* buffer, int value) {
+    wal_put(buffer, &value, sizeof(value));
+}
+
+void wal_put_u64(StrBuffer* buffer, unsigned long value) {
+    unsigned long long wide = value;
+    wal_put(buffer, &wide, sizeof(wide));
+}
+
+// appends a name as its length then its characters
+void wal_put_name(StrBuffer* buffer, StrView name) {
+    wal_put_u32(buffer, name.len);
+    if (name.len > 0) {
+        wal_put(buffer, name.start, name.len);
+    }
+}
+
+// appends a deferred message, as stored by both WAL_DEFER and snapshots
+void wal_put_deferred(StrBuffer* buffer, MessageView* view) {
+    wal_put_u8(buffer, view->type);
+    wal_put_i32(buffer, view->quantity);
+    wal_put_name(buffer, view->matName);
+    wal_put_name(buffer, view->type == MSG_TRANSFER ?
+            view->depotName : (StrView){NULL, 0});
+}
+
+/* Reads size bytes into value, returning false if there are not enough left.
+ */
+bool wal_get(WalReader* reader, void* value, int size) {
+    if (reader->end - reader->pos < size) {
+        return false;
+    }
+    memcpy(value, reader->pos, size);
+    reader->pos += size;
+    return true;
+}
+
+bool wal_get_u64(WalReader* reader, unsigned long* value) {
+    unsigned long long wide;
+    if (!wal_get(reader, &wide, sizeof(wide))) {
+        return false;
+    }
+    *value = wide;
+    return true;
+}
+
+// reads a name, leaving the view pointing into the reader's data
+bool wal_get_name(WalReader* reader, StrView* name) {
+    unsigned int len;
+    if (!wal_get(reader, &len, sizeof(len)) ||
+            (unsigned long)(reader->end - reader->pos) < len) {
+        return false;
+    }
+    name->start = reader->pos;
+    name->len = len;
+    reader->pos += len;
+    return true;
+}
+
+// reads a deferred message written by wal_put_deferred
+bool wal_get_deferred(WalReader* reader, MessageView* view) {
+    unsigned char type;
+    memset(view, 0, sizeof(MessageView));
+    if (!wal_get(reader, &type, sizeof(type)) ||
+            !wal_get(reader, &view->quantity, sizeof(int)) ||
+            !wal_get_name(reader, &view->matName) ||
+            !wal_get_name(reader, &view->depotName)) {
+        return false;
+    }
+    view->type = type;
+    return true;
+}
+
+/* files {{{1 */
+
+/* Writes all of the given buffer to fd, returning false on error.
+ */
+bool wal_write_all(int fd, char* data, int len) {
+    while (len > 0) {
+        ssize_t wrote = write(fd, data, len);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote < 0) {
+            return false;
+        }
+        data += wrote;
+        len -= wrote;
+    }
+    return true;
+}
+
+/* Reads the whole of the file at path into the buffer, which must be
+ * initialised. Returns false if the file could not be opened or read.
+ */
+bool wal_read_file(char* path, StrBuffer* buffer) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char chunk[4096];
+    ssize_t got;
+    while ((got = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            close(fd);
+            return false;
+        }
+        sb_append(buffer, chunk, got);
+    }
+    close(fd);
+    return true;
+}
+
+/* Syncs the WAL directory itself, so renames and new files survive a crash.
+ */
+void wal_sync_dir(Wal* wal) {
+    int fd = open(wal->dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/* Sync thread for WAL_FSYNC_BATCH, taking the Wal* as its argument. Syncs the
+ * log at most every WAL_SYNC_MS while anything is being written. Return
+ * value unused.
+ */
+void* wal_sync_thread(void* walArg) {
+    Wal* wal = walArg;
+    pthread_mutex_lock(&wal->lock);
+    while (true) {
+        while (!wal->dirty && !wal->stopping) {
+            pthread_cond_wait(&wal->wake, &wal->lock);
+        }
+        if (!wal->dirty) {
+            break; // stopping with nothing left to sync
+        }
+        wal->dirty = false;
+        pthread_mutex_unlock(&wal->lock);
+        fdatasync(wal->fd);
+        // anything committed while sleeping shares the next sync
+        usleep(WAL_SYNC_MS * 1000);
+        pthread_mutex_lock(&wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+// see header
+WalFsync wal_parse_fsync(char* name, WalFsync fallback) {
+    if (name == NULL) {
+        return fallback;
+    } else if (strcmp(name, "always") == 0) {
+        return WAL_FSYNC_ALWAYS;
+    } else if (strcmp(name, "batch") == 0) {
+        return WAL_FSYNC_BATCH;
+    } else if (strcmp(name, "none") == 0) {
+        return WAL_FSYNC_NONE;
+    }
+    DEBUG_PRINTF("ignoring invalid fsync policy %s\n", name);
+    return fallback;
+}
+
+// see header
+bool wal_open(Wal* wal, char* dir, WalFsync fsync, int snapshotEvery) {
+    memset(wal, 0, sizeof(Wal));
+    wal->fd = -1;
+    wal->dir = strdup(dir);
+    wal->fsync = fsync;
+    wal->snapshotEvery = snapshotEvery;
+    wal->nextLsn = 1;
+    sb_init(&wal->pending);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        DEBUG_PERROR("mkdir()");
+        return false;
+    }
+    char* path = asprintf("%s/%s", dir, WAL_LOG_FILE);
+    wal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    free(path);
+    if (wal->fd < 0) {
+        DEBUG_PERROR("open()");
+        return false;
+    }
+
+    if (fsync == WAL_FSYNC_BATCH) {
+        pthread_mutex_init(&wal->lock, NULL);
+        pthread_cond_init(&wal->wake, NULL);
+        errno = start_quiet_thread(&wal->syncThread, wal_sync_thread, wal);
+        if (errno != 0) {
+            DEBUG_PERROR("pthread_create()");
+            pthread_mutex_destroy(&wal->lock);
+            pthread_cond_destroy(&wal->wake);
+            return false;
+        }
+        wal->syncing = true;
+    }
+    return true;
+}
+
+// see header
+void wal_close(Wal* wal) {
+    if (wal == NULL) {
+        return;
+    }
+    if (wal->fd >= 0) {
+        wal_commit(wal);
+    }
+    if (wal->syncing) {
+        pthread_mutex_lock(&wal->lock);
+        wal->stopping = true;
+        pthread_cond_signal(&wal->wake);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->syncThread, NULL); // which syncs one last time
+        pthread_mutex_destroy(&wal->lock);
+        pthread_cond_destroy(&wal->wake);
+        wal->syncing = false;
+    }
+    if (wal->fd >= 0) {
+        close(wal->fd);
+        wal->fd = -1;
+    }
+    sb_destroy(&wal->pending);
+    TRY_FREE(wal->dir);
+}
+
+/* logging {{{1 */
+
+/* Starts a record of the given kind in the pending buffer, returning where it
+ * starts for wal_end_record.
+ */
+int wal_begin_record(Wal* wal, WalKind kind) {
+    int start = wal->pending.len;
+    char header[WAL_RECORD_HEADER] = {0}; // filled in by wal_end_record
+    wal_put(&wal->pending, header, WAL_RECORD_HEADER);
+    wal_put_u64(&wal->pending, wal->nextLsn);
+    wal_put_u8(&wal->pending, kind);
+    return start;
+}
+
+/* Finishes the record started at start, filling in its header.
+ */
+void wal_end_record(Wal* wal, int start) {
+    StrView body;
+    body.start = wal->pending.data + start + WAL_RECORD_HEADER;
+    body.len = wal->pending.len - start - WAL_RECORD_HEADER;
+    unsigned int header[2] = {body.len, sv_hash(body)};
+    memcpy(wal->pending.data + start, header, WAL_RECORD_HEADER);
+    wal->nextLsn++;
+    wal->sinceSnapshot++;
+}
+
+// see header
+void wal_log_alter(Wal* wal, StrView matName, int delta) {
+    int start = wal_begin_record(wal, WAL_ALTER);
+    wal_put_i32(&wal->pending, delta);
+    wal_put_name(&wal->pending, matName);
+    wal_end_record(wal, start);
+}
+
+// see header
+void wal_log_defer(Wal* wal, int key, MessageView* inner) {
+    int start = wal_begin_record(wal, WAL_DEFER);
+    wal_put_i32(&wal->pending, key);
+    wal_put_deferred(&wal->pending, inner);
+    wal_end_record(wal, start);
+}
+
+// see header
+void wal_log_execute(Wal* wal, int key) {
+    int start = wal_begin_record(wal, WAL_EXECUTE);
+    wal_put_i32(&wal->pending, key);
+    wal_end_record(wal, start);
+}
+
+// see header
+bool wal_commit(Wal* wal) {
+    if (wal->pending.len == 0) {
+        return true;
+    }
+    bool written = wal_write_all(wal->fd, wal->pending.data,
+            wal->pending.len);
+    sb_clear(&wal->pending);
+    if (!written) {
+        DEBUG_PERROR("write()");
+        return false;
+    }
+    switch (wal->fsync) {
+        case WAL_FSYNC_ALWAYS:
+            if (fdatasync(wal->fd) != 0) {
+                DEBUG_PERROR("fdatasync()");
+                return false;
+            }
+            break;
+        case WAL_FSYNC_BATCH:
+            pthread_mutex_lock(&wal->lock);
+            wal->dirty = true;
+            pthread_cond_signal(&wal->wake);
+            pthread_mutex_unlock(&wal->lock);
+            break;
+        case WAL_FSYNC_NONE:
+            break;
+    }
+    return true;
+}
+
+/* snapshots {{{1 */
+
+// see header
+bool wal_snapshot_due(Wal* wal) {
+    return wal->snapshotEvery > 0 && wal->sinceSnapshot >= wal->snapshotEvery;
+}
+
+/* Encodes a snapshot of the given depot state into the buffer.
+ */
+void wal_encode_snapshot(Wal* wal, DepotState* depotState,
+        StrBuffer* buffer) {
+    wal_put(buffer, WAL_SNAPSHOT_MAGIC, WAL_MAGIC_LEN);
+    wal_put_u64(buffer, wal->nextLsn - 1); // last record included
+
+    Array* materials = depotState->materials->materials;
+    wal_put_u32(buffer, materials->numItems);
+    for (int i = 0; i < materials->numItems; i++) {
+        Material* mat = ARRAY_ITEM(Material, materials, i);
+        wal_put_i32(buffer, mat->quantity);
+        wal_put_name(buffer, sym_view(mat->id));
+    }
+
+    HashMap* groups = depotState->deferGroups;
+    wal_put_u32(buffer, groups->numItems);
+    int index = 0;
+    DeferGroup* dg;
+    while ((dg = hashmap_next(groups, &index)) != NULL) {
+        wal_put_i32(buffer, dg->key);
+        wal_put_u32(buffer, dg->numMessages);
+        int offset = 0;
+        MessageView deferred;
+        while (dg_next(dg, &offset, &deferred)) {
+            wal_put_deferred(buffer, &deferred);
+        }
+    }
+    StrView all = {buffer->data, buffer->len};
+    wal_put_u32(buffer, sv_hash(all));
+}
+
+// see header
+bool wal_snapshot(Wal* wal, DepotState* depotState) {
+    assert(wal->pending.len == 0);
+    StrBuffer buffer;
+    sb_init(&buffer);
+    wal_encode_snapshot(wal, depotState, &buffer);
+
+    char* temp = asprintf("%s/%s", wal->dir, WAL_SNAPSHOT_TEMP);
+    char* path = asprintf("%s/%s", wal->dir, WAL_SNAPSHOT_FILE);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = fd >= 0 && wal_write_all(fd, buffer.data, buffer.len) &&
+            (wal->fsync == WAL_FSYNC_NONE || fsync(fd) == 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    // the old snapshot and log stay whole until the new snapshot is
+    ok = ok && rename(temp, path) == 0;
+    free(temp);
+    free(path);
+    sb_destroy(&buffer);
+    if (!ok) {
+        DEBUG_PERROR("writing snapshot");
+        return false;
+    }
+    if (wal->fsync != WAL_FSYNC_NONE) {
+        wal_sync_dir(wal);
+    }
+    // if this fails, recovery skips the records by LSN anyway
+    if (ftruncate(wal->fd, 0) != 0) {
+        DEBUG_PERROR("ftruncate()");
+    }
+    DEBUG_PRINTF("snapshot at lsn %lu after %d records\n", wal->nextLsn - 1,
+            wal->sinceSnapshot);
+    wal->sinceSnapshot = 0;
+    return true;
+}
+
+/* recovery {{{1 */
+
+/* Loads the snapshot in the buffer into the depot state, storing the LSN of
+ * its last record into *lsn. Returns false if the snapshot is damaged, in
+ * which case the depot state may be partly loaded.
+ */
+bool wal_load_snapshot(StrBuffer* buffer, DepotState* depotState,
+        unsigned long* lsn) {
+    unsigned int hash;
+    if (buffer->len < WAL_MAGIC_LEN + (int)sizeof(hash) ||
+            memcmp(buffer->data, WAL_SNAPSHOT_MAGIC, WAL_MAGIC_LEN) != 0) {
+        return false;
+    }
+    StrView all = {buffer->data, buffer->len - sizeof(hash)};
+    memcpy(&hash, buffer->data + all.len, sizeof(hash));
+    if (sv_hash(all) != hash) {
+        return false;
+    }
+    WalReader reader = {buffer->data + WAL_MAGIC_LEN,
+            buffer->data + all.len};
+
+    unsigned int numMaterials, numGroups;
+    if (!wal_get_u64(&reader, lsn) ||
+            !wal_get(&reader, &numMaterials, sizeof(numMaterials))) {
+        return false;
+    }
+    for (unsigned int i = 0; i < numMaterials; i++) {
+        int quantity;
+        StrView name;
+        if (!wal_get(&reader, &quantity, sizeof(quantity)) ||
+                !wal_get_name(&reader, &name) || name.len == 0) {
+            return false;
+        }
+        mt_ensure_view(depotState->materials, name)->quantity = quantity;
+    }
+
+    if (!wal_get(&reader, &numGroups, sizeof(numGroups))) {
+        return false;
+    }
+    for (unsigned int i = 0; i < numGroups; i++) {
+        int key;
+        unsigned int numMessages;
+        if (!wal_get(&reader, &key, sizeof(key)) ||
+                !wal_get(&reader, &numMessages, sizeof(numMessages))) {
+            return false;
+        }
+        for (unsigned int j = 0; j < numMessages; j++) {
+            MessageView deferred;
+            if (!wal_get_deferred(&reader, &deferred)) {
+                return false;
+            }
+            ds_defer(depotState, key, &deferred);
+        }
+    }
+    return true;
+}
+
+/* Applies the body of one log record to the depot state. Returns false if
+ * the body is malformed.
+ */
+bool wal_apply_record(WalReader* body, unsigned char kind,
+        DepotState* depotState) {
+    int number; // delta or key
+    if (!wal_get(body, &number, sizeof(number))) {
+        return false;
+    }
+    StrView name;
+    MessageView deferred;
+    DeferGroup* dg;
+    switch (kind) {
+        case WAL_ALTER:
+            // ids don't outlive the process, so names are logged
+            if (!wal_get_name(body, &name) || name.len == 0) {
+                return false;
+            }
+            ds_alter_mat_view(depotState, name, number);
+            return true;
+        case WAL_DEFER:
+            if (!wal_get_deferred(body, &deferred)) {
+                return false;
+            }
+            ds_defer(depotState, number, &deferred);
+            return true;
+        case WAL_EXECUTE:
+            dg = ds_take_defer_group(depotState, number);
+            dg_destroy(dg);
+            TRY_FREE(dg);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Replays the records in the log buffer after LSN snapshotLsn into the depot
+ * state. Returns the length of the undamaged part of the log and stores the
+ * LSN of the last record into *lastLsn, if there were any.
+ */
+int wal_replay(StrBuffer* log, DepotState* depotState,
+        unsigned long snapshotLsn, unsigned long* lastLsn) {
+    int pos = 0;
+    while (log->len - pos >= WAL_RECORD_HEADER) {
+        unsigned int header[2];
+        memcpy(header, log->data + pos, WAL_RECORD_HEADER);
+        if (header[0] > (unsigned int)(log->len - pos - WAL_RECORD_HEADER)) {
+            break; // cut short
+        }
+        StrView bodyView = {log->data + pos + WAL_RECORD_HEADER, header[0]};
+        if (sv_hash(bodyView) != header[1]) {
+            break; // damaged
+        }
+        WalReader body = {bodyView.start, bodyView.start + bodyView.len};
+        unsigned long lsn;
+        unsigned char kind;
+        if (!wal_get_u64(&body, &lsn) ||
+                !wal_get(&body, &kind, sizeof(kind))) {
+            break;
+        }
+        if (lsn > snapshotLsn &&
+                !wal_apply_record(&body, kind, depotState)) {
+            break;
+        }
+        if (lsn > *lastLsn) {
+            *lastLsn = lsn;
+        }
+        pos += WAL_RECORD_HEADER + header[0];
+    }
+    return pos;
+}
+
+// see header
+bool wal_recover(Wal* wal, DepotState* depotState) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool found = false;
+    unsigned long lastLsn = 0;
+    StrBuffer buffer;
+    sb_init(&buffer);
+    char* path = asprintf("%s/%s", wal->dir, WAL_SNAPSHOT_FILE);
+    if (wal_read_file(path, &buffer)) {
+        if (wal_load_snapshot(&buffer, depotState, &lastLsn)) {
+            found = true;
+        } else {
+            DEBUG_PRINT("ignoring damaged snapshot");
+            lastLsn = 0;
+        }
+    }
+    free(path);
+
+    sb_clear(&buffer);
+    path = asprintf("%s/%s", wal->dir, WAL_LOG_FILE);
+    wal_read_file(path, &buffer);
+    free(path);
+    unsigned long snapshotLsn = lastLsn;
+    int valid = wal_replay(&buffer, depotState, snapshotLsn, &lastLsn);
+    if (valid < buffer.len) {
+        DEBUG_PRINTF("discarding %d damaged bytes of log\n",
+                buffer.len - valid);
+        if (ftruncate(wal->fd, valid) != 0) {
+            DEBUG_PERROR("ftruncate()");
+        }
+    }
+    found = found || valid > 0;
+    wal->nextLsn = lastLsn + 1;
+    wal->sinceSnapshot = lastLsn - snapshotLsn;
+    sb_destroy(&buffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    DEBUG_PRINTF("recovered to lsn %lu in %.3fs\n", lastLsn,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return found;
+}
@@ -0,0 +1,139 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "msgView.h"
+#include "strBuffer.h"
+#include "strView.h"
+
+// file names inside the WAL directory
+#define WAL_LOG_FILE "wal.log"
+#define WAL_SNAPSHOT_FILE "snapshot"
+#define WAL_SNAPSHOT_TEMP "snapshot.tmp"
+// identifies (and versions) a snapshot file
+#define WAL_SNAPSHOT_MAGIC "DEPOTSN1"
+// how often the batch policy's sync thread syncs the log
+#define WAL_SYNC_MS 10
+
+struct DepotState;
+
+/* When the log is synced to disk, from DEPOT_WAL_FSYNC.
+ */
+typedef enum WalFsync {
+    WAL_FSYNC_ALWAYS, // at every commit, before anything is sent to peers
+    WAL_FSYNC_BATCH, // every WAL_SYNC_MS, by a separate thread
+    WAL_FSYNC_NONE // never, left to the OS
+} WalFsync;
+
+/* Kinds of WAL record.
+ */
+typedef enum WalKind {
+    WAL_ALTER = 1, // a material changed by some delta
+    WAL_DEFER, // a message was added to a defer group
+    WAL_EXECUTE // a defer group was executed, so removed
+} WalKind;
+
+/* Append-only write-ahead log of every change made to a depot's materials and
+ * defer groups, with periodic snapshots so the log stays short. Changes are
+ * logged as they are applied by the main thread and written together by
+ * wal_commit once per batch (group commit), which happens before anything
+ * the batch queued is sent to peers.
+ *
+ * Every record has a log sequence number (LSN), one more than the last. A
+ * snapshot stores the LSN of the last record it includes, then the log is
+ * emptied. If the depot dies in between, records the snapshot already
+ * includes are recognised by their LSN and skipped.
+ *
+ * Only effects are logged: Execute is logged as removing its group and each
+ * deferred message it runs is logged as the change it made, so replay never
+ * needs to know which peers existed.
+ *
+ * Log record, all integers in host byte order (so files are not portable):
+ *   u32 bodyLen, u32 FNV-1a hash of body, body
+ * body:
+ *   u64 lsn, u8 kind, then by kind:
+ *   WAL_ALTER:   i32 delta, u32 nameLen, name
+ *   WAL_DEFER:   i32 key, u8 type, i32 quantity, u32 matLen, mat,
+ *                u32 depotLen, depot
+ *   WAL_EXECUTE: i32 key
+ * A record which is cut short or fails its hash ends the log; it and
+ * anything after it is discarded on recovery.
+ *
+ * Snapshot file, written to a temporary file then renamed over the old one:
+ *   WAL_SNAPSHOT_MAGIC, u64 lsn, u32 numMaterials,
+ *   { i32 quantity, u32 nameLen, name } * numMaterials, u32 numGroups,
+ *   { i32 key, u32 numMessages, u32 arenaLen, arena } * numGroups,
+ *   u32 FNV-1a hash of everything before it
+ */
+typedef struct Wal {
+    char* dir; // MALLOC! directory holding the log and snapshot
+    int fd; // log file, opened for appending
+    WalFsync fsync;
+    int snapshotEvery; // records between snapshots, 0 for never
+
+    unsigned long nextLsn; // LSN of the next record logged
+    int sinceSnapshot; // records logged since the last snapshot
+    StrBuffer pending; // sb_destroy! records logged but not yet written
+
+    // used by the sync thread of WAL_FSYNC_BATCH only
+    bool syncing; // whether the sync thread was started
+    pthread_t syncThread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping; // set to end the sync thread
+    bool dirty; // written since last sync
+} Wal;
+
+/* Opens (creating if needed) the log in the given directory, which is also
+ * created if needed. Does not read anything, see wal_recover. Returns false
+ * if the log could not be opened.
+ */
+bool wal_open(Wal* wal, char* dir, WalFsync fsync, int snapshotEvery);
+
+/* Commits anything logged, stops syncing and closes the log. Safe to call on
+ * a wal which failed to open.
+ */
+void wal_close(Wal* wal);
+
+/* Loads the latest snapshot into the given depot state then replays the log
+ * after it, truncating the log at the first damaged record. The depot state
+ * MUST NOT log to this wal while recovering. Returns true if there was
+ * anything to recover, false for a fresh depot.
+ */
+bool wal_recover(Wal* wal, struct DepotState* depotState);
+
+/* Logs a change of delta to the named material.
+ */
+void wal_log_alter(Wal* wal, StrView matName, int delta);
+
+/* Logs the given deferred message being added to the group with key.
+ */
+void wal_log_defer(Wal* wal, int key, MessageView* inner);
+
+/* Logs the group with the given key being executed and removed.
+ */
+void wal_log_execute(Wal* wal, int key);
+
+/* Writes every record logged since the last commit, syncing if the policy is
+ * WAL_FSYNC_ALWAYS. Returns false if writing failed.
+ */
+bool wal_commit(Wal* wal);
+
+/* Returns true if enough records have been logged that a snapshot is due.
+ */
+bool wal_snapshot_due(Wal* wal);
+
+/* Writes a snapshot of the given depot state and empties the log. Everything
+ * logged must already be committed. Returns false if the snapshot could not
+ * be written, in which case the log is kept.
+ */
+bool wal_snapshot(Wal* wal, struct DepotState* depotState);
+
+/* Parses the given name of a DEPOT_WAL_FSYNC policy, returning fallback if it
+ * is NULL or not a policy.
+ */
+WalFsync wal_parse_fsync(char* name, WalFsync fallback);
+
+#endif
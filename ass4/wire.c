@@ -0,0 +1,496 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "wire.h"
+#include "arrayHelpers.h"
+#include "util.h"
+
+// see header
+void wenc_init(WireEncoder* encoder) {
+    encoder->names = calloc(1, sizeof(HashMap));
+    hashmap_init(encoder->names, ah_wirename_mapper, ah_inthash, ah_intcmp);
+    encoder->byId = NULL;
+    encoder->nextId = 0;
+    encoder->nextEvict = 0;
+    encoder->epoch = 0;
+}
+
+// see header
+void wenc_destroy(WireEncoder* encoder) {
+    if (encoder == NULL || encoder->names == NULL) {
+        return;
+    }
+    hashmap_foreach(encoder->names, free);
+    hashmap_destroy(encoder->names);
+    TRY_FREE(encoder->names);
+    TRY_FREE(encoder->byId);
+}
+
+/* Writes number as an unsigned LEB128 varint into bytes, which must have
+ * space for WIRE_MAX_VARINT bytes. Returns the number of bytes written.
+ */
+int wire_varint(unsigned int number, char* bytes) {
+    int len = 0;
+    do {
+        bytes[len] = number & 0x7f;
+        number >>= 7;
+        if (number != 0) {
+            bytes[len] |= 0x80; // more bytes follow
+        }
+        len++;
+    } while (number != 0);
+    return len;
+}
+
+/* Appends number to the buffer as a varint.
+ */
+void wire_append_varint(StrBuffer* buffer, unsigned int number) {
+    char bytes[WIRE_MAX_VARINT];
+    sb_append(buffer, bytes, wire_varint(number, bytes));
+}
+
+/* Prefixes everything appended to the buffer since offset start with its
+ * length, making it one frame. The body is written first because its length
+ * isn't known until then, and is only a few bytes to move.
+ */
+void wire_finish_frame(StrBuffer* buffer, int start) {
+    char bytes[WIRE_MAX_VARINT];
+    int len = wire_varint(buffer->len - start, bytes);
+    sb_insert(buffer, start, bytes, len);
+}
+
+/* Returns a WireName whose id can be (re)defined: a new one while ids are
+ * left, otherwise the next one in id order not used by the message being
+ * encoded, taken out of the index.
+ */
+WireName* wenc_free_name(WireEncoder* encoder) {
+    if (encoder->nextId < WIRE_MAX_NAMES) {
+        if (encoder->nextId % 1024 == 0) {
+            encoder->byId = realloc(encoder->byId,
+                    (encoder->nextId + 1024) * sizeof(WireName*));
+        }
+        WireName* wireName = malloc(sizeof(WireName));
+        wireName->id = encoder->nextId++;
+        encoder->byId[wireName->id] = wireName;
+        return wireName;
+    }
+    // a message uses at most WIRE_BATCH_OPS names, so not every id
+    for (int i = 0; i < WIRE_MAX_NAMES; i++) {
+        WireName* wireName = encoder->byId[encoder->nextEvict];
+        encoder->nextEvict = (encoder->nextEvict + 1) % WIRE_MAX_NAMES;
+        if (wireName->epoch != encoder->epoch) {
+            hashmap_remove(encoder->names, &wireName->sym);
+            return wireName;
+        }
+    }
+    assert(0);
+    return NULL;
+}
+
+/* Returns the wire id of the material with the given interned name id,
+ * first appending a frame defining it if the peer hasn't seen it.
+ */
+int wenc_name_id(WireEncoder* encoder, SymId sym, StrBuffer* buffer) {
+    WireName* wireName = hashmap_get(encoder->names, &sym);
+    if (wireName != NULL) {
+        wireName->epoch = encoder->epoch;
+        return wireName->id;
+    }
+    wireName = wenc_free_name(encoder);
+    wireName->sym = sym;
+    wireName->epoch = encoder->epoch;
+    hashmap_put(encoder->names, wireName);
+
+    int start = buffer->len;
+    StrView name = sym_view(sym);
+    sb_append_char(buffer, WIRE_DEFINE);
+    wire_append_varint(buffer, wireName->id);
+    sb_append(buffer, name.start, name.len);
+    wire_finish_frame(buffer, start);
+    return wireName->id;
+}
+
+/* Defines every material name used by the message, including deferred
+ * ones, so the message's own frame can be written in one piece.
+ */
+void wenc_define_names(WireEncoder* encoder, Message* message,
+        StrBuffer* buffer) {
+    switch (message->type) {
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+        case MSG_TRANSFER:
+            wenc_name_id(encoder, mat_intern(&message->data.material),
+                    buffer);
+            break;
+        case MSG_DEFER:
+            wenc_define_names(encoder, message->data.deferMessage, buffer);
+            break;
+        case MSG_BATCH_OPS:
+            for (int i = 0; i < message->data.batch->numOps; i++) {
+                wenc_name_id(encoder,
+                        sym_intern(message->data.batch->ops[i].matName),
+                        buffer);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Appends the frame for the given message, whose names are all defined.
+ */
+void wenc_frame(WireEncoder* encoder, Message* message, StrBuffer* buffer) {
+    MessageData* data = &message->data;
+    int start = buffer->len;
+    WireName* wireName;
+    SymId sym;
+    switch (message->type) {
+        case MSG_CONNECT:
+            sb_append_char(buffer, WIRE_CONNECT);
+            wire_append_varint(buffer, data->depotPort);
+            break;
+        case MSG_IM:
+            sb_append_char(buffer, WIRE_IM);
+            wire_append_varint(buffer, data->depotPort);
+            sb_append_str(buffer, data->depotName);
+            break;
+        case MSG_DELIVER:
+        case MSG_WITHDRAW:
+        case MSG_TRANSFER:
+            sb_append_char(buffer, message->type == MSG_DELIVER ?
+                    WIRE_DELIVER : message->type == MSG_WITHDRAW ?
+                    WIRE_WITHDRAW : WIRE_TRANSFER);
+            wire_append_varint(buffer, data->material.quantity);
+            sym = mat_intern(&data->material); // already interned
+            wireName = hashmap_get(encoder->names, &sym);
+            wire_append_varint(buffer, wireName->id);
+            if (message->type == MSG_TRANSFER) {
+                sb_append_str(buffer, data->depotName);
+            }
+            break;
+        case MSG_DEFER:
+            sb_append_char(buffer, WIRE_DEFER);
+            wire_append_varint(buffer, data->deferKey);
+            wenc_frame(encoder, data->deferMessage, buffer); // sub-frame
+            break;
+        case MSG_EXECUTE:
+            sb_append_char(buffer, WIRE_EXECUTE);
+            wire_append_varint(buffer, data->deferKey);
+            break;
+        case MSG_BATCH_OPS:
+            sb_append_char(buffer, WIRE_BATCH);
+            wire_append_varint(buffer, data->batch->numOps);
+            for (int i = 0; i < data->batch->numOps; i++) {
+                BatchOp* op = &data->batch->ops[i];
+                sb_append_char(buffer, op->type == MSG_DELIVER ?
+                        WIRE_DELIVER : WIRE_WITHDRAW);
+                wire_append_varint(buffer, op->quantity);
+                sym = sym_intern(op->matName);
+                wireName = hashmap_get(encoder->names, &sym);
+                wire_append_varint(buffer, wireName->id);
+            }
+            break;
+        default:
+            assert(0); // meta messages are never sent
+    }
+    wire_finish_frame(buffer, start);
+}
+
+/* Appends the given message's definitions then its frame.
+ */
+void wenc_encode_one(WireEncoder* encoder, Message* message,
+        StrBuffer* buffer) {
+    encoder->epoch++;
+    wenc_define_names(encoder, message, buffer);
+    wenc_frame(encoder, message, buffer);
+}
+
+// see header
+void wenc_encode(WireEncoder* encoder, Message message, StrBuffer* buffer) {
+    Message* inner = &message;
+    while (inner->type == MSG_DEFER) {
+        inner = inner->data.deferMessage;
+    }
+    if (inner->type != MSG_BATCH_OPS ||
+            inner->data.batch->numOps <= WIRE_BATCH_OPS) {
+        wenc_encode_one(encoder, &message, buffer);
+        return;
+    }
+    // the ops are swapped into the message a slice at a time, then put back.
+    // their names still point into the whole Batch
+    Batch* whole = inner->data.batch;
+    Batch* part = malloc(sizeof(Batch) + WIRE_BATCH_OPS * sizeof(BatchOp));
+    inner->data.batch = part;
+    for (int i = 0; i < whole->numOps; i += WIRE_BATCH_OPS) {
+        part->numOps = whole->numOps - i < WIRE_BATCH_OPS ?
+                whole->numOps - i : WIRE_BATCH_OPS;
+        memcpy(part->ops, &whole->ops[i], part->numOps * sizeof(BatchOp));
+        wenc_encode_one(encoder, &message, buffer);
+    }
+    inner->data.batch = whole;
+    free(part);
+}
+
+// see header
+void wdec_init(WireDecoder* decoder) {
+    decoder->binary = false;
+    decoder->names = NULL;
+    decoder->numNames = 0;
+    decoder->size = 0;
+}
+
+// see header
+void wdec_destroy(WireDecoder* decoder) {
+    if (decoder == NULL) {
+        return;
+    }
+    for (int i = 0; i < decoder->numNames; i++) {
+        TRY_FREE(decoder->names[i]);
+    }
+    TRY_FREE(decoder->names);
+    decoder->numNames = 0;
+}
+
+/* Reads a varint from *pos, which must be before end, advancing *pos past
+ * it. Returns false if it is truncated or does not fit in 32 bits.
+ */
+bool wire_read_varint(char** pos, char* end, unsigned int* output) {
+    unsigned int value = 0;
+    for (int i = 0; i < WIRE_MAX_VARINT && *pos < end; i++) {
+        unsigned char byte = *(*pos)++;
+        if (i == WIRE_MAX_VARINT - 1 && (byte & 0xf0) != 0) {
+            break; // more than 32 bits
+        }
+        value |= (unsigned int)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *output = value;
+            return true;
+        }
+    }
+    DEBUG_PRINT("bad varint");
+    return false;
+}
+
+/* As wire_read_varint, but the value must also fit in a non-negative int,
+ * as with integers in text messages.
+ */
+bool wire_read_int(char** pos, char* end, int* output) {
+    unsigned int value;
+    if (!wire_read_varint(pos, end, &value) || value > INT_MAX) {
+        return false;
+    }
+    *output = value;
+    return true;
+}
+
+/* Reads a material id from *pos, storing a view of its defined name.
+ */
+bool wdec_read_name(WireDecoder* decoder, char** pos, char* end,
+        StrView* output) {
+    unsigned int id;
+    if (!wire_read_varint(pos, end, &id) || id >= (unsigned)decoder->numNames
+            || decoder->names[id] == NULL) {
+        DEBUG_PRINT("undefined material id");
+        return false;
+    }
+    *output = sv_from(decoder->names[id]);
+    return true;
+}
+
+/* Stores the name defined by a WIRE_DEFINE frame, replacing any name the id
+ * was defined as before.
+ */
+void wdec_define(WireDecoder* decoder, char* pos, char* end) {
+    unsigned int id;
+    if (!wire_read_varint(&pos, end, &id) || pos == end ||
+            id >= WIRE_MAX_NAMES) {
+        DEBUG_PRINT("invalid definition");
+        return;
+    }
+    if ((int)id >= decoder->size) {
+        int size = decoder->size == 0 ? 16 : decoder->size;
+        while (size <= (int)id) {
+            size *= 2;
+        }
+        decoder->names = realloc(decoder->names, size * sizeof(char*));
+        memset(decoder->names + decoder->size, 0,
+                (size - decoder->size) * sizeof(char*));
+        decoder->size = size;
+    }
+    if ((int)id >= decoder->numNames) {
+        decoder->numNames = id + 1;
+    }
+    free(decoder->names[id]);
+    decoder->names[id] = strndup(pos, end - pos);
+}
+
+// see header
+bool wdec_parse_op(WireDecoder* decoder, char** pos, char* end,
+        MessageView* outOp) {
+    MessageView op = {0};
+    if (*pos == end || (**pos != WIRE_DELIVER && **pos != WIRE_WITHDRAW)) {
+        DEBUG_PRINT("batch op is not Deliver or Withdraw");
+        return false;
+    }
+    op.type = **pos == WIRE_DELIVER ? MSG_DELIVER : MSG_WITHDRAW;
+    (*pos)++;
+    if (!wire_read_int(pos, end, &op.quantity) ||
+            !wdec_read_name(decoder, pos, end, &op.matName)) {
+        return false;
+    }
+    *outOp = op;
+    return true;
+}
+
+// see header
+bool wdec_parse(WireDecoder* decoder, char* body, int len,
+        MessageView* outView) {
+    MessageView view = {0};
+    view.type = MSG_NULL;
+    *outView = view;
+    if (len < 1) {
+        return false;
+    }
+    char* pos = body + 1;
+    char* end = body + len;
+    unsigned int frameLen;
+    bool valid = false;
+    switch (body[0]) {
+        case WIRE_DEFINE:
+            wdec_define(decoder, pos, end);
+            return false;
+        case WIRE_CONNECT:
+            view.type = MSG_CONNECT;
+            valid = wire_read_int(&pos, end, &view.depotPort) && pos == end;
+            break;
+        case WIRE_IM:
+            view.type = MSG_IM;
+            valid = wire_read_int(&pos, end, &view.depotPort) && pos < end;
+            view.depotName = (StrView) {pos, end - pos};
+            break;
+        case WIRE_DELIVER:
+        case WIRE_WITHDRAW:
+            view.type = body[0] == WIRE_DELIVER ? MSG_DELIVER : MSG_WITHDRAW;
+            valid = wire_read_int(&pos, end, &view.quantity) &&
+                    wdec_read_name(decoder, &pos, end, &view.matName) &&
+                    pos == end;
+            break;
+        case WIRE_TRANSFER:
+            view.type = MSG_TRANSFER;
+            valid = wire_read_int(&pos, end, &view.quantity) &&
+                    wdec_read_name(decoder, &pos, end, &view.matName) &&
+                    pos < end;
+            view.depotName = (StrView) {pos, end - pos};
+            break;
+        case WIRE_DEFER:
+            view.type = MSG_DEFER;
+            valid = wire_read_int(&pos, end, &view.deferKey) &&
+                    wire_read_varint(&pos, end, &frameLen) &&
+                    frameLen == (unsigned)(end - pos);
+            if (valid) {
+                MessageView inner;
+                view.deferLine = (StrView) {pos, frameLen};
+                view.deferWire = decoder;
+                valid = wdec_parse(decoder, pos, frameLen, &inner);
+            }
+            break;
+        case WIRE_EXECUTE:
+            view.type = MSG_EXECUTE;
+            valid = wire_read_int(&pos, end, &view.deferKey) && pos == end;
+            break;
+        case WIRE_BATCH:
+            view.type = MSG_BATCH_OPS;
+            valid = wire_read_int(&pos, end, &view.numOps) &&
+                    view.numOps > 0;
+            view.batchOps = (StrView) {pos, end - pos};
+            view.batchWire = decoder;
+            for (int i = 0; valid && i < view.numOps; i++) {
+                MessageView op;
+                valid = wdec_parse_op(decoder, &pos, end, &op);
+            }
+            valid = valid && pos == end;
+            break;
+        default:
+            DEBUG_PRINT("unknown frame tag");
+            return false;
+    }
+    if (!valid) {
+        DEBUG_PRINT("invalid frame");
+        return false;
+    }
+    *outView = view;
+    return true;
+}
+
+// see header
+bool wire_next_frame(RecvBuffer* buffer, char** body, int* len) {
+    char* pos = buffer->data + buffer->start;
+    char* end = buffer->data + buffer->used;
+    if (pos == end) {
+        return false;
+    }
+    unsigned int frameLen;
+    char* lengthEnd = pos;
+    if (!wire_read_varint(&lengthEnd, end, &frameLen)) {
+        if (end - pos >= WIRE_MAX_VARINT) {
+            buffer->eof = true; // can't be a valid length
+        }
+        return false; // otherwise, wait for the rest of the length
+    }
+    if (frameLen > WIRE_MAX_FRAME) {
+        DEBUG_PRINT("frame too long, closing");
+        buffer->eof = true;
+        return false;
+    }
+    if ((unsigned)(end - lengthEnd) < frameLen) {
+        return false; // wait for the rest of the frame
+    }
+    *body = lengthEnd;
+    *len = frameLen;
+    buffer->start = lengthEnd + frameLen - buffer->data;
+    return true;
+}
+
+// see header
+WireControl wire_control(char* line, int len) {
+    StrView view = {line, len};
+    if (sv_equals(view, WIRE_OFFER)) {
+        return WIRE_OFFERED;
+    }
+    if (sv_equals(view, WIRE_SWITCH)) {
+        return WIRE_SWITCHED;
+    }
+    return WIRE_NONE;
+}
+
+// see header
+bool wire_next_message(RecvBuffer* buffer, WireDecoder* decoder,
+        bool offered, MessageView* outView) {
+    char* data;
+    int len;
+    if (decoder->binary) {
+        if (!wire_next_frame(buffer, &data, &len)) {
+            return false;
+        }
+        wdec_parse(decoder, data, len, outView); // MSG_NULL on failure
+        return true;
+    }
+    if (!rb_next_line(buffer, &data, &len)) {
+        return false;
+    }
+    DEBUG_PRINTF("received: %s\n", data);
+    WireControl control = offered ? wire_control(data, len) : WIRE_NONE;
+    if (control == WIRE_SWITCHED) {
+        DEBUG_PRINT("peer switched to binary");
+        decoder->binary = true;
+        outView->type = MSG_NULL;
+    } else if (control == WIRE_OFFERED) {
+        *outView = (MessageView) {0};
+        outView->type = MSG_META_WIRE_OFFER;
+    } else if (mv_parse(data, len, outView) != MS_OK) {
+        DEBUG_PRINT("message invalid");
+    }
+    return true;
+}
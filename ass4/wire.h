@@ -0,0 +1,174 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdbool.h>
+
+#include "messages.h"
+#include "msgView.h"
+#include "hashMap.h"
+#include "recvBuffer.h"
+#include "strBuffer.h"
+#include "symbols.h"
+
+// Compact binary encoding of depot messages, negotiated per connection.
+//
+// After its IM, a depot with DEPOT_WIRE set sends WIRE_OFFER as a text line.
+// Once a depot has received the peer's offer, it knows the peer can decode
+// binary, so it sends WIRE_SWITCH as a text line and everything it writes
+// after that is binary. Each direction switches independently. Peers which
+// never offer just see one invalid line, which the spec says to ignore.
+//
+// Binary frames are a varint body length followed by the body, which is a
+// WireTag and its fields. Varints are unsigned LEB128. Material names are
+// sent once per connection in a WIRE_DEFINE frame and referred to by id
+// afterwards, until the id is defined again as another name. Depot names
+// are sent as raw bytes, always last in the body.
+//
+// Text lines have no length limit, so neither do names, and a frame is as
+// long as its message needs, up to WIRE_MAX_FRAME. That is as much as a
+// RecvBuffer can grow to hold, so no line received as text, and so no
+// message built from one, is longer. Only Batches are split, into frames of
+// at most WIRE_BATCH_OPS ops, so one message never needs every material id.
+
+// line offering to receive binary frames
+#define WIRE_OFFER "Wire:bin1"
+// line after which the sender only writes binary frames
+#define WIRE_SWITCH "Wire:switch"
+// frames longer than this are treated as a broken stream. a RecvBuffer
+// holds at most 1 GiB, including the frame's length and a spare byte
+#define WIRE_MAX_FRAME ((1 << 30) - 16)
+// most ops in one Batch frame, longer Batches are sent as several
+#define WIRE_BATCH_OPS 4096
+// most material ids a peer may define. once an encoder has used them all,
+// it redefines the least recently defined id not used by the message
+#define WIRE_MAX_NAMES 65536
+// most bytes in a 32 bit varint
+#define WIRE_MAX_VARINT 5
+
+/* Tag at the start of a binary frame body, followed by the listed fields.
+ */
+typedef enum WireTag {
+    WIRE_DEFINE = 1, // id, name bytes. defines a material id
+    WIRE_CONNECT, // port
+    WIRE_IM, // port, name bytes
+    WIRE_DELIVER, // quantity, material id
+    WIRE_WITHDRAW, // quantity, material id
+    WIRE_TRANSFER, // quantity, material id, depot name bytes
+    WIRE_DEFER, // key, then a whole nested frame (length and body)
+    WIRE_EXECUTE, // key
+    // number of ops, then each op as its own WIRE_DELIVER or WIRE_WITHDRAW
+    // tag, quantity and material id, without a length
+    WIRE_BATCH
+} WireTag;
+
+/* Text control lines of the negotiation, see wire_control.
+ */
+typedef enum WireControl {
+    WIRE_NONE, // an ordinary line
+    WIRE_OFFERED, // the peer can receive binary
+    WIRE_SWITCHED // the peer's following bytes are binary
+} WireControl;
+
+/* An interned material name and the id it was defined with on a connection.
+ */
+typedef struct WireName {
+    SymId sym;
+    int id;
+    unsigned int epoch; // the encoder's epoch when last used
+} WireName;
+
+/* Sending state of a binary connection: the material names defined so far.
+ * Ids stay below WIRE_MAX_NAMES, which the decoder enforces, by redefining
+ * old ids once they run out. The peer decodes frames in order, so a frame
+ * queued before a redefinition still means the old name. Names are keyed
+ * by interned id: the depot only sends materials from its own tables, whose
+ * names are interned already, and any other name is interned when encoded.
+ */
+typedef struct WireEncoder {
+    HashMap* names; // MALLOC'd WireName*'s, keyed by interned name id
+    // MALLOC! byId[id] is the WireName currently defined as id
+    WireName** byId;
+    int nextId; // ids handed out so far, at most WIRE_MAX_NAMES
+    int nextEvict; // id to consider redefining next, once ids run out
+    // counts messages encoded, so the names of the one being encoded are
+    // never redefined under it
+    unsigned int epoch;
+} WireEncoder;
+
+/* Receiving state of a connection. Until binary is set, lines are text.
+ */
+typedef struct WireDecoder {
+    bool binary; // the peer has switched to binary frames
+    char** names; // MALLOC! names[id] is the MALLOC'd name of material id
+    int numNames;
+    int size;
+} WireDecoder;
+
+/* Appends number to the buffer as a varint.
+ */
+void wire_append_varint(StrBuffer* buffer, unsigned int number);
+
+/* Initialises an encoder with no names defined.
+ */
+void wenc_init(WireEncoder* encoder);
+
+/* Destroys the encoder, freeing its definitions.
+ */
+void wenc_destroy(WireEncoder* encoder);
+
+/* Appends the given message to the buffer as binary frames. Any material
+ * name the peer has not been sent yet is defined first, in its own frame. A
+ * Batch, deferred or not, of more than WIRE_BATCH_OPS ops is sent as several
+ * in order, each deferred with the same key if it was.
+ */
+void wenc_encode(WireEncoder* encoder, Message message, StrBuffer* buffer);
+
+/* Initialises a decoder for a peer which is still sending text.
+ */
+void wdec_init(WireDecoder* decoder);
+
+/* Destroys the decoder, freeing its names.
+ */
+void wdec_destroy(WireDecoder* decoder);
+
+/* Decodes one frame body of len bytes. Definitions are stored in the decoder
+ * and any other valid message is stored in outView, in which case true is
+ * returned. Material names in outView point into the decoder and are valid
+ * until it is destroyed or the name's id is defined again, so a view MUST be
+ * used before the next frame is decoded. If the message is a Defer or a
+ * Batch, outView->deferWire or outView->batchWire is set to this decoder.
+ */
+bool wdec_parse(WireDecoder* decoder, char* body, int len,
+        MessageView* outView);
+
+/* Decodes one operation of a Batch frame body starting at *pos, before end,
+ * into outOp, advancing *pos past it. Returns false if it is not a valid
+ * Deliver or Withdraw op.
+ */
+bool wdec_parse_op(WireDecoder* decoder, char** pos, char* end,
+        MessageView* outOp);
+
+/* Frames the next complete binary frame out of the buffer, storing a
+ * pointer to its body in *body and the body length in *len. Returns false if
+ * there is no complete frame. A frame over WIRE_MAX_FRAME marks the buffer
+ * as at EOF, since the stream can't be resynchronised.
+ */
+bool wire_next_frame(RecvBuffer* buffer, char** body, int* len);
+
+/* Returns which negotiation line, if any, the given text line is.
+ */
+WireControl wire_control(char* line, int len);
+
+/* Takes the next complete line or frame from the buffer, in whichever
+ * encoding the peer is currently using, and parses it into outView. Returns
+ * false if nothing complete is left.
+ *
+ * outView->type is MSG_NULL if the line or frame held no message, because
+ * it was invalid or only a definition. If offered is true (we sent
+ * WIRE_OFFER), a WIRE_SWITCH line switches the decoder to binary and a
+ * WIRE_OFFER line is returned as a view of type MSG_META_WIRE_OFFER.
+ */
+bool wire_next_message(RecvBuffer* buffer, WireDecoder* decoder,
+        bool offered, MessageView* outView);
+
+#endif